@@ -71,6 +71,11 @@ KatranGrpcService::KatranGrpcService(const ::katran::KatranConfig& config)
   lb_.attachBpfProgs();
 }
 
+void KatranGrpcService::saveSnapshotIfDue() {
+  Guard lock(giant_);
+  lb_.saveSnapshotIfDue();
+}
+
 Status KatranGrpcService::changeMac(
     ServerContext* context,
     const Mac* request,
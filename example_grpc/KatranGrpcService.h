@@ -139,6 +139,12 @@ class KatranGrpcService final : public KatranService::Service {
       const Empty* request,
       hcMap* response) override;
 
+  /**
+   * stores snapshot of katran's state if it is due (see
+   * KatranLb::saveSnapshotIfDue). must be called periodically
+   */
+  void saveSnapshotIfDue();
+
  private:
   ::katran::KatranLb lb_;
 
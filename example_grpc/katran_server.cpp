@@ -15,6 +15,8 @@
  */
 
 #include <signal.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -23,6 +25,7 @@
 
 #include <folly/Conv.h>
 #include <folly/String.h>
+#include <folly/executors/FunctionScheduler.h>
 #include <folly/init/Init.h>
 #include <folly/io/async/EventBase.h>
 #include <gflags/gflags.h>
@@ -35,6 +38,10 @@
 using grpc::Server;
 using grpc::ServerBuilder;
 
+namespace {
+constexpr std::chrono::milliseconds kSnapshotCheckInterval{1000};
+} // namespace
+
 DEFINE_string(server, "0.0.0.0:50051", "Service server:port");
 DEFINE_string(intf, "eth0", "main interface");
 DEFINE_string(hc_intf, "", "interface for healthchecking");
@@ -64,6 +71,14 @@ DEFINE_string(
     numa_nodes,
     "",
     "comma separed list of numa nodes to forwarding cores mapping");
+DEFINE_string(
+    snapshot_path,
+    "",
+    "path where snapshot of katran's state is periodically stored");
+DEFINE_int32(
+    snapshot_interval_ms,
+    0,
+    "how often snapshot is stored. 0 disables periodic snapshots");
 
 // routine which parses comma separated string of numbers
 // (e.g. "1,2,3,4,10,11,12,13") to vector of int32_t
@@ -100,6 +115,18 @@ void RunServer(
   lb::katran::GrpcSignalHandler grpcSigHandler(evb, server.get(), delay);
   grpcSigHandler.registerSignalHandler(SIGINT);
   grpcSigHandler.registerSignalHandler(SIGTERM);
+  folly::FunctionScheduler scheduler;
+  if (config.snapshotIntervalMs > 0) {
+    // snapshot's interval is enforced by katran itself, timer only needs to
+    // fire often enough
+    scheduler.addFunction(
+        [&service]() { service.saveSnapshotIfDue(); },
+        std::min(
+            std::chrono::milliseconds(config.snapshotIntervalMs),
+            kSnapshotCheckInterval),
+        "katran_snapshot");
+    scheduler.start();
+  }
   // Wait for the server to shutdown. Note that some other thread must be
   // responsible for shutting down the server for this call to ever return.
   server->Wait();
@@ -131,6 +158,8 @@ int main(int argc, char** argv) {
   config.numaNodes = numaNodes;
   config.hcInterface = FLAGS_hc_intf;
   config.hashFunction = katran::HashFunction::MaglevV2;
+  config.snapshotPath = FLAGS_snapshot_path;
+  config.snapshotIntervalMs = static_cast<uint32_t>(FLAGS_snapshot_interval_ms);
 
   auto evb = std::make_shared<folly::EventBase>();
   std::thread t1([evb]() { evb->loopForever(); });
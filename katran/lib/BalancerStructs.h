@@ -54,12 +54,37 @@ struct event_metadata {
   uint32_t data_len;
 } __attribute__((__packed__));
 
+// set in event_metadata's event if it is followed by uint64_t
+// bpf_ktime_get_ns() of the event (KATRAN_INTROSPECTION_KTIME)
+constexpr uint32_t kEventFlagKtime = 1U << 31;
+
+// sampling rate and filters of introspection event
+struct event_filter {
+  uint32_t sample_rate;
+  uint32_t flags;
+  union {
+    uint32_t vip;
+    uint32_t vipv6[4];
+  };
+  union {
+    uint32_t src;
+    uint32_t srcv6[4];
+  };
+  uint16_t vip_port;
+  uint8_t vip_proto;
+  uint8_t src_prefixlen;
+};
+
 // result of vip's lookup
 struct vip_meta {
   uint32_t flags;
   uint32_t vip_num;
 };
 
+// set in vip_meta's flags of v6 vips (F_VIP_V6). vip_definition has no
+// address family, so v6 vip w/ zeroed low 96 bits looks like v4 one
+constexpr uint32_t kVipFlagV6 = 1U << 31;
+
 // generic struct for statistics counters
 struct lb_stats {
   uint64_t v1;
@@ -576,6 +576,29 @@ int BaseBpfAdapter::testXdpProg(
   return ret;
 }
 
+int BaseBpfAdapter::testXdpProgLiveFrames(
+    const int prog_fd,
+    const int repeat,
+    void* data,
+    uint32_t data_size,
+    const int ifindex,
+    uint32_t batch_size) {
+  struct xdp_md ctx = {};
+  ctx.data_end = data_size;
+  ctx.ingress_ifindex = ifindex;
+  LIBBPF_OPTS(
+      bpf_test_run_opts,
+      attr,
+      .data_in = data,
+      .data_size_in = data_size,
+      .ctx_in = &ctx,
+      .ctx_size_in = sizeof(ctx),
+      .repeat = repeat,
+      .flags = BPF_F_TEST_XDP_LIVE_FRAMES,
+      .batch_size = batch_size);
+  return bpf_prog_test_run_opts(prog_fd, &attr);
+}
+
 int BaseBpfAdapter::modifyXdpProg(
     const int prog_fd,
     const unsigned int ifindex,
@@ -86,6 +86,56 @@ class BaseBpfAdapter {
       const std::string& bpf_prog,
       const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC) = 0;
 
+  /**
+   * @param string bpf_prog path to bpf program
+   * @param vector<string> errors description of found problems
+   * @param bpf_prog_type type of bpf prog to load
+   * @return int result 0 in case of success, other val otherwise
+   *
+   * helper function to load new version of already loaded bpf program next
+   * to the current one, reusing (compatible, as verified by BTF) maps of the
+   * current one. staged program does not replace current one until
+   * commitStagedBpfProg() is called
+   */
+  virtual int stageBpfProg(
+      const std::string& bpf_prog,
+      std::vector<std::string>& errors,
+      const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC) = 0;
+
+  /**
+   * @param string name of the staged bpf program
+   * @return int fd of staged program, negative on failure
+   */
+  virtual int getStagedProgFdByName(const std::string& name) = 0;
+
+  /**
+   * @return int result 0 in case of success, other val otherwise
+   *
+   * helper function to make staged programs current. replaced programs are
+   * kept loaded for rollback
+   */
+  virtual int commitStagedBpfProg() = 0;
+
+  /**
+   * helper function to unload staged programs
+   */
+  virtual void discardStagedBpfProg() = 0;
+
+  /**
+   * @param string name of the bpf program
+   * @return int fd of the program replaced by the last commit, negative if
+   * there is none
+   */
+  virtual int getPreviousProgFdByName(const std::string& name) = 0;
+
+  /**
+   * @return int result 0 in case of success, other val otherwise
+   *
+   * helper function to swap current programs w/ the ones replaced by the last
+   * commitStagedBpfProg()
+   */
+  virtual int rollbackBpfProg() = 0;
+
   /**
    * @param char* ptr to buffer with bpf's elf object
    * @param int size of the buffer
@@ -503,6 +553,31 @@ class BaseBpfAdapter {
       void* ctx_out = nullptr,
       uint32_t* ctx_size_out = nullptr);
 
+  /**
+   * @param int prog_fd descriptor of the program
+   * @param int repeat how many times the packet is going to be injected
+   * @param void* data pointer to the input packet
+   * @param uint32_t data_size size of the packet
+   * @param int ifindex of the interface packet is "received" on. packets
+   * for which program returns XDP_TX are sent out of this interface
+   * @param uint32_t batch_size number of frames kernel processes at once.
+   * 0 - kernel's default
+   * @return int result of the test. 0 on success, non 0 otherwise
+   *
+   * helper function to run xdp program in live frames mode
+   * (BPF_F_TEST_XDP_LIVE_FRAMES). unlike testXdpProg, packets are not
+   * copied back to userspace: XDP_TX and XDP_REDIRECT are actually
+   * performed, so it could be used to measure forwarding throughput.
+   * requires kernel 5.18+
+   */
+  static int testXdpProgLiveFrames(
+      const int prog_fd,
+      const int repeat,
+      void* data,
+      uint32_t data_size,
+      const int ifindex,
+      uint32_t batch_size = 0);
+
   /**
    * @param int prog_fd descriptor of the program
    * @param string path to cgroup directory
@@ -37,6 +37,33 @@ int BpfAdapter::reloadBpfProg(
   return loader_.reloadBpfFromFile(bpf_prog, type);
 }
 
+int BpfAdapter::stageBpfProg(
+    const std::string& bpf_prog,
+    std::vector<std::string>& errors,
+    const bpf_prog_type type) {
+  return loader_.stageBpfFromFile(bpf_prog, errors, type);
+}
+
+int BpfAdapter::getStagedProgFdByName(const std::string& name) {
+  return loader_.getStagedProgFdByName(name);
+}
+
+int BpfAdapter::commitStagedBpfProg() {
+  return loader_.commitStagedBpf();
+}
+
+void BpfAdapter::discardStagedBpfProg() {
+  loader_.discardStagedBpf();
+}
+
+int BpfAdapter::getPreviousProgFdByName(const std::string& name) {
+  return loader_.getPreviousProgFdByName(name);
+}
+
+int BpfAdapter::rollbackBpfProg() {
+  return loader_.rollbackBpf();
+}
+
 int BpfAdapter::loadBpfProg(
     const char* buf,
     int buf_size,
@@ -50,6 +50,21 @@ class BpfAdapter : public BaseBpfAdapter {
       const std::string& bpf_prog,
       const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC) override;
 
+  int stageBpfProg(
+      const std::string& bpf_prog,
+      std::vector<std::string>& errors,
+      const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC) override;
+
+  int getStagedProgFdByName(const std::string& name) override;
+
+  int commitStagedBpfProg() override;
+
+  void discardStagedBpfProg() override;
+
+  int getPreviousProgFdByName(const std::string& name) override;
+
+  int rollbackBpfProg() override;
+
   int loadBpfProg(
       const char* buf,
       int buf_size,
@@ -23,6 +23,7 @@
 #include <folly/String.h>
 #include <glog/logging.h>
 #include <libmnl/libmnl.h>
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
@@ -221,7 +222,89 @@ class BpfBatchUtil {
     return 0;
   }
 
+  /**
+   * reads values for [first, first + count) range of keys of bpf array (w/o
+   * per-cpu values) into values. falls back to per element lookups if batch
+   * operations are not supported by the kernel
+   */
+  template <typename ValueT>
+  static int bpfArrayReadRange(
+      int map_fd,
+      std::uint32_t first,
+      std::uint32_t count,
+      ValueT* values,
+      std::uint32_t batch_sz = 4096) {
+    return arrayReadRange(map_fd, first, count, sizeof(ValueT), values, batch_sz);
+  }
+
+  /**
+   * same as bpfArrayReadRange but for per-cpu arrays. values must have room
+   * for count * num_cpus records; kernel pads each per-cpu record to 8 bytes,
+   * so value_size is rounded up accordingly
+   */
+  static int bpfPerCpuArrayReadRange(
+      int map_fd,
+      std::uint32_t first,
+      std::uint32_t count,
+      std::uint32_t num_cpus,
+      std::size_t value_size,
+      void* values,
+      std::uint32_t batch_sz = 1024) {
+    auto stride = ((value_size + 7) & ~static_cast<std::size_t>(7)) * num_cpus;
+    return arrayReadRange(map_fd, first, count, stride, values, batch_sz);
+  }
+
  private:
+  static int arrayReadRange(
+      int map_fd,
+      std::uint32_t first,
+      std::uint32_t count,
+      std::size_t stride,
+      void* values,
+      std::uint32_t batch_sz) {
+    auto out = static_cast<char*>(values);
+    std::vector<uint32_t> key_buf(batch_sz);
+    // batch lookup starts from the key next to in_batch
+    uint32_t inKey = first - 1;
+    uint32_t nextKey = 0;
+    uint32_t read = 0;
+
+    DECLARE_LIBBPF_OPTS(
+        bpf_map_batch_opts, opts, .elem_flags = 0, .flags = 0, );
+
+    while (read < count) {
+      __u32 batch = std::min(batch_sz, count - read);
+      auto lookupErr = bpf_map_lookup_batch(
+          map_fd,
+          first + read == 0 ? nullptr : &inKey,
+          &nextKey,
+          key_buf.data(),
+          out + read * stride,
+          &batch,
+          &opts);
+      if (lookupErr && lookupErr != -ENOENT) {
+        VLOG(2) << "Failed to perform batch lookup, errno = "
+                << folly::errnoStr(-lookupErr)
+                << ". falling back to per element lookups";
+        break;
+      }
+      read += batch;
+      inKey = nextKey;
+      if (lookupErr == -ENOENT || batch == 0) {
+        break;
+      }
+    }
+
+    for (; read < count; read++) {
+      uint32_t key = first + read;
+      if (BaseBpfAdapter::bpfMapLookupElement(
+              map_fd, &key, out + read * stride)) {
+        LOG(ERROR) << "Failed to lookup key " << key << " in bpf array";
+        return -1;
+      }
+    }
+    return 0;
+  }
 };
 
 } // namespace katran
@@ -18,6 +18,13 @@
 #include "BpfLoader.h"
 #include <glog/logging.h>
 #include <array>
+#include <cstring>
+#include <utility>
+
+extern "C" {
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+}
 
 namespace katran {
 
@@ -26,6 +33,8 @@ constexpr int kError = 1;
 constexpr int kNotExists = -1;
 constexpr int kSuccess = 0;
 constexpr int kMaxSharedMapNameSize = 15;
+// max nesting of types which is compared during maps compatibility check
+constexpr int kMaxBtfDepth = 16;
 } // namespace
 
 namespace {
@@ -46,6 +55,65 @@ std::string libBpfErrMsg(int err) {
   return std::string(buf.begin(), buf.end());
 }
 
+bool compareBtfTypes(
+    const struct ::btf* a,
+    uint32_t aId,
+    const struct ::btf* b,
+    uint32_t bId,
+    int depth = 0) {
+  if (depth > kMaxBtfDepth) {
+    return true;
+  }
+  auto aRes = ::btf__resolve_type(a, aId);
+  auto bRes = ::btf__resolve_type(b, bId);
+  if (aRes < 0 || bRes < 0) {
+    return false;
+  }
+  auto aType = ::btf__type_by_id(a, aRes);
+  auto bType = ::btf__type_by_id(b, bRes);
+  if (!aType || !bType || btf_kind(aType) != btf_kind(bType) ||
+      ::btf__resolve_size(a, aRes) != ::btf__resolve_size(b, bRes)) {
+    return false;
+  }
+  switch (btf_kind(aType)) {
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION: {
+      if (btf_vlen(aType) != btf_vlen(bType)) {
+        return false;
+      }
+      auto aMembers = btf_members(aType);
+      auto bMembers = btf_members(bType);
+      for (int i = 0; i < btf_vlen(aType); i++) {
+        if (std::strcmp(
+                ::btf__name_by_offset(a, aMembers[i].name_off),
+                ::btf__name_by_offset(b, bMembers[i].name_off)) != 0 ||
+            btf_member_bit_offset(aType, i) !=
+                btf_member_bit_offset(bType, i) ||
+            btf_member_bitfield_size(aType, i) !=
+                btf_member_bitfield_size(bType, i) ||
+            !compareBtfTypes(
+                a, aMembers[i].type, b, bMembers[i].type, depth + 1)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case BTF_KIND_ARRAY: {
+      auto aArray = btf_array(aType);
+      auto bArray = btf_array(bType);
+      return aArray->nelems == bArray->nelems &&
+          compareBtfTypes(a, aArray->type, b, bArray->type, depth + 1);
+    }
+    case BTF_KIND_INT:
+      return btf_int_encoding(aType) == btf_int_encoding(bType) &&
+          btf_int_bits(aType) == btf_int_bits(bType) &&
+          btf_int_offset(aType) == btf_int_offset(bType);
+    default:
+      // sizes have been compared already
+      return true;
+  }
+}
+
 } // namespace
 
 BpfLoader::BpfLoader() {
@@ -54,9 +122,13 @@ BpfLoader::BpfLoader() {
 }
 
 BpfLoader::~BpfLoader() {
+  discardStagedBpf();
   for (auto& obj : bpfObjects_) {
     closeBpfObject(obj.second);
   }
+  if (previousObject_) {
+    closeBpfObject(previousObject_);
+  }
 }
 
 int BpfLoader::closeBpfObject(::bpf_object* obj) {
@@ -144,6 +216,303 @@ int BpfLoader::reloadBpfFromFile(
   return reloadBpfObject(obj, path, type);
 }
 
+int BpfLoader::stageBpfFromFile(
+    const std::string& path,
+    std::vector<std::string>& errors,
+    const bpf_prog_type type) {
+  if (stagedObject_) {
+    errors.push_back("another bpf object is staged already: " + stagedObjName_);
+    return kError;
+  }
+  auto obj = ::bpf_object__open(path.c_str());
+  const auto err = ::libbpf_get_error(obj);
+  if (err) {
+    errors.push_back(
+        "error while opening bpf object: " + path +
+        ", error: " + libBpfErrMsg(err));
+    return kError;
+  }
+
+  ::bpf_program* prog;
+  ::bpf_map* map;
+  bpf_object__for_each_program(prog, obj) {
+    if (progs_.find(::bpf_program__name(prog)) == progs_.end()) {
+      errors.push_back(
+          std::string("program is not loaded yet: ") +
+          ::bpf_program__name(prog));
+    }
+  }
+
+  bpf_map__for_each(map, obj) {
+    auto map_name = ::bpf_map__name(map);
+    // global data (.rodata, .bss etc) belongs to the new version
+    if (::bpf_map__is_internal(map)) {
+      continue;
+    }
+    int fd = kNotExists;
+    auto shared_map_iter = sharedMaps_.find(map_name);
+    if (shared_map_iter != sharedMaps_.end()) {
+      fd = shared_map_iter->second;
+    } else {
+      auto map_iter = maps_.find(map_name);
+      if (map_iter != maps_.end()) {
+        fd = map_iter->second;
+      }
+    }
+    if (fd >= 0) {
+      auto map_errors = checkMapCompatibility(obj, map, fd);
+      if (!map_errors.empty()) {
+        errors.insert(errors.end(), map_errors.begin(), map_errors.end());
+      } else if (::bpf_map__reuse_fd(map, fd)) {
+        errors.push_back(std::string("can't reuse fd of map: ") + map_name);
+      }
+      continue;
+    }
+    auto inner_map_iter = innerMapsProto_.find(map_name);
+    if (inner_map_iter != innerMapsProto_.end()) {
+      if (bpf_map__set_inner_map_fd(map, inner_map_iter->second)) {
+        errors.push_back(
+            std::string("can't set inner map fd for: ") + map_name);
+      }
+    }
+  }
+  if (!errors.empty()) {
+    return closeBpfObject(obj);
+  }
+
+  if (::bpf_object__load(obj)) {
+    errors.push_back("error while trying to load bpf object: " + path);
+    return closeBpfObject(obj);
+  }
+  checkBpfProgType(obj, type);
+  stagedObject_ = obj;
+  stagedObjName_ = path;
+  return kSuccess;
+}
+
+bool BpfLoader::btfTypesEqual(
+    const struct ::btf* a,
+    uint32_t aId,
+    const struct ::btf* b,
+    uint32_t bId) {
+  return compareBtfTypes(a, aId, b, bId);
+}
+
+std::vector<std::string> BpfLoader::checkMapCompatibility(
+    const std::string& mapName,
+    const struct ::bpf_map_info& loaded,
+    const struct ::btf* loadedBtf,
+    const struct ::bpf_map_info& staged,
+    const struct ::btf* stagedBtf) {
+  std::vector<std::string> errors;
+  auto check = [&](const char* field, uint64_t loadedVal, uint64_t stagedVal) {
+    if (loadedVal != stagedVal) {
+      errors.push_back(
+          mapName + ": " + field + " mismatch, loaded " +
+          std::to_string(loadedVal) + " new " + std::to_string(stagedVal));
+    }
+  };
+  check("type", loaded.type, staged.type);
+  check("key size", loaded.key_size, staged.key_size);
+  check("value size", loaded.value_size, staged.value_size);
+  check("max entries", loaded.max_entries, staged.max_entries);
+  check("flags", loaded.map_flags, staged.map_flags);
+  if (!errors.empty()) {
+    return errors;
+  }
+  if (!loadedBtf || !stagedBtf) {
+    // nothing to compare w/. sizes have been checked already
+    VLOG(2) << "no BTF to compare for map: " << mapName;
+    return errors;
+  }
+  if (staged.btf_key_type_id && loaded.btf_key_type_id &&
+      !btfTypesEqual(
+          stagedBtf,
+          staged.btf_key_type_id,
+          loadedBtf,
+          loaded.btf_key_type_id)) {
+    errors.push_back(mapName + ": BTF of key does not match");
+  }
+  if (staged.btf_value_type_id && loaded.btf_value_type_id &&
+      !btfTypesEqual(
+          stagedBtf,
+          staged.btf_value_type_id,
+          loadedBtf,
+          loaded.btf_value_type_id)) {
+    errors.push_back(mapName + ": BTF of value does not match");
+  }
+  return errors;
+}
+
+std::vector<std::string>
+BpfLoader::checkMapCompatibility(::bpf_object* obj, ::bpf_map* map, int fd) {
+  std::string map_name = ::bpf_map__name(map);
+  struct ::bpf_map_info loaded = {};
+  uint32_t info_size = sizeof(loaded);
+  if (::bpf_obj_get_info_by_fd(fd, &loaded, &info_size)) {
+    return {"can't get info about loaded map: " + map_name};
+  }
+  struct ::bpf_map_info staged = {};
+  staged.type = ::bpf_map__type(map);
+  staged.key_size = ::bpf_map__key_size(map);
+  staged.value_size = ::bpf_map__value_size(map);
+  staged.max_entries = ::bpf_map__max_entries(map);
+  staged.map_flags = ::bpf_map__map_flags(map);
+  staged.btf_key_type_id = ::bpf_map__btf_key_type_id(map);
+  staged.btf_value_type_id = ::bpf_map__btf_value_type_id(map);
+
+  auto obj_btf = ::bpf_object__btf(obj);
+  struct ::btf* loaded_btf = nullptr;
+  if (obj_btf && loaded.btf_id != 0) {
+    loaded_btf = ::btf__load_from_kernel_by_id(loaded.btf_id);
+    if (!loaded_btf || ::libbpf_get_error(loaded_btf)) {
+      return {"can't load BTF of loaded map: " + map_name};
+    }
+  }
+  auto errors =
+      checkMapCompatibility(map_name, loaded, loaded_btf, staged, obj_btf);
+  ::btf__free(loaded_btf);
+  return errors;
+}
+
+int BpfLoader::getStagedProgFdByName(const std::string& name) {
+  if (!stagedObject_) {
+    LOG(ERROR) << "there is no staged bpf object";
+    return kNotExists;
+  }
+  auto prog = ::bpf_object__find_program_by_name(stagedObject_, name.c_str());
+  if (!prog) {
+    LOG(ERROR) << "Can't find staged prog with name: " << name;
+    return kNotExists;
+  }
+  return ::bpf_program__fd(prog);
+}
+
+int BpfLoader::commitStagedBpf() {
+  if (!stagedObject_) {
+    LOG(ERROR) << "there is no staged bpf object to commit";
+    return kError;
+  }
+  ::bpf_program* prog;
+  ::bpf_map* map;
+  std::set<std::string> loadedProgNames;
+  std::set<std::string> loadedMapNames;
+
+  // object which owns the programs being replaced. it is looked up by the
+  // programs, as staged object could have been loaded from another path
+  auto replaced = bpfObjects_.end();
+  bpf_object__for_each_program(prog, stagedObject_) {
+    replaced = findObjectByProg(::bpf_program__name(prog));
+    if (replaced != bpfObjects_.end()) {
+      break;
+    }
+  }
+
+  // programs replaced by previous commit are not a rollback target anymore
+  previousProgs_.clear();
+  previousMaps_.clear();
+  bpf_object__for_each_program(prog, stagedObject_) {
+    auto prog_name = ::bpf_program__name(prog);
+    VLOG(4) << "replacing bpf program: " << prog_name
+            << " with fd: " << ::bpf_program__fd(prog);
+    previousProgs_[prog_name] = progs_[prog_name];
+    progs_[prog_name] = ::bpf_program__fd(prog);
+    loadedProgNames.insert(prog_name);
+  }
+
+  bpf_map__for_each(map, stagedObject_) {
+    auto map_name = bpf_map__name(map);
+    if (maps_.find(map_name) == maps_.end()) {
+      VLOG(4) << "adding bpf map: " << map_name
+              << " with fd: " << ::bpf_map__fd(map);
+      maps_[map_name] = bpf_map__fd(map);
+    }
+    loadedMapNames.insert(map_name);
+  }
+
+  for (auto& progName : loadedProgNames) {
+    previousMaps_[progName] = std::move(currentMaps_[progName]);
+    currentMaps_[progName] = loadedMapNames;
+  }
+
+  // object of the programs, which were replaced by previous commit, is not
+  // needed anymore. object which is replaced now becomes rollback target
+  if (previousObject_) {
+    closeBpfObject(previousObject_);
+    previousObject_ = nullptr;
+  }
+  if (replaced != bpfObjects_.end()) {
+    previousObject_ = replaced->second;
+    previousObjName_ = replaced->first;
+    bpfObjects_.erase(replaced);
+  }
+  bpfObjects_[stagedObjName_] = stagedObject_;
+  stagedObject_ = nullptr;
+  stagedObjName_.clear();
+  return kSuccess;
+}
+
+void BpfLoader::discardStagedBpf() {
+  if (stagedObject_) {
+    closeBpfObject(stagedObject_);
+    stagedObject_ = nullptr;
+    stagedObjName_.clear();
+  }
+}
+
+int BpfLoader::getPreviousProgFdByName(const std::string& name) {
+  auto prog = previousProgs_.find(name);
+  if (prog == previousProgs_.end()) {
+    return kNotExists;
+  }
+  return prog->second;
+}
+
+int BpfLoader::rollbackBpf() {
+  if (previousProgs_.empty()) {
+    LOG(ERROR) << "there are no programs to roll back to";
+    return kError;
+  }
+  // bpfObjects_ always holds object of the current programs
+  auto current = bpfObjects_.end();
+  for (auto& prog : previousProgs_) {
+    current = findObjectByProg(prog.first);
+    if (current != bpfObjects_.end()) {
+      break;
+    }
+  }
+  for (auto& prog : previousProgs_) {
+    std::swap(progs_[prog.first], prog.second);
+    std::swap(currentMaps_[prog.first], previousMaps_[prog.first]);
+  }
+  if (previousObject_ && current != bpfObjects_.end()) {
+    auto currentObject = current->second;
+    auto currentObjName = current->first;
+    bpfObjects_.erase(current);
+    bpfObjects_[previousObjName_] = previousObject_;
+    previousObject_ = currentObject;
+    previousObjName_ = std::move(currentObjName);
+  }
+  return kSuccess;
+}
+
+std::unordered_map<std::string, ::bpf_object*>::iterator
+BpfLoader::findObjectByProg(const std::string& progName) {
+  auto prog_iter = progs_.find(progName);
+  if (prog_iter == progs_.end()) {
+    return bpfObjects_.end();
+  }
+  for (auto obj_iter = bpfObjects_.begin(); obj_iter != bpfObjects_.end();
+       obj_iter++) {
+    auto prog =
+        ::bpf_object__find_program_by_name(obj_iter->second, progName.c_str());
+    if (prog && ::bpf_program__fd(prog) == prog_iter->second) {
+      return obj_iter;
+    }
+  }
+  return bpfObjects_.end();
+}
+
 int BpfLoader::loadBpfFromBuffer(
     const char* buf,
     int buf_size,
@@ -19,6 +19,7 @@
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 extern "C" {
 #include <bpf/libbpf.h>
@@ -83,6 +84,58 @@ class BpfLoader {
       const std::string& path,
       const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC);
 
+  /**
+   * @param string path to bpf object file
+   * @param vector<string> errors description of found problems (e.g.
+   * incompatibilities between maps of the object and already loaded ones)
+   * @param bpf_prog_type type of bpf program to load.
+   * @return int 0 on success
+   *
+   * helper function to load new version of already loaded bpf object next to
+   * the current one. maps are reused (as for reload), but before the load
+   * each reused map is checked for compatibility: type, key/value sizes,
+   * max entries, flags and BTF description of key and value. currently
+   * loaded programs stay intact until commitStagedBpf() is called
+   */
+  int stageBpfFromFile(
+      const std::string& path,
+      std::vector<std::string>& errors,
+      const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC);
+
+  /**
+   * @param string name of the bpf program (function name)
+   * @return int negative on failure, staged prog's fd on success
+   */
+  int getStagedProgFdByName(const std::string& name);
+
+  /**
+   * @return int 0 on success
+   *
+   * helper function to make staged programs current. replaced programs stay
+   * loaded, so it is possible to roll back to them (see rollbackBpf). the
+   * ones replaced by the previous commit are unloaded
+   */
+  int commitStagedBpf();
+
+  /**
+   * helper function to unload staged object (if any)
+   */
+  void discardStagedBpf();
+
+  /**
+   * @param string name of the bpf program (function name)
+   * @return int negative if there is no program to roll back to, fd otherwise
+   */
+  int getPreviousProgFdByName(const std::string& name);
+
+  /**
+   * @return int 0 on success
+   *
+   * helper function to swap current programs w/ the ones replaced by the last
+   * commitStagedBpf()
+   */
+  int rollbackBpf();
+
   /**
    * @param string name of the map
    * @return int negative on failure, map's fd on success
@@ -126,6 +179,42 @@ class BpfLoader {
    */
   int updateSharedMap(const std::string& name, int fd);
 
+  /**
+   * @param btf a BTF which contains the first type
+   * @param uint32_t aId id of the first type
+   * @param btf b BTF which contains the second type
+   * @param uint32_t bId id of the second type
+   * @return bool true if both types have the same layout
+   *
+   * structural comparison of two BTF types: typedefs and modifiers are
+   * skipped, names of the types themselves are ignored, but sizes, layouts
+   * and names of struct's members must match
+   */
+  static bool btfTypesEqual(
+      const struct ::btf* a,
+      uint32_t aId,
+      const struct ::btf* b,
+      uint32_t bId);
+
+  /**
+   * @param string mapName name of the map, used in errors
+   * @param bpf_map_info loaded description of already loaded map
+   * @param btf loadedBtf BTF of already loaded map, could be nullptr
+   * @param bpf_map_info staged description of the map from the new object
+   * @param btf stagedBtf BTF of the new object, could be nullptr
+   * @return vector<string> found incompatibilities, empty if new map could
+   * reuse loaded one
+   *
+   * helper function to compare map's type, key/value sizes, max entries,
+   * flags and (if both BTFs are present) BTF description of key and value
+   */
+  static std::vector<std::string> checkMapCompatibility(
+      const std::string& mapName,
+      const struct ::bpf_map_info& loaded,
+      const struct ::btf* loadedBtf,
+      const struct ::bpf_map_info& staged,
+      const struct ::btf* stagedBtf);
+
  private:
   /**
    * helper function to load bpf object
@@ -143,17 +232,58 @@ class BpfLoader {
       const std::string& objName,
       const bpf_prog_type type = BPF_PROG_TYPE_UNSPEC);
 
+  /**
+   * helper function to check that map from the object could reuse already
+   * loaded map w/ specified fd. returns list of found incompatibilities
+   */
+  std::vector<std::string>
+  checkMapCompatibility(::bpf_object* obj, ::bpf_map* map, int fd);
+
   /**
    * helper function to close bpf object and return error.
    */
   int closeBpfObject(::bpf_object* obj);
 
+  /**
+   * helper function which returns iterator to the object in bpfObjects_,
+   * which owns current program w/ specified name (or end() if there is none)
+   */
+  std::unordered_map<std::string, ::bpf_object*>::iterator findObjectByProg(
+      const std::string& progName);
+
   const char* getProgNameFromBpfProg(const struct bpf_program* prog);
 
   /**
    * dict of path to bpf objects mapping
    */
   std::unordered_map<std::string, ::bpf_object*> bpfObjects_;
+
+  /**
+   * object, which was replaced in bpfObjects_ by the last commitStagedBpf()
+   * (and its path). it owns previousProgs_, so it is closed as soon as they
+   * are not a rollback target anymore. it is found by the programs it owns,
+   * so new object could be loaded from another path
+   */
+  ::bpf_object* previousObject_{nullptr};
+  std::string previousObjName_;
+
+  /**
+   * loaded, but not yet committed object (and its path)
+   */
+  ::bpf_object* stagedObject_{nullptr};
+  std::string stagedObjName_;
+
+  /**
+   * dict of prog's name to descriptor of the program, which has been replaced
+   * by the last commitStagedBpf()
+   */
+  std::unordered_map<std::string, int> previousProgs_;
+
+  /**
+   * maps of the programs from previousProgs_ (same as currentMaps_)
+   */
+  std::unordered_map<std::string, std::set<std::string>> previousMaps_;
+
   /**
    * dict of map's name to map's descriptor mappings
    */
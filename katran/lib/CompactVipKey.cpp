@@ -0,0 +1,55 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/CompactVipKey.h"
+
+#include <folly/IPAddress.h>
+
+namespace katran {
+
+CompactVipKey::CompactVipKey(const VipKey& vip)
+    : port(vip.port), proto(vip.proto) {
+  auto addr_or_err = folly::IPAddress::tryFromString(vip.address);
+  if (addr_or_err.hasError()) {
+    return;
+  }
+  const auto& vip_addr = addr_or_err.value();
+  if (vip_addr.isV4()) {
+    auto bytes = vip_addr.asV4().toByteArray();
+    std::memcpy(addr.data(), bytes.data(), bytes.size());
+    family = 4;
+  } else {
+    auto bytes = vip_addr.asV6().toByteArray();
+    std::memcpy(addr.data(), bytes.data(), bytes.size());
+    family = 6;
+  }
+}
+
+VipKey CompactVipKey::toVipKey() const {
+  VipKey vip;
+  vip.port = port;
+  vip.proto = proto;
+  if (family == 4) {
+    vip.address =
+        folly::IPAddressV4::fromBinary(folly::ByteRange(addr.data(), 4)).str();
+  } else if (family == 6) {
+    vip.address =
+        folly::IPAddressV6::fromBinary(folly::ByteRange(addr.data(), 16)).str();
+  }
+  return vip;
+}
+
+} // namespace katran
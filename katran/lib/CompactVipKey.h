@@ -0,0 +1,85 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <folly/hash/Hash.h>
+
+#include "katran/lib/KatranLbStructs.h"
+
+namespace katran {
+
+/**
+ * fixed size binary representation of VipKey. used as a key of katran's
+ * internal indices instead of VipKey (which contains std::string), so
+ * indices could live in flat hash tables and hashing/comparison do not
+ * depend on textual representation of the address
+ */
+struct CompactVipKey {
+  // v4 address is stored in the first 4 bytes
+  std::array<uint8_t, 16> addr{};
+  uint16_t port{0};
+  uint8_t proto{0};
+  // 4 or 6. 0 if address, which key has been created from, is invalid
+  uint8_t family{0};
+
+  CompactVipKey() = default;
+
+  /**
+   * could be used w/ any address string. key w/ invalid address does not
+   * match any valid one and must not be inserted into the indices
+   */
+  explicit CompactVipKey(const VipKey& vip);
+
+  bool valid() const {
+    return family != 0;
+  }
+
+  /**
+   * @return VipKey w/ address in canonical (folly::IPAddress::str()) form
+   */
+  VipKey toVipKey() const;
+
+  bool operator==(const CompactVipKey& other) const {
+    return std::memcmp(this, &other, sizeof(CompactVipKey)) == 0;
+  }
+
+  bool operator!=(const CompactVipKey& other) const {
+    return !(*this == other);
+  }
+};
+
+static_assert(sizeof(CompactVipKey) == 20, "unexpected CompactVipKey size");
+
+struct CompactVipKeyHasher {
+  std::size_t operator()(const CompactVipKey& k) const {
+    uint64_t hi;
+    uint64_t lo;
+    std::memcpy(&hi, k.addr.data(), sizeof(hi));
+    std::memcpy(&lo, k.addr.data() + sizeof(hi), sizeof(lo));
+    uint64_t tail = (uint64_t(k.port) << 16) | (uint64_t(k.proto) << 8) |
+        uint64_t(k.family);
+    return folly::hash::hash_128_to_64(
+        folly::hash::hash_128_to_64(hi, lo), tail);
+  }
+};
+
+} // namespace katran
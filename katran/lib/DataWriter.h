@@ -14,7 +14,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #pragma once
+#include <folly/io/IOBuf.h>
+#include <sys/uio.h>
 #include <cstddef>
+#include <memory>
 
 namespace katran {
 
@@ -48,6 +51,41 @@ class DataWriter {
     writeData(ptr, size);
   }
 
+  /**
+   * @param const struct iovec* iov chunks of data to write
+   * @param std::size_t iovcnt number of chunks
+   *
+   * called when a batch of records needs to be written at once. writers,
+   * which could do it w/ a single syscall, should override this. default
+   * implementation writes chunks one by one w/ writeData()
+   */
+  virtual void writeDataBatch(const struct iovec* iov, std::size_t iovcnt) {
+    for (std::size_t i = 0; i < iovcnt; i++) {
+      writeData(iov[i].iov_base, iov[i].iov_len);
+    }
+  }
+
+  /**
+   * @param unique_ptr<IOBuf> chain of buffers w/ records to write
+   *
+   * same as writeDataBatch w/ iovec, but writer takes ownership of the data.
+   * writers, which need to keep the data after the call (e.g. untill pipe
+   * becomes writable), should override this to avoid a copy
+   */
+  virtual void writeDataBatch(std::unique_ptr<folly::IOBuf> chain) {
+    auto iov = chain->getIov();
+    writeDataBatch(iov.data(), iov.size());
+  }
+
+  /**
+   * @return true if records could be accumulated by the caller and written
+   * w/ writeDataBatch(). must be false for writers w/ limited storage, as
+   * available() does not account for accumulated records
+   */
+  virtual bool supportsBatching() const {
+    return false;
+  }
+
   /**
    * @param amount -- amount of bytes to write.
    *
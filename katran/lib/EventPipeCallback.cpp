@@ -11,20 +11,31 @@ namespace monitoring {
 
 void EventPipeCallback::readBuffer(
     std::unique_ptr<folly::IOBuf>&& buf) noexcept {
+  if (buf) {
+    readBuffer_.append(std::move(buf));
+  }
+  if (readBuffer_.empty()) {
+    return;
+  }
   VLOG(4) << __func__ << " ready to send data";
-  folly::io::Cursor rcursor(buf.get());
+  // Subscribers are taken once per read. Subscriptions could be changed
+  // concurrently w/o waiting for the delivery
+  std::shared_ptr<const ClientSubscriptionMap> subsmap;
+  if (enabled()) {
+    subsmap = *cb_subsmap_.rlock();
+  }
+  folly::io::Cursor rcursor(readBuffer_.front());
   size_t rec_hdr_sz = sizeof(pcaprec_hdr_s);
 
   // Here we enter the loop of reading complete pcap records from the buffer. If
   // either the pcap record header or the packet data is incomplete, we break
-  // the loop and store whatever is left over in the temporary buffer. Although
+  // the loop and keep whatever is left over in the read buffer. Although
   // there are situations where there's no client, the loop has to run in order
   // to maintain bounds between pcap records so that when clients subscribe we
   // can respond without worrying about breaking the bounds between two
   // consecutive pcap records.
   for (;;) {
     pcaprec_hdr_s rec_hdr;
-    Event msg;
     if (rcursor.canAdvance(rec_hdr_sz)) {
       rec_hdr = rcursor.read<pcaprec_hdr_s>();
     } else {
@@ -34,41 +45,37 @@ void EventPipeCallback::readBuffer(
       break;
     }
 
-    if (rcursor.canAdvance(rec_hdr.incl_len)) {
-      // Back up so that we can include pcap header in data
-      rcursor.retreat(rec_hdr_sz);
-      msg.id = event_id_;
-      msg.pktsize = rec_hdr.orig_len;
-      msg.data = std::string(
-          reinterpret_cast<const char*>(rcursor.data()),
-          rec_hdr_sz + rec_hdr.incl_len);
-      rcursor.skip(rec_hdr_sz + rec_hdr.incl_len);
-    } else {
+    if (!rcursor.canAdvance(rec_hdr.incl_len)) {
       VLOG(2) << fmt::format(
           "incomplete pcap message, expecting {} bytes of data, got {}",
           rec_hdr.incl_len,
-          rcursor.length());
+          rcursor.totalLength());
       rcursor.retreat(rec_hdr_sz);
       break;
     }
 
-    // Send data if the event is enabled
-    if (enabled()) {
-      auto subsmap = cb_subsmap_.rlock();
-      for (auto& it : *subsmap) {
-        VLOG(4) << fmt::format(
-            "sending event {} to client", toString(event_id_));
-        it.second->sendEvent(msg);
-      }
+    // Back up so that we can include pcap header in data
+    rcursor.retreat(rec_hdr_sz);
+    if (!subsmap || subsmap->empty()) {
+      rcursor.skip(rec_hdr_sz + rec_hdr.incl_len);
+      continue;
+    }
+    // Record is not copied: all the clients share a reference to the
+    // read buffer
+    std::unique_ptr<folly::IOBuf> record;
+    rcursor.clone(record, rec_hdr_sz + rec_hdr.incl_len);
+    SharedEvent msg{
+        .id = event_id_,
+        .pktsize = rec_hdr.orig_len,
+        .data = std::move(record)};
+    for (auto& it : *subsmap) {
+      VLOG(4) << fmt::format("sending event {} to client", toString(event_id_));
+      it.second->sendSharedEvent(msg);
     }
   }
 
-  // Simply triming the amount of bytes we've read. If there's leftover,
-  // we should append it to the readBuffer_, which is now empty.
-  buf->trimStart(rcursor.getCurrentPosition());
-  if (buf->length() != 0) {
-    readBuffer_.append(std::move(buf));
-  }
+  // Leftover (incomplete record) stays in the readBuffer_
+  readBuffer_.trimStart(rcursor.getCurrentPosition());
 }
 
 void EventPipeCallback::addClientSubscription(
@@ -76,19 +83,26 @@ void EventPipeCallback::addClientSubscription(
   ClientId cid = newSub.first;
   VLOG(4) << __func__ << fmt::format(" Adding client {}", cid);
   auto cb_subsmap = cb_subsmap_.wlock();
-  auto result = cb_subsmap->insert(std::move(newSub));
+  // Copy on write: reader could be delivering events to the current map
+  auto newSubsmap = std::make_shared<ClientSubscriptionMap>(**cb_subsmap);
+  auto result = newSubsmap->insert(std::move(newSub));
   if (!result.second) {
     LOG(ERROR) << fmt::format("duplicate client id: {}", cid);
+    return;
   }
+  *cb_subsmap = std::move(newSubsmap);
 }
 
 void EventPipeCallback::removeClientSubscription(ClientId cid) {
   auto cb_subsmap = cb_subsmap_.wlock();
-  size_t cnt = cb_subsmap->erase(cid);
+  auto newSubsmap = std::make_shared<ClientSubscriptionMap>(**cb_subsmap);
+  size_t cnt = newSubsmap->erase(cid);
   if (cnt != 1) {
     LOG(ERROR) << fmt::format(
         "no client subscription associated with id: {}", cid);
+    return;
   }
+  *cb_subsmap = std::move(newSubsmap);
 }
 
 } // namespace monitoring
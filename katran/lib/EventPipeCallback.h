@@ -22,7 +22,9 @@ constexpr uint32_t kReadBufAllocSize = 4096;
 class EventPipeCallback : public folly::AsyncReader::ReadCallback {
  public:
   EventPipeCallback() = delete;
-  explicit EventPipeCallback(EventId event_id) : event_id_(event_id) {}
+  explicit EventPipeCallback(EventId event_id)
+      : cb_subsmap_(std::make_shared<const ClientSubscriptionMap>()),
+        event_id_(event_id) {}
 
   /**
    * This facilitates testing
@@ -30,7 +32,9 @@ class EventPipeCallback : public folly::AsyncReader::ReadCallback {
   explicit EventPipeCallback(
       EventId event_id,
       folly::Synchronized<ClientSubscriptionMap>&& subsmap)
-      : cb_subsmap_(std::move(subsmap)), event_id_(event_id) {}
+      : cb_subsmap_(std::make_shared<const ClientSubscriptionMap>(
+            std::move(*subsmap.wlock()))),
+        event_id_(event_id) {}
 
   /**
    * Always use `readDataAvailable` instead of `readBufferAvailable`
@@ -61,15 +65,14 @@ class EventPipeCallback : public folly::AsyncReader::ReadCallback {
 
   /**
    * Called when data is available to read
-   * Pass the entire buf to readBuffer, which will properly handle incomplete
-   * messages and "leftover"
+   * Data is parsed in place by readBuffer, which will properly handle
+   * incomplete messages and "leftover". Buffer is not coalesced, as records
+   * are delivered as (possibly chained) references to it
    */
   void readDataAvailable(size_t len) noexcept override {
     VLOG(4) << __func__ << " " << len << "bytes";
     readBuffer_.postallocate(len);
-    auto buf = readBuffer_.move();
-    buf->coalesce();
-    readBuffer(std::move(buf));
+    readBuffer(nullptr);
   }
 
   /**
@@ -89,7 +92,8 @@ class EventPipeCallback : public folly::AsyncReader::ReadCallback {
   }
 
   /**
-   * Actual read buffer implementation
+   * Actual read buffer implementation. buf (if any) is appended to the
+   * pending data and all complete pcap records are sent to subscribers
    */
   void readBuffer(std::unique_ptr<folly::IOBuf>&& buf) noexcept;
 
@@ -132,17 +136,19 @@ class EventPipeCallback : public folly::AsyncReader::ReadCallback {
 
  private:
   /**
-   * A buffer queue in case readDataAvailable is chosen. Although it is not
-   * supposed to happen, having a fallback buffer here avoids potential segfault
-   * when bufReturn is nullptr.
+   * A buffer queue where data is read into. Incomplete record (if any) is
+   * kept here until the rest of it is read.
    */
   folly::IOBufQueue readBuffer_;
 
   /**
    * A ClientId -> ClientSubscription map, where all the clients have
-   * subscribed to the event to which this callback is attached.
+   * subscribed to the event to which this callback is attached. The map is
+   * immutable: add/remove replace it w/ an updated copy, so the lock is only
+   * held to take a reference to the current one.
    */
-  folly::Synchronized<ClientSubscriptionMap> cb_subsmap_;
+  folly::Synchronized<std::shared_ptr<const ClientSubscriptionMap>>
+      cb_subsmap_;
 
   /**
    * A flag indicating whether the event is enabled.
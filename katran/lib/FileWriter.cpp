@@ -34,6 +34,17 @@ void FileWriter::writeData(const void* ptr, std::size_t size) {
   }
 }
 
+void FileWriter::writeDataBatch(const struct iovec* iov, std::size_t iovcnt) {
+  // writevFull takes care of partial writes and of iovcnt > IOV_MAX
+  auto successfullyWritten =
+      folly::writevFull(pcapFile_.fd(), const_cast<iovec*>(iov), iovcnt);
+  if (successfullyWritten < 0) {
+    LOG(ERROR) << "Error while trying to write to pcap file: " << filename_;
+  } else {
+    writtenBytes_ += successfullyWritten;
+  }
+}
+
 bool FileWriter::available(size_t /* unused */) {
   return true;
 }
@@ -33,6 +33,17 @@ class FileWriter : public DataWriter {
 
   void writeData(const void* ptr, std::size_t size) override;
 
+  /**
+   * writes all chunks w/ writev
+   */
+  void writeDataBatch(const struct iovec* iov, std::size_t iovcnt) override;
+
+  using DataWriter::writeDataBatch;
+
+  bool supportsBatching() const override {
+    return true;
+  }
+
   bool available(std::size_t amount) override;
 
   bool restart() override;
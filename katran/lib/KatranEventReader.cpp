@@ -15,14 +15,24 @@
  */
 #include "katran/lib/KatranEventReader.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "katran/lib/BalancerStructs.h"
 
 namespace katran {
 
-void KatranEventReader::handlePerfBufferEvent(
-    int /* cpu */,
+namespace {
+
+/**
+ * copies raw record from the forwarding plane into source's queue toward
+ * the writer
+ */
+void enqueueEvent(
+    PcapEventQueues& queues,
+    uint32_t source,
     const char* data,
-    size_t size) noexcept {
+    size_t size) {
   if (size < sizeof(struct event_metadata)) {
     LOG(ERROR) << "size " << size
                << " is less than sizeof(struct event_metadata) "
@@ -30,16 +40,49 @@ void KatranEventReader::handlePerfBufferEvent(
     return;
   }
   auto mdata = (struct event_metadata*)data;
-  PcapMsg pcap_msg(
-      data + sizeof(struct event_metadata), mdata->pkt_size, mdata->data_len);
-  PcapMsgMeta pcap_msg_meta(std::move(pcap_msg), mdata->event);
-  auto res = queue_->write(std::move(pcap_msg_meta));
-  if (!res) {
-    LOG(ERROR) << "writer queue is full";
+  uint32_t event = mdata->event;
+  size_t hdrLen = sizeof(struct event_metadata);
+  uint64_t ktimeNs = 0;
+  if (event & kEventFlagKtime) {
+    // record layout is defined by forwarding plane's build flags: time of the
+    // event is present only if it is flagged
+    if (size < hdrLen + sizeof(ktimeNs)) {
+      LOG(ERROR) << "size " << size
+                 << " is too small for event w/ timestamp, skipping";
+      return;
+    }
+    std::memcpy(&ktimeNs, data + hdrLen, sizeof(ktimeNs));
+    hdrLen += sizeof(ktimeNs);
+    event &= ~kEventFlagKtime;
+  }
+  auto capturedLen = std::min<size_t>(mdata->data_len, size - hdrLen);
+  if (!queues.push(
+          source,
+          event,
+          data + hdrLen,
+          mdata->pkt_size,
+          capturedLen,
+          ktimeNs)) {
+    // queue full under event storm; drops are accounted in queues
+    LOG_EVERY_N(ERROR, 10000) << "writer queue is full";
   }
-  LOG(INFO) << __func__
-            << "write perf event to queue, queue stats: " << queue_->size()
-            << "/" << queue_->capacity();
+}
+
+} // namespace
+
+void KatranEventReader::handlePerfBufferEvent(
+    int /* cpu */,
+    const char* data,
+    size_t size) noexcept {
+  enqueueEvent(*queues_, source_, data, size);
+}
+
+void KatranRingBufferEventReader::handleRingBufferEvent(
+    const char* data,
+    size_t size) noexcept {
+  // records are reserved w/ fixed size, so size is an upper bound and
+  // metadata's data_len tells how much of it is valid
+  enqueueEvent(*queues_, source_, data, size);
 }
 
 } // namespace katran
@@ -16,9 +16,11 @@
 
 #pragma once
 
-#include <folly/MPMCQueue.h>
-#include "katran/lib/PcapMsgMeta.h"
+#include <memory>
+
+#include "katran/lib/PcapEventQueues.h"
 #include "katran/lib/PerfBufferEventReader.h"
+#include "katran/lib/RingBufferEventReader.h"
 
 namespace folly {
 class EventBase;
@@ -27,9 +29,13 @@ class EventBase;
 namespace katran {
 class KatranEventReader : public PerfBufferEventReader {
  public:
-  explicit KatranEventReader(
-      std::shared_ptr<folly::MPMCQueue<PcapMsgMeta>> queue)
-      : queue_(queue) {}
+  /**
+   * @param shared_ptr<PcapEventQueues> queues toward PcapWriter
+   * @param uint32_t source id of this reader in queues. all cpu buffers are
+   * consumed from the same event base thread, so they share a source
+   */
+  KatranEventReader(std::shared_ptr<PcapEventQueues> queues, uint32_t source)
+      : queues_(queues), source_(source) {}
 
   /**
    * @param int cpu
@@ -39,10 +45,51 @@ class KatranEventReader : public PerfBufferEventReader {
   void handlePerfBufferEvent(int cpu, const char* data, size_t size) noexcept
       override;
 
+  void handlePerfBufferBatchEnd() noexcept override {
+    queues_->notify();
+  }
+
  private:
   /**
-   * queue toward PcapWriter
+   * queues toward PcapWriter
    */
-  std::shared_ptr<folly::MPMCQueue<PcapMsgMeta>> queue_;
+  std::shared_ptr<PcapEventQueues> queues_;
+
+  uint32_t source_;
+};
+
+/**
+ * same as KatranEventReader, but for forwarding plane which has been built
+ * w/ KATRAN_INTROSPECTION_RINGBUF
+ */
+class KatranRingBufferEventReader : public RingBufferEventReader {
+ public:
+  KatranRingBufferEventReader(
+      std::shared_ptr<PcapEventQueues> queues,
+      uint32_t source)
+      : queues_(queues), source_(source) {}
+
+  ~KatranRingBufferEventReader() override {
+    // consumer thread must not outlive the queue it is writing into
+    stop();
+  }
+
+  /**
+   * @param const char* data received from the XDP prog.
+   * @param size_t size of the data chunk
+   */
+  void handleRingBufferEvent(const char* data, size_t size) noexcept override;
+
+  void handleRingBufferBatchEnd() noexcept override {
+    queues_->notify();
+  }
+
+ private:
+  /**
+   * queues toward PcapWriter
+   */
+  std::shared_ptr<PcapEventQueues> queues_;
+
+  uint32_t source_;
 };
 } // namespace katran
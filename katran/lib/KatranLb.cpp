@@ -18,16 +18,24 @@
 
 #include <fmt/core.h>
 #include <folly/String.h>
+#include <folly/container/F14Set.h>
 #include <folly/lang/Bits.h>
 #include <glog/logging.h>
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <fstream>
+#include <istream>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "katran/lib/BalancerStructs.h"
@@ -35,6 +43,10 @@
 #include "katran/lib/IpHelpers.h"
 #include "katran/lib/KatranLbStructs.h"
 #include "katran/lib/KatranMonitor.h"
+#include "katran/lib/KatranSnapshot.h"
+#include "katran/lib/KatranStatsEngine.h"
+#include "katran/lib/LruRemapCounter.h"
+#include "katran/lib/LruScanner.h"
 
 namespace katran {
 
@@ -45,6 +57,115 @@ constexpr int kMaxInvalidServerIds = 10000;
 // Limit LRU lookups when traversing entire map.
 // In case high ingress results in high LRU insertion rate, affecting traversal.
 const int kLruMaxLookups = 10 * 1000 * 1000;
+
+// max number of lpm entries pushed to forwarding plane in a single batch
+constexpr uint32_t kLpmBatchSize = 4096;
+// we are not spawning threads to parse small amount of src routing rules
+constexpr size_t kMinSrcRulesPerThread = 10000;
+constexpr uint32_t kLpmOuterMapSlot = 0;
+
+// limits on how many vips (and reals per vip) are listed in the comments of
+// katran monitor's events
+constexpr size_t kMaxMonitorCommentVips = 16;
+constexpr size_t kMaxMonitorCommentReals = 32;
+
+// maps which hold forwarding state and are pinned if config_.pinnedMapsPath
+// is specified
+const std::array<const char*, 8> kPinnedStateMaps = {
+    KatranLbMaps::vip_map,
+    KatranLbMaps::reals,
+    KatranLbMaps::ch_rings,
+    KatranLbMaps::server_id_map,
+    KatranLbMaps::lpm_src_v4,
+    KatranLbMaps::lpm_src_v6,
+    KatranLbMaps::lpm_src_v4_maps,
+    KatranLbMaps::lpm_src_v6_maps,
+};
+
+// max number of server ids which are read from server_id_map at once
+constexpr uint32_t kServerIdsReadChunk = 64 * 1024;
+
+/**
+ * calls func for each key/value pair of specified bpf map.
+ * returns number of visited entries or -1 on error
+ */
+template <typename KeyT, typename ValueT, typename Func>
+int64_t forEachMapEntry(int mapFd, Func&& func) {
+  KeyT key{};
+  KeyT nextKey{};
+  ValueT value{};
+  int64_t visited = 0;
+  bool first = true;
+  while (BaseBpfAdapter::bpfMapGetNextKey(
+             mapFd, first ? nullptr : &key, &nextKey) == 0) {
+    first = false;
+    key = nextKey;
+    if (BaseBpfAdapter::bpfMapLookupElement(mapFd, &key, &value) != 0) {
+      // element could be deleted while we are traversing the map
+      continue;
+    }
+    func(key, value);
+    visited++;
+  }
+  if (errno != ENOENT) {
+    LOG(ERROR) << "error while traversing bpf map: " << folly::errnoStr(errno);
+    return -1;
+  }
+  return visited;
+}
+
+folly::IPAddress beAddrToIPAddress(const uint32_t* addr, bool isV6) {
+  if (isV6) {
+    return folly::IPAddressV6::fromBinary(
+        folly::ByteRange(reinterpret_cast<const uint8_t*>(addr), 16));
+  }
+  return folly::IPAddressV4::fromLong(addr[0]);
+}
+
+struct EncodedSrcRule {
+  folly::CIDRNetwork src;
+  folly::IPAddress dst;
+  v4_lpm_key keyV4;
+  v6_lpm_key keyV6;
+};
+
+/**
+ * parses and encodes src routing rules in [begin, end) range. returns
+ * number of invalid rules
+ */
+int encodeSrcRules(
+    const std::vector<std::pair<std::string, std::string>>& rules,
+    size_t begin,
+    size_t end,
+    std::vector<EncodedSrcRule>& encoded) {
+  int num_errors = 0;
+  encoded.reserve(end - begin);
+  for (size_t i = begin; i < end; i++) {
+    const auto& rule = rules[i];
+    auto src = folly::IPAddress::tryCreateNetwork(rule.first);
+    auto dst = folly::IPAddress::tryFromString(rule.second);
+    // plain host address is not accepted as src prefix (same as in
+    // addSrcRoutingRule)
+    if (rule.first.find('/') == std::string::npos || src.hasError() ||
+        dst.hasError()) {
+      LOG(ERROR) << "invalid src routing rule: " << rule.first << " -> "
+                 << rule.second;
+      num_errors++;
+      continue;
+    }
+    EncodedSrcRule enc{src.value(), dst.value(), {}, {}};
+    auto lpm_addr = IpHelpers::parseAddrToBe(enc.src.first);
+    if (enc.src.first.isV4()) {
+      enc.keyV4.prefixlen = enc.src.second;
+      enc.keyV4.addr = lpm_addr.daddr;
+    } else {
+      enc.keyV6.prefixlen = enc.src.second;
+      std::memcpy(enc.keyV6.addr, lpm_addr.v6daddr, 16);
+    }
+    encoded.push_back(std::move(enc));
+  }
+  return num_errors;
+}
 } // namespace
 
 KatranLb::KatranLb(
@@ -189,6 +310,7 @@ KatranLb::KatranLb(
 }
 
 KatranLb::~KatranLb() {
+  stopStatsEngine();
   if (!config_.testing && progsAttached_ && config_.cleanupOnShutdown) {
     int res;
     auto mainIfindex = ctlValues_[kMainIntfPos].ifindex;
@@ -217,6 +339,9 @@ KatranLb::~KatranLb() {
       }
     }
   }
+  for (auto& lpm_map : lpmMapFdOverrides_) {
+    close(lpm_map.second);
+  }
 }
 
 AddressType KatranLb::validateAddress(
@@ -694,6 +819,13 @@ void KatranLb::featureDiscovering() {
   } else {
     features_.srcRouting = false;
   }
+  if (bpfAdapter_->isMapInProg(
+          kBalancerProgName.toString(), KatranLbMaps::lpm_src_v4_maps)) {
+    VLOG(2) << "shadow maps for source based routing are supported";
+    features_.srcRoutingShadowMaps = true;
+  } else {
+    features_.srcRoutingShadowMaps = false;
+  }
   if (bpfAdapter_->isMapInProg(
           kBalancerProgName.toString(), KatranLbMaps::decap_dst)) {
     VLOG(2) << "inline decapsulation is supported";
@@ -732,11 +864,54 @@ void KatranLb::featureDiscovering() {
   }
 }
 
+void KatranLb::reusePinnedMaps() {
+  for (const auto& map : kPinnedStateMaps) {
+    auto path = fmt::format("{}/{}", config_.pinnedMapsPath, map);
+    auto fd = bpfAdapter_->getPinnedBpfObject(path);
+    if (fd < 0) {
+      VLOG(2) << "there is no pinned map at " << path;
+      continue;
+    }
+    if (bpfAdapter_->updateSharedMap(map, fd) != 0) {
+      throw std::runtime_error(
+          fmt::format("can't reuse pinned map {}", path));
+    }
+    VLOG(2) << "reusing pinned map " << path;
+  }
+}
+
+void KatranLb::pinStateMaps() {
+  for (const auto& map : kPinnedStateMaps) {
+    if (!bpfAdapter_->isMapInProg(kBalancerProgName.toString(), map)) {
+      continue;
+    }
+    auto path = fmt::format("{}/{}", config_.pinnedMapsPath, map);
+    auto pinned_fd = bpfAdapter_->getPinnedBpfObject(path);
+    if (pinned_fd >= 0) {
+      close(pinned_fd);
+      continue;
+    }
+    auto res =
+        bpfAdapter_->pinBpfObject(bpfAdapter_->getMapFdByName(map), path);
+    if (res != 0) {
+      LOG(ERROR) << "can't pin map " << map << " to " << path
+                 << ", error: " << folly::errnoStr(errno);
+      lbStats_.bpfFailedCalls++;
+    }
+  }
+}
+
 void KatranLb::startIntrospectionRoutines() {
   auto monitor_config = config_.monitorConfig;
   monitor_config.nCpus = katran::BpfAdapter::getPossibleCpus();
   monitor_config.mapFd = bpfAdapter_->getMapFdByName(KatranLbMaps::event_pipe);
+  if (bpfAdapter_->isMapInProg(
+          kBalancerProgName.toString(), KatranLbMaps::event_filters)) {
+    monitor_config.filtersMapFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::event_filters);
+  }
   monitor_ = std::make_shared<KatranMonitor>(monitor_config);
+  annotateMonitorEvents();
 }
 
 void KatranLb::loadBpfProgs() {
@@ -755,6 +930,9 @@ void KatranLb::loadBpfProgs() {
   if (globalLruInProg) {
     initGlobalLruPrototypeMap();
   }
+  if (!config_.pinnedMapsPath.empty()) {
+    reusePinnedMaps();
+  }
   res = bpfAdapter_->loadBpfProg(config_.balancerProgPath);
   if (res) {
     throw std::invalid_argument("can't load main bpf program");
@@ -772,6 +950,10 @@ void KatranLb::loadBpfProgs() {
   initialSanityChecking(flowDebugInProg, globalLruInProg);
   featureDiscovering();
 
+  if (!config_.pinnedMapsPath.empty()) {
+    pinStateMaps();
+  }
+
   if (features_.gueEncap) {
     setupGueEnvironment();
   }
@@ -853,7 +1035,12 @@ bool KatranLb::reloadBalancerProg(
   }
 
   config_.balancerProgPath = path;
+  setupReloadedBalancerProg();
+  return true;
+}
 
+void KatranLb::setupReloadedBalancerProg() {
+  const auto& path = config_.balancerProgPath;
   bool flowDebugInProg =
       bpfAdapter_->isMapInBpfObject(path, KatranLbMaps::flow_debug_maps);
   bool globalLruInProg =
@@ -874,6 +1061,132 @@ bool KatranLb::reloadBalancerProg(
     introspectionStarted_ = true;
   }
   progsReloaded_ = true;
+}
+
+KatranLb::ProgUpgradeResponse KatranLb::upgradeBalancerProg(
+    const std::string& path,
+    const std::vector<KatranFlow>& testFlows) {
+  ProgUpgradeResponse response;
+  if (config_.testing || !progsLoaded_) {
+    response.errors.push_back("balancer program is not loaded");
+    return response;
+  }
+  if (bpfAdapter_->stageBpfProg(path, response.errors)) {
+    LOG(ERROR) << "can't load new balancer program " << path << ": "
+               << folly::join("; ", response.errors);
+    return response;
+  }
+  auto prog_name = kBalancerProgName.toString();
+  auto new_fd = bpfAdapter_->getStagedProgFdByName(prog_name);
+  if (new_fd < 0) {
+    response.errors.push_back(
+        fmt::format("{} does not contain {} program", path, prog_name));
+    bpfAdapter_->discardStagedBpfProg();
+    return response;
+  }
+
+  {
+    KatranSimulator current(getKatranProgFd());
+    KatranSimulator upgraded(new_fd);
+    for (const auto& flow : testFlows) {
+      VipKey vip;
+      vip.address = flow.dst;
+      vip.port = flow.dstPort;
+      vip.proto = flow.proto;
+      // both programs must make the decision from ch ring, not from lru
+      // entry created by the other one
+      auto current_real = current.getRealForFlow(flow);
+      deleteLru(vip, flow.src, flow.srcPort);
+      auto upgraded_real = upgraded.getRealForFlow(flow);
+      deleteLru(vip, flow.src, flow.srcPort);
+      response.flowsTested++;
+      if (current_real != upgraded_real) {
+        response.mismatches.push_back(fmt::format(
+            "{}:{} -> {}:{} proto {}: current '{}', new '{}'",
+            flow.src,
+            flow.srcPort,
+            flow.dst,
+            flow.dstPort,
+            flow.proto,
+            current_real,
+            upgraded_real));
+      }
+    }
+  }
+  if (!response.mismatches.empty()) {
+    LOG(ERROR) << "new balancer program routes "
+               << response.mismatches.size() << " of "
+               << response.flowsTested << " test flows differently";
+    response.errors.push_back("routing decisions do not match");
+    bpfAdapter_->discardStagedBpfProg();
+    return response;
+  }
+
+  if (!swapBalancerProg(new_fd)) {
+    response.errors.push_back(fmt::format(
+        "can't replace balancer program: {}", folly::errnoStr(errno)));
+    bpfAdapter_->discardStagedBpfProg();
+    return response;
+  }
+  if (bpfAdapter_->commitStagedBpfProg()) {
+    // should never happen: staged object exists. but new program is
+    // already in use, so we could only try to switch back
+    LOG(ERROR) << "can't commit new balancer program, switching back";
+    swapBalancerProg(getKatranProgFd());
+    bpfAdapter_->discardStagedBpfProg();
+    response.errors.push_back("can't commit new balancer program");
+    return response;
+  }
+  previousBalancerProgPath_ = config_.balancerProgPath;
+  config_.balancerProgPath = path;
+  setupReloadedBalancerProg();
+  response.upgraded = true;
+  LOG(INFO) << "balancer program upgraded to " << path << " after "
+            << response.flowsTested << " test flows";
+  return response;
+}
+
+bool KatranLb::rollbackBalancerProg() {
+  if (config_.testing) {
+    return false;
+  }
+  auto prev_fd =
+      bpfAdapter_->getPreviousProgFdByName(kBalancerProgName.toString());
+  if (prev_fd < 0) {
+    LOG(ERROR) << "there is no balancer program to roll back to";
+    return false;
+  }
+  if (!swapBalancerProg(prev_fd)) {
+    LOG(ERROR) << "can't switch back to previous balancer program: "
+               << folly::errnoStr(errno);
+    return false;
+  }
+  if (bpfAdapter_->rollbackBpfProg()) {
+    LOG(ERROR) << "can't roll back balancer program, switching back";
+    swapBalancerProg(getKatranProgFd());
+    return false;
+  }
+  std::swap(config_.balancerProgPath, previousBalancerProgPath_);
+  setupReloadedBalancerProg();
+  return true;
+}
+
+bool KatranLb::swapBalancerProg(int progFd) {
+  int res;
+  if (standalone_) {
+    // xdp attach replaces already attached program atomically
+    res = bpfAdapter_->modifyXdpProg(
+        progFd, ctlValues_[kMainIntfPos].ifindex, config_.xdpAttachFlags);
+  } else if (config_.useRootMap && rootMapFd_ >= 0) {
+    res = bpfAdapter_->bpfUpdateMap(rootMapFd_, &config_.rootMapPos, &progFd);
+  } else {
+    LOG(ERROR) << "balancer program is not attached by katran";
+    return false;
+  }
+  if (res) {
+    lbStats_.bpfFailedCalls++;
+    return false;
+  }
   return true;
 }
 
@@ -1003,14 +1316,15 @@ bool KatranLb::addVip(const VipKey& vip, const uint32_t flags) {
     LOG(ERROR) << "exhausted vip's space";
     return false;
   }
-  if (vips_.find(vip) != vips_.end()) {
+  CompactVipKey vip_key(vip);
+  if (vips_.find(vip_key) != vips_.end()) {
     LOG(ERROR) << "trying to add already existing vip";
     return false;
   }
   auto vip_num = vipNums_[0];
   vipNums_.pop_front();
   vips_.emplace(
-      vip, Vip(vip_num, flags, config_.chRingSize, config_.hashFunction));
+      vip_key, Vip(vip_num, flags, config_.chRingSize, config_.hashFunction));
   if (!config_.testing) {
     vip_meta meta;
     meta.vip_num = vip_num;
@@ -1030,13 +1344,18 @@ bool KatranLb::addHcKey(const VipKey& hcKey) {
     LOG(ERROR) << "exhausted hc key's space";
     return false;
   }
-  if (hckeys_.find(hcKey) != hckeys_.end()) {
+  CompactVipKey hc_key(hcKey);
+  if (!hc_key.valid()) {
+    LOG(ERROR) << "Invalid hc key address: " << hcKey.address;
+    return false;
+  }
+  if (hckeys_.find(hc_key) != hckeys_.end()) {
     LOG(ERROR) << "trying to add already existing hc key";
     return false;
   }
   auto hc_key_num = hcKeyNums_[0];
   hcKeyNums_.pop_front();
-  hckeys_.emplace(hcKey, hc_key_num);
+  hckeys_.emplace(hc_key, hc_key_num);
   if (!config_.testing) {
     return updateHcKeyMap(ModifyAction::ADD, hcKey, hc_key_num);
   }
@@ -1048,7 +1367,7 @@ bool KatranLb::changeHashFunctionForVip(const VipKey& vip, HashFunction func) {
     LOG(ERROR) << "Invalid Vip address: " << vip.address;
     return false;
   }
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << "trying to change non existing vip";
     return false;
@@ -1063,7 +1382,7 @@ bool KatranLb::delVip(const VipKey& vip) {
   VLOG(1) << fmt::format(
       "deleting vip: {}:{}:{}", vip.address, vip.port, vip.proto);
 
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << "trying to delete non-existing vip";
     return false;
@@ -1079,6 +1398,8 @@ bool KatranLb::delVip(const VipKey& vip) {
   if (!config_.testing) {
     updateVipMap(ModifyAction::DEL, vip);
   }
+  // pending changes do not hold references to reals
+  pendingRealsUpdates_.erase(vip_iter->first);
   vips_.erase(vip_iter);
   return true;
 }
@@ -1092,13 +1413,13 @@ bool KatranLb::delHcKey(const VipKey& hcKey) {
   VLOG(1) << fmt::format(
       "deleting hc_key: {}:{}:{}", hcKey.address, hcKey.port, hcKey.proto);
 
-  auto hc_key_iter = hckeys_.find(hcKey);
+  auto hc_key_iter = hckeys_.find(CompactVipKey(hcKey));
   if (hc_key_iter == hckeys_.end()) {
     LOG(ERROR) << "trying to delete non-existing hc_key";
     return false;
   }
   hcKeyNums_.push_back(hc_key_iter->second);
-  hckeys_.erase(hcKey);
+  hckeys_.erase(hc_key_iter);
 
   if (!config_.testing) {
     return updateHcKeyMap(ModifyAction::DEL, hcKey);
@@ -1110,13 +1431,13 @@ std::vector<VipKey> KatranLb::getAllVips() {
   std::vector<VipKey> vips(vips_.size());
   int i = 0;
   for (auto& vip : vips_) {
-    vips[i++] = vip.first;
+    vips[i++] = vip.first.toVipKey();
   }
   return vips;
 }
 
 uint32_t KatranLb::getVipFlags(const VipKey& vip) {
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     throw std::invalid_argument(fmt::format(
         "trying to get flags from non-existing vip: {}", vip.address));
@@ -1128,7 +1449,7 @@ bool KatranLb::modifyVip(const VipKey& vip, uint32_t flag, bool set) {
   VLOG(1) << fmt::format(
       "modifying vip: {}:{}:{}", vip.address, vip.port, vip.proto);
 
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << fmt::format(
         "trying to modify non-existing vip: {}", vip.address);
@@ -1190,108 +1511,251 @@ bool KatranLb::modifyRealsForVip(
     const ModifyAction action,
     const std::vector<NewReal>& reals,
     const VipKey& vip) {
-  UpdateReal ureal;
-  std::vector<UpdateReal> ureals;
-  ureal.action = action;
+  auto vip_iter = vips_.find(CompactVipKey(vip));
+  if (vip_iter == vips_.end()) {
+    LOG(ERROR) << fmt::format(
+        "trying to modify reals for non existing vip: {}", vip.address);
+    return false;
+  }
+  if (config_.realsUpdateCoalesceWindowMs > 0) {
+    coalesceRealsForVip(action, reals, vip_iter->first);
+    flushPendingRealsUpdates();
+    return true;
+  }
+
+  std::vector<RealPos> ch_positions;
+  uint32_t vip_num;
+  std::vector<uint32_t> released_nums;
+  computeRealsForVip(action, reals, vip, ch_positions, vip_num, released_nums);
+  programHashRing(ch_positions, vip_num);
+  releaseRealNums(released_nums);
+  return true;
+}
 
-  auto vip_iter = vips_.find(vip);
+bool KatranLb::computeRealsForVip(
+    const ModifyAction action,
+    const std::vector<NewReal>& reals,
+    const VipKey& vip,
+    std::vector<RealPos>& chPositions,
+    uint32_t& vipNum,
+    std::vector<uint32_t>& releasedNums) {
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << fmt::format(
         "trying to modify reals for non existing vip: {}", vip.address);
     return false;
   }
+  UpdateReal ureal;
+  std::vector<UpdateReal> ureals;
   auto cur_reals = vip_iter->second.getReals();
   for (const auto& real : reals) {
-    if (validateAddress(real.address) == AddressType::INVALID) {
-      LOG(ERROR) << "Invalid real's address: " << real.address;
-      continue;
+    if (prepareRealUpdate(
+            action, real, vip, cur_reals, ureal, releasedNums)) {
+      ureals.push_back(ureal);
     }
-    folly::IPAddress raddr(real.address);
-    VLOG(4) << fmt::format(
-        "modifying real: {} with weight {} for vip {}:{}:{}. action is {}",
-        real.address,
-        real.weight,
-        vip.address,
-        vip.port,
-        vip.proto,
-        (int)action);
+  }
 
-    if (action == ModifyAction::DEL) {
-      auto real_iter = reals_.find(raddr);
-      if (real_iter == reals_.end()) {
-        LOG(ERROR) << "trying to delete non-existing real";
-        continue;
-      }
+  chPositions = vip_iter->second.batchRealsUpdate(ureals);
+  vipNum = vip_iter->second.getVipNum();
+  return true;
+}
+
+void KatranLb::releaseRealNums(const std::vector<uint32_t>& nums) {
+  realNums_.insert(realNums_.end(), nums.begin(), nums.end());
+}
+
+bool KatranLb::prepareRealUpdate(
+    const ModifyAction action,
+    const NewReal& real,
+    const VipKey& vip,
+    std::vector<uint32_t>& curReals,
+    UpdateReal& ureal,
+    std::vector<uint32_t>& releasedNums) {
+  if (validateAddress(real.address) == AddressType::INVALID) {
+    LOG(ERROR) << "Invalid real's address: " << real.address;
+    return false;
+  }
+  folly::IPAddress raddr(real.address);
+  VLOG(4) << fmt::format(
+      "modifying real: {} with weight {} for vip {}:{}:{}. action is {}",
+      real.address,
+      real.weight,
+      vip.address,
+      vip.port,
+      vip.proto,
+      (int)action);
+
+  ureal.action = action;
+  if (action == ModifyAction::DEL) {
+    auto real_iter = reals_.find(raddr);
+    if (real_iter == reals_.end()) {
+      LOG(ERROR) << "trying to delete non-existing real";
+      return false;
+    }
+    if (std::find(curReals.begin(), curReals.end(), real_iter->second.num) ==
+        curReals.end()) {
+      // this real doesn't belong to this vip
+      LOG(ERROR) << fmt::format(
+          "trying to delete non-existing real for the VIP: {}", vip.address);
+      return false;
+    }
+    ureal.updatedReal.num = real_iter->second.num;
+    decreaseRefCountForReal(raddr, &releasedNums);
+  } else {
+    auto real_iter = reals_.find(raddr);
+    if (real_iter != reals_.end()) {
       if (std::find(
-              cur_reals.begin(), cur_reals.end(), real_iter->second.num) ==
-          cur_reals.end()) {
-        // this real doesn't belong to this vip
-        LOG(ERROR) << fmt::format(
-            "trying to delete non-existing real for the VIP: {}", vip.address);
-        continue;
+              curReals.begin(), curReals.end(), real_iter->second.num) ==
+          curReals.end()) {
+        // increment ref count if it's a new real for this vip
+        increaseRefCountForReal(raddr, real.flags);
+        curReals.push_back(real_iter->second.num);
       }
       ureal.updatedReal.num = real_iter->second.num;
-      decreaseRefCountForReal(raddr);
     } else {
+      auto rnum = increaseRefCountForReal(raddr, real.flags);
+      if (rnum == config_.maxReals) {
+        LOG(ERROR) << "exhausted real's space";
+        return false;
+      }
+      ureal.updatedReal.num = rnum;
+    }
+    ureal.updatedReal.weight = real.weight;
+    ureal.updatedReal.hash = raddr.hash();
+  }
+  return true;
+}
+
+void KatranLb::coalesceRealsForVip(
+    const ModifyAction action,
+    const std::vector<NewReal>& reals,
+    const CompactVipKey& vip) {
+  auto now = std::chrono::steady_clock::now();
+  auto& pending = pendingRealsUpdates_[vip];
+  if (pending.changes.empty()) {
+    pending.firstChange = now;
+  }
+  pending.lastChange = now;
+  lbStats_.realsUpdatesCoalesced++;
+
+  for (const auto& real : reals) {
+    if (validateAddress(real.address) == AddressType::INVALID) {
+      LOG(ERROR) << "Invalid real's address: " << real.address;
+      continue;
+    }
+    folly::IPAddress raddr(real.address);
+    auto pos_iter = pending.positions.find(raddr);
+    if (pos_iter == pending.positions.end()) {
+      pending.positions[raddr] = pending.changes.size();
+      pending.changes.push_back(PendingRealChange{action, real});
+      continue;
+    }
+    // the latest change for the real wins
+    auto& change = pending.changes[pos_iter->second];
+    lbStats_.realsChangesMerged++;
+    change.cancelled = false;
+    if (action == ModifyAction::DEL && change.action == ModifyAction::ADD) {
+      // deletion of the real which has been added during this window is
+      // no-op if vip was not using this real before
       auto real_iter = reals_.find(raddr);
-      if (real_iter != reals_.end()) {
-        if (std::find(
-                cur_reals.begin(), cur_reals.end(), real_iter->second.num) ==
-            cur_reals.end()) {
-          // increment ref count if it's a new real for this vip
-          increaseRefCountForReal(raddr, real.flags);
-          cur_reals.push_back(real_iter->second.num);
-        }
-        ureal.updatedReal.num = real_iter->second.num;
+      if (real_iter == reals_.end()) {
+        change.cancelled = true;
       } else {
-        auto rnum = increaseRefCountForReal(raddr, real.flags);
-        if (rnum == config_.maxReals) {
-          LOG(ERROR) << "exhausted real's space";
-          continue;
+        auto cur_reals = vips_.at(vip).getReals();
+        change.cancelled =
+            std::find(
+                cur_reals.begin(), cur_reals.end(), real_iter->second.num) ==
+            cur_reals.end();
+      }
+    }
+    change.action = action;
+    change.real = real;
+  }
+}
+
+uint32_t KatranLb::flushPendingRealsUpdates(bool force) {
+  auto now = std::chrono::steady_clock::now();
+  auto window = std::chrono::milliseconds(config_.realsUpdateCoalesceWindowMs);
+  auto max_delay = config_.realsUpdateMaxDelayMs > 0
+      ? std::chrono::milliseconds(config_.realsUpdateMaxDelayMs)
+      : window;
+  uint32_t flushed = 0;
+  for (auto pending_iter = pendingRealsUpdates_.begin();
+       pending_iter != pendingRealsUpdates_.end();) {
+    const auto& pending = pending_iter->second;
+    if (!force && now - pending.lastChange < window &&
+        now - pending.firstChange < max_delay) {
+      ++pending_iter;
+      continue;
+    }
+    auto vip_iter = vips_.find(pending_iter->first);
+    if (vip_iter != vips_.end()) {
+      auto vip = vip_iter->first.toVipKey();
+      UpdateReal ureal;
+      std::vector<UpdateReal> ureals;
+      std::vector<uint32_t> released_nums;
+      auto cur_reals = vip_iter->second.getReals();
+      for (const auto& change : pending.changes) {
+        if (!change.cancelled &&
+            prepareRealUpdate(
+                change.action,
+                change.real,
+                vip,
+                cur_reals,
+                ureal,
+                released_nums)) {
+          ureals.push_back(ureal);
         }
-        ureal.updatedReal.num = rnum;
       }
-      ureal.updatedReal.weight = real.weight;
-      ureal.updatedReal.hash = raddr.hash();
+      if (!ureals.empty()) {
+        auto ch_positions = vip_iter->second.batchRealsUpdate(ureals);
+        programHashRing(ch_positions, vip_iter->second.getVipNum());
+        lbStats_.coalescedRingUpdates++;
+      }
+      releaseRealNums(released_nums);
+      flushed++;
     }
-    ureals.push_back(ureal);
+    pending_iter = pendingRealsUpdates_.erase(pending_iter);
   }
-
-  auto ch_positions = vip_iter->second.batchRealsUpdate(ureals);
-  auto vip_num = vip_iter->second.getVipNum();
-  programHashRing(ch_positions, vip_num);
-  return true;
+  return flushed;
 }
 
 void KatranLb::programHashRing(
     const std::vector<RealPos>& chPositions,
     const uint32_t vipNum) {
-  if (chPositions.empty()) {
-    return;
+  if (!writeHashRing(chPositions, vipNum)) {
+    lbStats_.bpfFailedCalls++;
   }
+}
 
-  if (!config_.testing) {
-    uint32_t updateSize = chPositions.size();
-    uint32_t keys[updateSize];
-    uint32_t values[updateSize];
+bool KatranLb::writeHashRing(
+    const std::vector<RealPos>& chPositions,
+    const uint32_t vipNum) const {
+  if (chPositions.empty() || config_.testing) {
+    return true;
+  }
 
-    auto ch_fd = bpfAdapter_->getMapFdByName(KatranLbMaps::ch_rings);
-    for (uint32_t i = 0; i < updateSize; i++) {
-      keys[i] = vipNum * config_.chRingSize + chPositions[i].pos;
-      values[i] = chPositions[i].real;
-    }
+  uint32_t updateSize = chPositions.size();
+  uint32_t keys[updateSize];
+  uint32_t values[updateSize];
 
-    auto res = bpfAdapter_->bpfUpdateMapBatch(ch_fd, keys, values, updateSize);
-    if (res != 0) {
-      lbStats_.bpfFailedCalls++;
-      LOG(ERROR) << "can't update ch ring"
-                 << ", error: " << folly::errnoStr(errno);
-    }
+  auto ch_fd = bpfAdapter_->getMapFdByName(KatranLbMaps::ch_rings);
+  for (uint32_t i = 0; i < updateSize; i++) {
+    keys[i] = vipNum * config_.chRingSize + chPositions[i].pos;
+    values[i] = chPositions[i].real;
+  }
+
+  auto res = bpfAdapter_->bpfUpdateMapBatch(ch_fd, keys, values, updateSize);
+  if (res != 0) {
+    LOG(ERROR) << "can't update ch ring"
+               << ", error: " << folly::errnoStr(errno);
+    return false;
   }
+  return true;
 }
 
 std::vector<NewReal> KatranLb::getRealsForVip(const VipKey& vip) {
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     throw std::invalid_argument(fmt::format(
         "trying to get real from non-existing vip: {}", vip.address));
@@ -1389,41 +1853,262 @@ int KatranLb::addSrcRoutingRule(
   return 0;
 }
 
-bool KatranLb::delSrcRoutingRule(const std::vector<std::string>& srcs) {
+int KatranLb::addSrcRoutingRulesBulk(
+    const std::vector<std::pair<std::string, std::string>>& rules,
+    bool replace,
+    uint32_t numThreads) {
   if (!features_.srcRouting && !config_.testing) {
     LOG(ERROR) << "Source based routing is not enabled in forwarding plane";
-    return false;
+    return kError;
   }
-  std::vector<folly::CIDRNetwork> src_networks;
-  for (auto& src : srcs) {
-    auto network = folly::IPAddress::tryCreateNetwork(src);
-    if (network.hasValue()) {
-      src_networks.push_back(network.value());
-    }
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  numThreads = std::min<size_t>(
+      numThreads, rules.size() / kMinSrcRulesPerThread + 1);
+
+  // parsing and encoding does not touch any internal state, so could be
+  // done in parallel
+  std::vector<std::vector<EncodedSrcRule>> chunks(numThreads);
+  std::vector<int> chunkErrors(numThreads, 0);
+  size_t chunkSize = (rules.size() + numThreads - 1) / numThreads;
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < numThreads; i++) {
+    workers.emplace_back([&, i]() {
+      auto begin = std::min(rules.size(), i * chunkSize);
+      auto end = std::min(rules.size(), begin + chunkSize);
+      chunkErrors[i] = encodeSrcRules(rules, begin, end, chunks[i]);
+    });
+  }
+  chunkErrors[0] = encodeSrcRules(
+      rules, 0, std::min(rules.size(), chunkSize), chunks[0]);
+  for (auto& worker : workers) {
+    worker.join();
   }
-  return delSrcRoutingRule(src_networks);
-}
+  int num_errors = 0;
+  for (auto errors : chunkErrors) {
+    num_errors += errors;
+  }
+  lbStats_.addrValidationFailed += num_errors;
 
-bool KatranLb::delSrcRoutingRule(const std::vector<folly::CIDRNetwork>& srcs) {
-  if (!features_.srcRouting && !config_.testing) {
-    LOG(ERROR) << "Source based routing is not enabled in forwarding plane";
-    return false;
+  // last rule for the same prefix wins
+  std::unordered_map<folly::CIDRNetwork, const EncodedSrcRule*> latest;
+  for (const auto& chunk : chunks) {
+    for (const auto& rule : chunk) {
+      latest[rule.src] = &rule;
+    }
   }
-  for (auto& src : srcs) {
-    auto src_iter = lpmSrcMapping_.find(src);
-    if (src_iter == lpmSrcMapping_.end()) {
-      LOG(ERROR) << "trying to delete non existing src mapping " << src.first
-                 << "/" << src.second;
+  size_t newSize = latest.size();
+  if (!replace) {
+    newSize += lpmSrcMapping_.size();
+    for (const auto& rule : latest) {
+      if (lpmSrcMapping_.count(rule.first)) {
+        newSize--;
+      }
+    }
+  }
+  if (newSize > config_.maxLpmSrcSize) {
+    LOG(ERROR) << "source mappings map size is exhausted, requested: "
+               << newSize << " max: " << config_.maxLpmSrcSize;
+    return kError;
+  }
+
+  std::vector<v4_lpm_key> keysV4;
+  std::vector<uint32_t> valuesV4;
+  std::vector<v6_lpm_key> keysV6;
+  std::vector<uint32_t> valuesV6;
+  // rules which are going to be written into forwarding plane. internal
+  // state is changed only after forwarding plane has been updated, so failed
+  // update does not leave rules or reals' ref counts out of sync w/ it
+  std::unordered_map<folly::CIDRNetwork, uint32_t> written;
+  for (const auto& rule : latest) {
+    // ref count for new dst is increased before old one is released, so
+    // real's num stays the same if rule's dst has not changed
+    auto rnum = increaseRefCountForReal(rule.second->dst);
+    if (rnum == config_.maxReals) {
+      LOG(ERROR) << "exhausted real's space";
+      num_errors++;
       continue;
     }
-    auto dst = numToReals_[src_iter->second];
-    decreaseRefCountForReal(dst);
-    if (!config_.testing) {
-      modifyLpmSrcRule(ModifyAction::DEL, src, src_iter->second);
+    if (rule.first.first.isV4()) {
+      keysV4.push_back(rule.second->keyV4);
+      valuesV4.push_back(rnum);
+    } else {
+      keysV6.push_back(rule.second->keyV6);
+      valuesV6.push_back(rnum);
+    }
+    written[rule.first] = rnum;
+  }
+  // reals of the rules which are overridden or dropped
+  std::vector<uint32_t> released;
+  std::vector<folly::CIDRNetwork> stale;
+  for (const auto& rule : lpmSrcMapping_) {
+    bool overridden = written.find(rule.first) != written.end();
+    if (replace || overridden) {
+      released.push_back(rule.second);
+    }
+    if (replace && !overridden) {
+      stale.push_back(rule.first);
     }
-    lpmSrcMapping_.erase(src_iter);
   }
-  return true;
+
+  bool success = true;
+  if (!config_.testing) {
+    if (replace && features_.srcRoutingShadowMaps) {
+      int prevV4Fd;
+      int prevV6Fd;
+      success = swapLpmMap(
+          KatranLbMaps::lpm_src_v4,
+          KatranLbMaps::lpm_src_v4_maps,
+          keysV4.data(),
+          sizeof(v4_lpm_key),
+          valuesV4.data(),
+          keysV4.size(),
+          prevV4Fd);
+      if (success &&
+          !swapLpmMap(
+              KatranLbMaps::lpm_src_v6,
+              KatranLbMaps::lpm_src_v6_maps,
+              keysV6.data(),
+              sizeof(v6_lpm_key),
+              valuesV6.data(),
+              keysV6.size(),
+              prevV6Fd)) {
+        // v4 and v6 tables must stay consistent w/ each other
+        restoreLpmMap(
+            KatranLbMaps::lpm_src_v4, KatranLbMaps::lpm_src_v4_maps, prevV4Fd);
+        success = false;
+      }
+      if (success) {
+        retireLpmMap(KatranLbMaps::lpm_src_v4, sizeof(v4_lpm_key), prevV4Fd);
+        retireLpmMap(KatranLbMaps::lpm_src_v6, sizeof(v6_lpm_key), prevV6Fd);
+      }
+    } else {
+      success = writeLpmMapBatch(
+                    getLpmMapFd(KatranLbMaps::lpm_src_v4),
+                    keysV4.data(),
+                    sizeof(v4_lpm_key),
+                    valuesV4.data(),
+                    keysV4.size()) &&
+          writeLpmMapBatch(getLpmMapFd(KatranLbMaps::lpm_src_v6),
+                           keysV6.data(),
+                           sizeof(v6_lpm_key),
+                           valuesV6.data(),
+                           keysV6.size());
+      if (success) {
+        // stale prefixes are removed only after new table has been written, so
+        // prefixes which are present in both tables are never missing
+        for (const auto& src : stale) {
+          modifyLpmSrcRule(ModifyAction::DEL, src, 0);
+        }
+      } else {
+        // batches could have been partially written. previous rules are put
+        // back (best effort) one by one
+        for (const auto& rule : written) {
+          auto src_iter = lpmSrcMapping_.find(rule.first);
+          if (src_iter != lpmSrcMapping_.end()) {
+            modifyLpmSrcRule(ModifyAction::ADD, rule.first, src_iter->second);
+          } else {
+            modifyLpmSrcRule(ModifyAction::DEL, rule.first, 0);
+          }
+        }
+      }
+    }
+  }
+
+  if (!success) {
+    for (const auto& rule : written) {
+      decreaseRefCountForReal(numToReals_[rule.second]);
+    }
+    return kError;
+  }
+  for (auto rnum : released) {
+    decreaseRefCountForReal(numToReals_[rnum]);
+  }
+  if (replace) {
+    lpmSrcMapping_ = std::move(written);
+  } else {
+    for (const auto& rule : written) {
+      lpmSrcMapping_[rule.first] = rule.second;
+    }
+  }
+  return num_errors;
+}
+
+int KatranLb::loadSrcRoutingRules(
+    std::istream& input,
+    bool replace,
+    uint32_t numThreads) {
+  std::vector<std::pair<std::string, std::string>> rules;
+  int num_errors = 0;
+  std::string line;
+  while (std::getline(input, line)) {
+    std::istringstream fields(line);
+    std::string src, dst, extra;
+    if (!(fields >> src) || src[0] == '#') {
+      continue;
+    }
+    if (!(fields >> dst) || (fields >> extra && extra[0] != '#')) {
+      LOG(ERROR) << "malformed src routing rule: " << line;
+      num_errors++;
+      continue;
+    }
+    rules.emplace_back(std::move(src), std::move(dst));
+  }
+  auto rval = addSrcRoutingRulesBulk(rules, replace, numThreads);
+  if (rval == kError) {
+    return kError;
+  }
+  return num_errors + rval;
+}
+
+int KatranLb::loadSrcRoutingRulesFromFile(
+    const std::string& path,
+    bool replace,
+    uint32_t numThreads) {
+  std::ifstream input(path);
+  if (!input.is_open()) {
+    LOG(ERROR) << "can't open file with src routing rules: " << path;
+    return kError;
+  }
+  return loadSrcRoutingRules(input, replace, numThreads);
+}
+
+bool KatranLb::delSrcRoutingRule(const std::vector<std::string>& srcs) {
+  if (!features_.srcRouting && !config_.testing) {
+    LOG(ERROR) << "Source based routing is not enabled in forwarding plane";
+    return false;
+  }
+  std::vector<folly::CIDRNetwork> src_networks;
+  for (auto& src : srcs) {
+    auto network = folly::IPAddress::tryCreateNetwork(src);
+    if (network.hasValue()) {
+      src_networks.push_back(network.value());
+    }
+  }
+  return delSrcRoutingRule(src_networks);
+}
+
+bool KatranLb::delSrcRoutingRule(const std::vector<folly::CIDRNetwork>& srcs) {
+  if (!features_.srcRouting && !config_.testing) {
+    LOG(ERROR) << "Source based routing is not enabled in forwarding plane";
+    return false;
+  }
+  for (auto& src : srcs) {
+    auto src_iter = lpmSrcMapping_.find(src);
+    if (src_iter == lpmSrcMapping_.end()) {
+      LOG(ERROR) << "trying to delete non existing src mapping " << src.first
+                 << "/" << src.second;
+      continue;
+    }
+    auto dst = numToReals_[src_iter->second];
+    decreaseRefCountForReal(dst);
+    if (!config_.testing) {
+      modifyLpmSrcRule(ModifyAction::DEL, src, src_iter->second);
+    }
+    lpmSrcMapping_.erase(src_iter);
+  }
+  return true;
 }
 
 bool KatranLb::clearAllSrcRoutingRules() {
@@ -1523,6 +2208,28 @@ std::unique_ptr<folly::IOBuf> KatranLb::getKatranMonitorEventBuffer(
   return monitor_->getEventBuffer(event);
 }
 
+bool KatranLb::setKatranMonitorEventFilter(
+    EventId event,
+    const EventFilterConfig& filter) {
+  if (!monitor_) {
+    return false;
+  }
+  if (!monitor_->setEventFilter(event, filter)) {
+    return false;
+  }
+  // event filtered by vip is annotated only w/ this vip
+  annotateMonitorEvents();
+  return true;
+}
+
+std::optional<EventFilterConfig> KatranLb::getKatranMonitorEventFilter(
+    EventId event) {
+  if (!monitor_) {
+    return std::nullopt;
+  }
+  return monitor_->getEventFilter(event);
+}
+
 bool KatranLb::restartKatranMonitor(
     uint32_t limit,
     std::optional<PcapStorageFormat> storage) {
@@ -1532,10 +2239,51 @@ bool KatranLb::restartKatranMonitor(
   if (!changeKatranMonitorForwardingState(KatranMonitorState::ENABLED)) {
     return false;
   }
+  annotateMonitorEvents();
   monitor_->restartMonitor(limit, storage);
   return true;
 }
 
+void KatranLb::annotateMonitorEvents() {
+  for (auto event : config_.monitorConfig.events) {
+    // event which is filtered by vip is annotated only w/ this vip
+    std::vector<VipKey> vips;
+    auto filter = monitor_->getEventFilter(event);
+    if (filter.has_value() && filter->vip.has_value()) {
+      vips.push_back(*filter->vip);
+    } else {
+      vips = getAllVips();
+    }
+    std::string comment;
+    size_t described = 0;
+    for (const auto& vip : vips) {
+      auto vipIt = vips_.find(CompactVipKey(vip));
+      if (vipIt == vips_.end()) {
+        continue;
+      }
+      if (described == kMaxMonitorCommentVips) {
+        comment += fmt::format("; {} more vips", vips.size() - described);
+        break;
+      }
+      if (!comment.empty()) {
+        comment += "; ";
+      }
+      comment += fmt::format(
+          "vip: {}:{}:{} reals:", vip.address, vip.port, vip.proto);
+      auto reals = vipIt->second.getRealsAndWeight();
+      for (size_t i = 0; i < reals.size(); i++) {
+        if (i == kMaxMonitorCommentReals) {
+          comment += fmt::format(" +{} more", reals.size() - i);
+          break;
+        }
+        comment += " " + numToReals_[reals[i].num].str();
+      }
+      described++;
+    }
+    monitor_->setEventComment(event, comment);
+  }
+}
+
 KatranMonitorStats KatranLb::getKatranMonitorStats() {
   struct KatranMonitorStats stats;
   if (!monitor_) {
@@ -1545,6 +2293,7 @@ KatranMonitorStats KatranLb::getKatranMonitorStats() {
   stats.limit = writer_stats.limit;
   stats.amount = writer_stats.amount;
   stats.bufferFull = writer_stats.bufferFull;
+  stats.queueFull = writer_stats.queueFull;
   return stats;
 }
 
@@ -1555,6 +2304,124 @@ bool KatranLb::modifyLpmSrcRule(
   return modifyLpmMap("lpm_src", action, src, &rnum);
 }
 
+int KatranLb::getLpmMapFd(const std::string& mapName) {
+  auto fd_iter = lpmMapFdOverrides_.find(mapName);
+  if (fd_iter != lpmMapFdOverrides_.end()) {
+    return fd_iter->second;
+  }
+  return bpfAdapter_->getMapFdByName(mapName);
+}
+
+bool KatranLb::writeLpmMapBatch(
+    int mapFd,
+    void* keys,
+    uint32_t keySize,
+    uint32_t* values,
+    uint32_t count) {
+  for (uint32_t i = 0; i < count; i += kLpmBatchSize) {
+    auto batchSize = std::min(kLpmBatchSize, count - i);
+    auto res = bpfAdapter_->bpfUpdateMapBatch(
+        mapFd, static_cast<char*>(keys) + i * keySize, values + i, batchSize);
+    if (res != 0) {
+      LOG(ERROR) << "can't batch update lpm map, error: "
+                 << folly::errnoStr(errno);
+      lbStats_.bpfFailedCalls++;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool KatranLb::swapLpmMap(
+    const std::string& mapName,
+    const std::string& outerMapName,
+    void* keys,
+    uint32_t keySize,
+    uint32_t* values,
+    uint32_t count,
+    int& prevFd) {
+  int shadowFd = bpfAdapter_->createBpfMap(
+      kBpfMapTypeLpmTrie,
+      keySize,
+      sizeof(uint32_t),
+      config_.maxLpmSrcSize,
+      BPF_F_NO_PREALLOC);
+  if (shadowFd < 0) {
+    LOG(ERROR) << "can't create shadow map for " << mapName
+               << ", error: " << folly::errnoStr(errno);
+    lbStats_.bpfFailedCalls++;
+    return false;
+  }
+  if (!writeLpmMapBatch(shadowFd, keys, keySize, values, count)) {
+    close(shadowFd);
+    return false;
+  }
+  uint32_t slot = kLpmOuterMapSlot;
+  auto res = bpfAdapter_->bpfUpdateMap(
+      bpfAdapter_->getMapFdByName(outerMapName), &slot, &shadowFd);
+  if (res != 0) {
+    LOG(ERROR) << "can't swap shadow map into " << outerMapName
+               << ", error: " << folly::errnoStr(errno);
+    lbStats_.bpfFailedCalls++;
+    close(shadowFd);
+    return false;
+  }
+  prevFd = -1;
+  auto fd_iter = lpmMapFdOverrides_.find(mapName);
+  if (fd_iter != lpmMapFdOverrides_.end()) {
+    prevFd = fd_iter->second;
+  }
+  lpmMapFdOverrides_[mapName] = shadowFd;
+  return true;
+}
+
+void KatranLb::restoreLpmMap(
+    const std::string& mapName,
+    const std::string& outerMapName,
+    int prevFd) {
+  uint32_t slot = kLpmOuterMapSlot;
+  auto outerFd = bpfAdapter_->getMapFdByName(outerMapName);
+  // w/ empty slot forwarding plane falls back to the map itself
+  auto res = prevFd >= 0
+      ? bpfAdapter_->bpfUpdateMap(outerFd, &slot, &prevFd)
+      : bpfAdapter_->bpfMapDeleteElement(outerFd, &slot);
+  if (res != 0) {
+    LOG(ERROR) << "can't restore previous map in " << outerMapName
+               << ", error: " << folly::errnoStr(errno);
+    lbStats_.bpfFailedCalls++;
+  }
+  close(lpmMapFdOverrides_[mapName]);
+  if (prevFd >= 0) {
+    lpmMapFdOverrides_[mapName] = prevFd;
+  } else {
+    lpmMapFdOverrides_.erase(mapName);
+  }
+}
+
+void KatranLb::retireLpmMap(
+    const std::string& mapName,
+    uint32_t keySize,
+    int prevFd) {
+  if (prevFd >= 0) {
+    // previous trie is released by the kernel after it is no longer
+    // referenced by outer map and in-flight programs
+    close(prevFd);
+    return;
+  }
+  // the map itself is still referenced by the program. its stale content
+  // would be used again if the slot were ever emptied
+  auto mapFd = bpfAdapter_->getMapFdByName(mapName);
+  std::vector<char> key(keySize);
+  while (bpfAdapter_->bpfMapGetNextKey(mapFd, nullptr, key.data()) == 0) {
+    if (bpfAdapter_->bpfMapDeleteElement(mapFd, key.data()) != 0) {
+      LOG(ERROR) << "can't clear retired " << mapName
+                 << ", error: " << folly::errnoStr(errno);
+      lbStats_.bpfFailedCalls++;
+      return;
+    }
+  }
+}
+
 bool KatranLb::modifyLpmMap(
     const std::string& lpmMapNamePrefix,
     ModifyAction action,
@@ -1567,7 +2434,7 @@ bool KatranLb::modifyLpmMap(
     std::string mapName = lpmMapNamePrefix + "_v4";
     if (action == ModifyAction::ADD) {
       auto res = bpfAdapter_->bpfUpdateMap(
-          bpfAdapter_->getMapFdByName(mapName), &key_v4, value);
+          getLpmMapFd(mapName), &key_v4, value);
       if (res != 0) {
         LOG(ERROR) << "can't add new element into " << mapName
                    << ", error: " << folly::errnoStr(errno);
@@ -1576,7 +2443,7 @@ bool KatranLb::modifyLpmMap(
       }
     } else {
       auto res = bpfAdapter_->bpfMapDeleteElement(
-          bpfAdapter_->getMapFdByName(mapName), &key_v4);
+          getLpmMapFd(mapName), &key_v4);
       if (res != 0) {
         LOG(ERROR) << "can't delete element from " << mapName
                    << ", error: " << folly::errnoStr(errno);
@@ -1592,7 +2459,7 @@ bool KatranLb::modifyLpmMap(
     std::memcpy(key_v6.addr, lpm_addr.v6daddr, 16);
     if (action == ModifyAction::ADD) {
       auto res = bpfAdapter_->bpfUpdateMap(
-          bpfAdapter_->getMapFdByName(mapName), &key_v6, value);
+          getLpmMapFd(mapName), &key_v6, value);
       if (res != 0) {
         LOG(ERROR) << "can't add new element into " << mapName
                    << ", error: " << folly::errnoStr(errno);
@@ -1601,7 +2468,7 @@ bool KatranLb::modifyLpmMap(
       }
     } else {
       auto res = bpfAdapter_->bpfMapDeleteElement(
-          bpfAdapter_->getMapFdByName(mapName), &key_v6);
+          getLpmMapFd(mapName), &key_v6);
       if (res != 0) {
         LOG(ERROR) << "can't delete element from " << mapName
                    << ", error: " << folly::errnoStr(errno);
@@ -1776,6 +2643,463 @@ void KatranLb::modifyQuicRealsMapping(
   }
 }
 
+KatranLb::ForwardingState KatranLb::readForwardingState() {
+  ForwardingState state;
+  if (config_.testing) {
+    return state;
+  }
+
+  forEachMapEntry<vip_definition, vip_meta>(
+      bpfAdapter_->getMapFdByName(KatranLbMaps::vip_map),
+      [&](const vip_definition& vip_def, const vip_meta& meta) {
+        FwStateVip vip;
+        // vip_definition does not carry address family: v6 vip w/ zeroed
+        // low 96 bits has the same key as v4 one. family is in vip's flags
+        bool isV6 = meta.flags & kVipFlagV6;
+        vip.vip.address = beAddrToIPAddress(vip_def.vipv6, isV6).str();
+        vip.vip.port = folly::Endian::big(vip_def.port);
+        vip.vip.proto = vip_def.proto;
+        vip.vipNum = meta.vip_num;
+        vip.flags = meta.flags & ~kVipFlagV6;
+        state.vips.push_back(std::move(vip));
+      });
+
+  auto ch_fd = bpfAdapter_->getMapFdByName(KatranLbMaps::ch_rings);
+  for (auto& vip : state.vips) {
+    if (vip.vipNum >= config_.maxVips) {
+      continue;
+    }
+    vip.chRing.resize(config_.chRingSize);
+    auto res = BpfBatchUtil::bpfArrayReadRange(
+        ch_fd,
+        vip.vipNum * config_.chRingSize,
+        config_.chRingSize,
+        vip.chRing.data());
+    if (res != 0) {
+      LOG(ERROR) << "can't read ch ring for vip " << vip.vip.address;
+      lbStats_.bpfFailedCalls++;
+      vip.chRing.clear();
+    }
+  }
+
+  std::vector<beaddr> reals(config_.maxReals);
+  auto res = BpfBatchUtil::bpfArrayReadRange(
+      bpfAdapter_->getMapFdByName(KatranLbMaps::reals),
+      0,
+      config_.maxReals,
+      reals.data());
+  if (res != 0) {
+    LOG(ERROR) << "can't read reals";
+    lbStats_.bpfFailedCalls++;
+  } else {
+    // index 0 is reserved
+    for (uint32_t i = 1; i < config_.maxReals; i++) {
+      bool isV6 = reals[i].flags & V6DADDR;
+      if (!isV6 && reals[i].daddr == 0) {
+        continue;
+      }
+      state.reals[i] = FwStateReal{
+          beAddrToIPAddress(reals[i].v6daddr, isV6),
+          static_cast<uint8_t>(reals[i].flags & ~V6DADDR)};
+    }
+  }
+
+  auto server_id_fd = bpfAdapter_->getMapFdByName(KatranLbMaps::server_id_map);
+  struct bpf_map_info info = {};
+  if (BaseBpfAdapter::getBpfMapInfo(server_id_fd, &info) != 0) {
+    LOG(ERROR) << "can't get info about server_id_map";
+    lbStats_.bpfFailedCalls++;
+  } else if (info.type == kBpfMapTypeArray) {
+    std::vector<uint32_t> ids(kServerIdsReadChunk);
+    for (uint32_t first = 0; first < info.max_entries;
+         first += kServerIdsReadChunk) {
+      auto count = std::min(kServerIdsReadChunk, info.max_entries - first);
+      if (BpfBatchUtil::bpfArrayReadRange(
+              server_id_fd, first, count, ids.data()) != 0) {
+        LOG(ERROR) << "can't read server_id_map";
+        lbStats_.bpfFailedCalls++;
+        break;
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        if (ids[i] != 0) {
+          state.serverIds[first + i] = ids[i];
+        }
+      }
+    }
+  } else {
+    forEachMapEntry<uint32_t, uint32_t>(
+        server_id_fd, [&](uint32_t id, uint32_t rnum) {
+          state.serverIds[id] = rnum;
+        });
+  }
+
+  if (features_.srcRoutingShadowMaps) {
+    // tries which were swapped in by previous instance are active ones
+    for (const auto& maps : {
+             std::make_pair(
+                 KatranLbMaps::lpm_src_v4, KatranLbMaps::lpm_src_v4_maps),
+             std::make_pair(
+                 KatranLbMaps::lpm_src_v6, KatranLbMaps::lpm_src_v6_maps)}) {
+      uint32_t slot = kLpmOuterMapSlot;
+      auto inner_fd = bpfAdapter_->bpfMapGetFdOfInnerMap(
+          bpfAdapter_->getMapFdByName(maps.second), &slot);
+      if (inner_fd < 0) {
+        continue;
+      }
+      auto fd_iter = lpmMapFdOverrides_.find(maps.first);
+      if (fd_iter != lpmMapFdOverrides_.end()) {
+        close(fd_iter->second);
+      }
+      lpmMapFdOverrides_[maps.first] = inner_fd;
+    }
+  }
+  if (features_.srcRouting) {
+    forEachMapEntry<v4_lpm_key, uint32_t>(
+        getLpmMapFd(KatranLbMaps::lpm_src_v4),
+        [&](const v4_lpm_key& key, uint32_t rnum) {
+          auto addr = folly::IPAddressV4::fromLong(key.addr);
+          state.srcRouting[{addr, key.prefixlen}] = rnum;
+        });
+    forEachMapEntry<v6_lpm_key, uint32_t>(
+        getLpmMapFd(KatranLbMaps::lpm_src_v6),
+        [&](const v6_lpm_key& key, uint32_t rnum) {
+          auto addr = beAddrToIPAddress(key.addr, true);
+          state.srcRouting[{addr, key.prefixlen}] = rnum;
+        });
+  }
+  return state;
+}
+
+KatranLb::RestoreResponse KatranLb::restoreState(
+    const ForwardingState& state) {
+  RestoreResponse response;
+  if (!vips_.empty() || !reals_.empty() || !quicMapping_.empty() ||
+      !lpmSrcMapping_.empty()) {
+    response.errors.push_back("katran's state is not empty");
+    LOG(ERROR) << "can't restore state: katran's state is not empty";
+    return response;
+  }
+  auto& errors = response.errors;
+
+  // the same address could not be used by multiple reals' indexes
+  std::unordered_map<folly::IPAddress, uint32_t> addrToNum;
+  std::unordered_set<uint32_t> validReals;
+  std::vector<uint32_t> realNums;
+  for (const auto& real : state.reals) {
+    realNums.push_back(real.first);
+  }
+  std::sort(realNums.begin(), realNums.end());
+  for (auto num : realNums) {
+    const auto& addr = state.reals.at(num).address;
+    if (num == 0 || num >= config_.maxReals) {
+      errors.push_back(
+          fmt::format("real {} has invalid index {}", addr.str(), num));
+      continue;
+    }
+    auto addr_iter = addrToNum.find(addr);
+    if (addr_iter != addrToNum.end()) {
+      errors.push_back(fmt::format(
+          "real {} has multiple indexes: {} and {}",
+          addr.str(),
+          addr_iter->second,
+          num));
+      continue;
+    }
+    addrToNum[addr] = num;
+    validReals.insert(num);
+  }
+
+  // real's index -> number of references from vips, server ids and src rules
+  std::unordered_map<uint32_t, uint32_t> refCounts;
+  std::unordered_set<uint32_t> usedVipNums;
+  for (const auto& fw_vip : state.vips) {
+    auto vip_name = fmt::format(
+        "{}:{}:{}", fw_vip.vip.address, fw_vip.vip.port, fw_vip.vip.proto);
+    if (fw_vip.vipNum >= config_.maxVips ||
+        !usedVipNums.insert(fw_vip.vipNum).second) {
+      errors.push_back(fmt::format(
+          "vip {} has invalid or duplicate index {}", vip_name, fw_vip.vipNum));
+      continue;
+    }
+    if (fw_vip.chRing.size() != config_.chRingSize) {
+      errors.push_back(fmt::format(
+          "vip {} has ring of size {}, expected {}",
+          vip_name,
+          fw_vip.chRing.size(),
+          config_.chRingSize));
+      usedVipNums.erase(fw_vip.vipNum);
+      continue;
+    }
+    std::vector<int> ring(config_.chRingSize, -1);
+    std::unordered_map<uint32_t, uint32_t> positions;
+    uint32_t unset = 0;
+    uint32_t invalid = 0;
+    for (uint32_t i = 0; i < config_.chRingSize; i++) {
+      auto num = fw_vip.chRing[i];
+      if (num == 0) {
+        unset++;
+      } else if (validReals.find(num) == validReals.end()) {
+        invalid++;
+      } else {
+        ring[i] = num;
+        positions[num]++;
+      }
+    }
+    if (invalid > 0) {
+      errors.push_back(fmt::format(
+          "{} positions of vip {} ring point to unknown reals",
+          invalid,
+          vip_name));
+    }
+    if (unset > 0 && unset != config_.chRingSize) {
+      errors.push_back(fmt::format(
+          "{} positions of vip {} ring are not programmed", unset, vip_name));
+    }
+    std::vector<Endpoint> endpoints;
+    if (fw_vip.reals.empty()) {
+      for (const auto& position : positions) {
+        Endpoint endpoint;
+        endpoint.num = position.first;
+        endpoint.weight = position.second;
+        endpoint.hash = state.reals.at(position.first).address.hash();
+        endpoints.push_back(endpoint);
+      }
+    } else {
+      for (const auto& endpoint : fw_vip.reals) {
+        if (validReals.find(endpoint.num) == validReals.end()) {
+          errors.push_back(fmt::format(
+              "vip {} has unknown real {}", vip_name, endpoint.num));
+          continue;
+        }
+        endpoints.push_back(endpoint);
+      }
+    }
+    for (const auto& endpoint : endpoints) {
+      refCounts[endpoint.num]++;
+    }
+    Vip vip(
+        fw_vip.vipNum,
+        fw_vip.flags,
+        config_.chRingSize,
+        fw_vip.hashFunction.value_or(config_.hashFunction));
+    vip.restoreState(endpoints, std::move(ring));
+    vips_.emplace(CompactVipKey(fw_vip.vip), std::move(vip));
+    response.vips++;
+  }
+
+  for (const auto& server_id : state.serverIds) {
+    if (validReals.find(server_id.second) == validReals.end()) {
+      errors.push_back(fmt::format(
+          "server id {} points to unknown real {}",
+          server_id.first,
+          server_id.second));
+      continue;
+    }
+    quicMapping_[server_id.first] = state.reals.at(server_id.second).address;
+    refCounts[server_id.second]++;
+    response.serverIds++;
+  }
+
+  for (const auto& rule : state.srcRouting) {
+    if (validReals.find(rule.second) == validReals.end()) {
+      errors.push_back(fmt::format(
+          "src routing rule {}/{} points to unknown real {}",
+          rule.first.first.str(),
+          rule.first.second,
+          rule.second));
+      continue;
+    }
+    lpmSrcMapping_[rule.first] = rule.second;
+    refCounts[rule.second]++;
+    response.srcRoutingRules++;
+  }
+
+  // reals, which are not referenced by anything, are stale and would be
+  // overwritten as soon as their index is reused
+  for (const auto& ref : refCounts) {
+    const auto& real = state.reals.at(ref.first);
+    RealMeta meta;
+    meta.num = ref.first;
+    meta.refCount = ref.second;
+    meta.flags = real.flags;
+    reals_[real.address] = meta;
+    numToReals_[ref.first] = real.address;
+    for (auto& callback : realsIdCallbacks_) {
+      callback->onRealAdded(real.address, ref.first);
+    }
+  }
+  response.reals = refCounts.size();
+
+  vipNums_.erase(
+      std::remove_if(
+          vipNums_.begin(),
+          vipNums_.end(),
+          [&](uint32_t num) { return usedVipNums.count(num) > 0; }),
+      vipNums_.end());
+  realNums_.erase(
+      std::remove_if(
+          realNums_.begin(),
+          realNums_.end(),
+          [&](uint32_t num) { return refCounts.count(num) > 0; }),
+      realNums_.end());
+
+  for (const auto& error : errors) {
+    LOG(ERROR) << "inconsistency in forwarding state: " << error;
+  }
+  LOG(INFO) << fmt::format(
+      "restored {} vips, {} reals, {} server ids and {} src routing rules",
+      response.vips,
+      response.reals,
+      response.serverIds,
+      response.srcRoutingRules);
+  return response;
+}
+
+KatranLb::RestoreResponse KatranLb::restoreFromForwardingPlane() {
+  return restoreState(readForwardingState());
+}
+
+bool KatranLb::saveSnapshot(const std::string& path) {
+  // snapshot must reflect everything which has been requested so far
+  flushPendingRealsUpdates(true);
+  return writeSnapshot(path);
+}
+
+bool KatranLb::saveSnapshotIfDue() {
+  if (config_.snapshotPath.empty() || config_.snapshotIntervalMs == 0) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastSnapshotSave_ <
+      std::chrono::milliseconds(config_.snapshotIntervalMs)) {
+    return false;
+  }
+  // failed save is not retried before the next interval
+  lastSnapshotSave_ = now;
+  return writeSnapshot(config_.snapshotPath);
+}
+
+bool KatranLb::writeSnapshot(const std::string& path) {
+  KatranSnapshotData data;
+  data.chRingSize = config_.chRingSize;
+  for (const auto& real : reals_) {
+    data.reals.push_back(
+        KatranSnapshotReal{real.first, real.second.num, real.second.flags});
+  }
+  for (auto& vip : vips_) {
+    KatranSnapshotVip snapshot_vip;
+    snapshot_vip.vip = vip.first.toVipKey();
+    snapshot_vip.vipNum = vip.second.getVipNum();
+    snapshot_vip.flags = vip.second.getVipFlags();
+    snapshot_vip.hashFunction = vip.second.getHashFunction();
+    snapshot_vip.reals = vip.second.getRealsAndWeight();
+    snapshot_vip.chRing = vip.second.getChRing();
+    data.vips.push_back(std::move(snapshot_vip));
+  }
+  for (const auto& mapping : quicMapping_) {
+    auto real = reals_.find(mapping.second);
+    if (real != reals_.end()) {
+      data.serverIds.emplace_back(mapping.first, real->second.num);
+    }
+  }
+  for (const auto& rule : lpmSrcMapping_) {
+    data.srcRules.emplace_back(rule.first, rule.second);
+  }
+  return KatranSnapshot::write(path, data);
+}
+
+KatranLb::RestoreResponse KatranLb::loadSnapshot(
+    const std::string& path,
+    bool programForwardingPlane) {
+  RestoreResponse response;
+  auto snapshot = KatranSnapshot::open(path);
+  if (snapshot.hasError()) {
+    LOG(ERROR) << "can't load snapshot: " << snapshot.error();
+    response.errors.push_back(snapshot.error());
+    return response;
+  }
+  auto& header = snapshot.value()->header();
+  if (header.chRingSize != config_.chRingSize) {
+    response.errors.push_back(fmt::format(
+        "snapshot has ch ring size {}, expected {}",
+        header.chRingSize,
+        config_.chRingSize));
+    LOG(ERROR) << "can't load snapshot: " << response.errors.back();
+    return response;
+  }
+
+  auto data = snapshot.value()->toData();
+  ForwardingState state;
+  for (const auto& real : data.reals) {
+    state.reals[real.num] = FwStateReal{real.address, real.flags};
+  }
+  for (auto& vip : data.vips) {
+    FwStateVip fw_vip;
+    fw_vip.vip = vip.vip;
+    fw_vip.vipNum = vip.vipNum;
+    fw_vip.flags = vip.flags;
+    fw_vip.hashFunction = vip.hashFunction;
+    fw_vip.reals = std::move(vip.reals);
+    fw_vip.chRing.resize(vip.chRing.size());
+    for (size_t i = 0; i < vip.chRing.size(); i++) {
+      fw_vip.chRing[i] = vip.chRing[i] < 0 ? 0 : vip.chRing[i];
+    }
+    state.vips.push_back(std::move(fw_vip));
+  }
+  for (const auto& server_id : data.serverIds) {
+    state.serverIds[server_id.first] = server_id.second;
+  }
+  for (const auto& rule : data.srcRules) {
+    state.srcRouting[rule.first] = rule.second;
+  }
+
+  response = restoreState(state);
+  if (programForwardingPlane && !config_.testing) {
+    this->programForwardingPlane();
+  }
+  return response;
+}
+
+void KatranLb::programForwardingPlane() {
+  for (const auto& real : reals_) {
+    updateRealsMap(real.first, real.second.num, real.second.flags);
+  }
+  for (auto& vip : vips_) {
+    vip_meta meta;
+    meta.vip_num = vip.second.getVipNum();
+    meta.flags = vip.second.getVipFlags();
+    updateVipMap(ModifyAction::ADD, vip.first.toVipKey(), &meta);
+    const auto& ring = vip.second.getChRing();
+    std::vector<RealPos> positions;
+    for (uint32_t i = 0; i < ring.size(); i++) {
+      if (ring[i] >= 0) {
+        positions.push_back(RealPos{static_cast<uint32_t>(ring[i]), i});
+      }
+    }
+    programHashRing(positions, vip.second.getVipNum());
+  }
+  auto server_id_map_fd =
+      bpfAdapter_->getMapFdByName(KatranLbMaps::server_id_map);
+  for (const auto& mapping : quicMapping_) {
+    auto real = reals_.find(mapping.second);
+    if (real == reals_.end()) {
+      continue;
+    }
+    uint32_t id = mapping.first;
+    uint32_t rnum = real->second.num;
+    if (bpfAdapter_->bpfUpdateMap(server_id_map_fd, &id, &rnum) != 0) {
+      LOG(ERROR) << "can't update quic mapping, error: "
+                 << folly::errnoStr(errno);
+      lbStats_.bpfFailedCalls++;
+    }
+  }
+  if (features_.srcRouting) {
+    for (const auto& rule : lpmSrcMapping_) {
+      modifyLpmSrcRule(ModifyAction::ADD, rule.first, rule.second);
+    }
+  }
+}
+
 std::vector<QuicReal> KatranLb::getQuicRealsMapping() {
   std::vector<QuicReal> reals;
   QuicReal real;
@@ -1788,7 +3112,7 @@ std::vector<QuicReal> KatranLb::getQuicRealsMapping() {
 }
 
 lb_stats KatranLb::getStatsForVip(const VipKey& vip) {
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << fmt::format(
         "trying to get stats for non-existing vip  {}:{}:{}",
@@ -1802,7 +3126,7 @@ lb_stats KatranLb::getStatsForVip(const VipKey& vip) {
 }
 
 lb_stats KatranLb::getDecapStatsForVip(const VipKey& vip) {
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << fmt::format(
         "trying to get stats for non-existing vip  {}:{}:{}",
@@ -1816,7 +3140,7 @@ lb_stats KatranLb::getDecapStatsForVip(const VipKey& vip) {
 }
 
 uint64_t KatranLb::getPacketsProcessedForHcKey(const VipKey& hcKey) {
-  auto hc_key_iter = hckeys_.find(hcKey);
+  auto hc_key_iter = hckeys_.find(CompactVipKey(hcKey));
   if (hc_key_iter == hckeys_.end()) {
     LOG(ERROR) << "couldn't find hc_key";
     return 0;
@@ -1909,7 +3233,7 @@ std::unordered_map<std::string, int32_t> KatranLb::getVipLruMissStats(
     return std::unordered_map<std::string, int32_t>{};
   }
 
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     LOG(ERROR) << "trying to get stats for non-existing vip";
     return std::unordered_map<std::string, int32_t>{};
@@ -1977,6 +3301,13 @@ lb_stats KatranLb::getIcmpTooBigStats() {
 }
 
 lb_quic_packets_stats KatranLb::getLbQuicPacketsStats() {
+  if (auto snapshot = getStatsSnapshot()) {
+    auto stats = snapshot->quicStats;
+    logInvalidServerId(stats.cid_invalid_server_id_sample);
+    // sample is not a counter and is not a part of aggregated stats
+    stats.cid_invalid_server_id_sample = 0;
+    return stats;
+  }
   unsigned int nr_cpus = BpfAdapter::getPossibleCpus();
   if (nr_cpus < 0) {
     LOG(ERROR) << "Error while getting number of possible cpus";
@@ -1995,17 +3326,7 @@ lb_quic_packets_stats KatranLb::getLbQuicPacketsStats() {
         sum_stat.ch_routed += stat.ch_routed;
         sum_stat.cid_initial += stat.cid_initial;
         sum_stat.cid_invalid_server_id += stat.cid_invalid_server_id;
-        if (stat.cid_invalid_server_id_sample &&
-            (invalidServerIds_.find(stat.cid_invalid_server_id_sample) ==
-             invalidServerIds_.end()) &&
-            invalidServerIds_.size() < kMaxInvalidServerIds) {
-          LOG(ERROR) << "Invalid server id "
-                     << stat.cid_invalid_server_id_sample << " in quic packet";
-          invalidServerIds_.insert(stat.cid_invalid_server_id_sample);
-          if (invalidServerIds_.size() == kMaxInvalidServerIds) {
-            LOG(ERROR) << "Too many invalid server ids, will skip logging";
-          }
-        }
+        logInvalidServerId(stat.cid_invalid_server_id_sample);
         sum_stat.cid_routed += stat.cid_routed;
         sum_stat.cid_unknown_real_dropped += stat.cid_unknown_real_dropped;
         sum_stat.cid_v0 += stat.cid_v0;
@@ -2024,7 +3345,22 @@ lb_quic_packets_stats KatranLb::getLbQuicPacketsStats() {
   return sum_stat;
 }
 
+void KatranLb::logInvalidServerId(uint64_t serverId) {
+  if (serverId &&
+      (invalidServerIds_.find(serverId) == invalidServerIds_.end()) &&
+      invalidServerIds_.size() < kMaxInvalidServerIds) {
+    LOG(ERROR) << "Invalid server id " << serverId << " in quic packet";
+    invalidServerIds_.insert(serverId);
+    if (invalidServerIds_.size() == kMaxInvalidServerIds) {
+      LOG(ERROR) << "Too many invalid server ids, will skip logging";
+    }
+  }
+}
+
 lb_tpr_packets_stats KatranLb::getTcpServerIdRoutingStats() {
+  if (auto snapshot = getStatsSnapshot()) {
+    return snapshot->tprStats;
+  }
   unsigned int nr_cpus = BpfAdapter::getPossibleCpus();
   if (nr_cpus < 0) {
     LOG(ERROR) << "Error while getting number of possible cpus";
@@ -2166,7 +3502,76 @@ lb_stats KatranLb::getRealStats(uint32_t index) {
   return getLbStats(index, "reals_stats");
 }
 
+bool KatranLb::startStatsEngine(std::chrono::milliseconds interval) {
+  if (statsEngine_) {
+    LOG(ERROR) << "stats engine is already running";
+    return false;
+  }
+  KatranStatsEngineConfig engineConfig;
+  engineConfig.interval = interval;
+  engineConfig.statsSize = config_.maxVips * 2;
+  engineConfig.realsStatsSize = config_.maxReals;
+  engineConfig.decapVipStatsSize = config_.maxVips;
+  engineConfig.lruMissStatsSize = config_.maxReals;
+  KatranStatsEngine::PerCpuReader reader;
+  if (config_.testing) {
+    // no forwarding plane in testing mode: all counters are zeroes
+    reader = [](int, uint32_t, uint32_t, size_t, void*) { return 0; };
+  } else {
+    auto nr_cpus = BpfAdapter::getPossibleCpus();
+    if (nr_cpus <= 0) {
+      LOG(ERROR) << "Error while getting number of possible cpus";
+      return false;
+    }
+    engineConfig.numCpus = nr_cpus;
+    engineConfig.statsFd = bpfAdapter_->getMapFdByName(KatranLbMaps::stats);
+    engineConfig.realsStatsFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::reals_stats);
+    engineConfig.decapVipStatsFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::decap_vip_stats);
+    engineConfig.lruMissStatsFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::lru_miss_stats);
+    engineConfig.quicStatsFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::quic_stats_map);
+    engineConfig.tprStatsFd =
+        bpfAdapter_->getMapFdByName(KatranLbMaps::tpr_stats_map);
+    auto nCpus = engineConfig.numCpus;
+    reader = [nCpus](
+                 int fd,
+                 uint32_t first,
+                 uint32_t count,
+                 size_t valueSize,
+                 void* values) {
+      return BpfBatchUtil::bpfPerCpuArrayReadRange(
+          fd, first, count, nCpus, valueSize, values);
+    };
+  }
+  statsEngine_ =
+      std::make_unique<KatranStatsEngine>(engineConfig, std::move(reader));
+  statsEngine_->start();
+  return true;
+}
+
+void KatranLb::stopStatsEngine() {
+  if (statsEngine_) {
+    statsEngine_->stop();
+    statsEngine_.reset();
+  }
+}
+
+std::shared_ptr<const KatranStatsSnapshot> KatranLb::getStatsSnapshot() const {
+  if (!statsEngine_) {
+    return nullptr;
+  }
+  return statsEngine_->getSnapshot();
+}
+
 lb_stats KatranLb::getLbStats(uint32_t position, const std::string& map) {
+  if (auto snapshot = getStatsSnapshot()) {
+    if (auto stats = snapshot->lookup(map, position)) {
+      return *stats;
+    }
+  }
   unsigned int nr_cpus = BpfAdapter::getPossibleCpus();
   if (nr_cpus < 0) {
     LOG(ERROR) << "Error while getting number of possible cpus";
@@ -2383,22 +3788,436 @@ const std::string KatranLb::getRealForFlow(const KatranFlow& flow) {
   return result;
 }
 
-KatranLb::LruStatsResponse KatranLb::analyzeLru() {
+std::vector<std::string> KatranLb::getRealsForFlows(
+    const std::vector<KatranFlow>& flows) {
+  if (!initSimulator()) {
+    return std::vector<std::string>(flows.size());
+  }
+  return simulator_->getRealsForFlows(flows);
+}
+
+std::unique_ptr<KatranShadowDataPlane> KatranLb::getShadowDataPlane() {
+  // rings must reflect everything which has been requested so far
+  flushPendingRealsUpdates(true);
+  auto shadow = std::make_unique<KatranShadowDataPlane>(
+      config_.chRingSize, config_.maxVips, features_.srcRouting);
+  for (const auto& vip : vips_) {
+    shadow->addVip(vip.first, vip.second.getVipFlags(), vip.second.getChRing());
+  }
+  for (const auto& real : numToReals_) {
+    shadow->addReal(real.first, real.second);
+  }
+  for (const auto& rule : lpmSrcMapping_) {
+    shadow->addSrcRoutingRule(rule.first, rule.second);
+  }
+  return shadow;
+}
+
+KatranLb::LruStatsResponse KatranLb::analyzeLru(LruScanControl* control) {
   LruStatsResponse resp;
+  std::vector<int> mapFds;
   for (int cpu = 0; cpu < lruMapsFd_.size(); cpu++) {
-    int mapFd = lruMapsFd_[cpu];
-    if (mapFd <= 0) {
+    if (lruMapsFd_[cpu] > 0) {
+      mapFds.push_back(lruMapsFd_[cpu]);
+    }
+  }
+  // every worker accounts entries of its own map; results are merged after
+  std::vector<LruStatsResponse> perMapStats(mapFds.size());
+  int64_t currentTimeNs = BpfAdapter::getKtimeNs();
+  LruScanner scanner(
+      std::move(mapFds), bpfAdapter_->isBatchOpsEnabled(), 0, control);
+  auto scanResult = scanner.scan([&](size_t mapIdx,
+                                     const flow_key* keys,
+                                     const real_pos_lru* values,
+                                     uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+      accountLruEntry(keys[i], values[i], currentTimeNs, perMapStats[mapIdx]);
+    }
+  });
+  for (const auto& mapStats : perMapStats) {
+    for (const auto& [vipKey, vipStats] : mapStats.perVipStats) {
+      resp.perVipStats[vipKey].add(vipStats);
+    }
+  }
+  if (!scanResult.error.empty()) {
+    resp.error = scanResult.error;
+  }
+
+  finalizeLruStats(resp.perVipStats, resp.error);
+  return resp;
+}
+
+KatranLb::LruStatsResponse KatranLb::estimateLru(
+    uint32_t maxEntriesPerMap,
+    LruScanControl* control) {
+  if (!bpfAdapter_->isBatchOpsEnabled()) {
+    // w/o batch operations random access to lru is not possible
+    return analyzeLru(control);
+  }
+  LruStatsResponse resp;
+  std::vector<int> mapFds;
+  for (int cpu = 0; cpu < lruMapsFd_.size(); cpu++) {
+    if (lruMapsFd_[cpu] > 0) {
+      mapFds.push_back(lruMapsFd_[cpu]);
+    }
+  }
+  size_t numMaps = mapFds.size();
+  // stats of each sampled window of each map
+  std::vector<std::vector<LruStatsResponse>> windowStats(numMaps);
+  int64_t currentTimeNs = BpfAdapter::getKtimeNs();
+  LruScanner scanner(std::move(mapFds), true, 0, control);
+  auto sample = scanner.sample(
+      [&](size_t mapIdx,
+          size_t window,
+          const flow_key* keys,
+          const real_pos_lru* values,
+          uint32_t count) {
+        auto& mapWindows = windowStats[mapIdx];
+        if (mapWindows.size() <= window) {
+          mapWindows.resize(window + 1);
+        }
+        for (uint32_t i = 0; i < count; i++) {
+          accountLruEntry(
+              keys[i], values[i], currentTimeNs, mapWindows[window]);
+        }
+      },
+      maxEntriesPerMap);
+  resp.error = sample.error;
+  resp.sampled = true;
+
+  // index of each vip in per vip arrays below
+  std::unordered_map<LruVipKey, size_t, LruVipKeyHash> vipIdx;
+  std::vector<LruVipKey> vipKeys;
+  double totalBuckets = 0;
+  double sampledBuckets = 0;
+  for (size_t m = 0; m < numMaps; m++) {
+    totalBuckets += sample.totalBuckets[m];
+    for (const auto& window : sample.windows[m]) {
+      sampledBuckets += window.buckets;
+    }
+    for (const auto& window : windowStats[m]) {
+      for (const auto& vipStats : window.perVipStats) {
+        if (vipIdx.emplace(vipStats.first, vipKeys.size()).second) {
+          vipKeys.push_back(vipStats.first);
+        }
+      }
+    }
+  }
+  resp.sampledFraction =
+      totalBuckets > 0 ? std::min(1.0, sampledBuckets / totalBuckets) : 1.0;
+
+  static constexpr int VipLruStats::*kLruMetrics[] = {
+      &VipLruStats::count,
+      &VipLruStats::staleRealsCount,
+      &VipLruStats::atimeZeroCount,
+      &VipLruStats::atimeUnder30secCount,
+      &VipLruStats::atime30to60secCount,
+      &VipLruStats::atimeOver60secCount,
+  };
+  constexpr size_t kNumMetrics = std::size(kLruMetrics);
+  // maps are sampled independently: totals and variances add up
+  std::vector<std::array<double, kNumMetrics>> totals(vipKeys.size());
+  std::vector<std::array<double, kNumMetrics>> variances(vipKeys.size());
+  // value of each metric of each vip in each window of the map. filled
+  // from entries which are present in the windows, so there are no lookups
+  // per window, vip and metric
+  std::vector<std::vector<double>> sampled;
+  std::vector<double> buckets;
+  for (size_t m = 0; m < numMaps; m++) {
+    size_t numWindows = sample.windows[m].size();
+    buckets.resize(numWindows);
+    for (size_t w = 0; w < numWindows; w++) {
+      buckets[w] = sample.windows[m][w].buckets;
+    }
+    sampled.assign(
+        vipKeys.size() * kNumMetrics, std::vector<double>(numWindows, 0));
+    for (size_t w = 0; w < std::min(numWindows, windowStats[m].size()); w++) {
+      for (const auto& [vipKey, vipStats] : windowStats[m][w].perVipStats) {
+        auto vip = vipIdx[vipKey];
+        for (size_t k = 0; k < kNumMetrics; k++) {
+          sampled[vip * kNumMetrics + k][w] = vipStats.*kLruMetrics[k];
+        }
+      }
+    }
+    for (size_t vip = 0; vip < vipKeys.size(); vip++) {
+      for (size_t k = 0; k < kNumMetrics; k++) {
+        auto mapEstimate = LruScanner::estimateTotal(
+            sampled[vip * kNumMetrics + k], buckets, sample.totalBuckets[m]);
+        totals[vip][k] += mapEstimate.value;
+        variances[vip][k] += mapEstimate.stdErr * mapEstimate.stdErr;
+      }
+    }
+  }
+
+  // 95% confidence interval
+  constexpr double kZScore = 1.96;
+  // estimations are clamped to the range of VipLruStats' counters
+  auto toCount = [](double value) {
+    return static_cast<int>(std::lround(std::clamp(
+        value, 0.0, static_cast<double>(std::numeric_limits<int>::max()))));
+  };
+  for (size_t vip = 0; vip < vipKeys.size(); vip++) {
+    auto& estimate = resp.perVipStats[vipKeys[vip]];
+    auto& low = resp.perVipStatsLow[vipKeys[vip]];
+    auto& high = resp.perVipStatsHigh[vipKeys[vip]];
+    for (size_t k = 0; k < kNumMetrics; k++) {
+      auto metric = kLruMetrics[k];
+      double total = totals[vip][k];
+      double margin = kZScore * std::sqrt(variances[vip][k]);
+      estimate.*metric = toCount(total);
+      low.*metric = toCount(total - margin);
+      high.*metric = toCount(total + margin);
+    }
+  }
+  finalizeLruStats(resp.perVipStats, resp.error);
+  finalizeLruStats(resp.perVipStatsLow, resp.error);
+  finalizeLruStats(resp.perVipStatsHigh, resp.error);
+  return resp;
+}
+
+KatranLb::RemapResponse KatranLb::analyzeRemap(
+    const std::vector<RemapChange>& changes,
+    uint32_t maxEntriesPerMap,
+    LruScanControl* control) {
+  RemapResponse resp;
+  // reals which are not configured yet get temporary indexes above maxReals
+  folly::F14FastMap<folly::IPAddress, uint32_t> newRealNums;
+  folly::F14FastMap<uint32_t, std::string> newRealNames;
+  // affected vips, in the order of their first change
+  std::vector<CompactVipKey> affectedVips;
+  folly::F14FastMap<CompactVipKey, std::vector<UpdateReal>, CompactVipKeyHasher>
+      vipUpdates;
+  for (const auto& change : changes) {
+    CompactVipKey vipKey(change.vip);
+    auto vipIt = vips_.find(vipKey);
+    if (vipIt == vips_.end()) {
+      LOG(ERROR) << "trying to analyze remap for non-existing vip: "
+                 << change.vip.address;
+      resp.error = fmt::format("unknown vip: {}", change.vip.address);
       continue;
     }
-    analyzeLruMap(mapFd, resp);
+    if (vipUpdates.find(vipKey) == vipUpdates.end()) {
+      affectedVips.push_back(vipKey);
+    }
+    auto& ureals = vipUpdates[vipKey];
+    auto curReals = vipIt->second.getReals();
+    for (const auto& real : change.reals) {
+      if (validateAddress(real.address) == AddressType::INVALID) {
+        LOG(ERROR) << "Invalid real's address: " << real.address;
+        resp.error = fmt::format("invalid real: {}", real.address);
+        continue;
+      }
+      folly::IPAddress raddr(real.address);
+      UpdateReal ureal;
+      ureal.action = change.action;
+      auto realIt = reals_.find(raddr);
+      if (change.action == ModifyAction::DEL) {
+        if (realIt == reals_.end() ||
+            std::find(curReals.begin(), curReals.end(), realIt->second.num) ==
+                curReals.end()) {
+          LOG(ERROR) << fmt::format(
+              "trying to delete non-existing real for the VIP: {}",
+              change.vip.address);
+          continue;
+        }
+        ureal.updatedReal.num = realIt->second.num;
+      } else {
+        if (realIt != reals_.end()) {
+          ureal.updatedReal.num = realIt->second.num;
+        } else {
+          auto newIt = newRealNums.find(raddr);
+          if (newIt == newRealNums.end()) {
+            uint32_t num = config_.maxReals + 1 + newRealNums.size();
+            newIt = newRealNums.emplace(raddr, num).first;
+            newRealNames[num] = raddr.str();
+          }
+          ureal.updatedReal.num = newIt->second;
+        }
+        ureal.updatedReal.weight = real.weight;
+        ureal.updatedReal.hash = raddr.hash();
+      }
+      ureals.push_back(ureal);
+    }
+  }
+
+  auto realName = [&](int64_t num) -> std::string {
+    if (num <= 0) {
+      return "";
+    }
+    auto it = numToReals_.find(num);
+    if (it != numToReals_.end()) {
+      return it->second.str();
+    }
+    auto newIt = newRealNames.find(num);
+    return newIt != newRealNames.end() ? newIt->second : "";
+  };
+
+  // new ch rings and placement of flows on current ones
+  KatranShadowDataPlane shadow(
+      config_.chRingSize, config_.maxVips, features_.srcRouting);
+  folly::F14FastMap<CompactVipKey, std::vector<int>, CompactVipKeyHasher>
+      newRings;
+  for (const auto& vipKey : affectedVips) {
+    const auto& vip = vips_.at(vipKey);
+    const auto& ureals = vipUpdates[vipKey];
+    auto newRing = vip.previewHashRing(ureals);
+    // reals which vip would have after the change. positions which still
+    // point to deleted reals (e.g. if all of them are deleted) have no real
+    auto curReals = vip.getReals();
+    folly::F14FastSet<uint32_t> remaining(curReals.begin(), curReals.end());
+    for (const auto& ureal : ureals) {
+      if (ureal.action == ModifyAction::DEL) {
+        remaining.erase(ureal.updatedReal.num);
+      } else {
+        remaining.insert(ureal.updatedReal.num);
+      }
+    }
+    for (auto& num : newRing) {
+      if (num >= 0 && remaining.find(num) == remaining.end()) {
+        num = -1;
+      }
+    }
+
+    VipRemapStats stats;
+    auto key = vipKey.toVipKey();
+    stats.vip = fmt::format("{}-{}-{}", key.address, key.port, key.proto);
+    const auto& oldRing = vip.getChRing();
+    uint32_t changed = 0;
+    double positionShare = 1.0 / config_.chRingSize;
+    for (uint32_t i = 0; i < config_.chRingSize; i++) {
+      if (oldRing[i] != newRing[i]) {
+        changed++;
+      }
+      stats.reals[realName(oldRing[i])].ringShareBefore += positionShare;
+      stats.reals[realName(newRing[i])].ringShareAfter += positionShare;
+    }
+    stats.ringChanged = changed * positionShare;
+    resp.vips.push_back(std::move(stats));
+    shadow.addVip(vipKey, vip.getVipFlags(), oldRing);
+    newRings[vipKey] = std::move(newRing);
+  }
+  if (affectedVips.empty()) {
+    return resp;
+  }
+  for (const auto& rule : lpmSrcMapping_) {
+    shadow.addSrcRoutingRule(rule.first, rule.second);
+  }
+
+  std::vector<int> mapFds;
+  for (size_t cpu = 0; cpu < lruMapsFd_.size(); cpu++) {
+    if (lruMapsFd_[cpu] > 0) {
+      mapFds.push_back(lruMapsFd_[cpu]);
+    }
+  }
+  size_t numMaps = mapFds.size();
+  LruRemapCounter::VipSet unaffectedVips;
+  for (const auto& vip : vips_) {
+    if (newRings.find(vip.first) == newRings.end()) {
+      unaffectedVips.insert(vip.first);
+    }
+  }
+  // every worker accounts entries of its own map; results are merged after
+  LruRemapCounter remapCounter(
+      shadow, newRings, std::move(unaffectedVips), numMaps);
+  auto accountEntries = [&](size_t mapIdx,
+                            const flow_key* keys,
+                            const real_pos_lru* values,
+                            uint32_t count) {
+    remapCounter.accountEntries(mapIdx, keys, values, count);
+  };
+
+  // weight of a flow from each map: inverse of the share of buckets sampled
+  std::vector<double> mapWeights(numMaps, 1.0);
+  LruScanner scanner(
+      std::move(mapFds), bpfAdapter_->isBatchOpsEnabled(), 0, control);
+  if (bpfAdapter_->isBatchOpsEnabled()) {
+    auto sample = scanner.sample(
+        [&](size_t mapIdx,
+            size_t /* window */,
+            const flow_key* keys,
+            const real_pos_lru* values,
+            uint32_t count) { accountEntries(mapIdx, keys, values, count); },
+        maxEntriesPerMap);
+    if (!sample.error.empty()) {
+      resp.error = sample.error;
+    }
+    resp.sampled = true;
+    double totalBuckets = 0;
+    double sampledBuckets = 0;
+    for (size_t m = 0; m < numMaps; m++) {
+      double mapSampled = 0;
+      for (const auto& window : sample.windows[m]) {
+        mapSampled += window.buckets;
+      }
+      mapWeights[m] =
+          mapSampled > 0 ? sample.totalBuckets[m] / mapSampled : 0;
+      totalBuckets += sample.totalBuckets[m];
+      sampledBuckets += mapSampled;
+    }
+    resp.sampledFraction =
+        totalBuckets > 0 ? std::min(1.0, sampledBuckets / totalBuckets) : 1.0;
+  } else {
+    // w/o batch operations random access to lru is not possible
+    auto scanResult = scanner.scan(accountEntries);
+    if (!scanResult.error.empty()) {
+      resp.error = scanResult.error;
+    }
   }
 
+  for (size_t v = 0; v < affectedVips.size(); v++) {
+    auto& stats = resp.vips[v];
+    double flows = 0;
+    double moved = 0;
+    folly::F14FastMap<std::string, std::array<double, 4>> realFlows;
+    for (size_t m = 0; m < numMaps; m++) {
+      const auto* counters = remapCounter.getCounters(m, affectedVips[v]);
+      if (!counters) {
+        continue;
+      }
+      double weight = mapWeights[m];
+      flows += counters->flows * weight;
+      moved += counters->moved * weight;
+      for (const auto& [num, cnt] : counters->before) {
+        realFlows[realName(num)][0] += cnt * weight;
+      }
+      for (const auto& [num, cnt] : counters->after) {
+        realFlows[realName(num)][1] += cnt * weight;
+      }
+      for (const auto& [num, cnt] : counters->movedOut) {
+        realFlows[realName(num)][2] += cnt * weight;
+      }
+      for (const auto& [num, cnt] : counters->movedIn) {
+        realFlows[realName(num)][3] += cnt * weight;
+      }
+    }
+    stats.flows = std::llround(flows);
+    stats.flowsMoved = std::llround(moved);
+    for (const auto& [name, values] : realFlows) {
+      auto& realStats = stats.reals[name];
+      realStats.flowsBefore = std::llround(values[0]);
+      realStats.flowsAfter = std::llround(values[1]);
+      realStats.flowsMovedOut = std::llround(values[2]);
+      realStats.flowsMovedIn = std::llround(values[3]);
+    }
+    for (auto& [name, realStats] : stats.reals) {
+      realStats.real = name;
+      resp.reals[name].real = name;
+      resp.reals[name].add(realStats);
+    }
+  }
+  return resp;
+}
+
+void KatranLb::finalizeLruStats(
+    std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash>& perVipStats,
+    std::string& error) {
   // Populate human readable vip 3-tuple
-  for (const auto& [vipKey, _] : vips_) {
+  for (const auto& [compactKey, _] : vips_) {
+    auto vipKey = compactKey.toVipKey();
     auto maybeFlowKey = flowKeyFromParams(vipKey, "::0", 0);
     if (!maybeFlowKey) {
       LOG(ERROR) << "invalid vips_ key";
-      resp.error = "invalid vips_ key";
+      error = "invalid vips_ key";
       continue;
     }
     LruVipKey lruVipKey;
@@ -2408,8 +4227,8 @@ KatranLb::LruStatsResponse KatranLb::analyzeLru() {
     lruVipKey.dstv6[1] = maybeFlowKey->dstv6[1];
     lruVipKey.dstv6[2] = maybeFlowKey->dstv6[2];
     lruVipKey.dstv6[3] = maybeFlowKey->dstv6[3];
-    auto vipStatsIt = resp.perVipStats.find(lruVipKey);
-    if (vipStatsIt == resp.perVipStats.end()) {
+    auto vipStatsIt = perVipStats.find(lruVipKey);
+    if (vipStatsIt == perVipStats.end()) {
       continue;
     }
     vipStatsIt->second.vip =
@@ -2418,7 +4237,7 @@ KatranLb::LruStatsResponse KatranLb::analyzeLru() {
   // We have VIPs with wildcard ports, such VipKey entries don't match any
   // existing VIPs above. Aggregate separate entries at IP level, ignoring port.
   std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash> aggregateVipStats;
-  for (const auto& [vipKey, vipStats] : resp.perVipStats) {
+  for (const auto& [vipKey, vipStats] : perVipStats) {
     if (!vipStats.vip.empty()) {
       continue;
     }
@@ -2426,17 +4245,17 @@ KatranLb::LruStatsResponse KatranLb::analyzeLru() {
     aggVipKey.port = 0;
     aggregateVipStats[aggVipKey].add(vipStats);
   }
-  for (auto it = resp.perVipStats.begin(); it != resp.perVipStats.end();) {
+  for (auto it = perVipStats.begin(); it != perVipStats.end();) {
     if (it->second.vip.empty()) {
-      it = resp.perVipStats.erase(it);
+      it = perVipStats.erase(it);
     } else {
       it++;
     }
   }
   for (auto& [vipKey, vipStats] : aggregateVipStats) {
-    resp.perVipStats[vipKey].add(vipStats);
-    if (resp.perVipStats[vipKey].vip.empty()) {
-      resp.perVipStats[vipKey].vip = fmt::format(
+    perVipStats[vipKey].add(vipStats);
+    if (perVipStats[vipKey].vip.empty()) {
+      perVipStats[vipKey].vip = fmt::format(
           "agg-{:x},{:x},{:x},{:x}-{}",
           vipKey.dstv6[0],
           vipKey.dstv6[1],
@@ -2445,8 +4264,6 @@ KatranLb::LruStatsResponse KatranLb::analyzeLru() {
           vipKey.proto);
     }
   }
-
-  return resp;
 }
 
 KatranLb::LruEntries KatranLb::searchLru(
@@ -2647,75 +4464,43 @@ bool KatranLb::listLruMap(
   return true;
 }
 
-void KatranLb::analyzeLruMap(int mapFd, LruStatsResponse& lruStats) {
-  int64_t currentTimeNs = BpfAdapter::getKtimeNs();
-
-  real_pos_lru real = {};
+void KatranLb::accountLruEntry(
+    const flow_key& key,
+    const real_pos_lru& real,
+    int64_t currentTimeNs,
+    LruStatsResponse& lruStats) {
+  LruVipKey vipKey;
+  vipKey.proto = key.proto;
+  vipKey.port = key.port16[1];
+  vipKey.dstv6[0] = key.dstv6[0];
+  vipKey.dstv6[1] = key.dstv6[1];
+  vipKey.dstv6[2] = key.dstv6[2];
+  vipKey.dstv6[3] = key.dstv6[3];
 
-  flow_key key;
-  flow_key nextKey;
-  memset(&key, 0, sizeof(key));
-  memset(&nextKey, 0, sizeof(nextKey));
+  VipLruStats& stats = lruStats.perVipStats[vipKey];
 
-  for (int i = 0; i < kLruMaxLookups; i++) {
-    int nextKeyRes = bpfAdapter_->bpfMapGetNextKey(mapFd, &key, &nextKey);
-    // First lookup has empty key
-    if (i != 0) {
-      int lookupRes = bpfAdapter_->bpfMapLookupElement(mapFd, &key, &real);
-      if (lookupRes == 0) {
-        LruVipKey vipKey;
-        vipKey.proto = key.proto;
-        vipKey.port = key.port16[1];
-        vipKey.dstv6[0] = key.dstv6[0];
-        vipKey.dstv6[1] = key.dstv6[1];
-        vipKey.dstv6[2] = key.dstv6[2];
-        vipKey.dstv6[3] = key.dstv6[3];
-
-        VipLruStats& stats = lruStats.perVipStats[vipKey];
-
-        stats.count++;
-        if (real.pos == 0) {
-          stats.staleRealsCount++;
-          LOG(ERROR) << "Real position is 0";
-        } else {
-          auto realIt = numToReals_.find(real.pos);
-          if (realIt == numToReals_.end()) {
-            LOG(ERROR) << "Real with num " << real.pos << " not found";
-            stats.staleRealsCount++;
-          }
-        }
-        if (real.atime == 0) {
-          stats.atimeZeroCount++;
-        } else {
-          int deltaSec = (currentTimeNs - real.atime) / 1000000000;
-          if (deltaSec < 30) {
-            stats.atimeUnder30secCount++;
-          } else if (deltaSec < 60) {
-            stats.atime30to60secCount++;
-          } else {
-            stats.atimeOver60secCount++;
-          }
-        }
-      } else {
-        LOG(ERROR) << "Error while querying lru map, error=" << lookupRes;
-        lruStats.error = "lookup error";
-      }
-    }
-    if (nextKeyRes != 0) {
-      if (nextKeyRes == -ENOENT) {
-        // ENOENT is returned when last entry in the map is reached
-        return;
-      } else {
-        LOG(ERROR) << "Error while querying lru map, error=" << nextKeyRes;
-        lruStats.error = "query error";
-        return;
-      }
+  stats.count++;
+  if (real.pos == 0) {
+    stats.staleRealsCount++;
+    LOG(ERROR) << "Real position is 0";
+  } else {
+    auto realIt = numToReals_.find(real.pos);
+    if (realIt == numToReals_.end()) {
+      LOG(ERROR) << "Real with num " << real.pos << " not found";
+      stats.staleRealsCount++;
     }
-    if (i == kLruMaxLookups - 1) {
-      LOG(ERROR) << "Max lookups reached";
-      lruStats.error = "maxed lookups";
+  }
+  if (real.atime == 0) {
+    stats.atimeZeroCount++;
+  } else {
+    int deltaSec = (currentTimeNs - real.atime) / 1000000000;
+    if (deltaSec < 30) {
+      stats.atimeUnder30secCount++;
+    } else if (deltaSec < 60) {
+      stats.atime30to60secCount++;
+    } else {
+      stats.atimeOver60secCount++;
     }
-    key = nextKey;
   }
 }
 
@@ -2798,7 +4583,9 @@ std::vector<std::string> KatranLb::deleteLru(
   return mapsWithDeletions;
 }
 
-KatranLb::PurgeResponse KatranLb::purgeVipLru(const VipKey& dstVip) {
+KatranLb::PurgeResponse KatranLb::purgeVipLru(
+    const VipKey& dstVip,
+    LruScanControl* control) {
   PurgeResponse response;
   // we only need dst values, setting src to dummy values
   auto maybeKey = flowKeyFromParams(dstVip, "::0", 0);
@@ -2806,153 +4593,18 @@ KatranLb::PurgeResponse KatranLb::purgeVipLru(const VipKey& dstVip) {
     response.error = "invalid vip address";
     return response;
   }
-  flow_key filterKey = *maybeKey;
-  for (int cpu = 0; cpu < lruMapsFd_.size(); cpu++) {
-    int mapFd = lruMapsFd_[cpu];
-    if (mapFd <= 0) {
-      continue;
-    }
-    auto mapResp = purgeVipLruMap(mapFd, filterKey);
-    response.deletedCount += mapResp.deletedCount;
-    if (!mapResp.error.empty()) {
-      response.error = mapResp.error;
-    }
-  }
-  int fallbackMapFd = bpfAdapter_->getMapFdByName("fallback_cache");
-  if (fallbackMapFd > 0) {
-    auto mapResp = purgeVipLruMap(fallbackMapFd, filterKey);
-    response.deletedCount += mapResp.deletedCount;
-    if (!mapResp.error.empty()) {
-      response.error = mapResp.error;
-    }
-  } else {
-    LOG(ERROR) << "LRU fallback cache map not found";
-  }
-  return response;
-}
-
-KatranLb::PurgeResponse KatranLb::purgeVipLruMap(
-    int mapFd,
-    const flow_key& filter) {
-  PurgeResponse response;
-
-  flow_key key;
-  flow_key nextKey;
-  memset(&key, 0, sizeof(key));
-  memset(&nextKey, 0, sizeof(nextKey));
-
-  for (int i = 0; i < kLruMaxLookups; i++) {
-    int lookupRes = bpfAdapter_->bpfMapGetNextKey(mapFd, &key, &nextKey);
-    // First lookup has empty key
-    if (i != 0) {
-      if (key.proto == filter.proto && key.port16[1] == filter.port16[1] &&
-          key.dstv6[0] == filter.dstv6[0] && key.dstv6[1] == filter.dstv6[1] &&
-          key.dstv6[2] == filter.dstv6[2] && key.dstv6[3] == filter.dstv6[3]) {
-        // dst of the key matches the filter
-        int delRes = bpfAdapter_->bpfMapDeleteElement(mapFd, &key);
-        if (delRes != 0) {
-          LOG(ERROR) << "Error while deleting lru map: " << delRes;
-          response.error = "delete error";
-        } else {
-          response.deletedCount++;
-        }
-      }
-    }
-    if (lookupRes != 0) {
-      if (lookupRes == -ENOENT) {
-        // ENOENT is returned when last entry in the map is reached
-        return response;
-      } else {
-        LOG(ERROR) << "Error while querying lru map, error=" << lookupRes;
-        response.error = "query error";
-        return response;
-      }
-    }
-    if (i == kLruMaxLookups - 1) {
-      LOG(ERROR) << "Max lookups reached";
-      response.error = "maxed lookups";
-    }
-    key = nextKey;
-  }
-  return response;
-}
-
-KatranLb::PurgeResponse KatranLb::purgeVipLruMapForReal(
-    int mapFd,
-    const flow_key& filter,
-    uint32_t realPos) {
-  PurgeResponse response;
-  if (bpfAdapter_->isBatchOpsEnabled()) {
-    std::unordered_set<flow_key, FlowKeyHash> keysToDelete;
-    std::unordered_map<flow_key, std::vector<real_pos_lru>, FlowKeyHash>
-        foundMap;
-    auto readRes = BpfBatchUtil::bpfMapReadBatch(mapFd, foundMap);
-    if (readRes) {
-      LOG(ERROR) << "Error while reading lru map: " << readRes;
-      response.error = "read error";
-      return response;
-    }
-    for (auto& [key, value] : foundMap) {
-      if (key.proto == filter.proto && key.port16[1] == filter.port16[1] &&
-          key.dstv6[0] == filter.dstv6[0] && key.dstv6[1] == filter.dstv6[1] &&
-          key.dstv6[2] == filter.dstv6[2] && key.dstv6[3] == filter.dstv6[3]) {
-        // for a single cpu map we only care about the first value
-        auto pos = value[0].pos;
-        if (pos == realPos) {
-          keysToDelete.insert(key);
-        }
-      }
-    }
-    int deleteRes = BpfBatchUtil::bpfMapDeleteBatch(mapFd, keysToDelete);
-    if (deleteRes != 0) {
-      LOG(ERROR) << "Error while batch deleting from lru map: " << deleteRes;
-      response.error = "batch delete error";
-    } else {
-      response.deletedCount = keysToDelete.size();
-    }
-  } else {
-    flow_key key;
-    flow_key nextKey;
-    real_pos_lru value;
-    memset(&key, 0, sizeof(key));
-    memset(&nextKey, 0, sizeof(nextKey));
-    for (int i = 0; i < kLruMaxLookups; i++) {
-      int lookupRes = bpfAdapter_->bpfMapGetNextKey(mapFd, &key, &nextKey);
-      if (i != 0 && key.proto == filter.proto &&
-          key.port16[1] == filter.port16[1] &&
-          key.dstv6[0] == filter.dstv6[0] && key.dstv6[1] == filter.dstv6[1] &&
-          key.dstv6[2] == filter.dstv6[2] && key.dstv6[3] == filter.dstv6[3]) {
-        int valueRes = bpfAdapter_->bpfMapLookupElement(mapFd, &key, &value);
-        if (valueRes == 0 && value.pos == realPos) {
-          int delRes = bpfAdapter_->bpfMapDeleteElement(mapFd, &key);
-          if (delRes != 0) {
-            LOG(ERROR) << "Error while deleting lru map: " << delRes;
-            response.error = "delete error";
-          } else {
-            response.deletedCount++;
-          }
-        }
-      }
-      if (lookupRes != 0) {
-        if (lookupRes == -ENOENT) {
-          // ENOENT is returned when last entry in the map is reached
-          break;
-        } else {
-          LOG(ERROR) << "Error while querying lru map, error=" << lookupRes;
-          response.error = "query error";
-          return response;
-        }
-      }
-      key = nextKey;
-    }
-  }
-
-  return response;
+  flow_key filter = *maybeKey;
+  return purgeLruMaps(
+      [filter](const flow_key& key, const real_pos_lru&) {
+        return lruKeyMatchesVip(key, filter);
+      },
+      control);
 }
 
 KatranLb::PurgeResponse KatranLb::purgeVipLruForReal(
     const VipKey& dstVip,
-    uint32_t realPos) {
+    uint32_t realPos,
+    LruScanControl* control) {
   PurgeResponse response;
   // we only need dst values, setting src to dummy values
   auto maybeKey = flowKeyFromParams(dstVip, "::0", 0);
@@ -2960,28 +4612,45 @@ KatranLb::PurgeResponse KatranLb::purgeVipLruForReal(
     response.error = "invalid vip address";
     return response;
   }
-  flow_key filterKey = *maybeKey;
+  flow_key filter = *maybeKey;
+  return purgeLruMaps(
+      [filter, realPos](const flow_key& key, const real_pos_lru& value) {
+        return value.pos == realPos && lruKeyMatchesVip(key, filter);
+      },
+      control);
+}
+
+bool KatranLb::lruKeyMatchesVip(const flow_key& key, const flow_key& filter) {
+  return key.proto == filter.proto && key.port16[1] == filter.port16[1] &&
+      key.dstv6[0] == filter.dstv6[0] && key.dstv6[1] == filter.dstv6[1] &&
+      key.dstv6[2] == filter.dstv6[2] && key.dstv6[3] == filter.dstv6[3];
+}
+
+KatranLb::PurgeResponse KatranLb::purgeLruMaps(
+    const std::function<bool(const flow_key&, const real_pos_lru&)>& predicate,
+    LruScanControl* control) {
+  PurgeResponse response;
+  std::vector<int> mapFds;
   for (int cpu = 0; cpu < lruMapsFd_.size(); cpu++) {
-    int mapFd = lruMapsFd_[cpu];
-    if (mapFd <= 0) {
-      continue;
-    }
-    auto mapResp = purgeVipLruMapForReal(mapFd, filterKey, realPos);
-    response.deletedCount += mapResp.deletedCount;
-    if (!mapResp.error.empty()) {
-      response.error = mapResp.error;
+    if (lruMapsFd_[cpu] > 0) {
+      mapFds.push_back(lruMapsFd_[cpu]);
     }
   }
   int fallbackMapFd = bpfAdapter_->getMapFdByName(KatranLbMaps::fallback_cache);
   if (fallbackMapFd > 0) {
-    auto mapResp = purgeVipLruMapForReal(fallbackMapFd, filterKey, realPos);
-    response.deletedCount += mapResp.deletedCount;
-    if (!mapResp.error.empty()) {
-      response.error = mapResp.error;
-    }
+    mapFds.push_back(fallbackMapFd);
   } else {
     LOG(ERROR) << "LRU fallback cache map not found";
   }
+  LruScanner scanner(
+      std::move(mapFds), bpfAdapter_->isBatchOpsEnabled(), 0, control);
+  auto result = scanner.purge(
+      [&predicate](
+          size_t, const flow_key& key, const real_pos_lru& value) {
+        return predicate(key, value);
+      });
+  response.deletedCount = result.deleted;
+  response.error = result.error;
   return response;
 }
 
@@ -2991,8 +4660,13 @@ bool KatranLb::updateVipMap(
     vip_meta* meta) {
   vip_definition vip_def = vipKeyToVipDefinition(vip);
   if (action == ModifyAction::ADD) {
+    // family is stored along w/ vip, so it could be restored unambiguously
+    vip_meta fwMeta = *meta;
+    if (folly::IPAddress(vip.address).isV6()) {
+      fwMeta.flags |= kVipFlagV6;
+    }
     auto res = bpfAdapter_->bpfUpdateMap(
-        bpfAdapter_->getMapFdByName(KatranLbMaps::vip_map), &vip_def, meta);
+        bpfAdapter_->getMapFdByName(KatranLbMaps::vip_map), &vip_def, &fwMeta);
     if (res != 0) {
       LOG(ERROR) << "can't add new element into vip_map, error: "
                  << folly::errnoStr(errno);
@@ -3060,7 +4734,9 @@ bool KatranLb::updateRealsMap(
   }
 };
 
-void KatranLb::decreaseRefCountForReal(const folly::IPAddress& real) {
+void KatranLb::decreaseRefCountForReal(
+    const folly::IPAddress& real,
+    std::vector<uint32_t>* releasedNums) {
   auto real_iter = reals_.find(real);
   if (real_iter == reals_.end()) {
     return;
@@ -3069,7 +4745,11 @@ void KatranLb::decreaseRefCountForReal(const folly::IPAddress& real) {
   if (real_iter->second.refCount == 0) {
     auto num = real_iter->second.num;
     // no more vips using this real
-    realNums_.push_back(num);
+    if (releasedNums) {
+      releasedNums->push_back(num);
+    } else {
+      realNums_.push_back(num);
+    }
     reals_.erase(real_iter);
     numToReals_.erase(num);
 
@@ -3217,7 +4897,7 @@ std::vector<int> KatranLb::getGlobalLruMapsFds() {
 }
 
 lb_stats KatranLb::getSidRoutingStatsForVip(const VipKey& vip) {
-  auto vip_iter = vips_.find(vip);
+  auto vip_iter = vips_.find(CompactVipKey(vip));
   if (vip_iter == vips_.end()) {
     VLOG(1) << fmt::format(
         "trying to get sid routing stats for non-existing vip  {}:{}:{}",
@@ -3281,7 +4961,7 @@ bool KatranLb::addDownRealToVipToDownRealsMap(
     uint32_t realIndex) {
   VLOG(3) << "Adding real " << realIndex << " to down reals map for vip "
           << vip.address << " - " << vip.port << " - " << vip.proto;
-  auto vipIter = vips_.find(vip);
+  auto vipIter = vips_.find(CompactVipKey(vip));
   if (vipIter == vips_.end()) {
     LOG(ERROR) << "Trying to set state for non-existing vip";
     return false;
@@ -3366,7 +5046,7 @@ bool KatranLb::addDownRealToVipToDownRealsMap(
 bool KatranLb::checkRealFromVipToDownRealsMap(
     const VipKey& vip,
     uint32_t realIndex) {
-  auto vipIter = vips_.find(vip);
+  auto vipIter = vips_.find(CompactVipKey(vip));
   if (vipIter == vips_.end()) {
     LOG(ERROR) << "Trying to check for non-existing vip";
     return false;
@@ -3423,7 +5103,7 @@ bool KatranLb::checkRealFromVipToDownRealsMap(
 }
 
 bool KatranLb::removeVipFromVipToDownRealsMap(const VipKey& vip) {
-  auto vipIter = vips_.find(vip);
+  auto vipIter = vips_.find(CompactVipKey(vip));
   if (vipIter == vips_.end()) {
     LOG(ERROR) << "Trying to remove non-existing vip from state map";
     return false;
@@ -3457,7 +5137,7 @@ bool KatranLb::removeRealFromVipToDownRealsMap(
   VLOG(3) << "Removing real " << realIndex << " from vip " << vip.address << ":"
           << vip.port << " vip proto: " << vip.proto << " from "
           << "vip_to_down_reals_map";
-  auto vipIter = vips_.find(vip);
+  auto vipIter = vips_.find(CompactVipKey(vip));
   if (vipIter == vips_.end()) {
     LOG(ERROR) << "Trying to remove real from non-existing vip";
     return false;
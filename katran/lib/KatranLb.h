@@ -16,8 +16,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <deque>
+#include <functional>
+#include <iosfwd>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -31,9 +34,13 @@
 #include "katran/lib/BaseBpfAdapter.h"
 #include "katran/lib/BpfAdapter.h"
 #include "katran/lib/CHHelpers.h"
+#include "katran/lib/CompactVipKey.h"
 #include "katran/lib/IpHelpers.h"
 #include "katran/lib/KatranLbStructs.h"
+#include "katran/lib/KatranShadowDataPlane.h"
 #include "katran/lib/KatranSimulator.h"
+#include "katran/lib/KatranStatsEngine.h"
+#include "katran/lib/LruScanner.h"
 #include "katran/lib/MonitoringStructs.h"
 #include "katran/lib/Vip.h"
 
@@ -78,6 +85,8 @@ constexpr uint32_t kXdpPassOffset = 19;
  * LRU map related constants
  */
 constexpr int kFallbackLruSize = 1024;
+// default number of entries sampled from each per-cpu lru by estimateLru
+constexpr uint32_t kDefaultLruSampleSize = 16 * 1024;
 constexpr int kMapNoFlags = 0;
 constexpr int kNoNuma = -1;
 
@@ -108,7 +117,9 @@ namespace KatranLbMaps {
 constexpr auto ch_rings = "ch_rings";
 constexpr auto ctl_array = "ctl_array";
 constexpr auto decap_dst = "decap_dst";
+constexpr auto decap_vip_stats = "decap_vip_stats";
 constexpr auto event_pipe = "event_pipe";
+constexpr auto event_filters = "event_filters";
 constexpr auto fallback_cache = "fallback_cache";
 constexpr auto fallback_glru = "fallback_glru";
 constexpr auto flow_debug_lru = "flow_debug_lru";
@@ -123,13 +134,19 @@ constexpr auto hc_reals_map = "hc_reals_map";
 constexpr auto hc_stats_map = "hc_stats_map";
 constexpr auto katran_lru = "katran_lru";
 constexpr auto lpm_src_v4 = "lpm_src_v4";
+constexpr auto lpm_src_v4_maps = "lpm_src_v4_maps";
+constexpr auto lpm_src_v6 = "lpm_src_v6";
+constexpr auto lpm_src_v6_maps = "lpm_src_v6_maps";
 constexpr auto lru_mapping = "lru_mapping";
 constexpr auto lru_miss_stats = "lru_miss_stats";
 constexpr auto pckt_srcs = "pckt_srcs";
 constexpr auto per_hckey_stats = "per_hckey_stats";
+constexpr auto quic_stats_map = "quic_stats_map";
 constexpr auto reals = "reals";
+constexpr auto reals_stats = "reals_stats";
 constexpr auto server_id_map = "server_id_map";
 constexpr auto stats = "stats";
+constexpr auto tpr_stats_map = "tpr_stats_map";
 constexpr auto vip_map = "vip_map";
 constexpr auto vip_miss_stats = "vip_miss_stats";
 constexpr auto vip_to_down_reals_map = "vip_to_down_reals_map";
@@ -192,6 +209,42 @@ class KatranLb {
       const std::string& path,
       std::optional<KatranConfig> config = std::nullopt);
 
+  struct ProgUpgradeResponse {
+    bool upgraded{false};
+    uint32_t flowsTested{0};
+    // test flows, which were routed differently by current and new programs
+    std::vector<std::string> mismatches;
+    std::vector<std::string> errors;
+  };
+
+  /**
+   * @param string path to new version of balancer's bpf object
+   * @param vector<KatranFlow> testFlows flows to run through both programs
+   * @return ProgUpgradeResponse result of the upgrade
+   *
+   * helper function for zero downtime upgrade of balancer program. new
+   * program is loaded next to the current one and reuses all of its maps
+   * (including per cpu lrus, so established flows stay on theirs reals).
+   * maps compatibility is verified w/ BTF. then every test flow is run
+   * through both programs (w/ BPF_PROG_TEST_RUN) and routing decisions are
+   * compared. only if all of them match, new program atomically replaces
+   * current one (in xdp root's prog array or as attached xdp program).
+   * replaced program stays loaded for rollbackBalancerProg().
+   * lru entries of test flows are removed, so they must not be used by
+   * real clients
+   */
+  ProgUpgradeResponse upgradeBalancerProg(
+      const std::string& path,
+      const std::vector<KatranFlow>& testFlows);
+
+  /**
+   * @return true on success
+   *
+   * helper function to switch back to balancer program, which has been
+   * replaced by the last successful upgradeBalancerProg()
+   */
+  bool rollbackBalancerProg();
+
   /**
    * helper function to attach bpf program (e.g. to rootlet array,
    * driver or into tc qdisc)
@@ -338,22 +391,89 @@ class KatranLb {
    * helper function to add or delete reals for specified vip in batch
    * could throw if we will try to add real with address, which can't be
    * parsed to v4 or v6
+   * if realsUpdateCoalesceWindowMs is set in config, changes are merged into
+   * vip's pending set and applied later (see flushPendingRealsUpdates)
    */
   bool modifyRealsForVip(
       const ModifyAction action,
       const std::vector<NewReal>& reals,
       const VipKey& vip);
 
+  /**
+   * @param ModifyAction action. either ADD or DEL
+   * @param std::vector<NewReal> reals to be modified
+   * @param VipKey vip for which we are going to modify specified reals
+   * @param std::vector<RealPos> chPositions changed positions of vip's ch ring
+   * @param uint32_t vipNum internal index of the vip
+   * @param std::vector<uint32_t> releasedNums indexes of reals, which are not
+   * used anymore. they could still be in ch ring, which is programmed in
+   * forwarding plane, so they are not reused until releaseRealNums is called
+   * @return true on success
+   *
+   * first half of modifyRealsForVip: updates vip's reals and recalculates its
+   * ch ring, but does not program it into forwarding plane (see
+   * writeHashRing). coalescing of reals' updates is not applied
+   */
+  bool computeRealsForVip(
+      const ModifyAction action,
+      const std::vector<NewReal>& reals,
+      const VipKey& vip,
+      std::vector<RealPos>& chPositions,
+      uint32_t& vipNum,
+      std::vector<uint32_t>& releasedNums);
+
+  /**
+   * @param std::vector<uint32_t> nums indexes of reals from computeRealsForVip
+   *
+   * returns indexes of deleted reals into the pool. must be called only after
+   * ch ring, which has been computed together w/ them, is written into
+   * forwarding plane (see writeHashRing)
+   */
+  void releaseRealNums(const std::vector<uint32_t>& nums);
+
+  /**
+   * @param std::vector<RealPos> chPositions positions of ch ring to update
+   * @param uint32_t vipNum internal index of the vip
+   * @return true on success
+   *
+   * second half of modifyRealsForVip: programs ch ring's positions into
+   * forwarding plane. does not touch katran's internal state, so it could be
+   * called from other thread, while next ring is being computed
+   */
+  bool writeHashRing(
+      const std::vector<RealPos>& chPositions,
+      const uint32_t vipNum) const;
+
   /**
    * @param VipKey vip to get reals from
    * @return std::vector<NewReal> currently configured reals for vip
    *
    * helper function, which returns currently configured reals for vip
-   * and theirs weight
+   * and theirs weight. pending (coalesced) changes are not included
    * could throw if specified vip doesn't exist
    */
   std::vector<NewReal> getRealsForVip(const VipKey& vip);
 
+  /**
+   * @param bool force if true - apply all pending changes, even if theirs
+   * coalescing window has not expired yet
+   * @return uint32_t number of vips for which pending changes were applied
+   *
+   * helper function to apply coalesced reals' changes. each vip's pending set
+   * is applied w/ single ch ring recalculation and single ch_rings update.
+   * modifyRealsForVip calls it on its own, but if coalescing is enabled it
+   * must also be called periodically (e.g. from the timer which drives
+   * healthchecks), so the last changes are applied once the window expires
+   */
+  uint32_t flushPendingRealsUpdates(bool force = false);
+
+  /**
+   * @return uint32_t number of vips w/ not yet applied reals' changes
+   */
+  uint32_t getNumPendingRealsUpdates() const {
+    return pendingRealsUpdates_.size();
+  }
+
   /**
    * @param string address of the real
    * @return int64_t internal index of the real. -1 if does not exists
@@ -405,6 +525,53 @@ class KatranLb {
       const std::vector<folly::CIDRNetwork>& srcs,
       const std::string& dst);
 
+  /**
+   * @param vector<pair<string, string>> of (source prefix, dst) rules
+   * @param bool replace if true - rules would replace all existing ones
+   * @param uint32_t numThreads number of threads to parse rules with;
+   * 0 means number of available cores
+   * @return int 0 on success, number of errors otherwise. kError if
+   * forwarding plane could not be updated; rules are left intact in this case
+   *
+   * helper function to load large amount of src routing rules. rules are
+   * validated and encoded in parallel and pushed to forwarding plane with
+   * batch updates. if replace is set and forwarding plane supports shadow lpm
+   * maps, new table is built in separate trie and swapped in atomically.
+   * otherwise new rules are written first and stale ones are removed after.
+   * if the same prefix is specified more than once - last rule wins
+   */
+  int addSrcRoutingRulesBulk(
+      const std::vector<std::pair<std::string, std::string>>& rules,
+      bool replace = false,
+      uint32_t numThreads = 0);
+
+  /**
+   * @param istream& stream with "<src prefix> <dst>" rule per line
+   * @param bool replace if true - rules would replace all existing ones
+   * @param uint32_t numThreads number of threads to parse rules with
+   * @return int 0 on success, number of errors otherwise
+   *
+   * helper function to bulk load src routing rules from a stream. empty
+   * lines and lines starting with '#' are ignored
+   */
+  int loadSrcRoutingRules(
+      std::istream& input,
+      bool replace = false,
+      uint32_t numThreads = 0);
+
+  /**
+   * @param string path to file with "<src prefix> <dst>" rule per line
+   * @param bool replace if true - rules would replace all existing ones
+   * @param uint32_t numThreads number of threads to parse rules with
+   * @return int 0 on success, number of errors otherwise
+   *
+   * helper function to bulk load src routing rules from a file
+   */
+  int loadSrcRoutingRulesFromFile(
+      const std::string& path,
+      bool replace = false,
+      uint32_t numThreads = 0);
+
   /**
    * @param vector<string> of source prefixes
    * @return bool true if there was no fatal errors
@@ -810,6 +977,26 @@ class KatranLb {
   std::unique_ptr<folly::IOBuf> getKatranMonitorEventBuffer(
       monitoring::EventId event);
 
+  /**
+   * @param monitoring::EventId event monitoring event id
+   * @param EventFilterConfig filter sampling rate and filters for the event
+   * @return false if introspection is not enabled or filter is invalid
+   *
+   * if katran introspection is enabled: set in kernel filter for the event.
+   * see KatranMonitor::setEventFilter
+   */
+  bool setKatranMonitorEventFilter(
+      monitoring::EventId event,
+      const EventFilterConfig& filter);
+
+  /**
+   * @param monitoring::EventId event monitoring event id
+   * @return EventFilterConfig current filter of the event. nullopt if
+   * introspection is not enabled or forwarding plane does not have filters
+   */
+  std::optional<EventFilterConfig> getKatranMonitorEventFilter(
+      monitoring::EventId event);
+
   /**
    * @return KatranMonitorStats stats from katran monitor
    *
@@ -833,6 +1020,30 @@ class KatranLb {
    */
   HealthCheckProgStats getStatsForHealthCheckProgram();
 
+  /**
+   * @param milliseconds interval how often counters are going to be polled
+   * @return bool true on success
+   *
+   * helper function to start background polling of forwarding plane's
+   * counters. while it is running, vip/real/global stats getters are served
+   * from the latest snapshot w/o any syscalls. must not be called
+   * concurrently w/ other katran's methods
+   */
+  bool startStatsEngine(
+      std::chrono::milliseconds interval = kDefaultStatsPollInterval);
+
+  /**
+   * helper function to stop background polling of counters. getters fall
+   * back to direct lookups in forwarding plane
+   */
+  void stopStatsEngine();
+
+  /**
+   * @return latest snapshot of forwarding plane's counters (w/ pps/bps
+   * rates) or nullptr if stats engine is not running
+   */
+  std::shared_ptr<const KatranStatsSnapshot> getStatsSnapshot() const;
+
   /**
    * @param map string name of the bpf map
    * @return KatranBpfMapStats struct holding the max and current entry count
@@ -862,6 +1073,29 @@ class KatranLb {
    */
   const std::string getRealForFlow(const KatranFlow& flow);
 
+  /**
+   * @param vector<KatranFlow> flows 5 tuples which describe flows
+   * @return vector<string> address of the real for each of the flows, in the
+   * same order. empty string for flows which do not belong to a configured
+   * vip (or for all of them if simulator can't be initialized)
+   *
+   * batch version of getRealForFlow, which simulates flows in parallel
+   */
+  std::vector<std::string> getRealsForFlows(
+      const std::vector<KatranFlow>& flows);
+
+  /**
+   * @return unique_ptr<KatranShadowDataPlane> userspace replica of forwarding
+   * plane's routing decision, built from current vips, ch rings, reals and
+   * src routing rules
+   *
+   * helper function to answer flow placement queries w/o bpf program (e.g.
+   * offline or for millions of flows). shadow is a copy, so it must be
+   * recreated after configuration changes. see KatranShadowDataPlane.h for
+   * what is (and is not) replicated
+   */
+  std::unique_ptr<KatranShadowDataPlane> getShadowDataPlane();
+
   struct LruEntry {
     std::string realAddress;
     uint32_t realPos{0};
@@ -924,6 +1158,14 @@ class KatranLb {
   struct LruStatsResponse {
     std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash> perVipStats;
     std::string error;
+    // true if stats are extrapolated from a sample of lru entries
+    bool sampled{false};
+    // share of lru maps' hash buckets which have been read
+    double sampledFraction{1.0};
+    // bounds of 95% confidence interval for each estimation in perVipStats.
+    // filled only if stats are sampled
+    std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash> perVipStatsLow;
+    std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash> perVipStatsHigh;
   };
 
   /**
@@ -932,7 +1174,98 @@ class KatranLb {
   LruEntries
   searchLru(const VipKey& dstVip, const std::string& srcIp, uint16_t srcPort);
   LruEntries listLru(const VipKey& dstVip, int limit);
-  LruStatsResponse analyzeLru();
+
+  /**
+   * @param LruScanControl* control optional token to track progress of the
+   * scan and to cancel it from another thread
+   * @return LruStatsResponse per vip stats of all per-cpu lru maps
+   *
+   * per-cpu lru maps are scanned in parallel (one worker per map) w/ batch
+   * operations if kernel supports them
+   */
+  LruStatsResponse analyzeLru(LruScanControl* control = nullptr);
+
+  /**
+   * @param uint32_t maxEntriesPerMap max number of entries to read from each
+   * per-cpu lru map
+   * @param LruScanControl* control optional progress/cancellation token
+   * @return LruStatsResponse w/ per vip stats extrapolated from random sample
+   * of lru entries, w/ 95% confidence intervals
+   *
+   * cheap alternative to analyzeLru, which is suitable for periodic polling.
+   * falls back to analyzeLru if kernel does not support batch operations
+   */
+  LruStatsResponse estimateLru(
+      uint32_t maxEntriesPerMap = kDefaultLruSampleSize,
+      LruScanControl* control = nullptr);
+
+  /**
+   * proposed change of vip's reals. same semantic as in modifyRealsForVip
+   */
+  struct RemapChange {
+    ModifyAction action;
+    VipKey vip;
+    std::vector<NewReal> reals;
+  };
+  struct RealRemapStats {
+    std::string real;
+    // estimated number of flows on the real before and after the change
+    int64_t flowsBefore{0};
+    int64_t flowsAfter{0};
+    // estimated number of flows which would leave (or come to) the real
+    int64_t flowsMovedOut{0};
+    int64_t flowsMovedIn{0};
+    // share of ch ring positions (i.e. of new flows) before and after
+    double ringShareBefore{0};
+    double ringShareAfter{0};
+
+    void add(const RealRemapStats& other) {
+      flowsBefore += other.flowsBefore;
+      flowsAfter += other.flowsAfter;
+      flowsMovedOut += other.flowsMovedOut;
+      flowsMovedIn += other.flowsMovedIn;
+    }
+  };
+  struct VipRemapStats {
+    std::string vip;
+    // estimated number of active flows of the vip
+    int64_t flows{0};
+    // estimated number of flows which would be sent to a different real
+    int64_t flowsMoved{0};
+    // share of ch ring positions which would point to a different real
+    double ringChanged{0};
+    // per real stats. key is real's address ("" for flows w/o real)
+    std::unordered_map<std::string, RealRemapStats> reals;
+  };
+  struct RemapResponse {
+    // stats of the vips which are affected by the changes
+    std::vector<VipRemapStats> vips;
+    // per real stats, aggregated across affected vips (flows only)
+    std::unordered_map<std::string, RealRemapStats> reals;
+    // true if flows are extrapolated from a sample of lru entries
+    bool sampled{false};
+    double sampledFraction{1.0};
+    std::string error;
+  };
+
+  /**
+   * @param vector<RemapChange> proposed changes of vips' reals
+   * @param uint32_t maxEntriesPerMap max number of entries to read from each
+   * per-cpu lru map
+   * @param LruScanControl* control optional progress/cancellation token
+   * @return RemapResponse w/ estimation of flows, which would be remapped
+   *
+   * what-if analysis for reals' changes (e.g. before draining a rack). ch
+   * rings for proposed changes are calculated, but not programmed, and
+   * compared against current ones. flow population is sampled from per-cpu
+   * lrus the same way as in estimateLru: each sampled flow is placed on the
+   * new ring and counted as moved if it would land on a different real than
+   * the one it is using now. pending (coalesced) reals updates are ignored
+   */
+  RemapResponse analyzeRemap(
+      const std::vector<RemapChange>& changes,
+      uint32_t maxEntriesPerMap = kDefaultLruSampleSize,
+      LruScanControl* control = nullptr);
 
   /*
    * Delete given 5 tuple from all per-CPU and fallback LRU maps.
@@ -945,9 +1278,121 @@ class KatranLb {
     int deletedCount{0};
     std::string error;
   };
-  PurgeResponse purgeVipLru(const VipKey& dstVip);
+  /**
+   * delete all lru entries of the vip (or only ones which point to specified
+   * real) from per-cpu and fallback lru maps. maps are processed in parallel
+   * the same way as in analyzeLru
+   */
+  PurgeResponse purgeVipLru(
+      const VipKey& dstVip,
+      LruScanControl* control = nullptr);
 
-  PurgeResponse purgeVipLruForReal(const VipKey& dstVip, uint32_t realPos);
+  PurgeResponse purgeVipLruForReal(
+      const VipKey& dstVip,
+      uint32_t realPos,
+      LruScanControl* control = nullptr);
+
+  /**
+   * content of forwarding plane's state maps (or of the snapshot). used to
+   * rebuild katran's internal state (e.g. after restart of the control plane)
+   */
+  struct FwStateVip {
+    VipKey vip;
+    uint32_t vipNum{0};
+    uint32_t flags{0};
+    // real's index for each position of ch ring (0 for unset position)
+    std::vector<uint32_t> chRing;
+    // vip's reals w/ their weights. derived from ch ring if not specified
+    std::vector<Endpoint> reals;
+    std::optional<HashFunction> hashFunction;
+  };
+  struct FwStateReal {
+    folly::IPAddress address;
+    uint8_t flags{0};
+  };
+  struct ForwardingState {
+    std::vector<FwStateVip> vips;
+    // real's index to real mapping
+    std::unordered_map<uint32_t, FwStateReal> reals;
+    // server id to real's index mapping
+    std::unordered_map<uint32_t, uint32_t> serverIds;
+    // src prefix to real's index mapping
+    std::unordered_map<folly::CIDRNetwork, uint32_t> srcRouting;
+  };
+  struct RestoreResponse {
+    uint32_t vips{0};
+    uint32_t reals{0};
+    uint32_t serverIds{0};
+    uint32_t srcRoutingRules{0};
+    // inconsistencies which were found (and skipped) during restore
+    std::vector<std::string> errors;
+  };
+
+  /**
+   * @return ForwardingState content of forwarding plane's state maps
+   *
+   * helper function to read vips, reals, ch rings, server ids and src routing
+   * rules back from bpf maps (e.g. pinned by previous instance)
+   */
+  ForwardingState readForwardingState();
+
+  /**
+   * @param ForwardingState state to restore from
+   * @return RestoreResponse w/ number of restored objects and found
+   * inconsistencies
+   *
+   * helper function to rebuild internal state (vips, reals and their indexes,
+   * quic and src routing mappings) from forwarding plane's content. must be
+   * called before anything else is configured. forwarding plane is not
+   * modified: ch rings are restored as is (real's weight is set to number of
+   * its positions in the ring), so only delta against desired config would be
+   * programmed afterwards. inconsistent entries (e.g. ring's position which
+   * points to unknown real) are reported and skipped
+   */
+  RestoreResponse restoreState(const ForwardingState& state);
+
+  /**
+   * helper function to read forwarding plane's state and rebuild internal
+   * state from it
+   */
+  RestoreResponse restoreFromForwardingPlane();
+
+  /**
+   * @param string path where snapshot is going to be stored
+   * @return bool true on success
+   *
+   * helper function to store compact snapshot of vips, reals (w/ their
+   * weights and indexes), ch rings, quic and src routing mappings. format of
+   * the snapshot is described in KatranSnapshot.h
+   */
+  bool saveSnapshot(const std::string& path);
+
+  /**
+   * @return bool true if snapshot has been stored
+   *
+   * helper function to store snapshot into config's snapshotPath, if
+   * snapshotIntervalMs has passed since the previous one. unlike
+   * saveSnapshot, coalesced reals' changes are not forced, so snapshot
+   * matches forwarding plane. must be called periodically (e.g. from the
+   * timer which drives flushPendingRealsUpdates)
+   */
+  bool saveSnapshotIfDue();
+
+  /**
+   * @param string path to the snapshot
+   * @param bool programForwardingPlane if false - forwarding plane is
+   * expected to already contain snapshot's state (e.g. maps are pinned)
+   * @return RestoreResponse w/ number of restored objects and found
+   * inconsistencies
+   *
+   * helper function to restore internal state from snapshot w/o hash ring
+   * recalculation. must be called before anything else is configured.
+   * nothing is restored if snapshot is corrupted or was created w/ different
+   * ch ring size
+   */
+  RestoreResponse loadSnapshot(
+      const std::string& path,
+      bool programForwardingPlane = true);
 
   /**
    * Adds source ip to be used by Katran when it encapsulates packet.
@@ -1145,9 +1590,12 @@ class KatranLb {
 
   /**
    * helper function to decrease real's ref count and delete it from
-   * internal dicts if rec count became zero
+   * internal dicts if rec count became zero. if releasedNums is set - index
+   * of deleted real is appended to it instead of the pool
    */
-  void decreaseRefCountForReal(const folly::IPAddress& real);
+  void decreaseRefCountForReal(
+      const folly::IPAddress& real,
+      std::vector<uint32_t>* releasedNums = nullptr);
 
   /**
    * helper function to add new real or increase ref count for existing one
@@ -1250,6 +1698,25 @@ class KatranLb {
    */
   void featureDiscovering();
 
+  /**
+   * helper function to reuse state maps, which were pinned to
+   * config_.pinnedMapsPath by previous instance. must be called before bpf
+   * program is loaded
+   */
+  void reusePinnedMaps();
+
+  /**
+   * helper function to pin state maps, which were not pinned yet, to
+   * config_.pinnedMapsPath
+   */
+  void pinStateMaps();
+
+  /**
+   * helper function to program whole internal state (reals, vips, ch rings,
+   * quic and src routing mappings) into forwarding plane
+   */
+  void programForwardingPlane();
+
   /**
    * helper function to validate that specified string is a valid ip address
    * (or network prefix if allowNetAddr is equal to true)
@@ -1279,6 +1746,54 @@ class KatranLb {
       const folly::CIDRNetwork& addr,
       void* value);
 
+  /**
+   * helper function which returns fd of lpm map with specified name. if the
+   * map was replaced through map-in-map - fd of currently active trie
+   */
+  int getLpmMapFd(const std::string& mapName);
+
+  /**
+   * helper function to push encoded lpm keys and values into specified map
+   * with batch updates
+   */
+  bool writeLpmMapBatch(
+      int mapFd,
+      void* keys,
+      uint32_t keySize,
+      uint32_t* values,
+      uint32_t count);
+
+  /**
+   * helper function which builds new lpm trie with specified content and
+   * swaps it into single slot outer map. returns false (and keeps current
+   * trie active) on failure. on success prevFd is set to fd of previously
+   * active trie (-1 if it was the map itself), which must be either restored
+   * w/ restoreLpmMap or retired w/ retireLpmMap
+   */
+  bool swapLpmMap(
+      const std::string& mapName,
+      const std::string& outerMapName,
+      void* keys,
+      uint32_t keySize,
+      uint32_t* values,
+      uint32_t count,
+      int& prevFd);
+
+  /**
+   * helper function which makes trie, which was active before swapLpmMap,
+   * active again and releases the swapped in one
+   */
+  void restoreLpmMap(
+      const std::string& mapName,
+      const std::string& outerMapName,
+      int prevFd);
+
+  /**
+   * helper function which releases trie, which was active before swapLpmMap.
+   * if it was the map itself - the map is cleared
+   */
+  void retireLpmMap(const std::string& mapName, uint32_t keySize, int prevFd);
+
   /**
    * helper function to modify inline decap destanations map
    */
@@ -1292,6 +1807,12 @@ class KatranLb {
    */
   bool changeKatranMonitorForwardingState(KatranMonitorState state);
 
+  /**
+   * helper function which describes vips and reals, which could trigger each
+   * of monitored events, in events' pcapng interface description blocks
+   */
+  void annotateMonitorEvents();
+
   /*
    * setupGueEnvironment prepare katran to run w/ GUE encap (e.g. setting up
    * src addresses for outer packets)
@@ -1312,6 +1833,51 @@ class KatranLb {
    */
   void enableRecirculation();
 
+  /**
+   * helper function to validate single real's change for the vip and to
+   * convert it into UpdateReal. adjusts real's ref count. index of deleted
+   * real is appended to releasedNums instead of the pool. returns false if
+   * the change must be skipped
+   */
+  bool prepareRealUpdate(
+      const ModifyAction action,
+      const NewReal& real,
+      const VipKey& vip,
+      std::vector<uint32_t>& curReals,
+      UpdateReal& ureal,
+      std::vector<uint32_t>& releasedNums);
+
+  /**
+   * helper function to store snapshot of current state into specified path
+   */
+  bool writeSnapshot(const std::string& path);
+
+  /**
+   * helper function to merge reals' changes into vip's pending set
+   */
+  void coalesceRealsForVip(
+      const ModifyAction action,
+      const std::vector<NewReal>& reals,
+      const CompactVipKey& vip);
+
+  /**
+   * helper function to discover features of just (re)loaded balancer program
+   * and to set up environment they need
+   */
+  void setupReloadedBalancerProg();
+
+  /**
+   * helper function to atomically replace balancer program in the place,
+   * where katran has attached it
+   */
+  bool swapBalancerProg(int progFd);
+
+  /**
+   * helper function to log server id from invalid quic packet, if it has not
+   * been seen (and logged) before
+   */
+  void logInvalidServerId(uint64_t serverId);
+
   /**
    * program hash ring in forwarding plane
    */
@@ -1331,12 +1897,30 @@ class KatranLb {
       bool isIPv6,
       int limit,
       LruEntries& lruEntries);
-  void analyzeLruMap(int mapFd, LruStatsResponse& lruStats);
+  void accountLruEntry(
+      const flow_key& key,
+      const real_pos_lru& real,
+      int64_t currentTimeNs,
+      LruStatsResponse& lruStats);
 
-  PurgeResponse purgeVipLruMap(int mapFd, const flow_key& key);
+  /**
+   * helper function to delete entries, which match the predicate, from all
+   * per-cpu and fallback lru maps
+   */
+  PurgeResponse purgeLruMaps(
+      const std::function<bool(const flow_key&, const real_pos_lru&)>&
+          predicate,
+      LruScanControl* control);
 
-  PurgeResponse
-  purgeVipLruMapForReal(int mapFd, const flow_key& filter, uint32_t realPos);
+  static bool lruKeyMatchesVip(const flow_key& key, const flow_key& filter);
+
+  /**
+   * helper function to assign human readable names to lru stats and to
+   * aggregate stats of vips w/ wildcard ports
+   */
+  void finalizeLruStats(
+      std::unordered_map<LruVipKey, VipLruStats, LruVipKeyHash>& perVipStats,
+      std::string& error);
 
   static std::optional<flow_key> flowKeyFromParams(
       const VipKey& dstVip,
@@ -1360,6 +1944,11 @@ class KatranLb {
    */
   std::shared_ptr<KatranMonitor> monitor_{nullptr};
 
+  /**
+   * polls forwarding plane's counters in background (if started)
+   */
+  std::unique_ptr<KatranStatsEngine> statsEngine_;
+
   /**
    * vector of unused positions for vips, reals, and hckeys. for each element
    * we are going to pop position's num from the vector. for deleted one -
@@ -1377,34 +1966,71 @@ class KatranLb {
   /**
    * dict of so_mark to real mapping; for healthchecking
    */
-  std::unordered_map<uint32_t, folly::IPAddress> hcReals_;
+  folly::F14FastMap<uint32_t, folly::IPAddress> hcReals_;
 
   folly::F14FastMap<folly::IPAddress, RealMeta> reals_;
 
   /**
    * key: QUIC host id (from CID); value: real IP
    */
-  std::unordered_map<uint32_t, folly::IPAddress> quicMapping_;
+  folly::F14FastMap<uint32_t, folly::IPAddress> quicMapping_;
   /**
    * for reverse real's lookup. get real by num.
    * used when we are going to delete vip and coresponding reals.
    */
   folly::F14FastMap<uint32_t, folly::IPAddress> numToReals_;
 
-  std::unordered_map<VipKey, Vip, VipKeyHasher> vips_;
+  /**
+   * configured vips. keyed by binary vip's representation, so 64k vips do
+   * not require 64k separately allocated nodes w/ strings inside
+   */
+  folly::F14FastMap<CompactVipKey, Vip, CompactVipKeyHasher> vips_;
+
+  struct PendingRealChange {
+    ModifyAction action;
+    NewReal real;
+    // set if change has been cancelled by the later one (e.g. add and then
+    // delete of the real, which is not used by the vip)
+    bool cancelled{false};
+  };
+
+  struct PendingRealsUpdate {
+    // changes in the order of the first appearance of the real
+    std::vector<PendingRealChange> changes;
+    folly::F14FastMap<folly::IPAddress, size_t> positions;
+    std::chrono::steady_clock::time_point firstChange;
+    std::chrono::steady_clock::time_point lastChange;
+  };
+
+  /**
+   * not yet applied (coalesced) reals' changes per vip
+   */
+  folly::F14FastMap<CompactVipKey, PendingRealsUpdate, CompactVipKeyHasher>
+      pendingRealsUpdates_;
+
+  /**
+   * when saveSnapshotIfDue stored the snapshot last time
+   */
+  std::chrono::steady_clock::time_point lastSnapshotSave_;
 
   std::optional<VipKey> lruMissStatsVip_;
 
   /**
    * Maps an HcKey to its id
    */
-  std::unordered_map<VipKey, uint32_t, VipKeyHasher> hckeys_;
+  folly::F14FastMap<CompactVipKey, uint32_t, CompactVipKeyHasher> hckeys_;
 
   /**
    * map of src address to dst mapping. used for source based routing.
    */
   std::unordered_map<folly::CIDRNetwork, uint32_t> lpmSrcMapping_;
 
+  /**
+   * map of lpm map's name to fd of trie which was swapped in instead of it
+   * through map-in-map
+   */
+  std::unordered_map<std::string, int> lpmMapFdOverrides_;
+
   /**
    * set of destantions, which are used for inline decapsulation.
    */
@@ -1482,6 +2108,11 @@ class KatranLb {
    */
   bool progsReloaded_{false};
 
+  /**
+   * path of balancer program, which has been replaced by the last upgrade
+   */
+  std::string previousBalancerProgPath_;
+
   /**
    * Callbacks to be notified when a real is added or deleted
    */
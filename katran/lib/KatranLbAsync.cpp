@@ -0,0 +1,143 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/KatranLbAsync.h"
+
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/synchronization/Baton.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+KatranLbAsync::KatranLbAsync(KatranLb& lb)
+    : lb_(lb),
+      controlExecutor_(std::make_unique<folly::CPUThreadPoolExecutor>(
+          1,
+          std::make_shared<folly::NamedThreadFactory>("katran-ctl"))),
+      programExecutor_(std::make_unique<folly::CPUThreadPoolExecutor>(
+          1,
+          std::make_shared<folly::NamedThreadFactory>("katran-prog"))) {}
+
+KatranLbAsync::~KatranLbAsync() {
+  // control plane thread could still queue rings for programming
+  controlExecutor_->join();
+  programExecutor_->join();
+  releaseRealNums();
+}
+
+folly::SemiFuture<bool> KatranLbAsync::addVip(
+    const VipKey& vip,
+    uint32_t flags) {
+  return run([vip, flags](KatranLb& lb) { return lb.addVip(vip, flags); });
+}
+
+folly::SemiFuture<bool> KatranLbAsync::delVip(const VipKey& vip) {
+  return run([vip](KatranLb& lb) { return lb.delVip(vip); });
+}
+
+folly::SemiFuture<bool>
+KatranLbAsync::modifyVip(const VipKey& vip, uint32_t flag, bool set) {
+  return run(
+      [vip, flag, set](KatranLb& lb) { return lb.modifyVip(vip, flag, set); });
+}
+
+folly::SemiFuture<bool> KatranLbAsync::modifyRealsForVip(
+    ModifyAction action,
+    std::vector<NewReal> reals,
+    const VipKey& vip) {
+  auto contract = folly::makePromiseContract<bool>();
+  controlExecutor_->add([this,
+                         action,
+                         reals = std::move(reals),
+                         vip,
+                         promise = std::move(contract.first)]() mutable {
+    releaseRealNums();
+    std::vector<RealPos> ch_positions;
+    uint32_t vip_num;
+    std::vector<uint32_t> released_nums;
+    auto computed = folly::makeTryWith([&]() {
+      return lb_.computeRealsForVip(
+          action, reals, vip, ch_positions, vip_num, released_nums);
+    });
+    if (computed.hasException() || !computed.value()) {
+      promise.setTry(std::move(computed));
+      return;
+    }
+    inflightRingUpdates_++;
+    programExecutor_->add([this,
+                           ch_positions = std::move(ch_positions),
+                           vip_num,
+                           released_nums = std::move(released_nums),
+                           promise = std::move(promise)]() mutable {
+      auto written = lb_.writeHashRing(ch_positions, vip_num);
+      if (!written) {
+        LOG(ERROR) << "can't program ch ring for vip num " << vip_num;
+        failedRingUpdates_++;
+      }
+      // previous ring could point to deleted reals till this point
+      {
+        std::lock_guard<std::mutex> lock(releasedRealNumsMutex_);
+        releasedRealNums_.insert(
+            releasedRealNums_.end(),
+            released_nums.begin(),
+            released_nums.end());
+      }
+      ringUpdates_++;
+      inflightRingUpdates_--;
+      promise.setValue(written);
+    });
+  });
+  return std::move(contract.second);
+}
+
+folly::SemiFuture<bool> KatranLbAsync::addRealForVip(
+    const NewReal& real,
+    const VipKey& vip) {
+  return modifyRealsForVip(ModifyAction::ADD, {real}, vip);
+}
+
+folly::SemiFuture<bool> KatranLbAsync::delRealForVip(
+    const NewReal& real,
+    const VipKey& vip) {
+  return modifyRealsForVip(ModifyAction::DEL, {real}, vip);
+}
+
+folly::SemiFuture<folly::Unit> KatranLbAsync::flush() {
+  return run([](KatranLb&) {});
+}
+
+void KatranLbAsync::waitForRingUpdates() {
+  if (inflightRingUpdates_.load() != 0) {
+    // program executor is FIFO and fed only from this thread
+    folly::Baton<> baton;
+    programExecutor_->add([&baton]() { baton.post(); });
+    baton.wait();
+  }
+  releaseRealNums();
+}
+
+void KatranLbAsync::releaseRealNums() {
+  std::vector<uint32_t> nums;
+  {
+    std::lock_guard<std::mutex> lock(releasedRealNumsMutex_);
+    nums.swap(releasedRealNums_);
+  }
+  if (!nums.empty()) {
+    lb_.releaseRealNums(nums);
+  }
+}
+
+} // namespace katran
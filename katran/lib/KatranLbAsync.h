@@ -0,0 +1,160 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <folly/Unit.h>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/futures/Future.h>
+
+#include "katran/lib/KatranLb.h"
+
+namespace katran {
+
+/**
+ * asynchronous facade for KatranLb. every call is queued onto dedicated
+ * control plane thread and returns SemiFuture w/ the result of the
+ * operation.
+ *
+ * reals' updates are pipelined: ch ring for the next update is computed on
+ * control plane thread, while ring of the previous one is being programmed
+ * into forwarding plane by separate thread. all other operations are
+ * executed only after every previously queued ring is programmed. so
+ * operations take effect in the same order as they have been submitted
+ * (and per vip ordering is always preserved). indexes of deleted reals are
+ * reused only after ring, which stops pointing to them, is programmed.
+ *
+ * KatranLb must not be used directly while facade exists.
+ */
+class KatranLbAsync {
+ public:
+  explicit KatranLbAsync(KatranLb& lb);
+
+  /**
+   * waits for all queued operations to complete
+   */
+  ~KatranLbAsync();
+
+  KatranLbAsync(const KatranLbAsync&) = delete;
+  KatranLbAsync& operator=(const KatranLbAsync&) = delete;
+
+  folly::SemiFuture<bool> addVip(const VipKey& vip, uint32_t flags = 0);
+
+  folly::SemiFuture<bool> delVip(const VipKey& vip);
+
+  folly::SemiFuture<bool>
+  modifyVip(const VipKey& vip, uint32_t flag, bool set = true);
+
+  /**
+   * @return future which is fulfilled once vip's ch ring is programmed into
+   * forwarding plane. false if update or ring's programming has failed
+   */
+  folly::SemiFuture<bool> modifyRealsForVip(
+      ModifyAction action,
+      std::vector<NewReal> reals,
+      const VipKey& vip);
+
+  folly::SemiFuture<bool> addRealForVip(const NewReal& real, const VipKey& vip);
+
+  folly::SemiFuture<bool> delRealForVip(const NewReal& real, const VipKey& vip);
+
+  /**
+   * @param F func to run against KatranLb on control plane thread
+   * @return future w/ func's result (or exception, which func has thrown)
+   *
+   * helper function to run any other KatranLb's routine in order w/ the
+   * rest of queued operations
+   */
+  template <typename F>
+  folly::SemiFuture<folly::lift_unit_t<std::invoke_result_t<F, KatranLb&>>> run(
+      F&& func) {
+    using T = folly::lift_unit_t<std::invoke_result_t<F, KatranLb&>>;
+    auto contract = folly::makePromiseContract<T>();
+    controlExecutor_->add([this,
+                           func = std::forward<F>(func),
+                           promise = std::move(contract.first)]() mutable {
+      waitForRingUpdates();
+      promise.setWith([&]() { return func(lb_); });
+    });
+    return std::move(contract.second);
+  }
+
+  /**
+   * @return future which is fulfilled when all previously queued operations
+   * are completed
+   */
+  folly::SemiFuture<folly::Unit> flush();
+
+  /**
+   * @return uint64_t number of ch rings programmed by pipeline
+   */
+  uint64_t getRingUpdates() const {
+    return ringUpdates_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @return uint64_t number of ch rings, which pipeline failed to program
+   */
+  uint64_t getFailedRingUpdates() const {
+    return failedRingUpdates_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  /**
+   * must be called from control plane thread. blocks until all rings queued
+   * for programming are written into forwarding plane
+   */
+  void waitForRingUpdates();
+
+  /**
+   * must be called from control plane thread. returns indexes of reals,
+   * which have been deleted by already programmed rings, to KatranLb
+   */
+  void releaseRealNums();
+
+  KatranLb& lb_;
+
+  /**
+   * single threaded, so operations are executed in the order of submission
+   */
+  std::unique_ptr<folly::CPUThreadPoolExecutor> controlExecutor_;
+
+  /**
+   * programs ch rings computed by control plane thread
+   */
+  std::unique_ptr<folly::CPUThreadPoolExecutor> programExecutor_;
+
+  std::atomic<uint64_t> inflightRingUpdates_{0};
+  std::atomic<uint64_t> ringUpdates_{0};
+  std::atomic<uint64_t> failedRingUpdates_{0};
+
+  /**
+   * indexes of deleted reals, which are not referenced by forwarding plane
+   * anymore. filled by program thread, drained by control plane thread
+   */
+  std::vector<uint32_t> releasedRealNums_;
+  std::mutex releasedRealNumsMutex_;
+};
+
+} // namespace katran
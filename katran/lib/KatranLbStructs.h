@@ -18,10 +18,15 @@
 
 #include <cstdint>
 #include <functional>
+#include <optional>
 #include <string>
 #include <vector>
+
+#include <folly/IPAddress.h>
+
 #include "katran/lib/CHHelpers.h"
 #include "katran/lib/MonitoringStructs.h"
+#include "katran/lib/PcapStructs.h"
 
 namespace katran {
 
@@ -38,6 +43,8 @@ constexpr uint32_t kDefaultNumOfPages = 2;
 constexpr uint32_t kDefaultMonitorQueueSize = 4096;
 constexpr uint32_t kDefaultMonitorPcktLimit = 0;
 constexpr uint32_t kDefaultMonitorSnapLen = 128;
+constexpr uint32_t kDefaultRingBufPollTimeoutMs = 10;
+constexpr uint32_t kDefaultCompressFlushMs = 1000;
 constexpr unsigned int kDefaultLruSize = 8000000;
 constexpr uint32_t kDefaultGlobalLruSize = 100000;
 constexpr uint32_t kNoFlags = 0;
@@ -110,6 +117,24 @@ enum class PcapStorageFormat {
  * @param uint32_t snapLen maximum number of bytes from packet to write.
  * @param uint32_t maxEvents maximum supported events/pcap writers
  * @param std::string path where pcap outputs are going to be stored
+ * @param uint32_t ringBufPollTimeoutMs how often ring buffer's consumer polls
+ * for records which were committed w/o wakeup. only used if bpf code was
+ * build w/ -DKATRAN_INTROSPECTION_RINGBUF
+ * @param int filtersMapFd descriptor of map w/ per event sampling rates and
+ * filters. -1 if forwarding plane does not support them
+ * @param PcapFormat format of the output. w/ PCAPNG records have nsec
+ * timestamps (taken by the forwarding plane if it was built w/
+ * -DKATRAN_INTROSPECTION_KTIME, otherwise when event is read) and every event
+ * is described by its own interface description block
+ * @param uint64_t rotateBytes if not 0 - FILE storage starts new file
+ * (path_<event>.<seq>) when current one reaches this size
+ * @param uint32_t rotateSeconds if not 0 - FILE storage starts new file when
+ * current one is older than this
+ * @param uint32_t maxFiles number of the most recent rotated files to keep
+ * per event. 0 - keep all of them
+ * @param bool compress if true - FILE storage is compressed w/ streaming zstd
+ * @param uint32_t compressFlushMs how often compressed FILE storage writes
+ * out data buffered by compressor. 0 - only when file is switched or closed
  *
  * katran monitoring config. being used if katran's bpf code was build w/
  * introspection enabled (-DKATRAN_INTROSPECTION)
@@ -125,6 +150,14 @@ struct KatranMonitorConfig {
   std::string path{"/tmp/katran_pcap"};
   PcapStorageFormat storage{PcapStorageFormat::FILE};
   uint32_t bufferSize{0};
+  uint32_t ringBufPollTimeoutMs{kDefaultRingBufPollTimeoutMs};
+  int filtersMapFd{-1};
+  PcapFormat format{PcapFormat::PCAP};
+  uint64_t rotateBytes{0};
+  uint32_t rotateSeconds{0};
+  uint32_t maxFiles{0};
+  bool compress{false};
+  uint32_t compressFlushMs{kDefaultCompressFlushMs};
 };
 
 /**
@@ -165,6 +198,20 @@ struct KatranMonitorConfig {
  * we'll attempt to resolve mainInterface name to the interface index
  * @param uint32_t hcInterfaceIndex, if not specified (0) then
  * we'll attempt to resolve hcInterface name to the interface index
+ * @param std::string pinnedMapsPath path in bpffs. if specified, state maps
+ * (vips, reals, ch rings, server ids and src routing) are pinned there and
+ * reused on restart, so katran's state could be restored from them
+ * @param uint32_t realsUpdateCoalesceWindowMs if not 0, modifyRealsForVip
+ * calls are not applied right away, but merged into per vip pending set of
+ * changes. the set is applied (w/ single ch ring recalculation) when there
+ * were no new changes for the vip during this window
+ * @param uint32_t realsUpdateMaxDelayMs upper bound on how long changes could
+ * stay pending while vip keeps getting new updates. 0 means the same value as
+ * realsUpdateCoalesceWindowMs
+ * @param std::string snapshotPath where saveSnapshotIfDue stores snapshot of
+ * katran's state (see KatranSnapshot.h). empty means no periodic snapshots
+ * @param uint32_t snapshotIntervalMs how often saveSnapshotIfDue stores the
+ * snapshot. 0 means no periodic snapshots
  *
  * note about rootMapPath and rootMapPos:
  * katran has two modes of operation.
@@ -220,12 +267,21 @@ struct KatranConfig {
   uint32_t mainInterfaceIndex = kUnspecifiedInterfaceIndex;
   uint32_t hcInterfaceIndex = kUnspecifiedInterfaceIndex;
   bool cleanupOnShutdown = true;
+  std::string pinnedMapsPath = kNoExternalMap;
+  uint32_t realsUpdateCoalesceWindowMs = 0;
+  uint32_t realsUpdateMaxDelayMs = 0;
+  std::string snapshotPath;
+  uint32_t snapshotIntervalMs = 0;
 };
 
 /**
  * @param uint32_t limit of packet writer. how many packets we would write
  * before we stop
  * @param uint32_ amount of packets which has been written so far
+ * @param uint32_t bufferFull number of packets dropped because writer's
+ * buffer was full
+ * @param uint32_t queueFull number of events dropped because queue between
+ * event reader and writer was full
  *
  * struct which contains stats from katran monitor
  */
@@ -233,6 +289,7 @@ struct KatranMonitorStats {
   uint32_t limit{0};
   uint32_t amount{0};
   uint32_t bufferFull{0};
+  uint32_t queueFull{0};
 };
 
 /**
@@ -249,6 +306,12 @@ struct KatranBpfMapStats {
 /**
  * @param uint64_t bpfFailedCalls number of failed syscalls
  * @param uint64_t addrValidationFailed times provided ipaddress was invalid
+ * @param uint64_t realsUpdatesCoalesced number of modifyRealsForVip calls which
+ * were merged into pending set of changes instead of being applied right away
+ * @param uint64_t realsChangesMerged number of pending real's changes which
+ * were overridden by newer change for the same real of the same vip
+ * @param uint64_t coalescedRingUpdates number of ch ring recalculations done
+ * while applying pending sets of changes
  *
  * generic userspace related stats to track internals of katran library
  * such as number of failed bpf syscalls (could happens if we are trying to add
@@ -257,6 +320,9 @@ struct KatranBpfMapStats {
 struct KatranLbStats {
   uint64_t bpfFailedCalls{0};
   uint64_t addrValidationFailed{0};
+  uint64_t realsUpdatesCoalesced{0};
+  uint64_t realsChangesMerged{0};
+  uint64_t coalescedRingUpdates{0};
 };
 
 /**
@@ -289,6 +355,8 @@ struct HealthCheckProgStats {
  * be directly created instead of using tunnel interfaces
  * @param localDeliveryOptimization flag which indicates that local delivery
  * would be optimized by passing (xdp_pass) local traffic
+ * @param srcRoutingShadowMaps flag which indicates that src routing tries are
+ * looked up through map-in-map and could be atomically replaced
  */
 struct KatranFeatures {
   bool srcRouting{false};
@@ -298,6 +366,7 @@ struct KatranFeatures {
   bool directHealthchecking{false};
   bool localDeliveryOptimization{false};
   bool flowDebug{false};
+  bool srcRoutingShadowMaps{false};
 };
 
 /**
@@ -339,4 +408,21 @@ struct VipKeyHasher {
   }
 };
 
+/**
+ * @param uint32_t sampleRate report 1 out of sampleRate matching events.
+ * 0 or 1 - report every event
+ * @param optional<VipKey> vip if set - report only events for packets
+ * destined to this vip. port 0 matches any port
+ * @param optional<CIDRNetwork> src if set - report only events for packets
+ * from this prefix
+ *
+ * per event sampling and filtering, which is done in forwarding plane before
+ * packet is copied into event pipe
+ */
+struct EventFilterConfig {
+  uint32_t sampleRate{0};
+  std::optional<VipKey> vip;
+  std::optional<folly::CIDRNetwork> src;
+};
+
 } // namespace katran
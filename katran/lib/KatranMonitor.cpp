@@ -16,35 +16,95 @@
 
 #include "katran/lib/KatranMonitor.h"
 
+#include <cstring>
+
 #include <folly/Conv.h>
+#include <folly/String.h>
+#include <folly/lang/Bits.h>
 #include <folly/Utility.h>
 #include <folly/io/async/ScopedEventBaseThread.h>
 
+#include "katran/lib/BalancerStructs.h"
+#include "katran/lib/BaseBpfAdapter.h"
 #include "katran/lib/FileWriter.h"
 #include "katran/lib/IOBufWriter.h"
+#include "katran/lib/IpHelpers.h"
 #include "katran/lib/KatranEventReader.h"
 #include "katran/lib/MonitoringStructs.h"
 #include "katran/lib/PipeWriter.h"
+#include "katran/lib/RotatingFileWriter.h"
 
 namespace katran {
 
+namespace {
+// must be in sync w/ event_filters map and its flags in balancer_consts.h
+constexpr uint32_t kEventFiltersMapSize = 16;
+constexpr uint32_t kEventFilterVip = 1 << 0;
+constexpr uint32_t kEventFilterSrc = 1 << 1;
+constexpr uint32_t kEventFilterVipV6 = 1 << 2;
+constexpr uint32_t kEventFilterSrcV6 = 1 << 3;
+constexpr uint32_t kNumEventSources = 1;
+constexpr uint32_t kReaderSource = 0;
+
+/**
+ * @return string human readable description of the filter, which is stored
+ * alongside captured events
+ */
+std::string describeFilter(const EventFilterConfig& filter) {
+  std::string desc;
+  if (filter.vip.has_value()) {
+    folly::toAppend(
+        "vip: ",
+        filter.vip->address,
+        ":",
+        filter.vip->port,
+        ":",
+        filter.vip->proto,
+        " ",
+        &desc);
+  }
+  if (filter.src.has_value()) {
+    folly::toAppend(
+        "src: ", folly::IPAddress::networkToString(*filter.src), " ", &desc);
+  }
+  if (filter.sampleRate > 1) {
+    folly::toAppend("sampled: 1/", filter.sampleRate, &desc);
+  }
+  return desc;
+}
+} // namespace
+
 using monitoring::EventId;
 
 KatranMonitor::KatranMonitor(const KatranMonitorConfig& config)
     : config_(config) {
   scopedEvb_ = std::make_unique<folly::ScopedEventBaseThread>("katran_monitor");
-  queue_ = std::make_shared<folly::MPMCQueue<PcapMsgMeta>>(config_.queueSize);
+  // every reader's thread is a separate source; there is only one reader
+  queues_ =
+      std::make_shared<PcapEventQueues>(kNumEventSources, config_.queueSize);
   auto evb = scopedEvb_->getEventBase();
 
-  reader_ = std::make_unique<KatranEventReader>(queue_);
-  if (!reader_->open(config_.mapFd, evb, config_.pages)) {
-    LOG(ERROR) << "Perf event reader init failed";
+  // transport is defined by the flavor forwarding plane has been built w/
+  struct bpf_map_info mapInfo = {};
+  if (BaseBpfAdapter::getBpfMapInfo(config_.mapFd, &mapInfo) == 0 &&
+      mapInfo.type == BPF_MAP_TYPE_RINGBUF) {
+    ringReader_ =
+        std::make_unique<KatranRingBufferEventReader>(queues_, kReaderSource);
+    if (!ringReader_->open(config_.mapFd, config_.ringBufPollTimeoutMs)) {
+      LOG(ERROR) << "Ring buffer event reader init failed";
+    }
+  } else {
+    reader_ = std::make_unique<KatranEventReader>(queues_, kReaderSource);
+    if (!reader_->open(config_.mapFd, evb, config_.pages)) {
+      LOG(ERROR) << "Perf event reader init failed";
+    }
   }
 
   auto data_writers = createWriters();
 
   writer_ = std::make_shared<PcapWriter>(
       data_writers, config_.pcktLimit, config_.snapLen);
+  writer_->setFormat(config_.format);
 
   // No packet limit for pipe
   writer_->overridePacketLimit(config_.storage == PcapStorageFormat::PIPE);
@@ -54,14 +114,18 @@ KatranMonitor::KatranMonitor(const KatranMonitorConfig& config)
   for (auto event : config_.events) {
     enableWriterEvent(event);
   }
-  writerThread_ = std::thread([this]() { writer_->runMulti(queue_); });
+  writerThread_ = std::thread([this]() { writer_->runMulti(queues_); });
 }
 
 KatranMonitor::~KatranMonitor() {
+  if (ringReader_) {
+    // stop producing into the queue before writer goes away
+    ringReader_->stop();
+  }
   PcapMsgMeta msg;
   msg.setControl(true);
   msg.setShutdown(true);
-  queue_->write(std::move(msg));
+  queues_->pushControl(std::move(msg));
   writerThread_.join();
 };
 
@@ -69,7 +133,7 @@ void KatranMonitor::stopMonitor() {
   PcapMsgMeta msg;
   msg.setControl(true);
   msg.setStop(true);
-  queue_->blockingWrite(std::move(msg));
+  queues_->pushControl(std::move(msg));
 }
 
 void KatranMonitor::restartMonitor(
@@ -85,7 +149,7 @@ void KatranMonitor::restartMonitor(
   msg.setControl(true);
   msg.setRestart(true);
   msg.setLimit(limit);
-  queue_->blockingWrite(std::move(msg));
+  queues_->pushControl(std::move(msg));
   VLOG(4) << __func__ << "Successfully restarted monitor";
 }
 
@@ -163,8 +227,138 @@ void KatranMonitor::unsetAsyncPipeWriter(EventId event) {
   VLOG(4) << __func__ << "Successfully unset AsyncPipeWriter";
 }
 
+bool KatranMonitor::setEventFilter(
+    EventId event,
+    const EventFilterConfig& filter) {
+  uint32_t key = static_cast<uint32_t>(event);
+  if (config_.filtersMapFd < 0) {
+    LOG(ERROR) << "forwarding plane does not support introspection filters";
+    return false;
+  }
+  if (key >= kEventFiltersMapSize) {
+    LOG(ERROR) << "can't set filter for unknown event " << toString(event);
+    return false;
+  }
+  struct event_filter value = {};
+  value.sample_rate = filter.sampleRate;
+  if (filter.vip.has_value()) {
+    auto addr = folly::IPAddress::tryFromString(filter.vip->address);
+    if (addr.hasError()) {
+      LOG(ERROR) << "invalid vip address in filter: " << filter.vip->address;
+      return false;
+    }
+    auto beAddr = IpHelpers::parseAddrToBe(*addr);
+    value.flags |= kEventFilterVip;
+    if (addr->isV6()) {
+      value.flags |= kEventFilterVipV6;
+      std::memcpy(value.vipv6, beAddr.v6daddr, sizeof(value.vipv6));
+    } else {
+      value.vip = beAddr.daddr;
+    }
+    value.vip_port = folly::Endian::big(filter.vip->port);
+    value.vip_proto = filter.vip->proto;
+  }
+  if (filter.src.has_value()) {
+    const auto& prefix = filter.src->first;
+    auto prefixLen = filter.src->second;
+    if (prefixLen > prefix.bitCount()) {
+      LOG(ERROR) << "invalid src prefix length in filter: " << prefixLen;
+      return false;
+    }
+    // only masked part of the address is compared in forwarding plane
+    auto beAddr = IpHelpers::parseAddrToBe(prefix.mask(prefixLen));
+    value.flags |= kEventFilterSrc;
+    if (prefix.isV6()) {
+      value.flags |= kEventFilterSrcV6;
+      std::memcpy(value.srcv6, beAddr.v6daddr, sizeof(value.srcv6));
+    } else {
+      value.src = beAddr.daddr;
+    }
+    value.src_prefixlen = prefixLen;
+  }
+  auto res = BaseBpfAdapter::bpfUpdateMap(config_.filtersMapFd, &key, &value);
+  if (res != 0) {
+    LOG(ERROR) << "can't update filter for event " << toString(event);
+    return false;
+  }
+  filterDescriptions_[event] = describeFilter(filter);
+  updateEventComment(event);
+  return true;
+}
+
+void KatranMonitor::setEventComment(
+    EventId event,
+    const std::string& comment) {
+  comments_[event] = comment;
+  updateEventComment(event);
+}
+
+void KatranMonitor::updateEventComment(EventId event) {
+  if (!writer_) {
+    return;
+  }
+  std::vector<std::string> parts;
+  for (const auto* descriptions : {&filterDescriptions_, &comments_}) {
+    auto it = descriptions->find(event);
+    if (it != descriptions->end() && !it->second.empty()) {
+      parts.push_back(it->second);
+    }
+  }
+  writer_->setEventComment(event, folly::join("; ", parts));
+}
+
+bool KatranMonitor::setEventSampleRate(EventId event, uint32_t sampleRate) {
+  auto filter = getEventFilter(event);
+  if (!filter.has_value()) {
+    return false;
+  }
+  filter->sampleRate = sampleRate;
+  return setEventFilter(event, *filter);
+}
+
+std::optional<EventFilterConfig> KatranMonitor::getEventFilter(EventId event) {
+  uint32_t key = static_cast<uint32_t>(event);
+  if (config_.filtersMapFd < 0 || key >= kEventFiltersMapSize) {
+    return std::nullopt;
+  }
+  struct event_filter value = {};
+  auto res =
+      BaseBpfAdapter::bpfMapLookupElement(config_.filtersMapFd, &key, &value);
+  if (res != 0) {
+    LOG(ERROR) << "can't read filter for event " << toString(event);
+    return std::nullopt;
+  }
+  EventFilterConfig filter;
+  filter.sampleRate = value.sample_rate;
+  if (value.flags & kEventFilterVip) {
+    auto addr = (value.flags & kEventFilterVipV6)
+        ? folly::IPAddress::fromBinary(folly::ByteRange(
+              reinterpret_cast<const uint8_t*>(value.vipv6),
+              sizeof(value.vipv6)))
+        : folly::IPAddress::fromBinary(folly::ByteRange(
+              reinterpret_cast<const uint8_t*>(&value.vip), sizeof(value.vip)));
+    VipKey vip;
+    vip.address = addr.str();
+    vip.port = folly::Endian::big(value.vip_port);
+    vip.proto = value.vip_proto;
+    filter.vip = std::move(vip);
+  }
+  if (value.flags & kEventFilterSrc) {
+    auto addr = (value.flags & kEventFilterSrcV6)
+        ? folly::IPAddress::fromBinary(folly::ByteRange(
+              reinterpret_cast<const uint8_t*>(value.srcv6),
+              sizeof(value.srcv6)))
+        : folly::IPAddress::fromBinary(folly::ByteRange(
+              reinterpret_cast<const uint8_t*>(&value.src), sizeof(value.src)));
+    filter.src = folly::CIDRNetwork(addr, value.src_prefixlen);
+  }
+  return filter;
+}
+
 PcapWriterStats KatranMonitor::getWriterStats() {
-  return writer_->getStats();
+  auto stats = writer_->getStats();
+  stats.queueFull = queues_->getDrops();
+  return stats;
 }
 
 std::unordered_map<monitoring::EventId, std::shared_ptr<DataWriter>>
@@ -174,7 +368,19 @@ KatranMonitor::createWriters() {
     if (config_.storage == PcapStorageFormat::FILE) {
       std::string fname;
       folly::toAppend(config_.path, "_", event, &fname);
-      dataWriters.insert({event, std::make_shared<FileWriter>(fname)});
+      if (config_.rotateBytes || config_.rotateSeconds || config_.compress) {
+        dataWriters.insert(
+            {event,
+             std::make_shared<RotatingFileWriter>(
+                 fname,
+                 config_.rotateBytes,
+                 std::chrono::seconds(config_.rotateSeconds),
+                 config_.maxFiles,
+                 config_.compress,
+                 std::chrono::milliseconds(config_.compressFlushMs))});
+      } else {
+        dataWriters.insert({event, std::make_shared<FileWriter>(fname)});
+      }
     } else if (config_.storage == PcapStorageFormat::IOBUF) {
       auto res =
           buffers_.insert({event, folly::IOBuf::create(config_.bufferSize)});
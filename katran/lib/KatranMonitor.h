@@ -15,7 +15,6 @@
  */
 
 #pragma once
-#include <folly/MPMCQueue.h>
 #include <folly/io/IOBuf.h>
 #include <folly/io/async/AsyncPipe.h>
 #include <memory>
@@ -24,6 +23,7 @@
 
 #include "katran/lib/KatranLbStructs.h"
 #include "katran/lib/MonitoringStructs.h"
+#include "katran/lib/PcapEventQueues.h"
 #include "katran/lib/PcapMsgMeta.h"
 #include "katran/lib/PcapWriter.h"
 
@@ -34,6 +34,7 @@ class ScopedEventBaseThread;
 namespace katran {
 
 class KatranEventReader;
+class KatranRingBufferEventReader;
 class PcapWriter;
 /**
  * helper class which runs all introspection related routines
@@ -95,10 +96,54 @@ class KatranMonitor {
    */
   void unsetAsyncPipeWriter(monitoring::EventId event);
 
+  /**
+   * @param EventId event to configure
+   * @param EventFilterConfig filter sampling rate and filters for the event
+   * @return bool true on success
+   *
+   * helper function to change sampling and filtering of the event in
+   * forwarding plane. takes effect immediately, w/o monitor's restart
+   */
+  bool setEventFilter(
+      monitoring::EventId event,
+      const EventFilterConfig& filter);
+
+  /**
+   * @param EventId event to configure
+   * @param uint32_t sampleRate report 1 out of sampleRate events
+   * @return bool true on success
+   *
+   * helper function to change only sampling rate of the event. configured
+   * filters are preserved
+   */
+  bool setEventSampleRate(monitoring::EventId event, uint32_t sampleRate);
+
+  /**
+   * @param EventId event
+   * @return current sampling and filtering of the event. nullopt on error
+   */
+  std::optional<EventFilterConfig> getEventFilter(monitoring::EventId event);
+
+  /**
+   * @param EventId event to describe
+   * @param string comment e.g. vip and reals which are being monitored
+   *
+   * comment is stored in the event's pcapng interface description block
+   * after the description of event's filter (see setEventFilter), so it
+   * takes effect w/ the next header (i.e. after monitor's restart)
+   */
+  void setEventComment(monitoring::EventId event, const std::string& comment);
+
  private:
   std::unordered_map<monitoring::EventId, std::shared_ptr<DataWriter>>
   createWriters();
 
+  /**
+   * helper function which passes filter's description and comment of the
+   * event to the writer
+   */
+  void updateEventComment(monitoring::EventId event);
+
   /**
    * main config
    */
@@ -109,6 +154,12 @@ class KatranMonitor {
    */
   std::unique_ptr<KatranEventReader> reader_;
 
+  /**
+   * event reader for forwarding plane w/ ring buffer based introspection.
+   * only one of reader_ and ringReader_ is set
+   */
+  std::unique_ptr<KatranRingBufferEventReader> ringReader_;
+
   /**
    * a copy of pipe writers' destinations, which allows pipe readers at the
    * other end to survive monitor restart via re-binding
@@ -121,9 +172,9 @@ class KatranMonitor {
   std::shared_ptr<PcapWriter> writer_;
 
   /**
-   * queue toward writer
+   * per source queues toward writer
    */
-  std::shared_ptr<folly::MPMCQueue<PcapMsgMeta>> queue_;
+  std::shared_ptr<PcapEventQueues> queues_;
   /**
    * event base thread to run readers.
    */
@@ -140,6 +191,12 @@ class KatranMonitor {
    */
   std::unordered_map<monitoring::EventId, std::unique_ptr<folly::IOBuf>>
       buffers_;
+
+  /**
+   * descriptions of events' filters and comments, which are set by the user
+   */
+  std::unordered_map<monitoring::EventId, std::string> filterDescriptions_;
+  std::unordered_map<monitoring::EventId, std::string> comments_;
 };
 
 } // namespace katran
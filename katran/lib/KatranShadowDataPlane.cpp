@@ -0,0 +1,392 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/KatranShadowDataPlane.h"
+
+#include <netinet/in.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+
+#include <folly/lang/Bits.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+// vip's flags from balancer_consts.h, which affect routing decision
+constexpr uint32_t kHashNoSrcPort = 1 << 0;
+constexpr uint32_t kHashDportOnly = 1 << 3;
+constexpr uint32_t kSrcRouting = 1 << 4;
+constexpr uint32_t kHashSrcDstPort = 1 << 7;
+
+constexpr uint32_t kJhashInitval = 0xdeadbeef;
+
+inline uint32_t rol32(uint32_t word, unsigned int shift) {
+  return (word << shift) | (word >> ((-shift) & 31));
+}
+
+inline void jhashMix(uint32_t& a, uint32_t& b, uint32_t& c) {
+  a -= c;
+  a ^= rol32(c, 4);
+  c += b;
+  b -= a;
+  b ^= rol32(a, 6);
+  a += c;
+  c -= b;
+  c ^= rol32(b, 8);
+  b += a;
+  a -= c;
+  a ^= rol32(c, 16);
+  c += b;
+  b -= a;
+  b ^= rol32(a, 19);
+  a += c;
+  c -= b;
+  c ^= rol32(b, 4);
+  b += a;
+}
+
+inline void jhashFinal(uint32_t& a, uint32_t& b, uint32_t& c) {
+  c ^= b;
+  c -= rol32(b, 14);
+  a ^= c;
+  a -= rol32(c, 11);
+  b ^= a;
+  b -= rol32(a, 25);
+  c ^= b;
+  c -= rol32(b, 16);
+  a ^= c;
+  a -= rol32(c, 4);
+  b ^= a;
+  b -= rol32(a, 14);
+  c ^= b;
+  c -= rol32(b, 24);
+}
+
+inline uint32_t loadU32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t prefixMask64(uint8_t prefixlen) {
+  if (prefixlen == 0) {
+    return 0;
+  }
+  return prefixlen >= 64 ? ~0ULL : ~0ULL << (64 - prefixlen);
+}
+
+void insertPrefixLen(std::vector<uint8_t>& lens, uint8_t prefixlen) {
+  auto it = std::lower_bound(
+      lens.begin(), lens.end(), prefixlen, std::greater<uint8_t>());
+  if (it == lens.end() || *it != prefixlen) {
+    lens.insert(it, prefixlen);
+  }
+}
+} // namespace
+
+uint32_t bpfJhash(const void* key, uint32_t length, uint32_t initval) {
+  uint32_t a, b, c;
+  auto k = static_cast<const uint8_t*>(key);
+
+  a = b = c = kJhashInitval + length + initval;
+
+  while (length > 12) {
+    a += loadU32(k);
+    b += loadU32(k + 4);
+    c += loadU32(k + 8);
+    jhashMix(a, b, c);
+    length -= 12;
+    k += 12;
+  }
+  // fallthrough is intentional, same as in the kernel's version
+  switch (length) {
+    case 12:
+      c += uint32_t(k[11]) << 24;
+      [[fallthrough]];
+    case 11:
+      c += uint32_t(k[10]) << 16;
+      [[fallthrough]];
+    case 10:
+      c += uint32_t(k[9]) << 8;
+      [[fallthrough]];
+    case 9:
+      c += k[8];
+      [[fallthrough]];
+    case 8:
+      b += uint32_t(k[7]) << 24;
+      [[fallthrough]];
+    case 7:
+      b += uint32_t(k[6]) << 16;
+      [[fallthrough]];
+    case 6:
+      b += uint32_t(k[5]) << 8;
+      [[fallthrough]];
+    case 5:
+      b += k[4];
+      [[fallthrough]];
+    case 4:
+      a += uint32_t(k[3]) << 24;
+      [[fallthrough]];
+    case 3:
+      a += uint32_t(k[2]) << 16;
+      [[fallthrough]];
+    case 2:
+      a += uint32_t(k[1]) << 8;
+      [[fallthrough]];
+    case 1:
+      a += k[0];
+      jhashFinal(a, b, c);
+      break;
+    case 0:
+      break;
+  }
+  return c;
+}
+
+uint32_t bpfJhash2Words(uint32_t a, uint32_t b, uint32_t initval) {
+  uint32_t c = 0;
+  initval += kJhashInitval + (2 << 2);
+  a += initval;
+  b += initval;
+  c += initval;
+  jhashFinal(a, b, c);
+  return c;
+}
+
+std::size_t KatranShadowDataPlane::SrcPrefixKeyHasher::operator()(
+    const SrcPrefixKey& k) const {
+  return folly::hash::hash_128_to_64(
+      folly::hash::hash_128_to_64(k.hi, k.lo), k.prefixlen);
+}
+
+KatranShadowDataPlane::KatranShadowDataPlane(
+    uint32_t chRingSize,
+    uint32_t maxVips,
+    bool srcRouting)
+    : chRingSize_(chRingSize),
+      // INIT_JHASH_SEED is CH_RINGS_SIZE (MAX_VIPS * RING_SIZE) and
+      // INIT_JHASH_SEED_V6 is MAX_VIPS. see balancer_consts.h
+      hashSeed_(maxVips * chRingSize),
+      hashSeedV6_(maxVips),
+      srcRouting_(srcRouting) {}
+
+bool KatranShadowDataPlane::addVip(
+    const CompactVipKey& vip,
+    uint32_t flags,
+    const std::vector<int>& chRing) {
+  if (!vip.valid()) {
+    LOG(ERROR) << "can't add vip w/ invalid address to shadow data plane";
+    return false;
+  }
+  if (chRing.size() != chRingSize_) {
+    LOG(ERROR) << "unexpected ch ring size " << chRing.size()
+               << " for vip: " << vip.toVipKey().address
+               << " expected: " << chRingSize_;
+    return false;
+  }
+  auto res = vips_.emplace(vip, ShadowVip{flags, rings_.size()});
+  if (!res.second) {
+    LOG(ERROR) << "vip " << vip.toVipKey().address
+               << " already exists in shadow data plane";
+    return false;
+  }
+  rings_.reserve(rings_.size() + chRingSize_);
+  for (auto num : chRing) {
+    // same as uninitialized ch_rings's entry in forwarding plane
+    rings_.push_back(num < 0 ? 0 : num);
+  }
+  return true;
+}
+
+void KatranShadowDataPlane::addReal(
+    uint32_t num,
+    const folly::IPAddress& addr) {
+  if (num >= reals_.size()) {
+    reals_.resize(num + 1);
+  }
+  reals_[num] = addr;
+}
+
+void KatranShadowDataPlane::addSrcRoutingRule(
+    const folly::CIDRNetwork& src,
+    uint32_t num) {
+  SrcPrefixKey key{0, 0, src.second};
+  if (src.first.isV4()) {
+    uint64_t mask = prefixMask64(src.second) >> 32;
+    key.lo = src.first.asV4().toLongHBO() & mask;
+    insertPrefixLen(srcPrefixLensV4_, src.second);
+  } else {
+    auto bytes = src.first.asV6().bytes();
+    uint64_t hi;
+    uint64_t lo;
+    std::memcpy(&hi, bytes, sizeof(hi));
+    std::memcpy(&lo, bytes + sizeof(hi), sizeof(lo));
+    key.hi = folly::Endian::big(hi) & prefixMask64(src.second);
+    key.lo = folly::Endian::big(lo) &
+        prefixMask64(src.second > 64 ? src.second - 64 : 0);
+    insertPrefixLen(srcPrefixLensV6_, src.second);
+  }
+  srcRules_[key] = num;
+}
+
+const uint32_t* KatranShadowDataPlane::lookupSrc(
+    const folly::IPAddress& src) const {
+  if (src.isV4()) {
+    uint64_t addr = src.asV4().toLongHBO();
+    for (auto prefixlen : srcPrefixLensV4_) {
+      SrcPrefixKey key{0, addr & (prefixMask64(prefixlen) >> 32), prefixlen};
+      auto it = srcRules_.find(key);
+      if (it != srcRules_.end()) {
+        return &it->second;
+      }
+    }
+    return nullptr;
+  }
+  auto bytes = src.asV6().bytes();
+  uint64_t hi;
+  uint64_t lo;
+  std::memcpy(&hi, bytes, sizeof(hi));
+  std::memcpy(&lo, bytes + sizeof(hi), sizeof(lo));
+  hi = folly::Endian::big(hi);
+  lo = folly::Endian::big(lo);
+  for (auto prefixlen : srcPrefixLensV6_) {
+    SrcPrefixKey key{
+        hi & prefixMask64(prefixlen),
+        lo & prefixMask64(prefixlen > 64 ? prefixlen - 64 : 0),
+        prefixlen};
+    auto it = srcRules_.find(key);
+    if (it != srcRules_.end()) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+bool KatranShadowDataPlane::matchFlow(
+    const folly::IPAddress& src,
+    const folly::IPAddress& dst,
+    uint16_t srcPort,
+    uint16_t dstPort,
+    uint8_t proto,
+    FlowMatch& match) const {
+  if (src.empty() || src.family() != dst.family()) {
+    return false;
+  }
+  if (proto != IPPROTO_TCP && proto != IPPROTO_UDP) {
+    return false;
+  }
+  auto& vip = match.vip;
+  vip = CompactVipKey();
+  if (dst.isV4()) {
+    std::memcpy(vip.addr.data(), dst.asV4().bytes(), 4);
+    vip.family = 4;
+  } else {
+    std::memcpy(vip.addr.data(), dst.asV6().bytes(), 16);
+    vip.family = 6;
+  }
+  vip.port = dstPort;
+  vip.proto = proto;
+  auto vipIt = vips_.find(vip);
+  if (vipIt == vips_.end()) {
+    vip.port = 0;
+    vipIt = vips_.find(vip);
+    if (vipIt == vips_.end()) {
+      return false;
+    }
+    if (!(vipIt->second.flags & (kHashDportOnly | kHashSrcDstPort))) {
+      dstPort = 0;
+    }
+  }
+  auto flags = vipIt->second.flags;
+  if (flags & kHashNoSrcPort) {
+    srcPort = 0;
+  }
+
+  if (srcRouting_ && (flags & kSrcRouting)) {
+    if (auto num = lookupSrc(src)) {
+      match.srcRouted = true;
+      match.ringPos = 0;
+      match.realNum = *num;
+      return true;
+    }
+  }
+  bool dportOnly = flags & kHashDportOnly;
+  if (dportOnly) {
+    srcPort = dstPort;
+  }
+  // flow.ports is u32 over two ports in network byte order
+  uint16_t port16[2] = {
+      folly::Endian::big(srcPort), folly::Endian::big(dstPort)};
+  uint32_t ports;
+  std::memcpy(&ports, port16, sizeof(ports));
+  uint32_t hash;
+  if (src.isV6()) {
+    static const std::array<uint8_t, 16> kZeroSrc{};
+    const uint8_t* srcv6 = dportOnly ? kZeroSrc.data() : src.asV6().bytes();
+    hash = bpfJhash2Words(bpfJhash(srcv6, 16, hashSeedV6_), ports, hashSeed_);
+  } else {
+    uint32_t srcv4 = dportOnly ? 0 : src.asV4().toLong();
+    hash = bpfJhash2Words(srcv4, ports, hashSeed_);
+  }
+  match.srcRouted = false;
+  match.ringPos = hash % chRingSize_;
+  match.realNum = rings_[vipIt->second.ringOffset + match.ringPos];
+  return true;
+}
+
+const folly::IPAddress* KatranShadowDataPlane::getRealForFlow(
+    const folly::IPAddress& src,
+    const folly::IPAddress& dst,
+    uint16_t srcPort,
+    uint16_t dstPort,
+    uint8_t proto) const {
+  FlowMatch match;
+  if (!matchFlow(src, dst, srcPort, dstPort, proto, match)) {
+    return nullptr;
+  }
+  auto num = match.realNum;
+  if (num == 0 || num >= reals_.size() || reals_[num].empty()) {
+    return nullptr;
+  }
+  return &reals_[num];
+}
+
+std::string KatranShadowDataPlane::getRealForFlow(
+    const KatranFlow& flow) const {
+  auto src = folly::IPAddress::tryFromString(flow.src);
+  auto dst = folly::IPAddress::tryFromString(flow.dst);
+  if (src.hasError() || dst.hasError()) {
+    return "";
+  }
+  auto real = getRealForFlow(
+      src.value(), dst.value(), flow.srcPort, flow.dstPort, flow.proto);
+  return real ? real->str() : "";
+}
+
+std::vector<std::string> KatranShadowDataPlane::getRealsForFlows(
+    const std::vector<KatranFlow>& flows) const {
+  std::vector<std::string> reals;
+  reals.reserve(flows.size());
+  for (const auto& flow : flows) {
+    reals.push_back(getRealForFlow(flow));
+  }
+  return reals;
+}
+
+} // namespace katran
@@ -0,0 +1,196 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <folly/IPAddress.h>
+#include <folly/container/F14Map.h>
+
+#include "katran/lib/CompactVipKey.h"
+#include "katran/lib/KatranSimulatorUtils.h"
+
+namespace katran {
+
+/**
+ * userspace port of jhash from linux_includes/jhash.h. must produce exactly
+ * the same values as the one which is used by the forwarding plane
+ */
+uint32_t bpfJhash(const void* key, uint32_t length, uint32_t initval);
+
+uint32_t bpfJhash2Words(uint32_t a, uint32_t b, uint32_t initval);
+
+/**
+ * KatranShadowDataPlane is a userspace replica of the routing decision,
+ * which is made by balancer.bpf.c for a new flow: vip lookup (w/ fallback to
+ * port 0 vip), hashing related vip flags, source based routing and
+ * consistent hashing w/ the same jhash and ch ring position. it allows to
+ * answer "where would this flow go" for millions of flows w/o running them
+ * through the bpf program.
+ *
+ * state which is only known to the forwarding plane is not replicated:
+ * connection table (LRU), quic's connection id and tcp's server id routing,
+ * udp stable routing, local delivery and flood protection. for such flows
+ * the result is the real, which would be picked by consistent hashing.
+ *
+ * shadow is an immutable copy of KatranLb's state and must be recreated
+ * (e.g. w/ KatranLb::getShadowDataPlane) after any configuration change.
+ */
+class KatranShadowDataPlane {
+ public:
+  /**
+   * @param uint32_t chRingSize size of the ch ring (RING_SIZE)
+   * @param uint32_t maxVips max number of vips (MAX_VIPS). jhash seeds are
+   * derived from it in the same way as in balancer_consts.h
+   * @param bool srcRouting true if forwarding plane is built w/
+   * LPM_SRC_LOOKUP
+   */
+  KatranShadowDataPlane(uint32_t chRingSize, uint32_t maxVips, bool srcRouting);
+
+  /**
+   * @param CompactVipKey& vip to add
+   * @param uint32_t flags vip's flags
+   * @param vector<int>& chRing real's index for each ring position (-1 if
+   * position is unset)
+   * @return bool true on success
+   */
+  bool addVip(
+      const CompactVipKey& vip,
+      uint32_t flags,
+      const std::vector<int>& chRing);
+
+  /**
+   * @param uint32_t num real's index
+   * @param IPAddress& addr real's address
+   */
+  void addReal(uint32_t num, const folly::IPAddress& addr);
+
+  /**
+   * @param CIDRNetwork& src source prefix
+   * @param uint32_t num index of the real where prefix is routed to
+   */
+  void addSrcRoutingRule(const folly::CIDRNetwork& src, uint32_t num);
+
+  /**
+   * flow's classification by the forwarding plane
+   */
+  struct FlowMatch {
+    // vip which flow belongs to (w/ port 0 if matched by port 0 fallback)
+    CompactVipKey vip;
+    // true if real is picked by source based routing
+    bool srcRouted{false};
+    // position in vip's ch ring (if not srcRouted)
+    uint32_t ringPos{0};
+    // real's index. 0 if ch ring's position is unset
+    uint32_t realNum{0};
+  };
+
+  /**
+   * @return bool true if flow belongs to one of the vips. ports are in host
+   * byte order
+   */
+  bool matchFlow(
+      const folly::IPAddress& src,
+      const folly::IPAddress& dst,
+      uint16_t srcPort,
+      uint16_t dstPort,
+      uint8_t proto,
+      FlowMatch& match) const;
+
+  /**
+   * @return const IPAddress* address of the real, where flow is going to be
+   * sent, or nullptr if flow does not match any vip or would be dropped.
+   * ports are in host byte order
+   */
+  const folly::IPAddress* getRealForFlow(
+      const folly::IPAddress& src,
+      const folly::IPAddress& dst,
+      uint16_t srcPort,
+      uint16_t dstPort,
+      uint8_t proto) const;
+
+  /**
+   * @param KatranFlow& flow that we are interested in
+   * @return string ip address of the real (or empty string if packet will not
+   * be sent). same contract as KatranSimulator::getRealForFlow
+   */
+  std::string getRealForFlow(const KatranFlow& flow) const;
+
+  /**
+   * batch version of getRealForFlow. results are in the same order as flows
+   */
+  std::vector<std::string> getRealsForFlows(
+      const std::vector<KatranFlow>& flows) const;
+
+  uint32_t getVipsCount() const {
+    return vips_.size();
+  }
+
+ private:
+  struct ShadowVip {
+    uint32_t flags;
+    // position of vip's ring in rings_
+    size_t ringOffset;
+  };
+
+  /**
+   * src prefix in the form of masked address and prefix length. v4 address
+   * is stored in the lower 32 bits of lo
+   */
+  struct SrcPrefixKey {
+    uint64_t hi;
+    uint64_t lo;
+    uint8_t prefixlen;
+
+    bool operator==(const SrcPrefixKey& other) const {
+      return hi == other.hi && lo == other.lo && prefixlen == other.prefixlen;
+    }
+  };
+
+  struct SrcPrefixKeyHasher {
+    std::size_t operator()(const SrcPrefixKey& k) const;
+  };
+
+  /**
+   * helper function to find longest src prefix, which contains address
+   * @return const uint32_t* real's index or nullptr if there is no match
+   */
+  const uint32_t* lookupSrc(const folly::IPAddress& src) const;
+
+  uint32_t chRingSize_;
+  uint32_t hashSeed_;
+  uint32_t hashSeedV6_;
+  bool srcRouting_;
+
+  folly::F14FastMap<CompactVipKey, ShadowVip, CompactVipKeyHasher> vips_;
+
+  // ch rings of all vips, one after another. 0 for unset position
+  std::vector<uint32_t> rings_;
+
+  // real's index to real's address. empty address for unused index
+  std::vector<folly::IPAddress> reals_;
+
+  folly::F14FastMap<SrcPrefixKey, uint32_t, SrcPrefixKeyHasher> srcRules_;
+
+  // prefix lengths of src rules (per family), longest first
+  std::vector<uint8_t> srcPrefixLensV4_;
+  std::vector<uint8_t> srcPrefixLensV6_;
+};
+
+} // namespace katran
@@ -16,8 +16,13 @@
 
 #include "katran/lib/KatranSimulator.h"
 
+#include <folly/hash/Hash.h>
+#include <folly/synchronization/Baton.h>
 #include <glog/logging.h>
+#include <sched.h>
+#include <algorithm>
 #include <cstring>
+#include <thread>
 
 #include "katran/lib/BpfAdapter.h"
 #include "katran/lib/KatranSimulatorUtils.h"
@@ -37,9 +42,57 @@ constexpr uint16_t kTestPacketSize = 512;
 constexpr int kTestRepeatCount = 1;
 constexpr uint8_t kDefaultTtl = 64;
 constexpr folly::StringPiece kEmptyString = "";
+
+void affinitizeToCpu(folly::EventBase* evb, uint32_t cpu) {
+  evb->runInEventBaseThreadAndWait([cpu]() {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    pthread_t currentThread = pthread_self();
+    auto ret =
+        pthread_setaffinity_np(currentThread, sizeof(cpu_set_t), &cpuSet);
+    if (ret != 0) {
+      LOG(ERROR) << "Error while affinitizing simulator thread to CPU " << cpu
+                 << ": " << ret;
+    }
+  });
+}
+
+// cpus which the process is allowed to run on. pinning a thread to any other
+// cpu (e.g. inside of a container w/ restricted cpuset) fails
+std::vector<uint32_t> getAllowedCpus() {
+  std::vector<uint32_t> cpus;
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuSet) == 0) {
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &cpuSet)) {
+        cpus.push_back(cpu);
+      }
+    }
+  } else {
+    PLOG(ERROR) << "Error while getting cpu affinity of simulator";
+  }
+  if (cpus.empty()) {
+    uint32_t nCpus = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t cpu = 0; cpu < nCpus; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+size_t flowShard(const KatranFlow& flow, size_t numShards) {
+  auto hash = folly::hash::hash_combine(
+      flow.src, flow.dst, flow.srcPort, flow.dstPort, flow.proto);
+  return hash % numShards;
+}
 } // namespace
 
-KatranSimulator::KatranSimulator(int progFd) : progFd_(progFd) {
+KatranSimulator::KatranSimulator(int progFd, uint32_t batchThreads)
+    : progFd_(progFd),
+      batchThreads_(batchThreads),
+      allowedCpus_(getAllowedCpus()) {
   affinitizeSimulatorThread();
 }
 
@@ -107,19 +160,83 @@ const std::string KatranSimulator::getRealForFlow(const KatranFlow& flow) {
   return KatranSimulatorUtils::getPcktDst(rpckt);
 }
 
-void KatranSimulator::affinitizeSimulatorThread() {
-  simulatorEvb_.getEventBase()->runInEventBaseThreadAndWait([]() {
-    cpu_set_t cpuSet;
-    CPU_ZERO(&cpuSet);
-    CPU_SET(0, &cpuSet);
-    pthread_t currentThread = pthread_self();
-    auto ret =
-        pthread_setaffinity_np(currentThread, sizeof(cpu_set_t), &cpuSet);
-    if (ret != 0) {
-      LOG(ERROR) << "Error while affinitizing simulator thread to CPU 0: "
-                 << ret;
+std::vector<std::string> KatranSimulator::getRealsForFlows(
+    const std::vector<KatranFlow>& flows) {
+  std::vector<std::string> reals(flows.size());
+  if (flows.empty()) {
+    return reals;
+  }
+  initBatchThreads();
+  std::vector<std::vector<size_t>> shards(batchEvbs_.size());
+  for (size_t i = 0; i < flows.size(); i++) {
+    shards[flowShard(flows[i], shards.size())].push_back(i);
+  }
+  std::vector<folly::Baton<>> done(shards.size());
+  for (size_t shard = 0; shard < shards.size(); shard++) {
+    batchEvbs_[shard]->getEventBase()->runInEventBaseThread([&, shard]() {
+      simulateFlows(flows, shards[shard], reals);
+      done[shard].post();
+    });
+  }
+  for (auto& baton : done) {
+    baton.wait();
+  }
+  return reals;
+}
+
+void KatranSimulator::simulateFlows(
+    const std::vector<KatranFlow>& flows,
+    const std::vector<size_t>& positions,
+    std::vector<std::string>& reals) {
+  auto pckt = folly::IOBuf::create(kTestPacketSize);
+  auto rpckt = folly::IOBuf::create(kMaxXdpPcktSize);
+  if (!pckt || !rpckt) {
+    LOG(ERROR) << "not able to allocate memory for simulated packets";
+    return;
+  }
+  for (auto pos : positions) {
+    if (!KatranSimulatorUtils::fillPacketFromFlow(
+            flows[pos], pckt, kTestPacketSize, kDefaultTtl)) {
+      continue;
+    }
+    uint32_t output_pckt_size{0};
+    uint32_t prog_ret_val{0};
+    rpckt->clear();
+    auto res = BpfAdapter::testXdpProg(
+        progFd_,
+        kTestRepeatCount,
+        pckt->writableData(),
+        pckt->length(),
+        rpckt->writableData(),
+        &output_pckt_size,
+        &prog_ret_val);
+    if (res < 0) {
+      LOG(ERROR) << "failed to run simulator";
+      continue;
+    }
+    if (prog_ret_val != XDP_TX) {
+      continue;
+    }
+    rpckt->append(output_pckt_size);
+    reals[pos] = KatranSimulatorUtils::getPcktDst(rpckt);
+  }
+}
+
+void KatranSimulator::initBatchThreads() {
+  std::call_once(batchThreadsInit_, [this]() {
+    auto numThreads = batchThreads_ ? batchThreads_ : allowedCpus_.size();
+    for (uint32_t i = 0; i < numThreads; i++) {
+      auto evb = std::make_unique<folly::ScopedEventBaseThread>(
+          "KatranSimulatorBatch");
+      affinitizeToCpu(
+          evb->getEventBase(), allowedCpus_[i % allowedCpus_.size()]);
+      batchEvbs_.push_back(std::move(evb));
     }
   });
 }
 
+void KatranSimulator::affinitizeSimulatorThread() {
+  affinitizeToCpu(simulatorEvb_.getEventBase(), allowedCpus_[0]);
+}
+
 } // namespace katran
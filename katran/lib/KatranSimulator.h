@@ -19,9 +19,11 @@
 #include <folly/io/IOBuf.h>
 #include <folly/io/async/ScopedEventBaseThread.h>
 #include <memory>
+#include <mutex>
 #include "katran/lib/KatranSimulatorUtils.h"
 
 #include <string>
+#include <vector>
 
 namespace katran {
 
@@ -34,8 +36,11 @@ class KatranSimulator final {
  public:
   /**
    * @param int progFd descriptor of katran xdp program
+   * @param uint32_t batchThreads number of threads used by getRealsForFlows.
+   * 0 - one per cpu which the process is allowed to run on. threads are
+   * started on the first batch
    */
-  explicit KatranSimulator(int progFd);
+  explicit KatranSimulator(int progFd, uint32_t batchThreads = 0);
   ~KatranSimulator();
 
   /**
@@ -44,10 +49,29 @@ class KatranSimulator final {
    * be sent)
    *
    * getRealForFlow helps to determines where specific flow is going to be sent
-   * by returning ip address of the real
+   * by returning ip address of the real. simulation runs on the first cpu
+   * which the process is allowed to run on, so LRU entries which it creates
+   * (or hits) are in this cpu's LRU map
    */
   const std::string getRealForFlow(const KatranFlow& flow);
 
+  /**
+   * @param vector<KatranFlow>& flows that we are interested in
+   * @return vector<string> ip address of the real for each of the flows, in
+   * the same order (empty string if packet will not be sent)
+   *
+   * batch version of getRealForFlow. flows are sharded by their 5 tuple
+   * between simulator threads, each of them is affinitized to its own cpu
+   * (out of the ones the process is allowed to run on), so the same flow
+   * always hits the same per-CPU maps from batch to batch. that cpu is not
+   * necessarily the one getRealForFlow is using: if flow's LRU entries differ
+   * between cpus (e.g. after reals have been changed), results could differ
+   * as well. packets are built in per thread buffers, which are reused for
+   * all the flows of the batch
+   */
+  std::vector<std::string> getRealsForFlows(
+      const std::vector<KatranFlow>& flows);
+
   // runSimulation takes packet (in iobuf represenation) and
   // run it through katran bpf program. It returns a modified pckt, if the
   // result was XDP_TX or nullptr otherwise.
@@ -58,12 +82,40 @@ class KatranSimulator final {
   std::unique_ptr<folly::IOBuf> runSimulationInternal(
       std::unique_ptr<folly::IOBuf> pckt);
 
-  // Affinitize simulator evb thread to CPU 0.
+  // Affinitize simulator evb thread to the first allowed CPU.
   // This ensures that subsequent simulations run on the same CPU and hit
   // same per-CPU maps.
   void affinitizeSimulatorThread();
 
+  /**
+   * helper function to start batch threads (if not yet started)
+   */
+  void initBatchThreads();
+
+  /**
+   * helper function to simulate flows w/ specified positions in the batch.
+   * runs in one of the batch threads
+   */
+  void simulateFlows(
+      const std::vector<KatranFlow>& flows,
+      const std::vector<size_t>& positions,
+      std::vector<std::string>& reals);
+
   int progFd_;
+  uint32_t batchThreads_;
   folly::ScopedEventBaseThread simulatorEvb_{"KatranSimulator"};
+
+  /**
+   * cpus which the process is allowed to run on (sched_getaffinity)
+   */
+  std::vector<uint32_t> allowedCpus_;
+
+  std::once_flag batchThreadsInit_;
+
+  /**
+   * threads which run batched simulations. thread i is affinitized to
+   * allowedCpus_[i % allowedCpus_.size()]
+   */
+  std::vector<std::unique_ptr<folly::ScopedEventBaseThread>> batchEvbs_;
 };
 } // namespace katran
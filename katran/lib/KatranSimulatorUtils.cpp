@@ -146,6 +146,22 @@ std::unique_ptr<folly::IOBuf> KatranSimulatorUtils::createPacketFromFlow(
     const KatranFlow& flow,
     uint16_t packetSize,
     uint8_t ttl) {
+  auto pckt = folly::IOBuf::create(packetSize);
+  if (!pckt) {
+    LOG(ERROR) << "cannot allocate IOBuf";
+    return pckt;
+  }
+  if (!fillPacketFromFlow(flow, pckt, packetSize, ttl)) {
+    return nullptr;
+  }
+  return pckt;
+}
+
+bool KatranSimulatorUtils::fillPacketFromFlow(
+    const KatranFlow& flow,
+    std::unique_ptr<folly::IOBuf>& pckt,
+    uint16_t packetSize,
+    uint8_t ttl) {
   int offset = sizeof(struct ethhdr);
   bool is_tcp = true;
   bool is_v4 = true;
@@ -156,18 +172,13 @@ std::unique_ptr<folly::IOBuf> KatranSimulatorUtils::createPacketFromFlow(
   if (srcExp.hasError() || dstExp.hasError()) {
     LOG(ERROR) << "malformed src or dst ip address. src: " << flow.src
                << " dst: " << flow.dst;
-    return nullptr;
+    return false;
   }
   auto src = srcExp.value();
   auto dst = dstExp.value();
   if (src.family() != dst.family()) {
     LOG(ERROR) << "src and dst must have same address family";
-    return nullptr;
-  }
-  auto pckt = folly::IOBuf::create(packetSize);
-  if (!pckt) {
-    LOG(ERROR) << "cannot allocate IOBuf";
-    return pckt;
+    return false;
   }
   if (src.family() == AF_INET) {
     l3hdr_len = sizeof(struct iphdr);
@@ -185,7 +196,12 @@ std::unique_ptr<folly::IOBuf> KatranSimulatorUtils::createPacketFromFlow(
     default:
       LOG(ERROR) << "unsupported protocol: " << flow.proto
                  << " must be either TCP or UDP";
-      return nullptr;
+      return false;
+  }
+  pckt->clear();
+  if (pckt->tailroom() < packetSize) {
+    LOG(ERROR) << "buffer is too small for the packet of size " << packetSize;
+    return false;
   }
   pckt->append(packetSize);
   auto payload_size = packetSize - sizeof(struct ethhdr);
@@ -200,7 +216,7 @@ std::unique_ptr<folly::IOBuf> KatranSimulatorUtils::createPacketFromFlow(
   } else {
     createUdpHeader(pckt, flow.srcPort, flow.dstPort, offset, payload_size);
   }
-  return pckt;
+  return true;
 }
 
 } // namespace katran
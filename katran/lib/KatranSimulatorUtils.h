@@ -69,6 +69,17 @@ class KatranSimulatorUtils {
       uint16_t packetSize,
       uint8_t ttl = 64);
 
+  /**
+   * Same as createPacketFromFlow, but packet is written into existing buffer
+   * (w/ at least packetSize bytes of capacity), so it could be reused for
+   * many flows. Returns false if packet can't be created for the flow
+   */
+  static bool fillPacketFromFlow(
+      const KatranFlow& flow,
+      std::unique_ptr<folly::IOBuf>& pckt,
+      uint16_t packetSize,
+      uint8_t ttl = 64);
+
   /**
    * Create TCP header in the packet buffer
    */
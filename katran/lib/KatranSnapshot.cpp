@@ -0,0 +1,437 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/KatranSnapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <folly/hash/Checksum.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+constexpr size_t kSnapshotAlignment = 8;
+constexpr std::array<size_t, kSnapshotNumSections> kSectionRecordSize = {
+    sizeof(SnapshotReal),
+    sizeof(SnapshotVip),
+    sizeof(SnapshotVipReal),
+    sizeof(int32_t),
+    sizeof(SnapshotServerId),
+    sizeof(SnapshotSrcRule),
+};
+constexpr std::array<const char*, kSnapshotNumSections> kSectionNames = {
+    "reals",
+    "vips",
+    "vip_reals",
+    "rings",
+    "server_ids",
+    "src_rules",
+};
+
+size_t alignOffset(size_t offset) {
+  return (offset + kSnapshotAlignment - 1) & ~(kSnapshotAlignment - 1);
+}
+
+void addrToSnapshot(const folly::IPAddress& addr, uint8_t* out, uint8_t& isV6) {
+  std::memset(out, 0, 16);
+  std::memcpy(out, addr.bytes(), addr.byteCount());
+  isV6 = addr.isV6();
+}
+
+folly::IPAddress addrFromSnapshot(const uint8_t* addr, uint8_t isV6) {
+  if (isV6) {
+    return folly::IPAddressV6::fromBinary(folly::ByteRange(addr, 16));
+  }
+  return folly::IPAddressV4::fromBinary(folly::ByteRange(addr, 4));
+}
+
+/**
+ * appends data to the file and keeps track of current offset and checksum
+ */
+class SnapshotFileWriter {
+ public:
+  SnapshotFileWriter(int fd, uint64_t offset) : fd_(fd), offset_(offset) {}
+
+  bool append(const void* data, size_t size) {
+    if (size == 0) {
+      return true;
+    }
+    if (folly::writeFull(fd_, data, size) != static_cast<ssize_t>(size)) {
+      return false;
+    }
+    crc_ = folly::crc32c(static_cast<const uint8_t*>(data), size, crc_);
+    offset_ += size;
+    return true;
+  }
+
+  bool align() {
+    static const std::array<uint8_t, kSnapshotAlignment> zeroes{};
+    return append(zeroes.data(), alignOffset(offset_) - offset_);
+  }
+
+  template <typename T>
+  bool appendSection(
+      SnapshotHeader& header,
+      SnapshotSectionId id,
+      const std::vector<T>& records) {
+    if (!align()) {
+      return false;
+    }
+    header.sections[id].offset = offset_;
+    header.sections[id].count = records.size();
+    return append(records.data(), records.size() * sizeof(T));
+  }
+
+  uint64_t offset() const {
+    return offset_;
+  }
+
+  uint32_t crc() const {
+    return crc_;
+  }
+
+ private:
+  int fd_;
+  uint64_t offset_;
+  uint32_t crc_{~0U};
+};
+} // namespace
+
+KatranSnapshot::~KatranSnapshot() {
+  ::munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+bool KatranSnapshot::write(
+    const std::string& path,
+    const KatranSnapshotData& data) {
+  std::vector<SnapshotReal> reals;
+  std::vector<SnapshotVip> vips;
+  std::vector<SnapshotVipReal> vipReals;
+  std::vector<SnapshotServerId> serverIds;
+  std::vector<SnapshotSrcRule> srcRules;
+
+  for (const auto& real : data.reals) {
+    SnapshotReal rec{};
+    addrToSnapshot(real.address, rec.addr, rec.isV6);
+    rec.num = real.num;
+    rec.flags = real.flags;
+    reals.push_back(rec);
+  }
+  for (const auto& vip : data.vips) {
+    if (vip.chRing.size() != data.chRingSize) {
+      LOG(ERROR) << "ch ring of vip " << vip.vip.address
+                 << " has unexpected size " << vip.chRing.size();
+      return false;
+    }
+    SnapshotVip rec{};
+    addrToSnapshot(folly::IPAddress(vip.vip.address), rec.addr, rec.isV6);
+    rec.port = vip.vip.port;
+    rec.proto = vip.vip.proto;
+    rec.vipNum = vip.vipNum;
+    rec.flags = vip.flags;
+    rec.hashFunction = static_cast<uint32_t>(vip.hashFunction);
+    rec.realsOffset = vipReals.size();
+    rec.realsCount = vip.reals.size();
+    for (const auto& real : vip.reals) {
+      vipReals.push_back(SnapshotVipReal{real.hash, real.num, real.weight});
+    }
+    vips.push_back(rec);
+  }
+  for (const auto& serverId : data.serverIds) {
+    serverIds.push_back(SnapshotServerId{serverId.first, serverId.second});
+  }
+  for (const auto& rule : data.srcRules) {
+    SnapshotSrcRule rec{};
+    addrToSnapshot(rule.first.first, rec.addr, rec.isV6);
+    rec.prefixlen = rule.first.second;
+    rec.num = rule.second;
+    srcRules.push_back(rec);
+  }
+
+  auto tmpPath = path + ".tmp";
+  int fd = ::open(
+      tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG(ERROR) << "can't create snapshot " << tmpPath
+               << ", error: " << folly::errnoStr(errno);
+    return false;
+  }
+  bool success = false;
+  SCOPE_EXIT {
+    ::close(fd);
+    if (!success) {
+      ::unlink(tmpPath.c_str());
+    }
+  };
+
+  SnapshotHeader header{};
+  header.magic = kSnapshotMagic;
+  header.version = kSnapshotVersion;
+  header.headerSize = sizeof(SnapshotHeader);
+  header.chRingSize = data.chRingSize;
+  header.createdAt = std::time(nullptr);
+  // header is written last, when checksum and layout are known
+  if (folly::writeFull(fd, &header, sizeof(header)) != sizeof(header)) {
+    LOG(ERROR) << "can't write snapshot header: " << folly::errnoStr(errno);
+    return false;
+  }
+  SnapshotFileWriter writer(fd, sizeof(header));
+  bool res = writer.appendSection(header, kSnapshotReals, reals) &&
+      writer.appendSection(header, kSnapshotVips, vips) &&
+      writer.appendSection(header, kSnapshotVipReals, vipReals) &&
+      writer.align();
+  if (res) {
+    header.sections[kSnapshotRings].offset = writer.offset();
+    header.sections[kSnapshotRings].count =
+        static_cast<uint64_t>(data.vips.size()) * data.chRingSize;
+    for (const auto& vip : data.vips) {
+      static_assert(sizeof(int) == sizeof(int32_t), "unexpected int size");
+      res = res &&
+          writer.append(vip.chRing.data(), vip.chRing.size() * sizeof(int));
+    }
+  }
+  res = res && writer.appendSection(header, kSnapshotServerIds, serverIds) &&
+      writer.appendSection(header, kSnapshotSrcRules, srcRules);
+  if (!res) {
+    LOG(ERROR) << "can't write snapshot: " << folly::errnoStr(errno);
+    return false;
+  }
+  header.fileSize = writer.offset();
+  header.checksum = writer.crc();
+  if (folly::pwriteFull(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      ::fsync(fd) != 0) {
+    LOG(ERROR) << "can't finalize snapshot: " << folly::errnoStr(errno);
+    return false;
+  }
+  if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    LOG(ERROR) << "can't rename snapshot to " << path
+               << ", error: " << folly::errnoStr(errno);
+    return false;
+  }
+  success = true;
+  // rename is durable only after directory's entry has been synced
+  auto slash = path.rfind('/');
+  std::string dir = ".";
+  if (slash != std::string::npos) {
+    dir = slash == 0 ? "/" : path.substr(0, slash);
+  }
+  int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd < 0 || ::fsync(dirFd) != 0) {
+    LOG(ERROR) << "can't sync directory " << dir
+               << " of snapshot, error: " << folly::errnoStr(errno);
+    if (dirFd >= 0) {
+      ::close(dirFd);
+    }
+    return false;
+  }
+  ::close(dirFd);
+  return true;
+}
+
+folly::Expected<std::unique_ptr<KatranSnapshot>, std::string>
+KatranSnapshot::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return folly::makeUnexpected(fmt::format(
+        "can't open snapshot {}: {}", path, folly::errnoStr(errno)));
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return folly::makeUnexpected(
+        fmt::format("can't stat snapshot: {}", folly::errnoStr(errno)));
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    ::close(fd);
+    return folly::makeUnexpected(
+        fmt::format("snapshot is too small: {} bytes", size));
+  }
+  auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return folly::makeUnexpected(
+        fmt::format("can't mmap snapshot: {}", folly::errnoStr(errno)));
+  }
+  std::unique_ptr<KatranSnapshot> snapshot(
+      new KatranSnapshot(static_cast<const uint8_t*>(addr), size));
+
+  const auto& header = snapshot->header();
+  if (header.magic != kSnapshotMagic) {
+    return folly::makeUnexpected(std::string("not a katran snapshot"));
+  }
+  if (header.version != kSnapshotVersion ||
+      header.headerSize != sizeof(SnapshotHeader)) {
+    return folly::makeUnexpected(fmt::format(
+        "unsupported snapshot version {} (header size {})",
+        header.version,
+        header.headerSize));
+  }
+  if (header.fileSize != size) {
+    return folly::makeUnexpected(fmt::format(
+        "snapshot is truncated: {} bytes, expected {}", size, header.fileSize));
+  }
+  auto crc = folly::crc32c(
+      snapshot->data_ + header.headerSize, size - header.headerSize);
+  if (crc != header.checksum) {
+    return folly::makeUnexpected(fmt::format(
+        "snapshot checksum mismatch: {:#x}, expected {:#x}",
+        crc,
+        header.checksum));
+  }
+  for (uint32_t id = 0; id < kSnapshotNumSections; id++) {
+    const auto& sec = header.sections[id];
+    if (sec.offset % kSnapshotAlignment != 0 ||
+        sec.offset < header.headerSize || sec.offset > size ||
+        sec.count > (size - sec.offset) / kSectionRecordSize[id]) {
+      return folly::makeUnexpected(
+          fmt::format("section {} is out of bounds", kSectionNames[id]));
+    }
+  }
+  auto vips = snapshot->vips();
+  if (header.sections[kSnapshotRings].count !=
+      static_cast<uint64_t>(vips.size()) * header.chRingSize) {
+    return folly::makeUnexpected(std::string("unexpected size of ch rings"));
+  }
+  auto numVipReals = snapshot->vipReals().size();
+  for (const auto& vip : vips) {
+    if (static_cast<uint64_t>(vip.realsOffset) + vip.realsCount >
+            numVipReals ||
+        vip.hashFunction > static_cast<uint32_t>(HashFunction::MaglevV2)) {
+      return folly::makeUnexpected(
+          fmt::format("vip #{} has invalid reals or hash function", vip.vipNum));
+    }
+  }
+  return snapshot;
+}
+
+folly::Range<const int32_t*> KatranSnapshot::ring(size_t vipPos) const {
+  auto rings = section<int32_t>(kSnapshotRings);
+  auto ringSize = header().chRingSize;
+  return rings.subpiece(vipPos * ringSize, ringSize);
+}
+
+KatranSnapshotData KatranSnapshot::toData() const {
+  KatranSnapshotData data;
+  data.chRingSize = header().chRingSize;
+  for (const auto& real : reals()) {
+    data.reals.push_back(KatranSnapshotReal{
+        addrFromSnapshot(real.addr, real.isV6), real.num, real.flags});
+  }
+  auto allVips = vips();
+  auto allVipReals = vipReals();
+  for (size_t i = 0; i < allVips.size(); i++) {
+    const auto& rec = allVips[i];
+    KatranSnapshotVip vip;
+    vip.vip.address = addrFromSnapshot(rec.addr, rec.isV6).str();
+    vip.vip.port = rec.port;
+    vip.vip.proto = rec.proto;
+    vip.vipNum = rec.vipNum;
+    vip.flags = rec.flags;
+    vip.hashFunction = static_cast<HashFunction>(rec.hashFunction);
+    for (uint32_t j = 0; j < rec.realsCount; j++) {
+      const auto& real = allVipReals[rec.realsOffset + j];
+      vip.reals.push_back(Endpoint{real.num, real.weight, real.hash});
+    }
+    auto vipRing = ring(i);
+    vip.chRing.assign(vipRing.begin(), vipRing.end());
+    data.vips.push_back(std::move(vip));
+  }
+  for (const auto& serverId : serverIds()) {
+    data.serverIds.emplace_back(serverId.id, serverId.num);
+  }
+  for (const auto& rule : srcRules()) {
+    data.srcRules.emplace_back(
+        folly::CIDRNetwork(addrFromSnapshot(rule.addr, rule.isV6), rule.prefixlen),
+        rule.num);
+  }
+  return data;
+}
+
+std::string KatranSnapshot::dump(bool withRings) const {
+  const auto& hdr = header();
+  std::string out = fmt::format(
+      "version: {}\nsize: {}\nchecksum: {:#x}\ncreated at: {}\n"
+      "ch ring size: {}\n",
+      hdr.version,
+      hdr.fileSize,
+      hdr.checksum,
+      hdr.createdAt,
+      hdr.chRingSize);
+  for (uint32_t id = 0; id < kSnapshotNumSections; id++) {
+    out += fmt::format(
+        "section {}: offset {} records {}\n",
+        kSectionNames[id],
+        hdr.sections[id].offset,
+        hdr.sections[id].count);
+  }
+  for (const auto& real : reals()) {
+    out += fmt::format(
+        "real #{}: {} flags {:#x}\n",
+        real.num,
+        addrFromSnapshot(real.addr, real.isV6).str(),
+        real.flags);
+  }
+  auto allVips = vips();
+  auto allVipReals = vipReals();
+  for (size_t i = 0; i < allVips.size(); i++) {
+    const auto& vip = allVips[i];
+    out += fmt::format(
+        "vip #{}: {}:{}:{} flags {:#x} hash function {}\n",
+        vip.vipNum,
+        addrFromSnapshot(vip.addr, vip.isV6).str(),
+        vip.port,
+        vip.proto,
+        vip.flags,
+        vip.hashFunction);
+    for (uint32_t j = 0; j < vip.realsCount; j++) {
+      const auto& real = allVipReals[vip.realsOffset + j];
+      out += fmt::format("  real #{} weight {}\n", real.num, real.weight);
+    }
+    if (withRings) {
+      out += "  ring:";
+      for (auto pos : ring(i)) {
+        out += fmt::format(" {}", pos);
+      }
+      out += "\n";
+    }
+  }
+  for (const auto& serverId : serverIds()) {
+    out += fmt::format("server id {}: real #{}\n", serverId.id, serverId.num);
+  }
+  for (const auto& rule : srcRules()) {
+    out += fmt::format(
+        "src rule {}/{}: real #{}\n",
+        addrFromSnapshot(rule.addr, rule.isV6).str(),
+        rule.prefixlen,
+        rule.num);
+  }
+  return out;
+}
+
+} // namespace katran
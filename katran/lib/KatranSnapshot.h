@@ -0,0 +1,233 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <folly/Expected.h>
+#include <folly/IPAddress.h>
+#include <folly/Range.h>
+
+#include "katran/lib/CHHelpers.h"
+#include "katran/lib/KatranLbStructs.h"
+
+namespace katran {
+
+/**
+ * on-disk snapshot of katran's control plane state. snapshot is a single
+ * file: fixed size header followed by sections w/ arrays of fixed size
+ * records, so it could be mmap'ed and used w/o any parsing. ch rings are
+ * stored as is, so they could be restored w/o hash ring recalculation.
+ *
+ * all values are in host byte order. snapshot is not meant to be moved
+ * between hosts w/ different endianness.
+ */
+constexpr uint64_t kSnapshotMagic = 0x50414e534e525441; // "ATRNSNAP"
+constexpr uint32_t kSnapshotVersion = 1;
+
+enum SnapshotSectionId : uint32_t {
+  kSnapshotReals = 0,
+  kSnapshotVips,
+  kSnapshotVipReals,
+  kSnapshotRings,
+  kSnapshotServerIds,
+  kSnapshotSrcRules,
+  kSnapshotNumSections,
+};
+
+struct SnapshotSection {
+  // offset from the beginning of the file
+  uint64_t offset;
+  // number of records in section
+  uint64_t count;
+};
+
+struct SnapshotHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t fileSize;
+  // crc32c of everything after the header
+  uint32_t checksum;
+  uint32_t chRingSize;
+  // unix time (in seconds) when snapshot has been created
+  uint64_t createdAt;
+  SnapshotSection sections[kSnapshotNumSections];
+};
+
+struct SnapshotReal {
+  uint8_t addr[16];
+  uint32_t num;
+  uint8_t flags;
+  uint8_t isV6;
+  uint16_t pad;
+};
+
+struct SnapshotVip {
+  uint8_t addr[16];
+  uint32_t vipNum;
+  uint32_t flags;
+  // position of the first real of this vip in kSnapshotVipReals section
+  uint32_t realsOffset;
+  uint32_t realsCount;
+  uint16_t port;
+  uint8_t proto;
+  uint8_t isV6;
+  uint32_t hashFunction;
+};
+
+struct SnapshotVipReal {
+  uint64_t hash;
+  uint32_t num;
+  uint32_t weight;
+};
+
+struct SnapshotServerId {
+  uint32_t id;
+  uint32_t num;
+};
+
+struct SnapshotSrcRule {
+  uint8_t addr[16];
+  uint32_t num;
+  uint8_t prefixlen;
+  uint8_t isV6;
+  uint16_t pad;
+};
+
+static_assert(sizeof(SnapshotReal) == 24, "unexpected SnapshotReal size");
+static_assert(sizeof(SnapshotVip) == 40, "unexpected SnapshotVip size");
+static_assert(sizeof(SnapshotVipReal) == 16, "unexpected SnapshotVipReal size");
+static_assert(sizeof(SnapshotSrcRule) == 24, "unexpected SnapshotSrcRule size");
+
+/**
+ * in-memory representation of snapshot's content
+ */
+struct KatranSnapshotVip {
+  VipKey vip;
+  uint32_t vipNum{0};
+  uint32_t flags{0};
+  HashFunction hashFunction{HashFunction::Maglev};
+  std::vector<Endpoint> reals;
+  // real's index for each position of ch ring (-1 for unset position)
+  std::vector<int> chRing;
+};
+
+struct KatranSnapshotReal {
+  folly::IPAddress address;
+  uint32_t num{0};
+  uint8_t flags{0};
+};
+
+struct KatranSnapshotData {
+  uint32_t chRingSize{0};
+  std::vector<KatranSnapshotVip> vips;
+  std::vector<KatranSnapshotReal> reals;
+  // server id to real's index
+  std::vector<std::pair<uint32_t, uint32_t>> serverIds;
+  // src prefix to real's index
+  std::vector<std::pair<folly::CIDRNetwork, uint32_t>> srcRules;
+};
+
+/**
+ * read only view of mmap'ed snapshot
+ */
+class KatranSnapshot {
+ public:
+  KatranSnapshot(const KatranSnapshot&) = delete;
+  KatranSnapshot& operator=(const KatranSnapshot&) = delete;
+  ~KatranSnapshot();
+
+  /**
+   * @param string path where snapshot is going to be stored
+   * @param KatranSnapshotData data to store
+   * @return bool true on success
+   *
+   * helper function to write snapshot. snapshot is written into temporary
+   * file first and then renamed, so readers never see partially written one
+   */
+  static bool write(const std::string& path, const KatranSnapshotData& data);
+
+  /**
+   * @param string path to snapshot
+   * @return mmap'ed snapshot or error's description
+   *
+   * helper function to mmap snapshot and validate its header, layout and
+   * checksum
+   */
+  static folly::Expected<std::unique_ptr<KatranSnapshot>, std::string> open(
+      const std::string& path);
+
+  const SnapshotHeader& header() const {
+    return *reinterpret_cast<const SnapshotHeader*>(data_);
+  }
+
+  folly::Range<const SnapshotReal*> reals() const {
+    return section<SnapshotReal>(kSnapshotReals);
+  }
+
+  folly::Range<const SnapshotVip*> vips() const {
+    return section<SnapshotVip>(kSnapshotVips);
+  }
+
+  folly::Range<const SnapshotVipReal*> vipReals() const {
+    return section<SnapshotVipReal>(kSnapshotVipReals);
+  }
+
+  folly::Range<const SnapshotServerId*> serverIds() const {
+    return section<SnapshotServerId>(kSnapshotServerIds);
+  }
+
+  folly::Range<const SnapshotSrcRule*> srcRules() const {
+    return section<SnapshotSrcRule>(kSnapshotSrcRules);
+  }
+
+  /**
+   * @return ch ring of the vip w/ specified position in vips section
+   */
+  folly::Range<const int32_t*> ring(size_t vipPos) const;
+
+  /**
+   * helper function to convert snapshot into in-memory representation
+   */
+  KatranSnapshotData toData() const;
+
+  /**
+   * @param bool withRings if true - ch rings are going to be dumped as well
+   * @return string human readable representation of the snapshot
+   */
+  std::string dump(bool withRings = false) const;
+
+ private:
+  KatranSnapshot(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T>
+  folly::Range<const T*> section(SnapshotSectionId id) const {
+    const auto& sec = header().sections[id];
+    auto begin = reinterpret_cast<const T*>(data_ + sec.offset);
+    return folly::Range<const T*>(begin, begin + sec.count);
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+};
+
+} // namespace katran
@@ -0,0 +1,258 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/KatranStatsEngine.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+constexpr uint64_t kNanosInSec = 1000000000;
+
+uint64_t monotonicNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void calculateRates(
+    const std::vector<lb_stats>& current,
+    const std::vector<lb_stats>* previous,
+    uint64_t intervalNs,
+    std::vector<lb_stats>& rates) {
+  rates.assign(current.size(), lb_stats{});
+  if (!previous || previous->size() != current.size() || intervalNs == 0) {
+    return;
+  }
+  auto perSec = [intervalNs](uint64_t cur, uint64_t prev) -> uint64_t {
+    // counters could go backward if map's entry has been reset
+    if (cur <= prev) {
+      return 0;
+    }
+    return static_cast<uint64_t>(
+        static_cast<double>(cur - prev) * kNanosInSec / intervalNs);
+  };
+  for (size_t i = 0; i < current.size(); i++) {
+    rates[i].v1 = perSec(current[i].v1, (*previous)[i].v1);
+    rates[i].v2 = perSec(current[i].v2, (*previous)[i].v2);
+  }
+}
+} // namespace
+
+static_assert(sizeof(lb_stats) % sizeof(uint64_t) == 0, "unexpected size");
+static_assert(
+    sizeof(lb_quic_packets_stats) % sizeof(uint64_t) == 0,
+    "unexpected size");
+static_assert(
+    sizeof(lb_tpr_packets_stats) % sizeof(uint64_t) == 0,
+    "unexpected size");
+
+std::optional<lb_stats> KatranStatsSnapshot::lookup(
+    const std::string& map,
+    uint32_t position) const {
+  const std::vector<lb_stats>* values = nullptr;
+  if (map == "stats") {
+    values = &stats;
+  } else if (map == "reals_stats") {
+    values = &realsStats;
+  } else if (map == "decap_vip_stats") {
+    values = &decapVipStats;
+  }
+  if (!values || position >= values->size()) {
+    return std::nullopt;
+  }
+  return (*values)[position];
+}
+
+KatranStatsEngine::KatranStatsEngine(
+    KatranStatsEngineConfig config,
+    PerCpuReader reader)
+    : config_(std::move(config)), reader_(std::move(reader)) {
+  if (config_.numCpus == 0) {
+    config_.numCpus = 1;
+  }
+}
+
+KatranStatsEngine::~KatranStatsEngine() {
+  stop();
+}
+
+void KatranStatsEngine::start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+  }
+  poll(monotonicNowNs());
+  thread_ = std::thread([this]() { run(); });
+}
+
+void KatranStatsEngine::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void KatranStatsEngine::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, config_.interval, [this] { return stopping_; })) {
+    lock.unlock();
+    poll(monotonicNowNs());
+    lock.lock();
+  }
+}
+
+bool KatranStatsEngine::readAndAggregate(
+    int fd,
+    uint32_t size,
+    size_t valueSize,
+    uint64_t* out) {
+  const size_t words = valueSize / sizeof(uint64_t);
+  std::fill(out, out + size * words, 0);
+  if (fd < 0 || size == 0) {
+    return true;
+  }
+  const size_t stride = config_.numCpus * words;
+  rawBuf_.resize(size * stride);
+  if (reader_(fd, 0, size, valueSize, rawBuf_.data()) != 0) {
+    return false;
+  }
+  // values of each key are contiguous across cpus, so the inner loops walk
+  // memory sequentially and are vectorized by the compiler
+  const uint64_t* raw = rawBuf_.data();
+  for (uint32_t key = 0; key < size; key++) {
+    const uint64_t* values = raw + key * stride;
+    uint64_t* sum = out + key * words;
+    for (uint32_t cpu = 0; cpu < config_.numCpus; cpu++) {
+      for (size_t word = 0; word < words; word++) {
+        sum[word] += values[cpu * words + word];
+      }
+    }
+  }
+  return true;
+}
+
+bool KatranStatsEngine::poll(uint64_t nowNs) {
+  std::lock_guard<std::mutex> guard(pollMutex_);
+  auto prev = getSnapshot();
+  auto snapshot = std::make_shared<KatranStatsSnapshot>();
+  snapshot->timestampNs = nowNs;
+  if (prev && nowNs > prev->timestampNs) {
+    snapshot->intervalNs = nowNs - prev->timestampNs;
+  }
+
+  bool success = true;
+  auto read = [&](int fd,
+                  uint32_t size,
+                  size_t valueSize,
+                  void* out,
+                  const void* prevOut) {
+    if (readAndAggregate(fd, size, valueSize, static_cast<uint64_t*>(out))) {
+      return true;
+    }
+    success = false;
+    failedReads_.fetch_add(1, std::memory_order_relaxed);
+    if (prevOut) {
+      std::memcpy(out, prevOut, size * valueSize);
+    }
+    return false;
+  };
+
+  snapshot->stats.resize(config_.statsSize);
+  read(
+      config_.statsFd,
+      config_.statsSize,
+      sizeof(lb_stats),
+      snapshot->stats.data(),
+      prev ? prev->stats.data() : nullptr);
+  snapshot->realsStats.resize(config_.realsStatsSize);
+  read(
+      config_.realsStatsFd,
+      config_.realsStatsSize,
+      sizeof(lb_stats),
+      snapshot->realsStats.data(),
+      prev ? prev->realsStats.data() : nullptr);
+  snapshot->decapVipStats.resize(config_.decapVipStatsSize);
+  read(
+      config_.decapVipStatsFd,
+      config_.decapVipStatsSize,
+      sizeof(lb_stats),
+      snapshot->decapVipStats.data(),
+      prev ? prev->decapVipStats.data() : nullptr);
+  // values of lru_miss_stats are u32, which kernel pads to 8 bytes
+  snapshot->lruMissStats.resize(config_.lruMissStatsSize);
+  read(
+      config_.lruMissStatsFd,
+      config_.lruMissStatsSize,
+      sizeof(uint64_t),
+      snapshot->lruMissStats.data(),
+      prev ? prev->lruMissStats.data() : nullptr);
+  read(
+      config_.tprStatsFd,
+      config_.tprStatsFd < 0 ? 0 : 1,
+      sizeof(lb_tpr_packets_stats),
+      &snapshot->tprStats,
+      prev ? &prev->tprStats : nullptr);
+  if (read(
+          config_.quicStatsFd,
+          config_.quicStatsFd < 0 ? 0 : 1,
+          sizeof(lb_quic_packets_stats),
+          &snapshot->quicStats,
+          prev ? &prev->quicStats : nullptr) &&
+      config_.quicStatsFd >= 0) {
+    // sample of invalid server id is not a counter. keep the last one seen
+    snapshot->quicStats.cid_invalid_server_id_sample = 0;
+    auto samples =
+        reinterpret_cast<const lb_quic_packets_stats*>(rawBuf_.data());
+    for (uint32_t cpu = 0; cpu < config_.numCpus; cpu++) {
+      if (samples[cpu].cid_invalid_server_id_sample) {
+        snapshot->quicStats.cid_invalid_server_id_sample =
+            samples[cpu].cid_invalid_server_id_sample;
+      }
+    }
+  }
+
+  calculateRates(
+      snapshot->stats,
+      prev ? &prev->stats : nullptr,
+      snapshot->intervalNs,
+      snapshot->statsRates);
+  calculateRates(
+      snapshot->realsStats,
+      prev ? &prev->realsStats : nullptr,
+      snapshot->intervalNs,
+      snapshot->realsRates);
+
+  snapshot_.store(std::shared_ptr<const KatranStatsSnapshot>(snapshot));
+  if (!success) {
+    VLOG(2) << "some of the stats maps could not be read";
+  }
+  return success;
+}
+
+} // namespace katran
@@ -0,0 +1,172 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <folly/concurrency/AtomicSharedPtr.h>
+
+#include "katran/lib/BalancerStructs.h"
+
+namespace katran {
+
+constexpr std::chrono::milliseconds kDefaultStatsPollInterval{1000};
+
+/**
+ * immutable view of forwarding plane's counters, aggregated across all cpus
+ * at the moment of the poll. rates are per second and are calculated
+ * against previous snapshot (they are zero in the first one)
+ */
+struct KatranStatsSnapshot {
+  // monotonic time of the poll, in ns
+  uint64_t timestampNs{0};
+  // time passed since previous snapshot, in ns. 0 for the first snapshot
+  uint64_t intervalNs{0};
+  // per position counters from "stats" map (vips' and global counters)
+  std::vector<lb_stats> stats;
+  std::vector<lb_stats> statsRates;
+  // per real's index counters from "reals_stats" map
+  std::vector<lb_stats> realsStats;
+  std::vector<lb_stats> realsRates;
+  // per vip's index counters from "decap_vip_stats" map
+  std::vector<lb_stats> decapVipStats;
+  // per real's index counters from "lru_miss_stats" map
+  std::vector<uint64_t> lruMissStats;
+  lb_quic_packets_stats quicStats{};
+  lb_tpr_packets_stats tprStats{};
+
+  /**
+   * @param string map name of the bpf map w/ lb_stats values
+   * @param uint32_t position in the map
+   * @return counters at specified position or nullopt if map is not part of
+   * the snapshot or position is out of range
+   */
+  std::optional<lb_stats> lookup(const std::string& map, uint32_t position)
+      const;
+};
+
+/**
+ * description of maps which are going to be polled. fd < 0 means that map
+ * does not exist in forwarding plane and its counters would be zeroes
+ */
+struct KatranStatsEngineConfig {
+  int statsFd{-1};
+  uint32_t statsSize{0};
+  int realsStatsFd{-1};
+  uint32_t realsStatsSize{0};
+  int decapVipStatsFd{-1};
+  uint32_t decapVipStatsSize{0};
+  int lruMissStatsFd{-1};
+  uint32_t lruMissStatsSize{0};
+  int quicStatsFd{-1};
+  int tprStatsFd{-1};
+  uint32_t numCpus{1};
+  std::chrono::milliseconds interval{kDefaultStatsPollInterval};
+};
+
+/**
+ * helper class which periodically reads all per-cpu counters w/ batch
+ * lookups, aggregates them and publishes the result as immutable snapshot.
+ * readers never block the poller (and each other) and never issue syscalls
+ */
+class KatranStatsEngine {
+ public:
+  /**
+   * reads [first, first + count) range of per-cpu array. values must be
+   * written as count * numCpus records of valueSize, padded to 8 bytes
+   * (the same layout as kernel uses for per-cpu maps)
+   */
+  using PerCpuReader = std::function<int(
+      int fd,
+      uint32_t first,
+      uint32_t count,
+      size_t valueSize,
+      void* values)>;
+
+  KatranStatsEngine(KatranStatsEngineConfig config, PerCpuReader reader);
+
+  ~KatranStatsEngine();
+
+  KatranStatsEngine(const KatranStatsEngine&) = delete;
+  KatranStatsEngine& operator=(const KatranStatsEngine&) = delete;
+
+  /**
+   * polls the maps once (so snapshot is available right away) and starts
+   * background thread which repeats it every config.interval
+   */
+  void start();
+
+  void stop();
+
+  /**
+   * @param uint64_t nowNs monotonic timestamp of the poll
+   * @return bool true if all maps have been read successfully
+   *
+   * helper function to read all maps and publish new snapshot. counters of
+   * maps which could not be read are carried over from previous snapshot
+   */
+  bool poll(uint64_t nowNs);
+
+  /**
+   * @return latest published snapshot (nullptr if there were no polls yet)
+   */
+  std::shared_ptr<const KatranStatsSnapshot> getSnapshot() const {
+    return snapshot_.load();
+  }
+
+  uint64_t getFailedReads() const {
+    return failedReads_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  /**
+   * reads map into rawBuf_ and sums values of each key across all cpus.
+   * valueSize must be multiple of 8
+   */
+  bool readAndAggregate(
+      int fd,
+      uint32_t size,
+      size_t valueSize,
+      uint64_t* out);
+
+  void run();
+
+  KatranStatsEngineConfig config_;
+  PerCpuReader reader_;
+  // serializes polls. raw per-cpu values are reused between polls to avoid
+  // allocations
+  std::mutex pollMutex_;
+  std::vector<uint64_t> rawBuf_;
+  folly::atomic_shared_ptr<const KatranStatsSnapshot> snapshot_;
+  std::atomic<uint64_t> failedReads_{0};
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+};
+
+} // namespace katran
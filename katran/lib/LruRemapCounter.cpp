@@ -0,0 +1,117 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/LruRemapCounter.h"
+
+#include <cstring>
+#include <utility>
+
+#include <folly/IPAddress.h>
+#include <folly/lang/Bits.h>
+
+namespace katran {
+
+namespace {
+folly::IPAddress beAddrToIPAddress(const uint32_t* addr, bool isV6) {
+  if (isV6) {
+    return folly::IPAddressV6::fromBinary(
+        folly::ByteRange(reinterpret_cast<const uint8_t*>(addr), 16));
+  }
+  return folly::IPAddressV4::fromLong(addr[0]);
+}
+} // namespace
+
+LruRemapCounter::LruRemapCounter(
+    const KatranShadowDataPlane& shadow,
+    const ChRings& newRings,
+    VipSet unaffectedVips,
+    size_t numMaps)
+    : shadow_(shadow),
+      newRings_(newRings),
+      unaffectedVips_(std::move(unaffectedVips)),
+      perMapCounters_(numMaps) {}
+
+bool LruRemapCounter::matchFlow(
+    const flow_key& key,
+    bool isV6,
+    KatranShadowDataPlane::FlowMatch& match) const {
+  uint16_t srcPort = folly::Endian::big(key.port16[0]);
+  uint16_t dstPort = folly::Endian::big(key.port16[1]);
+  // flows of the vips, which are not affected, could match affected
+  // vip w/ port 0 in the shadow
+  CompactVipKey exact;
+  std::memcpy(exact.addr.data(), key.dstv6, isV6 ? 16 : 4);
+  exact.port = dstPort;
+  exact.proto = key.proto;
+  exact.family = isV6 ? 6 : 4;
+  if (unaffectedVips_.find(exact) != unaffectedVips_.end()) {
+    return false;
+  }
+  return shadow_.matchFlow(
+      beAddrToIPAddress(key.srcv6, isV6),
+      beAddrToIPAddress(key.dstv6, isV6),
+      srcPort,
+      dstPort,
+      key.proto,
+      match);
+}
+
+void LruRemapCounter::accountEntries(
+    size_t mapIdx,
+    const flow_key* keys,
+    const real_pos_lru* values,
+    uint32_t count) {
+  auto& mapCounters = perMapCounters_[mapIdx];
+  KatranShadowDataPlane::FlowMatch match;
+  for (uint32_t i = 0; i < count; i++) {
+    const auto& key = keys[i];
+    // lru key does not carry address family. v4 flows have zeroed tail of
+    // the address, but so could v6 ones (e.g. to 2a03:2880::)
+    bool zeroTail = !(key.dstv6[1] || key.dstv6[2] || key.dstv6[3]);
+    if (!(zeroTail && matchFlow(key, false, match)) &&
+        !matchFlow(key, true, match)) {
+      continue;
+    }
+    auto ringIt = newRings_.find(match.vip);
+    if (ringIt == newRings_.end()) {
+      continue;
+    }
+    int64_t before = values[i].pos;
+    int64_t after = before;
+    if (!match.srcRouted) {
+      after = ringIt->second[match.ringPos];
+    }
+    auto& counters = mapCounters[match.vip];
+    counters.flows++;
+    counters.before[before]++;
+    counters.after[after]++;
+    if (before != after) {
+      counters.moved++;
+      counters.movedOut[before]++;
+      counters.movedIn[after]++;
+    }
+  }
+}
+
+const LruRemapCounter::Counters* LruRemapCounter::getCounters(
+    size_t mapIdx,
+    const CompactVipKey& vip) const {
+  const auto& mapCounters = perMapCounters_[mapIdx];
+  auto it = mapCounters.find(vip);
+  return it != mapCounters.end() ? &it->second : nullptr;
+}
+
+} // namespace katran
@@ -0,0 +1,108 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <folly/container/F14Map.h>
+#include <folly/container/F14Set.h>
+
+#include "katran/lib/BalancerStructs.h"
+#include "katran/lib/CompactVipKey.h"
+#include "katran/lib/KatranShadowDataPlane.h"
+
+namespace katran {
+
+/**
+ * LruRemapCounter accounts flows from lru entries for what-if analysis of
+ * reals' changes (KatranLb::analyzeRemap): flow is matched to its vip by the
+ * shadow data plane, placed on the vip's new ch ring and counted as moved if
+ * it would land on a different real than the one its lru entry points to.
+ *
+ * counters are kept per lru map, so entries of different maps could be
+ * accounted from different threads (but each map only from one of them)
+ */
+class LruRemapCounter {
+ public:
+  /**
+   * flows of the vip in one of the lru maps. keys are reals' indexes
+   */
+  struct Counters {
+    uint64_t flows{0};
+    uint64_t moved{0};
+    folly::F14FastMap<int64_t, uint64_t> before;
+    folly::F14FastMap<int64_t, uint64_t> after;
+    folly::F14FastMap<int64_t, uint64_t> movedOut;
+    folly::F14FastMap<int64_t, uint64_t> movedIn;
+  };
+
+  using ChRings =
+      folly::F14FastMap<CompactVipKey, std::vector<int>, CompactVipKeyHasher>;
+  using VipSet = folly::F14FastSet<CompactVipKey, CompactVipKeyHasher>;
+
+  /**
+   * @param KatranShadowDataPlane& shadow w/ current ch rings of affected vips
+   * @param ChRings& newRings ch rings of affected vips after the change
+   * @param VipSet unaffectedVips vips which are not changed. their flows are
+   * skipped even if they would match affected vip w/ port 0 in the shadow
+   * @param size_t numMaps number of lru maps
+   *
+   * shadow and newRings must outlive the counter
+   */
+  LruRemapCounter(
+      const KatranShadowDataPlane& shadow,
+      const ChRings& newRings,
+      VipSet unaffectedVips,
+      size_t numMaps);
+
+  /**
+   * @param size_t mapIdx index of the lru map which entries are from
+   * @param flow_key* keys lru keys
+   * @param real_pos_lru* values lru values
+   * @param uint32_t count number of entries
+   */
+  void accountEntries(
+      size_t mapIdx,
+      const flow_key* keys,
+      const real_pos_lru* values,
+      uint32_t count);
+
+  /**
+   * @return const Counters* counters of the vip in the map or nullptr if
+   * there were no flows of the vip
+   */
+  const Counters* getCounters(size_t mapIdx, const CompactVipKey& vip) const;
+
+ private:
+  /**
+   * @return true if flow from lru key, treated as the flow of given address
+   * family, matches affected vip in the shadow
+   */
+  bool matchFlow(
+      const flow_key& key,
+      bool isV6,
+      KatranShadowDataPlane::FlowMatch& match) const;
+
+  const KatranShadowDataPlane& shadow_;
+  const ChRings& newRings_;
+  VipSet unaffectedVips_;
+  std::vector<folly::F14FastMap<CompactVipKey, Counters, CompactVipKeyHasher>>
+      perMapCounters_;
+};
+
+} // namespace katran
@@ -0,0 +1,439 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/LruScanner.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include <bpf/bpf.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+#include "katran/lib/BaseBpfAdapter.h"
+
+namespace katran {
+
+namespace {
+// max number of entries visited in a single map w/o batch operations
+constexpr uint64_t kMaxLegacyLookups = 10 * 1000 * 1000;
+constexpr auto kCancelledError = "cancelled";
+
+/**
+ * deletes keys w/ batch operation. entries could be evicted by forwarding
+ * plane at any moment, so missing keys are skipped instead of failing the
+ * whole batch
+ */
+int deleteKeys(int mapFd, std::vector<flow_key>& keys, uint64_t& deleted) {
+  DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = 0, .flags = 0, );
+  size_t done = 0;
+  while (done < keys.size()) {
+    __u32 count = keys.size() - done;
+    int err = bpf_map_delete_batch(mapFd, keys.data() + done, &count, &opts);
+    deleted += count;
+    done += count;
+    if (!err) {
+      break;
+    }
+    if (err == -ENOENT) {
+      // key at position done is already gone
+      done++;
+      continue;
+    }
+    return err;
+  }
+  return 0;
+}
+} // namespace
+
+LruScanner::LruScanner(
+    std::vector<int> mapFds,
+    bool useBatchOps,
+    uint32_t maxWorkers,
+    LruScanControl* control)
+    : mapFds_(std::move(mapFds)),
+      useBatchOps_(useBatchOps),
+      maxWorkers_(maxWorkers),
+      control_(control) {}
+
+LruScanResult LruScanner::scan(const Visitor& visitor) {
+  return run(&visitor, nullptr);
+}
+
+LruScanResult LruScanner::purge(const Predicate& predicate) {
+  return run(nullptr, &predicate);
+}
+
+LruScanResult LruScanner::run(
+    const Visitor* visitor,
+    const Predicate* predicate) {
+  std::vector<LruScanResult> results(mapFds_.size());
+  if (control_) {
+    control_->totalMaps = mapFds_.size();
+    control_->completedMaps = 0;
+    control_->scannedEntries = 0;
+  }
+
+  forEachMap([&](size_t idx) {
+    results[idx] = useBatchOps_ ? scanMapBatch(idx, visitor, predicate)
+                                : scanMapLegacy(idx, visitor, predicate);
+  });
+
+  LruScanResult result;
+  for (const auto& mapResult : results) {
+    result.scanned += mapResult.scanned;
+    result.deleted += mapResult.deleted;
+    if (!mapResult.error.empty()) {
+      result.error = mapResult.error;
+    }
+  }
+  if (isCancelled()) {
+    result.error = kCancelledError;
+  }
+  return result;
+}
+
+void LruScanner::forEachMap(const std::function<void(size_t)>& func) {
+  std::atomic<size_t> nextMap{0};
+  auto worker = [&]() {
+    size_t idx;
+    while ((idx = nextMap.fetch_add(1)) < mapFds_.size()) {
+      if (isCancelled()) {
+        continue;
+      }
+      func(idx);
+      if (control_) {
+        control_->completedMaps++;
+      }
+    }
+  };
+
+  size_t numWorkers = maxWorkers_ > 0
+      ? maxWorkers_
+      : std::max(1u, std::thread::hardware_concurrency());
+  numWorkers = std::min(numWorkers, mapFds_.size());
+  if (numWorkers <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < numWorkers; i++) {
+      workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+      t.join();
+    }
+  }
+}
+
+LruSampleResult LruScanner::sample(
+    const WindowVisitor& visitor,
+    uint32_t maxEntriesPerMap,
+    uint32_t windowSize,
+    uint64_t seed) {
+  LruSampleResult result;
+  result.windows.resize(mapFds_.size());
+  result.totalBuckets.resize(mapFds_.size());
+  if (!useBatchOps_) {
+    result.error = "sampling requires batch operations";
+    return result;
+  }
+  if (control_) {
+    control_->totalMaps = mapFds_.size();
+    control_->completedMaps = 0;
+    control_->scannedEntries = 0;
+  }
+  if (seed == 0) {
+    seed = std::random_device{}();
+  }
+  std::vector<LruScanResult> results(mapFds_.size());
+  forEachMap([&](size_t idx) {
+    results[idx] = sampleMap(
+        idx,
+        visitor,
+        maxEntriesPerMap,
+        windowSize,
+        seed + idx,
+        result.windows[idx],
+        result.totalBuckets[idx]);
+  });
+  for (const auto& mapResult : results) {
+    result.sampled += mapResult.scanned;
+    if (!mapResult.error.empty()) {
+      result.error = mapResult.error;
+    }
+  }
+  if (isCancelled()) {
+    result.error = kCancelledError;
+  }
+  return result;
+}
+
+LruScanResult LruScanner::sampleMap(
+    size_t idx,
+    const WindowVisitor& visitor,
+    uint32_t maxEntries,
+    uint32_t windowSize,
+    uint64_t seed,
+    std::vector<LruSampleWindow>& windows,
+    uint32_t& totalBuckets) {
+  LruScanResult result;
+  int mapFd = mapFds_[idx];
+  struct bpf_map_info info = {};
+  if (BaseBpfAdapter::getBpfMapInfo(mapFd, &info)) {
+    LOG(ERROR) << "Error while retrieving lru map info: "
+               << folly::errnoStr(errno);
+    result.error = "map info error";
+    return result;
+  }
+  // hash maps (including lru ones) round number of buckets up to power of 2
+  uint64_t nBuckets = 1;
+  while (nBuckets < info.max_entries) {
+    nBuckets <<= 1;
+  }
+  totalBuckets = nBuckets;
+
+  // windows are sampled w/o replacement: starting buckets are drawn up front
+  // and visited in ascending order, starts which fall into already read
+  // window are skipped. this way windows never overlap and number of read
+  // buckets is exact. kernel hashes keys w/ random seed, so stopping early
+  // (when budget is spent) does not bias the sample
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<uint32_t> startDist(0, nBuckets - 1);
+  std::vector<uint32_t> starts(maxEntries / windowSize + 1);
+  for (auto& start : starts) {
+    start = startDist(rng);
+  }
+  std::sort(starts.begin(), starts.end());
+  std::vector<flow_key> keys(windowSize);
+  std::vector<real_pos_lru> values(windowSize);
+  // first bucket which has not been read yet
+  uint64_t readUpTo = 0;
+
+  DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = 0, .flags = 0, );
+
+  size_t next = 0;
+  while (next < starts.size() && result.scanned < maxEntries) {
+    if (isCancelled()) {
+      result.error = kCancelledError;
+      break;
+    }
+    if (starts[next] < readUpTo) {
+      next++;
+      continue;
+    }
+    uint32_t inBatch = starts[next];
+    uint32_t outBatch = 0;
+    __u32 count = keys.size();
+    int err = bpf_map_lookup_batch(
+        mapFd, &inBatch, &outBatch, keys.data(), values.data(), &count, &opts);
+    if (err && err != -ENOENT) {
+      if (err == -ENOSPC && count == 0) {
+        keys.resize(keys.size() * 2);
+        values.resize(values.size() * 2);
+        continue;
+      }
+      LOG(ERROR) << "Error while sampling lru map: " << folly::errnoStr(-err);
+      result.error = "query error";
+      break;
+    }
+    next++;
+    // on ENOENT the window spans up to the end of the map
+    readUpTo = err == -ENOENT ? nBuckets : outBatch;
+    LruSampleWindow window;
+    window.buckets = readUpTo - inBatch;
+    if (window.buckets == 0) {
+      continue;
+    }
+    visitor(idx, windows.size(), keys.data(), values.data(), count);
+    windows.push_back(window);
+    result.scanned += count;
+    reportProgress(count);
+  }
+  return result;
+}
+
+LruEstimate LruScanner::estimateTotal(
+    const std::vector<double>& sampled,
+    const std::vector<double>& buckets,
+    double totalBuckets) {
+  LruEstimate estimate;
+  size_t m = std::min(sampled.size(), buckets.size());
+  double sumY = 0;
+  double sumB = 0;
+  for (size_t i = 0; i < m; i++) {
+    sumY += sampled[i];
+    sumB += buckets[i];
+  }
+  if (m == 0 || sumB == 0) {
+    return estimate;
+  }
+  double ratio = sumY / sumB;
+  estimate.value = ratio * totalBuckets;
+  double f = std::min(1.0, sumB / totalBuckets);
+  if (m < 2 || f >= 1.0) {
+    // whole map has been read (or variance could not be estimated)
+    estimate.stdErr = f >= 1.0 ? 0 : estimate.value;
+    return estimate;
+  }
+  double meanB = sumB / m;
+  double s2 = 0;
+  for (size_t i = 0; i < m; i++) {
+    double residual = sampled[i] - ratio * buckets[i];
+    s2 += residual * residual;
+  }
+  s2 /= (m - 1);
+  double varRatio = (1 - f) * s2 / (m * meanB * meanB);
+  estimate.stdErr = totalBuckets * std::sqrt(varRatio);
+  return estimate;
+}
+
+LruScanResult LruScanner::scanMapBatch(
+    size_t idx,
+    const Visitor* visitor,
+    const Predicate* predicate) {
+  LruScanResult result;
+  int mapFd = mapFds_[idx];
+  std::vector<flow_key> keys(batchSize_);
+  std::vector<real_pos_lru> values(batchSize_);
+  std::vector<flow_key> toDelete;
+  // opaque position of the batch iterator (bucket's index for hash maps)
+  uint64_t inBatch = 0;
+  uint64_t outBatch = 0;
+  bool firstBatch = true;
+
+  DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts, .elem_flags = 0, .flags = 0, );
+
+  while (true) {
+    if (isCancelled()) {
+      result.error = kCancelledError;
+      break;
+    }
+    __u32 count = keys.size();
+    int err = bpf_map_lookup_batch(
+        mapFd,
+        firstBatch ? nullptr : &inBatch,
+        &outBatch,
+        keys.data(),
+        values.data(),
+        &count,
+        &opts);
+    if (err && err != -ENOENT) {
+      if (err == -ENOSPC && count == 0) {
+        // hash bucket does not fit into the buffer
+        keys.resize(keys.size() * 2);
+        values.resize(values.size() * 2);
+        continue;
+      }
+      LOG(ERROR) << "Error while reading lru map: " << folly::errnoStr(-err);
+      result.error = "query error";
+      break;
+    }
+    firstBatch = false;
+    inBatch = outBatch;
+    result.scanned += count;
+    reportProgress(count);
+    if (visitor) {
+      (*visitor)(idx, keys.data(), values.data(), count);
+    }
+    if (predicate) {
+      toDelete.clear();
+      for (uint32_t i = 0; i < count; i++) {
+        if ((*predicate)(idx, keys[i], values[i])) {
+          toDelete.push_back(keys[i]);
+        }
+      }
+      // keys from already visited buckets could be safely deleted w/o
+      // affecting the iteration
+      int delErr = deleteKeys(mapFd, toDelete, result.deleted);
+      if (delErr) {
+        LOG(ERROR) << "Error while deleting from lru map: "
+                   << folly::errnoStr(-delErr);
+        result.error = "delete error";
+      }
+    }
+    if (err == -ENOENT) {
+      // end of the map
+      break;
+    }
+  }
+  return result;
+}
+
+LruScanResult LruScanner::scanMapLegacy(
+    size_t idx,
+    const Visitor* visitor,
+    const Predicate* predicate) {
+  LruScanResult result;
+  int mapFd = mapFds_[idx];
+  flow_key key = {};
+  flow_key nextKey = {};
+  real_pos_lru value = {};
+  bool hasKey = false;
+
+  for (uint64_t i = 0;; i++) {
+    if (i == kMaxLegacyLookups) {
+      LOG(ERROR) << "Max lookups reached";
+      result.error = "maxed lookups";
+      break;
+    }
+    if (isCancelled()) {
+      result.error = kCancelledError;
+      break;
+    }
+    // next key must be fetched before current one is deleted
+    int nextKeyRes = BaseBpfAdapter::bpfMapGetNextKey(
+        mapFd, hasKey ? &key : nullptr, &nextKey);
+    if (hasKey) {
+      int lookupRes = BaseBpfAdapter::bpfMapLookupElement(mapFd, &key, &value);
+      if (lookupRes == 0) {
+        result.scanned++;
+        reportProgress(1);
+        if (visitor) {
+          (*visitor)(idx, &key, &value, 1);
+        }
+        if (predicate && (*predicate)(idx, key, value)) {
+          if (BaseBpfAdapter::bpfMapDeleteElement(mapFd, &key) == 0) {
+            result.deleted++;
+          } else if (errno != ENOENT) {
+            LOG(ERROR) << "Error while deleting lru map: "
+                       << folly::errnoStr(errno);
+            result.error = "delete error";
+          }
+        }
+      } else if (errno != ENOENT) {
+        // entry could be evicted between get_next_key and lookup
+        LOG(ERROR) << "Error while querying lru map, error=" << lookupRes;
+        result.error = "lookup error";
+      }
+    }
+    if (nextKeyRes != 0) {
+      if (nextKeyRes != -ENOENT) {
+        LOG(ERROR) << "Error while querying lru map, error=" << nextKeyRes;
+        result.error = "query error";
+      }
+      // ENOENT is returned when last entry in the map is reached
+      break;
+    }
+    key = nextKey;
+    hasKey = true;
+  }
+  return result;
+}
+
+} // namespace katran
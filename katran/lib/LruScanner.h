@@ -0,0 +1,208 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "katran/lib/BalancerStructs.h"
+
+namespace katran {
+
+/**
+ * progress of the running lru scan and a way to cancel it. could be polled
+ * (and cancelled) from any thread while scan is running
+ */
+struct LruScanControl {
+  // set to true to stop running scan. workers check it between batches
+  std::atomic<bool> cancelled{false};
+  // number of lru entries which have been read so far
+  std::atomic<uint64_t> scannedEntries{0};
+  // number of lru maps which have been fully processed
+  std::atomic<uint32_t> completedMaps{0};
+  std::atomic<uint32_t> totalMaps{0};
+};
+
+struct LruScanResult {
+  uint64_t scanned{0};
+  uint64_t deleted{0};
+  // description of the last error (empty if there were none)
+  std::string error;
+};
+
+/**
+ * estimation of the total and its standard error
+ */
+struct LruEstimate {
+  double value{0};
+  double stdErr{0};
+};
+
+/**
+ * window of consecutive hash buckets which has been read during sampling
+ */
+struct LruSampleWindow {
+  uint32_t buckets{0};
+};
+
+struct LruSampleResult {
+  // windows read from each map (indexed the same way as map fds)
+  std::vector<std::vector<LruSampleWindow>> windows;
+  // total number of hash buckets of each map
+  std::vector<uint32_t> totalBuckets;
+  uint64_t sampled{0};
+  std::string error;
+};
+
+/**
+ * helper class to walk (and purge entries from) set of lru maps. each map is
+ * processed by its own worker. if kernel supports batch operations, entries
+ * are read w/ bpf_map_lookup_batch and deleted w/ bpf_map_delete_batch,
+ * otherwise it falls back to per element syscalls
+ */
+class LruScanner {
+ public:
+  /**
+   * called from worker threads w/ chunk of entries from map w/ specified
+   * index. calls for the same map are never concurrent
+   */
+  using Visitor = std::function<void(
+      size_t mapIdx,
+      const flow_key* keys,
+      const real_pos_lru* values,
+      uint32_t count)>;
+
+  /**
+   * returns true if entry must be deleted. called from worker threads
+   */
+  using Predicate = std::function<
+      bool(size_t mapIdx, const flow_key& key, const real_pos_lru& value)>;
+
+  /**
+   * @param vector<int> mapFds descriptors of lru maps to scan
+   * @param bool useBatchOps true if kernel supports batch operations
+   * @param uint32_t maxWorkers max number of parallel workers. 0 means one
+   * per map, bounded by number of available cpus
+   * @param LruScanControl* control optional progress/cancellation token
+   */
+  LruScanner(
+      std::vector<int> mapFds,
+      bool useBatchOps,
+      uint32_t maxWorkers = 0,
+      LruScanControl* control = nullptr);
+
+  /**
+   * helper function to read all entries of all maps
+   */
+  LruScanResult scan(const Visitor& visitor);
+
+  /**
+   * helper function to delete all entries which match the predicate
+   */
+  LruScanResult purge(const Predicate& predicate);
+
+  /**
+   * called from worker threads w/ entries of specified window of the map
+   */
+  using WindowVisitor = std::function<void(
+      size_t mapIdx,
+      size_t window,
+      const flow_key* keys,
+      const real_pos_lru* values,
+      uint32_t count)>;
+
+  /**
+   * @param WindowVisitor visitor to call for each sampled chunk
+   * @param uint32_t maxEntriesPerMap sampling budget for each map
+   * @param uint32_t windowSize number of entries to read from each random
+   * position of the map
+   * @param uint64_t seed seed of random generator (0 - random seed)
+   * @return LruSampleResult w/ description of sampled windows
+   *
+   * helper function to read bounded random subset of entries. hash maps are
+   * iterated by buckets, so each window starts at random bucket and spans
+   * consecutive buckets until windowSize entries are read. windows never
+   * overlap. requires batch operations support
+   */
+  LruSampleResult sample(
+      const WindowVisitor& visitor,
+      uint32_t maxEntriesPerMap,
+      uint32_t windowSize = 128,
+      uint64_t seed = 0);
+
+  /**
+   * @param vector<double> sampled value of the metric in each window
+   * @param vector<double> buckets number of buckets in each window
+   * @param double totalBuckets total number of buckets in the map
+   * @return LruEstimate estimation of the metric's total across the map
+   *
+   * ratio estimator for cluster sample: windows are clusters of buckets,
+   * which must not overlap (sum of buckets is the share of the map which
+   * has been read)
+   */
+  static LruEstimate estimateTotal(
+      const std::vector<double>& sampled,
+      const std::vector<double>& buckets,
+      double totalBuckets);
+
+  void setBatchSize(uint32_t batchSize) {
+    batchSize_ = batchSize;
+  }
+
+ private:
+  LruScanResult run(const Visitor* visitor, const Predicate* predicate);
+
+  LruScanResult
+  scanMapBatch(size_t idx, const Visitor* visitor, const Predicate* predicate);
+
+  LruScanResult sampleMap(
+      size_t idx,
+      const WindowVisitor& visitor,
+      uint32_t maxEntries,
+      uint32_t windowSize,
+      uint64_t seed,
+      std::vector<LruSampleWindow>& windows,
+      uint32_t& totalBuckets);
+
+  /**
+   * runs func(mapIdx) for each map, w/ up to maxWorkers_ maps in parallel
+   */
+  void forEachMap(const std::function<void(size_t)>& func);
+
+  LruScanResult
+  scanMapLegacy(size_t idx, const Visitor* visitor, const Predicate* predicate);
+
+  bool isCancelled() const {
+    return control_ && control_->cancelled.load(std::memory_order_relaxed);
+  }
+
+  void reportProgress(uint64_t scanned) {
+    if (control_) {
+      control_->scannedEntries.fetch_add(scanned, std::memory_order_relaxed);
+    }
+  }
+
+  std::vector<int> mapFds_;
+  bool useBatchOps_;
+  uint32_t maxWorkers_;
+  LruScanControl* control_;
+  uint32_t batchSize_{4096};
+};
+
+} // namespace katran
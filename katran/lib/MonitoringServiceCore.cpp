@@ -69,6 +69,9 @@ void MonitoringServiceCore::tearDown() {
     for (auto& eventAndCb : event_pipe_cbs_) {
       eventAndCb.second->disable();
     }
+    for (auto& clientAndQueue : *client_queues_.rlock()) {
+      clientAndQueue.second->stop();
+    }
     // This facilitate testing
     if (monitor_) {
       for (auto eventId : enabled_events_) {
@@ -177,9 +180,14 @@ bool MonitoringServiceCore::addSubscription(
     }
     cbs.push_back(cb->second.get());
   }
+  // Events are delivered to the client from its own queue, so slow client
+  // can't delay delivery to others
+  auto queued = QueuedClientSubscription::create(
+      sub, subscriber_queue_size_, slow_client_policy_);
   for (auto& cb : cbs) {
-    cb->addClientSubscription({cid, sub});
+    cb->addClientSubscription({cid, queued});
   }
+  client_queues_.wlock()->insert({cid, queued});
   auto subsmap = subscription_map_.wlock();
   subsmap->insert({cid, sub});
   client_to_event_ids_.insert({cid, subscribed_events});
@@ -205,10 +213,34 @@ void MonitoringServiceCore::cancelSubscription(ClientId cid) {
           clientAndEventIds->first);
     }
   }
+  // Stop delivery outside of the lock, client could be in the middle of
+  // sending an event
+  std::shared_ptr<QueuedClientSubscription> queued;
+  {
+    auto queues = client_queues_.wlock();
+    auto clientAndQueue = queues->find(cid);
+    if (clientAndQueue != queues->end()) {
+      queued = std::move(clientAndQueue->second);
+      queues->erase(clientAndQueue);
+    }
+  }
+  if (queued) {
+    queued->stop();
+  }
   // Remove client from subscriptio map
   auto subsmap = subscription_map_.wlock();
   subsmap->erase(cid);
 }
 
+std::optional<SubscriberStats> MonitoringServiceCore::get_client_stats(
+    ClientId cid) {
+  auto queues = client_queues_.rlock();
+  auto clientAndQueue = queues->find(cid);
+  if (clientAndQueue == queues->end()) {
+    return std::nullopt;
+  }
+  return clientAndQueue->second->getStats();
+}
+
 } // namespace monitoring
 } // namespace katran
@@ -8,6 +8,7 @@
 #include "katran/lib/EventPipeCallback.h"
 #include "katran/lib/KatranLb.h"
 #include "katran/lib/MonitoringStructs.h"
+#include "katran/lib/QueuedClientSubscription.h"
 
 namespace katran {
 namespace monitoring {
@@ -140,6 +141,21 @@ class MonitoringServiceCore
     }
   }
 
+  /**
+   * Change size of per client queue and what to do when it is full
+   * Takes effect for clients which subscribe after this call
+   */
+  void set_subscriber_queue(uint32_t queue_size, SlowClientPolicy policy) {
+    subscriber_queue_size_ = queue_size;
+    slow_client_policy_ = policy;
+  }
+
+  /**
+   * Returns delivery counters of the client, nullopt if there is no such
+   * client
+   */
+  std::optional<SubscriberStats> get_client_stats(ClientId cid);
+
   /**
    * Returns true if subscription_map_ contains cid
    */
@@ -198,6 +214,23 @@ class MonitoringServiceCore
    */
   EventIds enabled_events_;
 
+  /**
+   * Size of per client queue
+   */
+  uint32_t subscriber_queue_size_{kDefaultSubscriberQueueSize};
+
+  /**
+   * What to do when client's queue is full
+   */
+  SlowClientPolicy slow_client_policy_{SlowClientPolicy::DROP};
+
+  /**
+   * Map of client id -> queue which delivers events to the client
+   */
+  folly::Synchronized<
+      std::unordered_map<ClientId, std::shared_ptr<QueuedClientSubscription>>>
+      client_queues_;
+
   /**
    * Map of client:set<event>,
    */
@@ -24,6 +24,18 @@ std::string toString(const EventId& eventId) {
   }
 }
 
+Event SharedEvent::toEvent() const {
+  Event event{.id = id, .pktsize = pktsize};
+  if (data) {
+    event.data.reserve(data->computeChainDataLength());
+    for (const auto& range : *data) {
+      event.data.append(
+          reinterpret_cast<const char*>(range.data()), range.size());
+    }
+  }
+  return event;
+}
+
 std::ostream& operator<<(std::ostream& os, const EventId& eventId) {
   os << toString(eventId);
   return os;
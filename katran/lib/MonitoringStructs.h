@@ -1,6 +1,7 @@
 // Copyright 2004-present Facebook. All Rights Reserved.
 
 #pragma once
+#include <folly/io/IOBuf.h>
 #include <memory>
 #include <ostream>
 #include <set>
@@ -11,6 +12,8 @@ namespace katran {
 namespace monitoring {
 
 constexpr auto kDefaultClientLimit = 10;
+// Max number of events queued for a single client
+constexpr uint32_t kDefaultSubscriberQueueSize = 4096;
 
 // This is the internal enum for event id. Protocol specific types will need to
 // be casted to/from this type. One can take advantage of the UNKNOWN event id
@@ -45,6 +48,43 @@ struct Event {
   std::string data;
 };
 
+/**
+ * Same as Event, but pcap record is kept in refcounted (and possibly chained)
+ * buffer, which is shared by all the clients the event is sent to
+ */
+struct SharedEvent {
+  EventId id{EventId::UNKNOWN};
+  uint32_t pktsize{0};
+  std::shared_ptr<const folly::IOBuf> data;
+
+  /**
+   * Helper function to make a copy of the event w/ contiguous data
+   */
+  Event toEvent() const;
+};
+
+// What to do with new events when client's queue is full
+enum class SlowClientPolicy {
+  // new events are dropped, client receives the oldest queued ones
+  DROP = 0,
+  // the oldest queued events are dropped, client skips ahead to new ones
+  SKIP = 1,
+};
+
+/**
+ * Per client delivery counters
+ * @param delivered number of events sent to the client
+ * @param dropped number of events dropped because client's queue was full
+ * @param lag number of events queued, but not yet sent to the client
+ * @param maxLag max observed lag
+ */
+struct SubscriberStats {
+  uint64_t delivered{0};
+  uint64_t dropped{0};
+  uint64_t lag{0};
+  uint64_t maxLag{0};
+};
+
 using ClientId = uint32_t;
 using EventIds = std::set<EventId>;
 
@@ -59,6 +99,15 @@ class ClientSubscriptionIf {
    */
   virtual void sendEvent(const Event& event) = 0;
 
+  /**
+   * Stream event to client w/o copying its data. Clients which are able to
+   * send chained buffers should override this; the default implementation
+   * makes a contiguous copy and calls sendEvent
+   */
+  virtual void sendSharedEvent(const SharedEvent& event) {
+    sendEvent(event.toEvent());
+  }
+
   /**
    * Return true if this subscription contains the event
    */
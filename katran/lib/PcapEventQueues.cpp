@@ -0,0 +1,80 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/PcapEventQueues.h"
+
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+// control messages are rare. this is enough to never block in practice
+constexpr size_t kControlQueueSize = 64;
+} // namespace
+
+PcapEventQueues::PcapEventQueues(uint32_t numSources, uint32_t queueSize)
+    : control_(kControlQueueSize) {
+  CHECK_GT(numSources, 0) << "at least one source is required";
+  CHECK_GT(queueSize, 1) << "queue size must be greater than 1";
+  queues_.reserve(numSources);
+  for (uint32_t i = 0; i < numSources; i++) {
+    queues_.push_back(
+        std::make_unique<folly::ProducerConsumerQueue<PcapEvent>>(queueSize));
+  }
+}
+
+bool PcapEventQueues::push(
+    uint32_t source,
+    uint32_t event,
+    const char* pckt,
+    uint32_t origLen,
+    uint32_t capturedLen,
+    uint64_t ktimeNs) {
+  DCHECK_LT(source, queues_.size());
+  if (!queues_[source]->write(event, pckt, origLen, capturedLen, ktimeNs)) {
+    drops_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void PcapEventQueues::pushControl(PcapMsgMeta&& msg) {
+  control_.blockingWrite(std::move(msg));
+  eventCount_.notify();
+}
+
+bool PcapEventQueues::empty() const {
+  if (!control_.isEmpty()) {
+    return false;
+  }
+  for (const auto& queue : queues_) {
+    if (!queue->isEmpty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PcapEventQueues::waitForEvents() {
+  auto key = eventCount_.prepareWait();
+  if (!empty()) {
+    eventCount_.cancelWait();
+    return;
+  }
+  eventCount_.wait(key);
+}
+
+} // namespace katran
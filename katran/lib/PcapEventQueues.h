@@ -0,0 +1,178 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <folly/MPMCQueue.h>
+#include <folly/ProducerConsumerQueue.h>
+#include <folly/synchronization/EventCount.h>
+
+#include "katran/lib/PcapMsgMeta.h"
+
+namespace katran {
+
+// must be not less than MAX_EVENT_SIZE in bpf/introspection.h
+constexpr uint32_t kMaxPcapEventSize = 128;
+
+/**
+ * captured packet as it is stored in PcapEventQueues. slots of the queues
+ * are preallocated, so events are copied only once: from the event pipe into
+ * the slot. writer works w/ the slot in place.
+ */
+struct PcapEvent {
+  PcapEvent(
+      uint32_t eventId,
+      const char* pckt,
+      uint32_t origPcktLen,
+      uint32_t capturedPcktLen,
+      uint64_t ktime)
+      : ktimeNs(ktime),
+        event(eventId),
+        origLen(origPcktLen),
+        capturedLen(std::min(capturedPcktLen, kMaxPcapEventSize)) {
+    std::memcpy(data, pckt, capturedLen);
+  }
+
+  // CLOCK_MONOTONIC time of the event in ns (bpf_ktime_get_ns), 0 if unknown
+  uint64_t ktimeNs;
+  uint32_t event;
+  uint32_t origLen;
+  uint32_t capturedLen;
+  uint8_t data[kMaxPcapEventSize];
+};
+
+/**
+ * set of queues between event readers and PcapWriter. every source (reader's
+ * thread) owns a lock free single producer / single consumer ring, so there
+ * is no contention between producers and no per event allocation. control
+ * messages (stop/restart/shutdown) are rare and could be sent from any
+ * thread, so they go through separate MPMCQueue.
+ *
+ * producers are expected to call notify() once per batch of pushed events;
+ * consumer sleeps only when all queues are empty.
+ */
+class PcapEventQueues {
+ public:
+  /**
+   * @param uint32_t numSources number of producers
+   * @param uint32_t queueSize capacity of each per source queue
+   */
+  PcapEventQueues(uint32_t numSources, uint32_t queueSize);
+
+  PcapEventQueues(const PcapEventQueues&) = delete;
+  PcapEventQueues& operator=(const PcapEventQueues&) = delete;
+
+  uint32_t getNumSources() const {
+    return queues_.size();
+  }
+
+  /**
+   * @param uint32_t source id of the producer. must be used only by a single
+   * thread
+   * @param uint64_t ktimeNs time of the event from the forwarding plane
+   * @return true if event was queued, false if source's queue is full
+   *
+   * producer side. does not wake up consumer, see notify()
+   */
+  bool push(
+      uint32_t source,
+      uint32_t event,
+      const char* pckt,
+      uint32_t origLen,
+      uint32_t capturedLen,
+      uint64_t ktimeNs = 0);
+
+  /**
+   * wakes up consumer if it is waiting for events
+   */
+  void notify() {
+    eventCount_.notify();
+  }
+
+  /**
+   * @param PcapMsgMeta msg control message. blocks if control queue is full
+   *
+   * could be called from any thread
+   */
+  void pushControl(PcapMsgMeta&& msg);
+
+  /**
+   * @param PcapMsgMeta msg where control message is going to be stored
+   * @return true if there was a control message
+   */
+  bool readControl(PcapMsgMeta& msg) {
+    return control_.read(msg);
+  }
+
+  /**
+   * @param size_t maxPerSource max number of events to consume from each
+   * source during this call
+   * @param F f callback which is called w/ each event (const PcapEvent&)
+   * @return number of consumed events
+   *
+   * consumer side. drains sources in round robin, so single busy source can
+   * not starve the others
+   */
+  template <typename F>
+  size_t drain(size_t maxPerSource, F&& f) {
+    size_t consumed = 0;
+    for (auto& queue : queues_) {
+      for (size_t i = 0; i < maxPerSource; i++) {
+        auto event = queue->frontPtr();
+        if (event == nullptr) {
+          break;
+        }
+        f(*event);
+        queue->popFront();
+        ++consumed;
+      }
+    }
+    return consumed;
+  }
+
+  /**
+   * blocks consumer until there is something in any of the queues
+   */
+  void waitForEvents();
+
+  /**
+   * @return number of events dropped because source's queue was full
+   */
+  uint64_t getDrops() const {
+    return drops_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  bool empty() const;
+
+  std::vector<std::unique_ptr<folly::ProducerConsumerQueue<PcapEvent>>>
+      queues_;
+
+  folly::MPMCQueue<PcapMsgMeta> control_;
+
+  folly::EventCount eventCount_;
+
+  std::atomic<uint64_t> drops_{0};
+};
+
+} // namespace katran
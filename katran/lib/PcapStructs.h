@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 namespace katran {
 
 // reference to headers format:
@@ -37,4 +39,49 @@ struct pcaprec_hdr_s {
   uint32_t orig_len; /* actual length of packet */
 };
 
+/**
+ * format of the data produced by PcapWriter
+ */
+enum class PcapFormat : uint8_t {
+  // classic libpcap format w/ usec timestamps
+  PCAP = 0,
+  // pcapng w/ nsec timestamps and per event interface description block
+  PCAPNG,
+};
+
+// reference to pcapng blocks format:
+// https://www.ietf.org/archive/id/draft-tuexen-opsawg-pcapng-05.html
+// all the blocks are padded to 32 bits and end w/ copy of block_total_length
+struct pcapng_shb_s {
+  uint32_t block_type; /* 0x0A0D0D0A */
+  uint32_t block_total_length;
+  uint32_t byte_order_magic; /* 0x1A2B3C4D */
+  uint16_t version_major;
+  uint16_t version_minor;
+  int64_t section_length; /* -1 if unknown */
+};
+
+struct pcapng_idb_s {
+  uint32_t block_type; /* 0x00000001 */
+  uint32_t block_total_length;
+  uint16_t link_type;
+  uint16_t reserved;
+  uint32_t snaplen;
+};
+
+struct pcapng_epb_s {
+  uint32_t block_type; /* 0x00000006 */
+  uint32_t block_total_length;
+  uint32_t interface_id;
+  uint32_t ts_high; /* upper 32 bits of the timestamp */
+  uint32_t ts_low; /* lower 32 bits of the timestamp */
+  uint32_t captured_len;
+  uint32_t orig_len;
+};
+
+struct pcapng_opt_s {
+  uint16_t code;
+  uint16_t length; /* w/o padding */
+};
+
 } // namespace katran
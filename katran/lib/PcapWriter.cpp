@@ -16,7 +16,9 @@
 
 #include "katran/lib/PcapWriter.h"
 
+#include <time.h>
 #include <chrono>
+#include <cstring>
 #include "katran/lib/PcapStructs.h"
 
 using Guard = std::lock_guard<std::mutex>;
@@ -31,15 +33,201 @@ constexpr int32_t kGmt = 0;
 constexpr uint32_t kAccuracy = 0;
 constexpr uint32_t kMaxSnapLen = 0xFFFF; // 65535
 constexpr uint32_t kEthernet = 1;
+constexpr uint32_t kPcapngShbType = 0x0A0D0D0A;
+constexpr uint32_t kPcapngByteOrderMagic = 0x1A2B3C4D;
+constexpr uint16_t kPcapngVersionMajor = 1;
+constexpr uint16_t kPcapngVersionMinor = 0;
+constexpr int64_t kPcapngUnknownSectionLen = -1;
+constexpr uint32_t kPcapngIdbType = 0x00000001;
+constexpr uint32_t kPcapngEpbType = 0x00000006;
+constexpr uint16_t kPcapngOptEnd = 0;
+constexpr uint16_t kPcapngOptComment = 1;
+constexpr uint16_t kPcapngOptIfName = 2;
+constexpr uint16_t kPcapngOptIfDescription = 3;
+constexpr uint16_t kPcapngOptIfTsresol = 9;
+// timestamps are in nsec (10^-9)
+constexpr uint8_t kPcapngTsresolNsec = 9;
+// every event has its own writer, so there is single interface per section
+constexpr uint32_t kPcapngInterfaceId = 0;
+constexpr uint64_t kNsecInSec = 1000000000;
+constexpr uint64_t kNsecInUsec = 1000;
 using EventId = monitoring::EventId;
 constexpr EventId kDefaultWriter = EventId::TCP_NONSYN_LRUMISS;
+// max number of events consumed from a single source before writer moves to
+// the next one
+constexpr size_t kWriterBatchSize = 256;
+// readers could still be producing during shutdown, so final drain is bounded
+constexpr size_t kMaxShutdownBatches = 64;
+
+uint64_t nowNsec() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t clockNsec(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * kNsecInSec + ts.tv_nsec;
+}
+
+/**
+ * @return int64_t offset which must be added to CLOCK_MONOTONIC time (which
+ * is used by bpf_ktime_get_ns()) to get unix time
+ */
+int64_t monotonicToRealtimeOffset() {
+  return clockNsec(CLOCK_REALTIME) - clockNsec(CLOCK_MONOTONIC);
+}
+
+uint32_t pcapngPad(uint32_t len) {
+  return (4 - (len & 3)) & 3;
+}
+
+/**
+ * framing of a single record: header before packet's data and (for pcapng)
+ * padding and trailing block length after it
+ */
+struct RecordFraming {
+  union {
+    pcaprec_hdr_s pcap;
+    pcapng_epb_s pcapng;
+  } hdr;
+  uint32_t hdrLen;
+  uint8_t trailer[3 + sizeof(uint32_t)];
+  uint32_t trailerLen;
+
+  uint32_t size(uint32_t capturedLen) const {
+    return hdrLen + capturedLen + trailerLen;
+  }
+};
+
+RecordFraming makeRecordFraming(
+    PcapFormat format,
+    uint32_t capturedLen,
+    uint32_t origLen,
+    uint64_t unixNsec) {
+  RecordFraming framing{};
+  if (format == PcapFormat::PCAP) {
+    // in pcap format ts_usec is a offset in usec after ts_sec.
+    framing.hdr.pcap.ts_sec = unixNsec / kNsecInSec;
+    framing.hdr.pcap.ts_usec = (unixNsec % kNsecInSec) / kNsecInUsec;
+    framing.hdr.pcap.incl_len = capturedLen;
+    framing.hdr.pcap.orig_len = origLen;
+    framing.hdrLen = sizeof(pcaprec_hdr_s);
+    framing.trailerLen = 0;
+    return framing;
+  }
+  auto pad = pcapngPad(capturedLen);
+  uint32_t totalLen =
+      sizeof(pcapng_epb_s) + capturedLen + pad + sizeof(uint32_t);
+  auto& epb = framing.hdr.pcapng;
+  epb.block_type = kPcapngEpbType;
+  epb.block_total_length = totalLen;
+  epb.interface_id = kPcapngInterfaceId;
+  epb.ts_high = unixNsec >> 32;
+  epb.ts_low = unixNsec & 0xFFFFFFFF;
+  epb.captured_len = capturedLen;
+  epb.orig_len = origLen;
+  framing.hdrLen = sizeof(pcapng_epb_s);
+  // padding is already zeroed
+  std::memcpy(framing.trailer + pad, &totalLen, sizeof(totalLen));
+  framing.trailerLen = pad + sizeof(totalLen);
+  return framing;
+}
+
+void writeRecord(
+    katran::DataWriter& writer,
+    const RecordFraming& framing,
+    const uint8_t* pckt,
+    uint32_t capturedLen) {
+  // single call per record, so writers which rotate their output on
+  // writeDataBatch would never split a record
+  struct iovec iov[3] = {
+      {const_cast<void*>(static_cast<const void*>(&framing.hdr)),
+       framing.hdrLen},
+      {const_cast<uint8_t*>(pckt), capturedLen},
+      {const_cast<uint8_t*>(framing.trailer), framing.trailerLen},
+  };
+  writer.writeDataBatch(iov, framing.trailerLen ? 3 : 2);
+}
+
+void appendPcapngOption(
+    std::vector<uint8_t>& buf,
+    uint16_t code,
+    const void* data,
+    uint16_t len) {
+  pcapng_opt_s opt{.code = code, .length = len};
+  auto optPtr = reinterpret_cast<const uint8_t*>(&opt);
+  buf.insert(buf.end(), optPtr, optPtr + sizeof(opt));
+  auto dataPtr = reinterpret_cast<const uint8_t*>(data);
+  buf.insert(buf.end(), dataPtr, dataPtr + len);
+  buf.insert(buf.end(), pcapngPad(len), 0);
+}
+
+void appendBlockLen(std::vector<uint8_t>& buf, uint32_t totalLen) {
+  auto lenPtr = reinterpret_cast<const uint8_t*>(&totalLen);
+  buf.insert(buf.end(), lenPtr, lenPtr + sizeof(totalLen));
+}
+
+/**
+ * @return vector<uint8_t> section header block followed by interface
+ * description block of the event
+ */
+std::vector<uint8_t> makePcapngHeader(
+    monitoring::EventId eventId,
+    uint32_t snaplen,
+    const std::string& comment) {
+  std::vector<uint8_t> buf;
+  pcapng_shb_s shb{
+      .block_type = kPcapngShbType,
+      .block_total_length = sizeof(pcapng_shb_s) + sizeof(uint32_t),
+      .byte_order_magic = kPcapngByteOrderMagic,
+      .version_major = kPcapngVersionMajor,
+      .version_minor = kPcapngVersionMinor,
+      .section_length = kPcapngUnknownSectionLen,
+  };
+  auto shbPtr = reinterpret_cast<const uint8_t*>(&shb);
+  buf.insert(buf.end(), shbPtr, shbPtr + sizeof(shb));
+  appendBlockLen(buf, shb.block_total_length);
+
+  std::vector<uint8_t> idb(sizeof(pcapng_idb_s));
+  auto name = monitoring::toString(eventId);
+  auto description = "katran introspection event " + name;
+  appendPcapngOption(idb, kPcapngOptIfName, name.data(), name.size());
+  appendPcapngOption(
+      idb, kPcapngOptIfDescription, description.data(), description.size());
+  appendPcapngOption(
+      idb,
+      kPcapngOptIfTsresol,
+      &kPcapngTsresolNsec,
+      sizeof(kPcapngTsresolNsec));
+  if (!comment.empty()) {
+    appendPcapngOption(
+        idb, kPcapngOptComment, comment.data(), comment.size());
+  }
+  appendPcapngOption(idb, kPcapngOptEnd, nullptr, 0);
+  uint32_t idbLen = idb.size() + sizeof(uint32_t);
+  pcapng_idb_s idbHdr{
+      .block_type = kPcapngIdbType,
+      .block_total_length = idbLen,
+      .link_type = kEthernet,
+      .reserved = 0,
+      .snaplen = snaplen,
+  };
+  std::memcpy(idb.data(), &idbHdr, sizeof(idbHdr));
+  appendBlockLen(idb, idbLen);
+  buf.insert(buf.end(), idb.begin(), idb.end());
+  return buf;
+}
 } // namespace
 
 PcapWriter::PcapWriter(
     std::shared_ptr<DataWriter> dataWriter,
     uint32_t packetLimit,
     uint32_t snaplen)
-    : packetLimit_(packetLimit), snaplen_(snaplen) {
+    : packetLimit_(packetLimit),
+      snaplen_(snaplen),
+      monotonicToRealtime_(monotonicToRealtimeOffset()) {
   dataWriters_.insert({kDefaultWriter, dataWriter});
 }
 
@@ -47,30 +235,130 @@ PcapWriter::PcapWriter(
     std::unordered_map<EventId, std::shared_ptr<DataWriter>>& dataWriters,
     uint32_t packetLimit,
     uint32_t snaplen)
-    : dataWriters_(dataWriters), packetLimit_(packetLimit), snaplen_(snaplen) {}
+    : dataWriters_(dataWriters),
+      packetLimit_(packetLimit),
+      snaplen_(snaplen),
+      monotonicToRealtime_(monotonicToRealtimeOffset()) {}
 
 void PcapWriter::writePacket(const PcapMsg& msg, EventId writerId) {
-  auto unix_usec =
-      std::chrono::duration_cast<std::chrono::microseconds>(
-          std::chrono::high_resolution_clock::now().time_since_epoch())
-          .count();
-  // 1sec = 1mil usec
-  const uint32_t now_sec = unix_usec / 1000000;
-  // in pcap format ts_usec is a offset in msec after ts_sec.
-  const uint32_t now_usec = unix_usec - now_sec * 1000000;
-  pcaprec_hdr_s rec_hdr{
-      .ts_sec = now_sec,
-      .ts_usec = now_usec,
-  };
-  rec_hdr.incl_len = msg.getCapturedLen();
-  rec_hdr.orig_len = msg.getOrigLen();
   auto writerIt = dataWriters_.find(writerId);
   if (writerIt == dataWriters_.end()) {
     LOG(ERROR) << "no writer w/ specified ID: " << writerId;
     return;
   }
-  writerIt->second->writeData(&rec_hdr, sizeof(rec_hdr));
-  writerIt->second->writeData(msg.getRawBuffer(), msg.getCapturedLen());
+  auto framing = makeRecordFraming(
+      format_, msg.getCapturedLen(), msg.getOrigLen(), nowNsec());
+  writeRecord(
+      *writerIt->second, framing, msg.getRawBuffer(), msg.getCapturedLen());
+}
+
+void PcapWriter::writeEvent(
+    EventId eventId,
+    const uint8_t* pckt,
+    uint32_t capturedLen,
+    uint32_t origLen,
+    uint64_t unixNsec) {
+  if (!packetLimitOverride_ && packetAmount_ >= packetLimit_) {
+    VLOG(4)
+        << "No packetLimitOverride and packetAmount is greater than packetLimit. Skipping";
+    return;
+  }
+  if (enabledEvents_.find(eventId) == enabledEvents_.end()) {
+    VLOG(4) << "event " << eventId << " is not enabled, skipping";
+    return;
+  }
+  if (!writePcapHeader(eventId)) {
+    LOG(ERROR) << "DataWriter failed to write a header";
+    return;
+  }
+  auto writerIt = dataWriters_.find(eventId);
+  if (writerIt == dataWriters_.end()) {
+    LOG(ERROR) << "No writer w/ specified Id: " << eventId;
+    return;
+  }
+  auto framing = makeRecordFraming(format_, capturedLen, origLen, unixNsec);
+  if (!writerIt->second->available(framing.size(capturedLen))) {
+    VLOG(4) << "Writer buffer is full. Skipping";
+    ++bufferFull_;
+    return;
+  }
+  VLOG(4) << __func__ << " write packet for event: " << eventId;
+  ++packetAmount_;
+  if (batchMaxBytes_ == 0 || !writerIt->second->supportsBatching()) {
+    writeRecord(*writerIt->second, framing, pckt, capturedLen);
+    return;
+  }
+  auto& pending = pending_[eventId];
+  if (pending.buf.empty()) {
+    pending.firstRecord = std::chrono::steady_clock::now();
+  }
+  pending.buf.append(&framing.hdr, framing.hdrLen);
+  pending.buf.append(pckt, capturedLen);
+  pending.buf.append(framing.trailer, framing.trailerLen);
+  if (pending.buf.chainLength() >= batchMaxBytes_) {
+    flushPending(eventId);
+  }
+}
+
+void PcapWriter::flushPending(EventId eventId) {
+  auto pendingIt = pending_.find(eventId);
+  if (pendingIt == pending_.end() || pendingIt->second.buf.empty()) {
+    return;
+  }
+  auto chain = pendingIt->second.buf.move();
+  auto writerIt = dataWriters_.find(eventId);
+  if (writerIt == dataWriters_.end()) {
+    LOG(ERROR) << "No writer w/ specified Id: " << eventId;
+    return;
+  }
+  writerIt->second->writeDataBatch(std::move(chain));
+}
+
+void PcapWriter::flushAllPending(bool force) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto& eventAndPending : pending_) {
+    if (eventAndPending.second.buf.empty()) {
+      continue;
+    }
+    if (force || now - eventAndPending.second.firstRecord >= batchMaxDelay_) {
+      flushPending(eventAndPending.first);
+    }
+  }
+}
+
+void PcapWriter::setBatching(
+    size_t maxBytes,
+    std::chrono::milliseconds maxDelay) {
+  Guard lock(cntrLock_);
+  flushAllPending(true);
+  batchMaxBytes_ = maxBytes;
+  batchMaxDelay_ = maxDelay;
+}
+
+void PcapWriter::setFormat(PcapFormat format) {
+  Guard lock(cntrLock_);
+  format_ = format;
+}
+
+void PcapWriter::setEventComment(EventId eventId, const std::string& comment) {
+  Guard lock(cntrLock_);
+  eventComments_[eventId] = comment;
+}
+
+bool PcapWriter::handleControlMsg(PcapMsgMeta& msg) {
+  // accumulated records belong to the writers' current state
+  flushAllPending(true);
+  if (msg.isShutdown()) {
+    VLOG(4) << "Shutdown message was received. Stopping.";
+    return true;
+  } else if (msg.isRestart()) {
+    VLOG(4) << "Restart message was received. Restarting.";
+    restartWriters(msg.getLimit());
+  } else if (msg.isStop()) {
+    VLOG(4) << "Stop message was received. Stopping.";
+    stopWriters();
+  }
+  return false;
 }
 
 bool PcapWriter::writePcapHeader(EventId writerId) {
@@ -83,6 +371,20 @@ bool PcapWriter::writePcapHeader(EventId writerId) {
     LOG(ERROR) << "No writer w/ specified ID: " << writerId;
     return false;
   }
+  if (format_ == PcapFormat::PCAPNG) {
+    auto commentIt = eventComments_.find(writerId);
+    auto hdr = makePcapngHeader(
+        writerId,
+        snaplen_ ?: kMaxSnapLen,
+        commentIt == eventComments_.end() ? "" : commentIt->second);
+    if (!writerIt->second->available(hdr.size())) {
+      LOG(ERROR) << "DataWriter failed to write a header. Not enough space.";
+      return false;
+    }
+    writerIt->second->writeHeader(hdr.data(), hdr.size());
+    headerExists_.insert(writerId);
+    return true;
+  }
   if (!writerIt->second->available(sizeof(struct pcap_hdr_s))) {
     LOG(ERROR) << "DataWriter failed to write a header. Not enough space.";
     return false;
@@ -116,8 +418,9 @@ void PcapWriter::run(std::shared_ptr<folly::MPMCQueue<PcapMsg>> queue) {
     if (writerIt == dataWriters_.end()) {
       LOG(ERROR) << "No writer w/ specified Id: " << kDefaultWriter;
     }
-    if (!writerIt->second->available(
-            msg.getCapturedLen() + sizeof(pcaprec_hdr_s))) {
+    auto recordSize = makeRecordFraming(format_, msg.getCapturedLen(), 0, 0)
+                          .size(msg.getCapturedLen());
+    if (!writerIt->second->available(recordSize)) {
       ++bufferFull_;
       break;
     }
@@ -139,6 +442,8 @@ void PcapWriter::restartWriters(uint32_t packetLimit) {
   // as we are going to overrite all data writers. we would need to rewrite
   // headers
   headerExists_.clear();
+  // clocks could have been adjusted since last (re)start
+  monotonicToRealtime_ = monotonicToRealtimeOffset();
 
   for (auto& eventAndWriter : dataWriters_) {
     eventAndWriter.second->restart();
@@ -161,6 +466,8 @@ void PcapWriter::resetWriters(
         newDataWriters) {
   // Writers should have been stopped
   Guard lock(cntrLock_);
+  flushAllPending(true);
+  pending_.clear();
   // Gracefully stop
   for (auto& eventAndWriter : dataWriters_) {
     eventAndWriter.second->stop();
@@ -174,51 +481,76 @@ void PcapWriter::runMulti(
   auto snaplen = snaplen_ ?: kMaxSnapLen;
   PcapMsgMeta msg;
   for (;;) {
+    if (queue->isEmpty()) {
+      // nothing else to accumulate. do not keep records while idle
+      Guard lock(cntrLock_);
+      flushAllPending(true);
+    }
     VLOG(4) << __func__ << " blockingRead msg";
     queue->blockingRead(msg);
     Guard lock(cntrLock_);
     if (msg.isControl()) {
-      if (msg.isShutdown()) {
-        VLOG(4) << "Shutdown message was received. Stopping.";
+      if (handleControlMsg(msg)) {
         break;
-      } else if (msg.isRestart()) {
-        VLOG(4) << "Restart message was received. Restarting.";
-        restartWriters(msg.getLimit());
-      } else if (msg.isStop()) {
-        VLOG(4) << "Stop message was received. Stopping.";
-        stopWriters();
       }
       continue;
     }
-    if (!packetLimitOverride_ && packetAmount_ >= packetLimit_) {
-      VLOG(4)
-          << "No packetLimitOverride and packetAmount is greater than packetLimit. Skipping";
-      continue;
-    }
-    auto eventId = msg.getEventId();
-    if (enabledEvents_.find(eventId) == enabledEvents_.end()) {
-      LOG(INFO) << "event " << eventId << " is not enabled, skipping";
-      continue;
-    }
-    if (!writePcapHeader(eventId)) {
-      LOG(ERROR) << "DataWriter failed to write a header";
-      continue;
+    auto& pcapMsg = msg.getPcapMsg();
+    pcapMsg.trim(snaplen);
+    writeEvent(
+        msg.getEventId(),
+        pcapMsg.getRawBuffer(),
+        pcapMsg.getCapturedLen(),
+        pcapMsg.getOrigLen(),
+        nowNsec());
+    flushAllPending(false);
+  }
+}
+
+void PcapWriter::runMulti(std::shared_ptr<PcapEventQueues> queues) {
+  auto snaplen = snaplen_ ?: kMaxSnapLen;
+  auto writeBatch = [&]() {
+    Guard lock(cntrLock_);
+    // events w/o timestamp from the forwarding plane get the time when
+    // batch has been drained
+    auto unixNsec = nowNsec();
+    auto written =
+        queues->drain(kWriterBatchSize, [&](const PcapEvent& event) {
+          writeEvent(
+              static_cast<EventId>(event.event),
+              event.data,
+              std::min(event.capturedLen, snaplen),
+              event.origLen,
+              event.ktimeNs ? event.ktimeNs + monotonicToRealtime_
+                            : unixNsec);
+        });
+    flushAllPending(written == 0);
+    return written;
+  };
+  PcapMsgMeta msg;
+  for (;;) {
+    // events are drained before control messages, so events which were
+    // queued before e.g. stop are accounted as they used to be w/ single queue
+    auto written = writeBatch();
+    bool gotControl = false;
+    bool shutdown = false;
+    while (!shutdown && queues->readControl(msg)) {
+      gotControl = true;
+      Guard lock(cntrLock_);
+      shutdown = handleControlMsg(msg);
     }
-    msg.getPcapMsg().trim(snaplen);
-    auto writerIt = dataWriters_.find(eventId);
-    if (writerIt == dataWriters_.end()) {
-      LOG(ERROR) << "No writer w/ specified Id: " << eventId;
-      continue;
+    if (shutdown) {
+      for (size_t i = 0; i < kMaxShutdownBatches && writeBatch() > 0; i++) {
+      }
+      // drain could stop while events are still coming: records which
+      // are accumulated by the last batch must not be lost
+      Guard lock(cntrLock_);
+      flushAllPending(true);
+      return;
     }
-    if (!writerIt->second->available(
-            msg.getPcapMsg().getCapturedLen() + sizeof(pcaprec_hdr_s))) {
-      VLOG(4) << "Writer buffer is full. Skipping";
-      ++bufferFull_;
-      continue;
+    if (written == 0 && !gotControl) {
+      queues->waitForEvents();
     }
-    VLOG(4) << __func__ << " write packet for event: " << eventId;
-    writePacket(msg.getPcapMsg(), eventId);
-    ++packetAmount_;
   }
 }
 
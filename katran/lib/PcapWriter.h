@@ -16,21 +16,28 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <folly/MPMCQueue.h>
+#include <folly/io/IOBufQueue.h>
 
 #include "katran/lib/DataWriter.h"
 #include "katran/lib/MonitoringStructs.h"
+#include "katran/lib/PcapEventQueues.h"
 #include "katran/lib/PcapMsgMeta.h"
+#include "katran/lib/PcapStructs.h"
 
 struct PcapWriterStats {
   uint32_t limit{0};
   uint32_t amount{0};
   uint32_t bufferFull{0};
+  uint32_t queueFull{0};
 };
 
 namespace katran {
@@ -102,6 +109,16 @@ class PcapWriter {
    */
   void runMulti(std::shared_ptr<folly::MPMCQueue<PcapMsg>> queue);
 
+  /**
+   * @param shared_ptr<PcapEventQueues> queues where we receive events from
+   *
+   * same as runMulti w/ MPMCQueue, but events are consumed in batches from
+   * per source queues w/o any per event allocation. runs untill shutdown
+   * control message is received; events which were queued before shutdown
+   * are written
+   */
+  void runMulti(std::shared_ptr<PcapEventQueues> queues);
+
   /**
    * Get number of captured packets
    */
@@ -160,6 +177,38 @@ class PcapWriter {
     packetLimitOverride_ = value;
   }
 
+  /**
+   * @param size_t maxBytes records are accumulated untill this many bytes
+   * are pending for a writer. 0 disables batching
+   * @param milliseconds maxDelay max time record could stay accumulated
+   *
+   * batching is used only w/ writers which support it (see
+   * DataWriter::supportsBatching; pipe writers only if it has been enabled
+   * w/ PipeWriter::setBatching). pending records are flushed as well when
+   * writer becomes idle and before any control message is handled
+   */
+  void setBatching(size_t maxBytes, std::chrono::milliseconds maxDelay);
+
+  /**
+   * @param PcapFormat format of the output. default is PCAP
+   *
+   * takes effect for headers which are written after this call, so it must
+   * be set before writers are started (or restarted)
+   */
+  void setFormat(PcapFormat format);
+
+  /**
+   * @param EventId eventId event to describe
+   * @param string comment free form comment (e.g. which vip/real is
+   * monitored)
+   *
+   * comment is stored in interface description block of the event's pcapng
+   * output. ignored for PCAP format
+   */
+  void setEventComment(
+      monitoring::EventId eventId,
+      const std::string& comment);
+
  private:
   /**
    * @param PcapMsg msg which contains packet to writer
@@ -169,6 +218,63 @@ class PcapWriter {
    */
   void writePacket(const PcapMsg& msg, monitoring::EventId writerId);
 
+  /**
+   * @param EventId eventId event of the packet
+   * @param const uint8_t* pckt captured part of the packet
+   * @param uint32_t capturedLen length of captured part (already trimmed)
+   * @param uint32_t origLen length of the packet on the wire
+   * @param uint64_t unixNsec timestamp of the record
+   *
+   * helper function which checks limits and event's writer and writes the
+   * packet. must be called w/ cntrLock_ held
+   */
+  void writeEvent(
+      monitoring::EventId eventId,
+      const uint8_t* pckt,
+      uint32_t capturedLen,
+      uint32_t origLen,
+      uint64_t unixNsec);
+
+  /**
+   * @param PcapMsgMeta msg control message
+   * @return true if writer must stop (shutdown has been received)
+   *
+   * helper function to handle control messages. must be called w/ cntrLock_
+   * held
+   */
+  bool handleControlMsg(PcapMsgMeta& msg);
+
+  /**
+   * helper function to write accumulated records of the event w/ a single
+   * writeDataBatch call. must be called w/ cntrLock_ held
+   */
+  void flushPending(monitoring::EventId eventId);
+
+  /**
+   * @param bool force if false - only batches older than batchMaxDelay_ are
+   * flushed
+   *
+   * must be called w/ cntrLock_ held
+   */
+  void flushAllPending(bool force);
+
+  /**
+   * records which were accumulated for a writer, but not yet written
+   */
+  struct PendingRecords {
+    folly::IOBufQueue buf{folly::IOBufQueue::cacheChainLength()};
+    std::chrono::steady_clock::time_point firstRecord;
+  };
+
+  std::unordered_map<monitoring::EventId, PendingRecords> pending_;
+
+  /**
+   * bounds of accumulated records per writer, see setBatching()
+   */
+  size_t batchMaxBytes_{64 * 1024};
+
+  std::chrono::milliseconds batchMaxDelay_{100};
+
   /**
    * helper function to write pcap header
    */
@@ -228,6 +334,22 @@ class PcapWriter {
    */
   const uint32_t snaplen_{0};
 
+  /**
+   * format of the headers and records
+   */
+  PcapFormat format_{PcapFormat::PCAP};
+
+  /**
+   * per event comments for pcapng interface description blocks
+   */
+  std::unordered_map<monitoring::EventId, std::string> eventComments_;
+
+  /**
+   * offset between CLOCK_MONOTONIC (timestamps of events from the forwarding
+   * plane) and unix time. in nsec
+   */
+  int64_t monotonicToRealtime_{0};
+
   /**
    * lock which protects counters (e.g. packetAmount_ and packetLimit_) and
    * dataWriters_
@@ -76,7 +76,7 @@ bool PerfBufferEventReader::open(
     int bufFd = perf_buffer__buffer_fd(pb_, i);
     cpuBufferHandlers_.push_back(
         std::make_unique<PerfBufferEventReader::CpuBufferHandler>(
-            evb, pb_, bufFd, i));
+            evb, pb_, bufFd, i, this));
   }
 
   return true;
@@ -86,8 +86,9 @@ PerfBufferEventReader::CpuBufferHandler::CpuBufferHandler(
     folly::EventBase* evb,
     struct perf_buffer* pb,
     int fd,
-    size_t idx)
-    : pb_(pb), bufFd_(fd), bufIdx_(idx) {
+    size_t idx,
+    PerfBufferEventReader* reader)
+    : pb_(pb), bufFd_(fd), bufIdx_(idx), reader_(reader) {
   initHandler(evb, folly::NetworkSocket::fromFd(bufFd_));
   if (!registerHandler(READ | PERSIST)) {
     LOG(ERROR) << "Error registering for reading events";
@@ -100,6 +101,7 @@ void PerfBufferEventReader::CpuBufferHandler::handlerReady(
   if (res != 0) {
     LOG(ERROR) << "Error while polling perf event: " << res;
   }
+  reader_->handlePerfBufferBatchEnd();
 }
 
 } // namespace katran
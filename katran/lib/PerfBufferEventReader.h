@@ -59,6 +59,12 @@ class PerfBufferEventReader {
       int /* cpu */,
       uint64_t /* lossCount */) noexcept {}
 
+  /**
+   * Callback after all available events of a cpu buffer have been consumed,
+   * could be used to e.g. batch notifications toward consumers
+   */
+  virtual void handlePerfBufferBatchEnd() noexcept {}
+
  private:
   /**
    * The internal per-cpu event handler
@@ -72,12 +78,14 @@ class PerfBufferEventReader {
      * calls
      * @param fd The buffer fd for a cpu
      * @param idx The buffer fd's index inside struct perf_buffer
+     * @param reader Owning reader, notified once buffer is consumed
      */
     CpuBufferHandler(
         folly::EventBase* evb,
         struct perf_buffer* pb,
         int fd,
-        size_t idx);
+        size_t idx,
+        PerfBufferEventReader* reader);
 
     /**
      * EventHandler callback, will invoke perf_buffer__consume_buffer(), which
@@ -92,6 +100,7 @@ class PerfBufferEventReader {
     struct perf_buffer* pb_{nullptr};
     int bufFd_;
     size_t bufIdx_;
+    PerfBufferEventReader* reader_{nullptr};
   };
 
   /**
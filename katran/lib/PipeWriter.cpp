@@ -23,6 +23,47 @@ void PipeWriter::writeData(const void* ptr, std::size_t size) {
   pipe_->write(&writeCallback_, ptr, size);
 }
 
+void PipeWriter::writeDataBatch(const struct iovec* iov, std::size_t iovcnt) {
+  if (!enabled_) {
+    VLOG_EVERY_N(4, 10) << "Disabled pipe writer. Skipping";
+    return;
+  }
+  if (!pipe_) {
+    VLOG_EVERY_N(4, 10) << "No pipe writer destination. Skipping";
+    return;
+  }
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < iovcnt; i++) {
+    size += iov[i].iov_len;
+  }
+  if (size == 0) {
+    LOG(ERROR) << "Zero-sized data. Skipping";
+    return;
+  }
+  auto buf = folly::IOBuf::create(size);
+  for (std::size_t i = 0; i < iovcnt; i++) {
+    std::memcpy(buf->writableTail(), iov[i].iov_base, iov[i].iov_len);
+    buf->append(iov[i].iov_len);
+  }
+  pipe_->writeChain(&writeCallback_, std::move(buf));
+}
+
+void PipeWriter::writeDataBatch(std::unique_ptr<folly::IOBuf> chain) {
+  if (!enabled_) {
+    VLOG_EVERY_N(4, 10) << "Disabled pipe writer. Skipping";
+    return;
+  }
+  if (!pipe_) {
+    VLOG_EVERY_N(4, 10) << "No pipe writer destination. Skipping";
+    return;
+  }
+  if (!chain || chain->computeChainDataLength() == 0) {
+    LOG(ERROR) << "Zero-sized data. Skipping";
+    return;
+  }
+  pipe_->writeChain(&writeCallback_, std::move(chain));
+}
+
 void PipeWriter::writeHeader(const void* ptr, std::size_t size) {
   // This could overwrite pre-existing header
   headerBuf_ = folly::IOBuf::copyBuffer(ptr, size);
@@ -59,6 +59,33 @@ class PipeWriter : public DataWriter {
    */
   void writeData(const void* ptr, std::size_t size) override;
 
+  /**
+   * Write batch of chunks to the pipe w/ a single write. chunks are copied,
+   * as pipe writer could queue data untill pipe becomes writable
+   */
+  void writeDataBatch(const struct iovec* iov, std::size_t iovcnt) override;
+
+  /**
+   * Write chain of buffers to the pipe as is, w/o a copy
+   */
+  void writeDataBatch(std::unique_ptr<folly::IOBuf> chain) override;
+
+  /**
+   * records are accumulated by PcapWriter only if batching has been enabled,
+   * as it delays delivery to the reader at the other end of the pipe
+   */
+  bool supportsBatching() const override {
+    return batching_;
+  }
+
+  /**
+   * @param bool enabled allow PcapWriter to accumulate records and to write
+   * them in batches. disabled by default
+   */
+  void setBatching(bool enabled) {
+    batching_ = enabled;
+  }
+
   /**
    * Save a copy of header and write data to pipe
    */
@@ -126,6 +153,11 @@ class PipeWriter : public DataWriter {
    */
   bool enabled_{true};
 
+  /**
+   * Flag to allow batching of the records, see setBatching()
+   */
+  bool batching_{false};
+
   /**
    * Writer callback
    */
@@ -0,0 +1,116 @@
+// Copyright 2004-present Facebook. All Rights Reserved.
+
+#include "katran/lib/QueuedClientSubscription.h"
+#include <glog/logging.h>
+#include <algorithm>
+
+namespace katran {
+namespace monitoring {
+
+QueuedClientSubscription::QueuedClientSubscription(
+    std::shared_ptr<ClientSubscriptionIf> sub,
+    uint32_t queueSize,
+    SlowClientPolicy policy)
+    : sub_(std::move(sub)), queue_(queueSize), policy_(policy) {}
+
+std::shared_ptr<QueuedClientSubscription> QueuedClientSubscription::create(
+    std::shared_ptr<ClientSubscriptionIf> sub,
+    uint32_t queueSize,
+    SlowClientPolicy policy) {
+  std::shared_ptr<QueuedClientSubscription> queued(
+      new QueuedClientSubscription(std::move(sub), queueSize, policy));
+  queued->thread_ = std::thread([self = queued]() { self->run(); });
+  return queued;
+}
+
+QueuedClientSubscription::~QueuedClientSubscription() {
+  // delivery thread holds a reference until run() returns, so at this point
+  // it is done w/ the subscription. If it was the last owner, we are on
+  // the delivery thread itself and it can't be joined
+  if (thread_.joinable()) {
+    if (thread_.get_id() == std::this_thread::get_id()) {
+      thread_.detach();
+    } else {
+      thread_.join();
+    }
+  }
+}
+
+void QueuedClientSubscription::sendEvent(const Event& event) {
+  SharedEvent shared{
+      .id = event.id,
+      .pktsize = event.pktsize,
+      .data = folly::IOBuf::copyBuffer(event.data.data(), event.data.size())};
+  sendSharedEvent(shared);
+}
+
+void QueuedClientSubscription::sendSharedEvent(const SharedEvent& event) {
+  if (stopped_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (!queue_.write(event)) {
+    if (policy_ == SlowClientPolicy::DROP) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    // make room for the new event; delivery thread could be reading
+    // concurrently, so it could take more than one attempt
+    SharedEvent oldest;
+    while (!queue_.write(event)) {
+      if (queue_.read(oldest)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  queueEvent_.notify();
+  uint64_t lag = std::max<ssize_t>(queue_.sizeGuess(), 0);
+  if (lag > maxLag_.load(std::memory_order_relaxed)) {
+    maxLag_.store(lag, std::memory_order_relaxed);
+  }
+}
+
+void QueuedClientSubscription::run() {
+  SharedEvent event;
+  while (true) {
+    auto key = queueEvent_.prepareWait();
+    if (stopped_.load()) {
+      queueEvent_.cancelWait();
+      break;
+    }
+    if (!queue_.read(event)) {
+      queueEvent_.wait(key);
+      continue;
+    }
+    queueEvent_.cancelWait();
+    sub_->sendSharedEvent(event);
+    // do not hold the buffer while waiting for the next event
+    event.data.reset();
+    delivered_.fetch_add(1, std::memory_order_relaxed);
+  }
+  while (queue_.read(event)) {
+  }
+}
+
+void QueuedClientSubscription::stop() {
+  if (stopped_.exchange(true)) {
+    return;
+  }
+  queueEvent_.notifyAll();
+  // when stopped from the wrapped subscription's callback the loop exits as
+  // soon as the callback returns
+  if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) {
+    thread_.join();
+  }
+}
+
+SubscriberStats QueuedClientSubscription::getStats() const {
+  SubscriberStats stats;
+  stats.delivered = delivered_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.lag = std::max<ssize_t>(queue_.sizeGuess(), 0);
+  stats.maxLag = maxLag_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+} // namespace monitoring
+} // namespace katran
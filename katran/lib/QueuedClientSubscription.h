@@ -0,0 +1,101 @@
+// Copyright 2004-present Facebook. All Rights Reserved.
+
+#pragma once
+
+#include <folly/MPMCQueue.h>
+#include <folly/synchronization/EventCount.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "katran/lib/MonitoringStructs.h"
+
+namespace katran {
+namespace monitoring {
+
+/**
+ * Subscription which puts events into bounded queue and sends them to the
+ * wrapped subscription from its own thread. This way a slow client can't
+ * stall the pipe reader, which delivers events to every other client.
+ * Queued events share their buffers w/ all the other clients.
+ * Delivery thread holds a reference to the subscription until it is stopped,
+ * so the subscription is never freed while an event is being sent.
+ */
+class QueuedClientSubscription
+    : public ClientSubscriptionIf,
+      public std::enable_shared_from_this<QueuedClientSubscription> {
+ public:
+  /**
+   * Creates subscription and starts its delivery thread. Subscription stays
+   * alive until stop() is called
+   *
+   * @param sub subscription where events are eventually sent to
+   * @param queueSize max number of events waiting to be sent
+   * @param policy what to do when queue is full
+   */
+  static std::shared_ptr<QueuedClientSubscription> create(
+      std::shared_ptr<ClientSubscriptionIf> sub,
+      uint32_t queueSize,
+      SlowClientPolicy policy);
+
+  ~QueuedClientSubscription() override;
+
+  /**
+   * Copies event into a new buffer and queues it
+   */
+  void sendEvent(const Event& event) override;
+
+  /**
+   * Queues event. Never blocks
+   */
+  void sendSharedEvent(const SharedEvent& event) override;
+
+  bool hasEvent(const EventId& event_id) override {
+    return sub_->hasEvent(event_id);
+  }
+
+  /**
+   * Stop delivery. Events which are still queued are discarded. Blocks
+   * until event, which is being sent, is sent, unless called from the
+   * delivery thread itself (e.g. client is canceled while sending); then
+   * delivery stops as soon as the send returns.
+   */
+  void stop();
+
+  /**
+   * Return delivery counters
+   */
+  SubscriberStats getStats() const;
+
+ private:
+  QueuedClientSubscription(
+      std::shared_ptr<ClientSubscriptionIf> sub,
+      uint32_t queueSize,
+      SlowClientPolicy policy);
+
+  /**
+   * Delivery loop, runs in thread_
+   */
+  void run();
+
+  std::shared_ptr<ClientSubscriptionIf> sub_;
+
+  folly::MPMCQueue<SharedEvent> queue_;
+
+  // wakes up delivery thread when event is queued or delivery is stopped
+  folly::EventCount queueEvent_;
+
+  const SlowClientPolicy policy_;
+
+  std::atomic<bool> stopped_{false};
+
+  std::atomic<uint64_t> delivered_{0};
+
+  std::atomic<uint64_t> dropped_{0};
+
+  std::atomic<uint64_t> maxLag_{0};
+
+  std::thread thread_;
+};
+
+} // namespace monitoring
+} // namespace katran
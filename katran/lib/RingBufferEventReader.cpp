@@ -0,0 +1,96 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/RingBufferEventReader.h"
+
+#include <cerrno>
+
+#include <glog/logging.h>
+
+namespace {
+
+// Callback for handling ring buffer's record, supplied to ring_buffer__new
+static int handleEvent(void* ctx, void* rawData, size_t dataSize) {
+  auto ringBufferReader =
+      reinterpret_cast<::katran::RingBufferEventReader*>(ctx);
+  ringBufferReader->handleRingBufferEvent(
+      reinterpret_cast<const char*>(rawData), dataSize);
+  return 0;
+}
+
+} // namespace
+
+namespace katran {
+
+RingBufferEventReader::~RingBufferEventReader() {
+  // by now derived part of the object is destroyed, so consumer thread must
+  // have been stopped by the most derived class (see stop())
+  if (consumer_.joinable()) {
+    LOG(DFATAL) << "ring buffer reader is destroyed w/o stop()";
+    stop();
+  }
+  ring_buffer__free(rb_);
+}
+
+bool RingBufferEventReader::open(int bpfRingBufMap, uint32_t pollTimeoutMs) {
+  if (rb_ != nullptr) {
+    LOG(ERROR) << "ring buffer reader is already opened";
+    return false;
+  }
+  if (pollTimeoutMs == 0) {
+    LOG(ERROR) << "poll timeout must be greater than 0";
+    return false;
+  }
+  rb_ = ring_buffer__new(bpfRingBufMap, handleEvent, this, nullptr);
+  auto maybeError = libbpf_get_error(rb_);
+  if (maybeError != 0) {
+    LOG(ERROR) << "ring_buffer__new() failed: " << maybeError;
+    rb_ = nullptr;
+    return false;
+  }
+  consumer_ = std::thread([this, pollTimeoutMs]() {
+    consumerLoop(pollTimeoutMs);
+  });
+  return true;
+}
+
+void RingBufferEventReader::stop() {
+  stopped_.store(true);
+  if (consumer_.joinable()) {
+    consumer_.join();
+  }
+}
+
+void RingBufferEventReader::consumerLoop(uint32_t pollTimeoutMs) {
+  while (!stopped_.load(std::memory_order_relaxed)) {
+    // returns number of consumed records; a batch of records is drained per
+    // wakeup, so we are paying for epoll only once per batch
+    int res = ring_buffer__poll(rb_, pollTimeoutMs);
+    if (res < 0) {
+      if (res == -EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "Error while polling ring buffer: " << res;
+      break;
+    }
+    if (res > 0) {
+      consumed_.fetch_add(res, std::memory_order_relaxed);
+      handleRingBufferBatchEnd();
+    }
+  }
+}
+
+} // namespace katran
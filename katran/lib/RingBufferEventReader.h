@@ -0,0 +1,97 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+#include <bpf/libbpf.h>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace katran {
+
+/**
+ * RingBufferEventReader consumes events from BPF_MAP_TYPE_RINGBUF. unlike
+ * perf buffer, ring buffer is shared by all cpus and preserves order of
+ * events, so it is drained by a single dedicated consumer thread. producers
+ * could suppress wakeups (see RINGBUF_WAKEUP_BYTES in balancer_consts.h);
+ * such records are picked up once poll's timeout expires.
+ *
+ * consumer thread calls virtual handlers, so the most derived class must call
+ * stop() in its destructor, before its part of the object is destroyed.
+ */
+class RingBufferEventReader {
+ public:
+  RingBufferEventReader() = default;
+  virtual ~RingBufferEventReader();
+
+  RingBufferEventReader(const RingBufferEventReader&) = delete;
+  RingBufferEventReader& operator=(const RingBufferEventReader&) = delete;
+
+  /**
+   * @param int bpfRingBufMap fd of the bpf map, must be of type
+   * BPF_MAP_TYPE_RINGBUF
+   * @param uint32_t pollTimeoutMs upper bound on delivery latency of records
+   * which were committed w/o wakeup
+   * @return true on success
+   *
+   * helper function to open ring buffer and start consumer thread
+   */
+  bool open(int bpfRingBufMap, uint32_t pollTimeoutMs);
+
+  /**
+   * stops consumer thread. records which are still in the ring are dropped.
+   * must be called by derived class before it is destroyed
+   */
+  void stop();
+
+  /**
+   * Callback when an event is ready to consume. called from consumer thread
+   * @param const char* data raw data
+   * @param size_t size data size in bytes
+   */
+  virtual void handleRingBufferEvent(
+      const char* data,
+      size_t size) noexcept = 0;
+
+  /**
+   * Callback after a batch of events has been consumed. called from consumer
+   * thread
+   */
+  virtual void handleRingBufferBatchEnd() noexcept {}
+
+  /**
+   * @return number of records consumed so far
+   */
+  uint64_t getConsumed() const {
+    return consumed_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void consumerLoop(uint32_t pollTimeoutMs);
+
+  /**
+   * Pointer to ring_buffer struct
+   */
+  struct ring_buffer* rb_{nullptr};
+
+  std::thread consumer_;
+
+  std::atomic<bool> stopped_{false};
+
+  std::atomic<uint64_t> consumed_{0};
+};
+
+} // namespace katran
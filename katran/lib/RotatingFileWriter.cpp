@@ -0,0 +1,231 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/RotatingFileWriter.h"
+
+#include <unistd.h>
+#include <cerrno>
+
+#include <folly/FileUtil.h>
+#include <folly/compression/Compression.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+constexpr size_t kCompressBufSize = 64 * 1024;
+constexpr folly::StringPiece kZstdSuffix = ".zst";
+} // namespace
+
+RotatingFileWriter::RotatingFileWriter(
+    const std::string& basename,
+    uint64_t maxBytes,
+    std::chrono::seconds maxAge,
+    uint32_t maxFiles,
+    bool compress,
+    std::chrono::milliseconds flushInterval)
+    : basename_(basename),
+      maxBytes_(maxBytes),
+      maxAge_(maxAge),
+      maxFiles_(maxFiles),
+      flushInterval_(flushInterval) {
+  if (compress) {
+    if (folly::compression::hasStreamCodec(
+            folly::compression::CodecType::ZSTD)) {
+      codec_ = folly::compression::getStreamCodec(
+          folly::compression::CodecType::ZSTD);
+      outBuf_.resize(kCompressBufSize);
+    } else {
+      LOG(ERROR) << "zstd is not supported by folly. writing " << basename_
+                 << " w/o compression";
+    }
+  }
+  openFile();
+}
+
+RotatingFileWriter::~RotatingFileWriter() {
+  closeFile();
+}
+
+std::string RotatingFileWriter::fileName(uint64_t seq) const {
+  auto name = basename_ + "." + std::to_string(seq);
+  if (codec_) {
+    name += kZstdSuffix.str();
+  }
+  return name;
+}
+
+void RotatingFileWriter::openFile() {
+  file_ = folly::File(fileName(seq_).c_str(), O_RDWR | O_CREAT | O_TRUNC);
+  fileBytes_ = 0;
+  fileHasRecords_ = false;
+  openedAt_ = std::chrono::steady_clock::now();
+  lastFlush_ = openedAt_;
+  if (codec_) {
+    codec_->resetStream();
+  }
+  if (maxFiles_ > 0 && seq_ >= maxFiles_) {
+    auto expired = fileName(seq_ - maxFiles_);
+    if (::unlink(expired.c_str()) != 0 && errno != ENOENT) {
+      PLOG(ERROR) << "Error while trying to remove old pcap file: " << expired;
+    }
+  }
+}
+
+void RotatingFileWriter::closeFile() {
+  if (!file_) {
+    return;
+  }
+  if (codec_) {
+    compress(folly::ByteRange(), true, true);
+  }
+  file_.closeNoThrow();
+}
+
+bool RotatingFileWriter::shouldRotate() const {
+  // file w/ nothing but header is never switched, even if header alone is
+  // bigger than maxBytes
+  if (!fileHasRecords_) {
+    return false;
+  }
+  if (maxBytes_ > 0 && fileBytes_ >= maxBytes_) {
+    return true;
+  }
+  return maxAge_.count() > 0 &&
+      std::chrono::steady_clock::now() - openedAt_ >= maxAge_;
+}
+
+void RotatingFileWriter::maybeFlush() {
+  if (!codec_ || flushInterval_.count() == 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastFlush_ < flushInterval_) {
+    return;
+  }
+  compress(folly::ByteRange(), true, false);
+  lastFlush_ = now;
+}
+
+void RotatingFileWriter::writeToFile(const void* ptr, std::size_t size) {
+  auto successfullyWritten = folly::writeFull(file_.fd(), ptr, size);
+  if (successfullyWritten < 0) {
+    LOG(ERROR) << "Error while trying to write to pcap file: "
+               << fileName(seq_);
+  } else {
+    fileBytes_ += successfullyWritten;
+  }
+}
+
+void RotatingFileWriter::compress(folly::ByteRange input, bool flush, bool end) {
+  auto op = end ? folly::compression::StreamCodec::FlushOp::END
+                : (flush ? folly::compression::StreamCodec::FlushOp::FLUSH
+                         : folly::compression::StreamCodec::FlushOp::NONE);
+  for (;;) {
+    folly::MutableByteRange output(outBuf_.data(), outBuf_.size());
+    bool done;
+    try {
+      done = codec_->compressStream(input, output, op);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Error while compressing pcap data: " << e.what();
+      return;
+    }
+    auto produced = output.begin() - outBuf_.data();
+    if (produced > 0) {
+      writeToFile(outBuf_.data(), produced);
+    }
+    // w/o flush compressor is done once it has consumed the input
+    if (op == folly::compression::StreamCodec::FlushOp::NONE ? input.empty()
+                                                              : done) {
+      return;
+    }
+  }
+}
+
+void RotatingFileWriter::writeChunks(
+    const struct iovec* iov,
+    std::size_t iovcnt) {
+  if (!file_) {
+    return;
+  }
+  if (!codec_) {
+    auto successfullyWritten =
+        folly::writevFull(file_.fd(), const_cast<iovec*>(iov), iovcnt);
+    if (successfullyWritten < 0) {
+      LOG(ERROR) << "Error while trying to write to pcap file: "
+                 << fileName(seq_);
+      return;
+    }
+    fileBytes_ += successfullyWritten;
+    writtenBytes_ += successfullyWritten;
+    return;
+  }
+  for (std::size_t i = 0; i < iovcnt; i++) {
+    auto chunk = folly::ByteRange(
+        static_cast<const uint8_t*>(iov[i].iov_base), iov[i].iov_len);
+    compress(chunk, false, false);
+    writtenBytes_ += iov[i].iov_len;
+  }
+}
+
+void RotatingFileWriter::write(const struct iovec* iov, std::size_t iovcnt) {
+  if (file_ && shouldRotate()) {
+    closeFile();
+    ++seq_;
+    openFile();
+    if (!header_.empty()) {
+      struct iovec hdr = {header_.data(), header_.size()};
+      writeChunks(&hdr, 1);
+    }
+  }
+  writeChunks(iov, iovcnt);
+  fileHasRecords_ = true;
+  maybeFlush();
+}
+
+void RotatingFileWriter::writeData(const void* ptr, std::size_t size) {
+  struct iovec iov = {const_cast<void*>(ptr), size};
+  write(&iov, 1);
+}
+
+void RotatingFileWriter::writeHeader(const void* ptr, std::size_t size) {
+  auto data = static_cast<const uint8_t*>(ptr);
+  header_.assign(data, data + size);
+  // header belongs to the file which is being written: no rotation here
+  struct iovec iov = {const_cast<void*>(ptr), size};
+  writeChunks(&iov, 1);
+}
+
+void RotatingFileWriter::writeDataBatch(
+    const struct iovec* iov,
+    std::size_t iovcnt) {
+  write(iov, iovcnt);
+}
+
+bool RotatingFileWriter::restart() {
+  closeFile();
+  header_.clear();
+  ++seq_;
+  openFile();
+  return true;
+}
+
+bool RotatingFileWriter::stop() {
+  closeFile();
+  return true;
+}
+
+} // namespace katran
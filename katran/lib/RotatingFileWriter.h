@@ -0,0 +1,185 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/File.h>
+#include <folly/Range.h>
+
+#include "katran/lib/DataWriter.h"
+
+namespace folly {
+namespace compression {
+class StreamCodec;
+} // namespace compression
+} // namespace folly
+
+namespace katran {
+
+/**
+ * RotatingFileWriter writes pcap-data into a sequence of files:
+ * <basename>.0, <basename>.1 and so on. new file is started when current one
+ * becomes bigger than maxBytes or older than maxAge. header (last one written
+ * w/ writeHeader) is repeated at the beginning of every file, so each of them
+ * could be read on its own. files are switched only between writeData or
+ * writeDataBatch calls, so records which are written w/ a single call are
+ * never split. compressed data is buffered by compressor, so size of such
+ * file grows (and is checked against maxBytes) in compressed blocks.
+ */
+class RotatingFileWriter : public DataWriter {
+ public:
+  /**
+   * @param const string basename prefix of files' names
+   * @param uint64_t maxBytes max size of a file on disk. 0 - unlimited
+   * @param seconds maxAge max time since file has been created. 0 - unlimited
+   * @param uint32_t maxFiles number of the most recent files to keep. older
+   * files are removed. 0 - keep all of them
+   * @param bool compress if true - files are compressed w/ streaming zstd and
+   * have .zst suffix
+   * @param milliseconds flushInterval how often data buffered by compressor
+   * is written out. 0 - only when file is switched or closed
+   */
+  RotatingFileWriter(
+      const std::string& basename,
+      uint64_t maxBytes,
+      std::chrono::seconds maxAge,
+      uint32_t maxFiles,
+      bool compress,
+      std::chrono::milliseconds flushInterval = std::chrono::milliseconds(0));
+
+  ~RotatingFileWriter() override;
+
+  /**
+   * rotates the file if needed and writes the data into it
+   */
+  void writeData(const void* ptr, std::size_t size) override;
+
+  /**
+   * saves a copy of the header to repeat it in the next files
+   */
+  void writeHeader(const void* ptr, std::size_t size) override;
+
+  /**
+   * rotates the file if needed and writes all the chunks into it
+   */
+  void writeDataBatch(const struct iovec* iov, std::size_t iovcnt) override;
+
+  using DataWriter::writeDataBatch;
+
+  bool supportsBatching() const override {
+    return true;
+  }
+
+  bool available(std::size_t /* unused */) override {
+    return true;
+  }
+
+  /**
+   * starts the next file. header is expected to be written again
+   */
+  bool restart() override;
+
+  bool stop() override;
+
+  /**
+   * @return string name of the file which is being written
+   */
+  std::string currentFile() const {
+    return fileName(seq_);
+  }
+
+ private:
+  std::string fileName(uint64_t seq) const;
+
+  /**
+   * helper function which opens file w/ current seq_ and removes files
+   * which are out of retention
+   */
+  void openFile();
+
+  /**
+   * helper function which finishes compressed stream and closes current file
+   */
+  void closeFile();
+
+  bool shouldRotate() const;
+
+  /**
+   * helper function which writes out data buffered by compressor if
+   * flushInterval has passed since the last flush
+   */
+  void maybeFlush();
+
+  /**
+   * shared write path of writeData and writeDataBatch: switches to the next
+   * file (and repeats the header there) if current one is full or too old
+   */
+  void write(const struct iovec* iov, std::size_t iovcnt);
+
+  void writeChunks(const struct iovec* iov, std::size_t iovcnt);
+
+  /**
+   * helper function to compress input and to write the output to the file.
+   * if flush is true - all the data buffered by compressor is written as well
+   */
+  void compress(folly::ByteRange input, bool flush, bool end);
+
+  void writeToFile(const void* ptr, std::size_t size);
+
+  const std::string basename_;
+  const uint64_t maxBytes_;
+  const std::chrono::seconds maxAge_;
+  const uint32_t maxFiles_;
+  const std::chrono::milliseconds flushInterval_;
+
+  std::unique_ptr<folly::compression::StreamCodec> codec_;
+
+  /**
+   * buffer for compressor's output
+   */
+  std::vector<uint8_t> outBuf_;
+
+  folly::File file_;
+
+  /**
+   * sequence number of current file
+   */
+  uint64_t seq_{0};
+
+  /**
+   * bytes written into current file on disk
+   */
+  uint64_t fileBytes_{0};
+
+  /**
+   * true if anything besides the header has been written into current file
+   */
+  bool fileHasRecords_{false};
+
+  std::chrono::steady_clock::time_point openedAt_;
+
+  std::chrono::steady_clock::time_point lastFlush_;
+
+  std::vector<uint8_t> header_;
+};
+
+} // namespace katran
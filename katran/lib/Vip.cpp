@@ -32,12 +32,14 @@ Vip::Vip(
     : vipNum_(vipNum),
       vipFlags_(vipFlags),
       chRingSize_(ringSize),
-      chRing_(ringSize, -1) {
+      chRing_(ringSize, -1),
+      hashFunction_(func) {
   chash = CHFactory::make(func);
 }
 
 void Vip::setHashFunction(HashFunction func) {
   chash = CHFactory::make(func);
+  hashFunction_ = func;
 }
 
 std::vector<RealPos> Vip::calculateHashRing(std::vector<Endpoint> endpoints) {
@@ -69,6 +71,21 @@ std::vector<RealPos> Vip::recalculateHashRing() {
   return calculateHashRing(reals);
 }
 
+bool Vip::restoreState(
+    const std::vector<Endpoint>& reals,
+    std::vector<int> chRing) {
+  if (chRing.size() != chRingSize_) {
+    return false;
+  }
+  reals_.clear();
+  for (const auto& real : reals) {
+    reals_[real.num].weight = real.weight;
+    reals_[real.num].hash = real.hash;
+  }
+  chRing_ = std::move(chRing);
+  return true;
+}
+
 std::vector<RealPos> Vip::addReal(Endpoint real) {
   std::vector<UpdateReal> reals;
   UpdateReal ureal;
@@ -111,26 +128,32 @@ std::vector<Endpoint> Vip::getRealsAndWeight() {
 }
 
 std::vector<Endpoint> Vip::getEndpoints(std::vector<UpdateReal>& ureals) {
+  return applyRealsUpdates(reals_, ureals);
+}
+
+std::vector<Endpoint> Vip::applyRealsUpdates(
+    std::unordered_map<uint32_t, VipRealMeta>& reals,
+    const std::vector<UpdateReal>& ureals) {
   Endpoint endpoint;
   std::vector<Endpoint> endpoints;
   bool reals_changed = false;
 
   for (auto& ureal : ureals) {
     if (ureal.action == ModifyAction::DEL) {
-      reals_.erase(ureal.updatedReal.num);
+      reals.erase(ureal.updatedReal.num);
       reals_changed = true;
     } else {
-      auto cur_weight = reals_[ureal.updatedReal.num].weight;
+      auto cur_weight = reals[ureal.updatedReal.num].weight;
       if (cur_weight != ureal.updatedReal.weight) {
-        reals_[ureal.updatedReal.num].weight = ureal.updatedReal.weight;
-        reals_[ureal.updatedReal.num].hash = ureal.updatedReal.hash;
+        reals[ureal.updatedReal.num].weight = ureal.updatedReal.weight;
+        reals[ureal.updatedReal.num].hash = ureal.updatedReal.hash;
         reals_changed = true;
       }
     }
   }
 
   if (reals_changed) {
-    for (auto& real : reals_) {
+    for (auto& real : reals) {
       // skipping 0 weight
       if (real.second.weight != 0) {
         endpoint.num = real.first;
@@ -144,4 +167,15 @@ std::vector<Endpoint> Vip::getEndpoints(std::vector<UpdateReal>& ureals) {
   return endpoints;
 }
 
+std::vector<int> Vip::previewHashRing(
+    const std::vector<UpdateReal>& ureals) const {
+  auto reals = reals_;
+  auto endpoints = applyRealsUpdates(reals, ureals);
+  if (endpoints.empty()) {
+    // same as calculateHashRing: ring is not touched
+    return chRing_;
+  }
+  return chash->generateHashRing(std::move(endpoints), chRingSize_);
+}
+
 } // namespace katran
@@ -81,6 +81,10 @@ class Vip {
     return chRingSize_;
   }
 
+  HashFunction getHashFunction() const {
+    return hashFunction_;
+  }
+
   /**
    * @param uint32_t flags to set
    *
@@ -158,6 +162,36 @@ class Vip {
    */
   std::vector<RealPos> recalculateHashRing();
 
+  /**
+   * @param vector<Endpoint> reals which are currently configured for the vip
+   * @param vector<int> ch ring which is currently programmed in forwarding
+   * plane (-1 for unset position)
+   * @return bool true on success
+   *
+   * helper function to restore vip's state (e.g. after restart) w/o hash ring
+   * recalculation. following updates would return delta against this ring
+   */
+  bool restoreState(
+      const std::vector<Endpoint>& reals,
+      std::vector<int> chRing);
+
+  /**
+   * @param vector<UpdateReal> reals which we want to update
+   * @return vector<int> ch ring which vip would have after batchRealsUpdate
+   * w/ the same reals (-1 for unset position)
+   *
+   * helper function to calculate hash ring for proposed changes w/o applying
+   * them to the vip
+   */
+  std::vector<int> previewHashRing(const std::vector<UpdateReal>& ureals) const;
+
+  /**
+   * @return const vector<int>& ch ring which is used for this vip
+   */
+  const std::vector<int>& getChRing() const {
+    return chRing_;
+  }
+
  private:
   /**
    * helper function which will modify reals_ and return vector of reals after
@@ -165,6 +199,14 @@ class Vip {
    */
   std::vector<Endpoint> getEndpoints(std::vector<UpdateReal>& ureals);
 
+  /**
+   * helper function which applies updates to specified reals and returns
+   * reals w/ non zero weight (empty if nothing has been changed)
+   */
+  static std::vector<Endpoint> applyRealsUpdates(
+      std::unordered_map<uint32_t, VipRealMeta>& reals,
+      const std::vector<UpdateReal>& ureals);
+
   /**
    * helper function to calculate hash ring and return delta
    */
@@ -202,6 +244,11 @@ class Vip {
    * hash function to generate hash ring
    */
   std::unique_ptr<ConsistentHash> chash;
+
+  /**
+   * type of the hash function which is used by chash
+   */
+  HashFunction hashFunction_;
 };
 
 } // namespace katran
@@ -108,12 +108,32 @@ __attribute__((__always_inline__)) static inline bool get_packet_dst(
       struct v6_lpm_key lpm_key_v6 = {};
       lpm_key_v6.prefixlen = 128;
       memcpy(lpm_key_v6.addr, pckt->flow.srcv6, 16);
+#ifdef LPM_SRC_SHADOW_MAPS
+      __u32 lpm_slot = 0;
+      void* lpm_map = bpf_map_lookup_elem(&lpm_src_v6_maps, &lpm_slot);
+      if (lpm_map) {
+        lpm_val = bpf_map_lookup_elem(lpm_map, &lpm_key_v6);
+      } else {
+        lpm_val = bpf_map_lookup_elem(&lpm_src_v6, &lpm_key_v6);
+      }
+#else
       lpm_val = bpf_map_lookup_elem(&lpm_src_v6, &lpm_key_v6);
+#endif
     } else {
       struct v4_lpm_key lpm_key_v4 = {};
       lpm_key_v4.addr = pckt->flow.src;
       lpm_key_v4.prefixlen = 32;
+#ifdef LPM_SRC_SHADOW_MAPS
+      __u32 lpm_slot = 0;
+      void* lpm_map = bpf_map_lookup_elem(&lpm_src_v4_maps, &lpm_slot);
+      if (lpm_map) {
+        lpm_val = bpf_map_lookup_elem(lpm_map, &lpm_key_v4);
+      } else {
+        lpm_val = bpf_map_lookup_elem(&lpm_src_v4, &lpm_key_v4);
+      }
+#else
       lpm_val = bpf_map_lookup_elem(&lpm_src_v4, &lpm_key_v4);
+#endif
     }
     if (lpm_val) {
       src_found = true;
@@ -795,12 +815,14 @@ process_packet(struct xdp_md* xdp, __u64 nh_off, bool is_ipv6) {
         !(vip_info->flags & F_HASH_SRC_DST_PORT)) {
       // VIP, which doesnt care about dst port (all packets to this VIP w/ diff
       // dst port but from the same src port/ip must go to the same real
+      pckt.orig_dport = pckt.flow.port16[1];
       pckt.flow.port16[1] = 0;
     }
   }
 
   if (data_end - data > MAX_PCKT_SIZE) {
-    REPORT_PACKET_TOOBIG(xdp, data, data_end - data, false);
+    REPORT_PACKET_TOOBIG(
+        xdp, data, data_end - data, false, &pckt, is_ipv6);
 #ifdef ICMP_TOOBIG_GENERATION
     __u32 stats_key = MAX_VIPS + ICMP_TOOBIG_CNTRS;
     data_stats = bpf_map_lookup_elem(&stats, &stats_key);
@@ -899,7 +921,7 @@ process_packet(struct xdp_md* xdp, __u64 nh_off, bool is_ipv6) {
               // fail to find a real server with the real pos, drop the packet
               quic_packets_stats->cid_unknown_real_dropped += 1;
               REPORT_QUIC_PACKET_DROP_NO_REAL(
-                  xdp, data, data_end - data, false);
+                  xdp, data, data_end - data, false, &pckt, is_ipv6);
               return XDP_DROP;
             }
             int res = check_and_update_real_index_in_lru(&pckt, lru_map);
@@ -1011,7 +1033,8 @@ process_packet(struct xdp_md* xdp, __u64 nh_off, bool is_ipv6) {
           // miss of non-syn tcp packet. could be either because of LRU
           // trashing or because another katran is restarting and all the
           // sessions have been reshuffled
-          REPORT_TCP_NONSYN_LRUMISS(xdp, data, data_end - data, false);
+          REPORT_TCP_NONSYN_LRUMISS(
+              xdp, data, data_end - data, false, &pckt, is_ipv6);
           lru_stats->v2 += 1;
         }
       }
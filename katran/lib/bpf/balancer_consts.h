@@ -106,6 +106,36 @@
 #define MAX_SUPPORTED_CPUS 128
 #endif
 
+// number of entries in introspection's event_filters map. indexed by event id
+#define EVENT_FILTERS_MAP_SIZE 16
+
+// flags for event_filter
+// report event only if packet is destined to specified vip
+#define F_EVENT_FILTER_VIP (1 << 0)
+// report event only if packet's source belongs to specified prefix
+#define F_EVENT_FILTER_SRC (1 << 1)
+// vip in filter is ipv6 address
+#define F_EVENT_FILTER_VIP_V6 (1 << 2)
+// src prefix in filter is ipv6 prefix
+#define F_EVENT_FILTER_SRC_V6 (1 << 3)
+
+// set in event_metadata's event field if metadata is followed by time of the
+// event (see struct event_header)
+#define EVENT_F_KTIME (1U << 31)
+
+// size (in bytes) of introspection's ring buffer. must be a power of 2 and
+// a multiple of page size
+#ifndef RINGBUF_SIZE
+#define RINGBUF_SIZE (1 << 20)
+#endif
+
+// consumer of introspection's ring buffer is woken up only when this much
+// data is pending. records below this watermark are picked up by consumer's
+// periodic poll, so wakeups (and their cost on forwarding path) are batched
+#ifndef RINGBUF_WAKEUP_BYTES
+#define RINGBUF_WAKEUP_BYTES (RINGBUF_SIZE / 32)
+#endif
+
 // default lru is a fallback lru, which will be used when forwarding cpu/core
 // cannot find per core lru in lrus map-in-map.
 // we should only have a hit in this default lru while running unittests.
@@ -154,6 +184,10 @@
 #define F_UDP_STABLE_ROUTING_VIP (1 << 8)
 // check if real is down and invalidate any packets which are going to it
 #define F_UDP_FLOW_MIGRATION (1 << 9)
+// vip's address is ipv6. set by the control plane only, so address family of
+// v6 vip w/ zeroed low 96 bits could be told from v4 one on restore. not used
+// by the forwarding plane
+#define F_VIP_V6 (1U << 31)
 // packet_description flags:
 // the description has been created from icmp msg
 #define F_ICMP (1 << 0)
@@ -363,6 +397,9 @@ v2 tracks misses for TCP non syns */
  *
  * LPM_SRC_LOOKUP - allow to do src based routing/dst decision override
  *
+ * LPM_SRC_SHADOW_MAPS - (requires LPM_SRC_LOOKUP) lookup src routing tries
+ * through single slot map-in-map, so whole table could be atomically replaced
+ *
  * INLINE_DECAP_GENERIC - enables features to allow pckt specific inline
  * decapsulation
  *
@@ -378,6 +415,13 @@ v2 tracks misses for TCP non syns */
  * KATRAN_INTROSPECTION - katran will start to perfpipe packet's header which
  * have triggered specific events
  *
+ * KATRAN_INTROSPECTION_RINGBUF - same as KATRAN_INTROSPECTION, but events are
+ * reported through BPF_MAP_TYPE_RINGBUF (shared by all cpus, requires kernel
+ * 5.18+) instead of per cpu perf buffers
+ *
+ * KATRAN_INTROSPECTION_KTIME - introspection events carry bpf_ktime_get_ns()
+ * of the moment they have been reported (used for pcapng timestamps)
+ *
  * LOCAL_DELIVERY_OPTIMIZATION - allow to do optimization on local traffic,
  * where vip and real address are specified the same machine
  */
@@ -395,6 +439,12 @@ v2 tracks misses for TCP non syns */
 #endif // of INLINE_DECAP_IPIP
 #endif
 
+#ifdef KATRAN_INTROSPECTION_RINGBUF
+#ifndef KATRAN_INTROSPECTION
+#define KATRAN_INTROSPECTION
+#endif // of KATRAN_INTROSPECTION
+#endif // of KATRAN_INTROSPECTION_RINGBUF
+
 #ifdef INLINE_DECAP_IPIP
 #ifndef INLINE_DECAP_GENERIC
 #define INLINE_DECAP_GENERIC
@@ -41,6 +41,94 @@
   })
 
 #ifdef KATRAN_INTROSPECTION
+/**
+ * helper to check if masked addresses are equal. prefixlen is in bits, and
+ * addresses are in network byte order
+ */
+__attribute__((__always_inline__)) static inline bool
+prefix_match(__be32* addr, __be32* prefix, __u32 prefixlen, int words) {
+  __u32 bits;
+  __u32 mask;
+#pragma clang loop unroll(full)
+  for (int i = 0; i < 4; i++) {
+    if (i >= words || prefixlen == 0) {
+      break;
+    }
+    bits = prefixlen > 32 ? 32 : prefixlen;
+    prefixlen -= bits;
+    mask = bits == 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> bits);
+    if ((addr[i] ^ prefix[i]) & bpf_htonl(mask)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * helper to check if packet matches event's filter
+ */
+__attribute__((__always_inline__)) static inline bool event_filter_match(
+    struct event_filter* filter,
+    struct packet_description* pckt,
+    bool is_ipv6) {
+  int words = is_ipv6 ? 4 : 1;
+  if (filter->flags & F_EVENT_FILTER_VIP) {
+    if (is_ipv6 != !!(filter->flags & F_EVENT_FILTER_VIP_V6) ||
+        pckt->flow.proto != filter->vip_proto) {
+      return false;
+    }
+    // flow's dst port is zeroed for vips which don't hash on it
+    __be16 dport =
+        pckt->flow.port16[1] ? pckt->flow.port16[1] : pckt->orig_dport;
+    if (filter->vip_port && dport != filter->vip_port) {
+      return false;
+    }
+    if (!prefix_match(pckt->flow.dstv6, filter->vipv6, words * 32, words)) {
+      return false;
+    }
+  }
+  if (filter->flags & F_EVENT_FILTER_SRC) {
+    if (is_ipv6 != !!(filter->flags & F_EVENT_FILTER_SRC_V6)) {
+      return false;
+    }
+    if (!prefix_match(
+            pckt->flow.srcv6, filter->srcv6, filter->src_prefixlen, words)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * helper to check if event should be reported: introspection must be
+ * enabled, packet must match event's filter and pass sampling. all of this
+ * is done before any packet's data is copied
+ */
+__attribute__((__always_inline__)) static inline bool should_report_event(
+    __u32 event_id,
+    struct packet_description* pckt,
+    bool is_ipv6) {
+  struct ctl_value* gk;
+  struct event_filter* filter;
+  __u32 introspection_gk_pos = 5;
+  gk = bpf_map_lookup_elem(&ctl_array, &introspection_gk_pos);
+  if (!gk || gk->value == 0) {
+    return false;
+  }
+  filter = bpf_map_lookup_elem(&event_filters, &event_id);
+  if (!filter) {
+    return true;
+  }
+  if (filter->flags && !event_filter_match(filter, pckt, is_ipv6)) {
+    return false;
+  }
+  if (filter->sample_rate > 1 &&
+      (bpf_get_prandom_u32() % filter->sample_rate) != 0) {
+    return false;
+  }
+  return true;
+}
+
 /**
  * helper to print blob of data into perf pipe
  */
@@ -50,25 +138,81 @@ __attribute__((__always_inline__)) static inline void submit_event(
     __u32 event_id,
     void* data,
     __u32 size,
-    bool metadata_only) {
-  struct ctl_value* gk;
-  __u32 introspection_gk_pos = 5;
-  gk = bpf_map_lookup_elem(&ctl_array, &introspection_gk_pos);
-  if (!gk || gk->value == 0) {
+    bool metadata_only,
+    struct packet_description* pckt,
+    bool is_ipv6) {
+  if (!should_report_event(event_id, pckt, is_ipv6)) {
     return;
   }
-  struct event_metadata md = {};
+  struct event_header hdr = {};
   __u64 flags = BPF_F_CURRENT_CPU;
-  md.event = event_id;
-  md.pkt_size = size;
+  hdr.md.event = event_id;
+  hdr.md.pkt_size = size;
+#ifdef KATRAN_INTROSPECTION_KTIME
+  hdr.md.event |= EVENT_F_KTIME;
+  hdr.ts = bpf_ktime_get_ns();
+#endif // of KATRAN_INTROSPECTION_KTIME
   if (metadata_only) {
-    md.data_len = 0;
+    hdr.md.data_len = 0;
   } else {
-    md.data_len = min_helper(size, MAX_EVENT_SIZE);
-    flags |= (__u64)md.data_len << 32;
+    hdr.md.data_len = min_helper(size, MAX_EVENT_SIZE);
+    flags |= (__u64)hdr.md.data_len << 32;
+  }
+  bpf_perf_event_output(ctx, map, flags, &hdr, sizeof(struct event_header));
+}
+
+#ifdef KATRAN_INTROSPECTION_RINGBUF
+struct ringbuf_event {
+  struct event_header hdr;
+  __u8 data[MAX_EVENT_SIZE];
+};
+
+/**
+ * helper to reserve a record in ring buffer, fill it in place and commit it.
+ * wakeups are adaptive: consumer is notified only when enough data is pending
+ */
+__attribute__((__always_inline__)) static inline void submit_event_ringbuf(
+    struct xdp_md* ctx,
+    void* map,
+    __u32 event_id,
+    __u32 size,
+    bool metadata_only,
+    struct packet_description* pckt,
+    bool is_ipv6) {
+  struct ringbuf_event* rec;
+  __u32 data_len = 0;
+  __u64 flags = BPF_RB_NO_WAKEUP;
+  if (!should_report_event(event_id, pckt, is_ipv6)) {
+    return;
+  }
+  // fixed size reservation, so record's layout is known to verifier. unused
+  // tail is cheaper than an extra copy through the stack
+  rec = bpf_ringbuf_reserve(map, sizeof(struct ringbuf_event), 0);
+  if (!rec) {
+    // ring is full; consumer is lagging
+    return;
+  }
+  if (!metadata_only) {
+    data_len = min_helper(size, MAX_EVENT_SIZE);
+  }
+  if (data_len > 0 && data_len <= MAX_EVENT_SIZE) {
+    if (bpf_xdp_load_bytes(ctx, 0, rec->data, data_len)) {
+      data_len = 0;
+    }
+  }
+  rec->hdr.md.event = event_id;
+  rec->hdr.md.pkt_size = size;
+  rec->hdr.md.data_len = data_len;
+#ifdef KATRAN_INTROSPECTION_KTIME
+  rec->hdr.md.event |= EVENT_F_KTIME;
+  rec->hdr.ts = bpf_ktime_get_ns();
+#endif // of KATRAN_INTROSPECTION_KTIME
+  if (bpf_ringbuf_query(map, BPF_RB_AVAIL_DATA) >= RINGBUF_WAKEUP_BYTES) {
+    flags = BPF_RB_FORCE_WAKEUP;
   }
-  bpf_perf_event_output(ctx, map, flags, &md, sizeof(struct event_metadata));
+  bpf_ringbuf_submit(rec, flags);
 }
+#endif // of KATRAN_INTROSPECTION_RINGBUF
 #endif
 
 #ifdef INLINE_DECAP_GENERIC
@@ -180,6 +180,43 @@ struct {
   __uint(map_flags, BPF_F_NO_PREALLOC);
 } lpm_src_v6 SEC(".maps");
 
+#ifdef LPM_SRC_SHADOW_MAPS
+// single slot outer maps. if slot is populated - the inner trie is used
+// instead of lpm_src_v4/v6. allows userspace to build a new table
+// in the shadow trie and swap it in w/ a single update
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+  __type(key, __u32);
+  __type(value, __u32);
+  __uint(max_entries, 1);
+  __array(
+      values,
+      struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __type(key, struct v4_lpm_key);
+        __type(value, __u32);
+        __uint(max_entries, MAX_LPM_SRC);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+      });
+} lpm_src_v4_maps SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+  __type(key, __u32);
+  __type(value, __u32);
+  __uint(max_entries, 1);
+  __array(
+      values,
+      struct {
+        __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+        __type(key, struct v6_lpm_key);
+        __type(value, __u32);
+        __uint(max_entries, MAX_LPM_SRC);
+        __uint(map_flags, BPF_F_NO_PREALLOC);
+      });
+} lpm_src_v6_maps SEC(".maps");
+#endif // of LPM_SRC_SHADOW_MAPS
+
 #endif // of LPM_SRC_LOOKUP
 
 #ifdef GLOBAL_LRU_LOOKUP
@@ -46,6 +46,9 @@ struct packet_description {
   __u8 flags;
   // dscp / ToS value in client's packet
   __u8 tos;
+  // dst port from the packet. set only when flow's dst port has been zeroed
+  // for vip which doesn't hash on it
+  __be16 orig_dport;
 };
 
 // value for ctl array, could contain e.g. mac address of default router
@@ -122,6 +125,38 @@ struct event_metadata {
   __u32 data_len;
 } __attribute__((__packed__));
 
+// header of the record in event pipe. layout of event_metadata is shared w/
+// older userspace, so time of the event is appended only if forwarding plane
+// is built w/ KATRAN_INTROSPECTION_KTIME. such records have EVENT_F_KTIME
+// set in md.event
+struct event_header {
+  struct event_metadata md;
+#ifdef KATRAN_INTROSPECTION_KTIME
+  // bpf_ktime_get_ns() when event has been reported
+  __u64 ts;
+#endif // of KATRAN_INTROSPECTION_KTIME
+} __attribute__((__packed__));
+
+// per event sampling rate and filters, checked before packet is copied into
+// event pipe. zeroed entry means report every event
+struct event_filter {
+  // report 1 out of sample_rate matching events. 0 or 1 - report all
+  __u32 sample_rate;
+  __u32 flags;
+  union {
+    __be32 vip;
+    __be32 vipv6[4];
+  };
+  union {
+    __be32 src;
+    __be32 srcv6[4];
+  };
+  // in network byte order. 0 matches any port
+  __u16 vip_port;
+  __u8 vip_proto;
+  __u8 src_prefixlen;
+};
+
 #endif
 
 #ifdef RECORD_FLOW_INFO
@@ -42,6 +42,14 @@ struct {
 
 #ifdef KATRAN_INTROSPECTION
 
+#ifdef KATRAN_INTROSPECTION_RINGBUF
+// same name as perf based pipe, so userspace could discover introspection
+// w/o knowing which flavor has been built; flavor is derived from map's type
+struct {
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, RINGBUF_SIZE);
+} event_pipe SEC(".maps");
+#else
 struct {
   __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
   __type(key, int);
@@ -49,6 +57,16 @@ struct {
   __uint(max_entries, MAX_SUPPORTED_CPUS);
   __uint(map_flags, NO_FLAGS);
 } event_pipe SEC(".maps");
+#endif // of KATRAN_INTROSPECTION_RINGBUF
+
+// sampling rates and filters for introspection events. indexed by event id
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __type(key, __u32);
+  __type(value, struct event_filter);
+  __uint(max_entries, EVENT_FILTERS_MAP_SIZE);
+  __uint(map_flags, NO_FLAGS);
+} event_filters SEC(".maps");
 
 #endif
 
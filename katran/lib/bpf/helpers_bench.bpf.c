@@ -0,0 +1,378 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * microbenchmarks of forwarding plane's helpers. every program runs exactly
+ * one helper (parsing, checksum, encapsulation or icmp generation) on the
+ * packet it has been given, so the cost of the helper could be measured w/
+ * BPF_PROG_TEST_RUN in isolation from the rest of balancer's pipeline.
+ *
+ * BPF_PROG_TEST_RUN runs the program on the same xdp_buff for every repeat,
+ * so programs which move packet's head (or tail) restore it before return.
+ * the cost of this restore is measured by bench_adjust_head. bytes in front
+ * of the original l3 header (i.e. ethernet header) are not restored, so
+ * such programs never look at them and take packet's family as a constant.
+ *
+ * all programs return XDP_PASS if helper has produced expected result and
+ * XDP_DROP otherwise.
+ */
+
+// both ipip and gue encap helpers are benchmarked
+#define GUE_ENCAP
+
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "katran/lib/linux_includes/bpf.h"
+#include "katran/lib/linux_includes/bpf_endian.h"
+#include "katran/lib/linux_includes/bpf_helpers.h"
+
+#include "katran/lib/bpf/balancer_consts.h"
+#include "katran/lib/bpf/balancer_structs.h"
+#include "katran/lib/bpf/csum_helpers.h"
+#include "katran/lib/bpf/handle_icmp.h"
+#include "katran/lib/bpf/pckt_encap.h"
+#include "katran/lib/bpf/pckt_parsing.h"
+
+// server id which runner puts into quic and stable routing packets
+#define BENCH_SERVER_ID 0x123456
+
+__attribute__((__always_inline__)) static inline bool is_ipv6_pckt(
+    void* data,
+    void* data_end) {
+  struct ethhdr* eth = data;
+  if (eth + 1 > data_end) {
+    return false;
+  }
+  return eth->h_proto == BE_ETH_P_IPV6;
+}
+
+// fills flow from the packet w/o going through parsing helpers, so encap
+// benchmarks don't include parsing cost (and their inputs are not compile
+// time constants)
+__attribute__((__always_inline__)) static inline bool fill_pckt(
+    void* data,
+    void* data_end,
+    bool is_ipv6,
+    struct packet_description* pckt,
+    __u32* pkt_bytes) {
+  __u64 off = sizeof(struct ethhdr);
+  if (is_ipv6) {
+    struct ipv6hdr* ip6h = data + off;
+    if (ip6h + 1 > data_end) {
+      return false;
+    }
+    memcpy(pckt->flow.srcv6, ip6h->saddr.s6_addr32, 16);
+    memcpy(pckt->flow.dstv6, ip6h->daddr.s6_addr32, 16);
+    pckt->flow.proto = ip6h->nexthdr;
+    *pkt_bytes = bpf_ntohs(ip6h->payload_len);
+    off += sizeof(struct ipv6hdr);
+  } else {
+    struct iphdr* iph = data + off;
+    if (iph + 1 > data_end) {
+      return false;
+    }
+    pckt->flow.src = iph->saddr;
+    pckt->flow.dst = iph->daddr;
+    pckt->flow.proto = iph->protocol;
+    *pkt_bytes = bpf_ntohs(iph->tot_len);
+    off += sizeof(struct iphdr);
+  }
+  __u32* ports = data + off;
+  if (ports + 1 > data_end) {
+    return false;
+  }
+  pckt->flow.ports = *ports;
+  return true;
+}
+
+__attribute__((__always_inline__)) static inline void fill_dst(
+    struct real_definition* dst,
+    struct ctl_value* cval) {
+  dst->dstv6[0] = bpf_htonl(0xfc000000);
+  dst->dstv6[1] = 0;
+  dst->dstv6[2] = 0;
+  dst->dstv6[3] = bpf_htonl(0x0a000001);
+  dst->flags = 0;
+  cval->value = 0;
+  cval->mac[0] = 0x02;
+  cval->mac[5] = 0x01;
+}
+
+// cost of the loop of BPF_PROG_TEST_RUN itself
+SEC("xdp")
+int bench_baseline(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  if (data + sizeof(struct ethhdr) > data_end) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+// cost of head's move and restore, which is a part of every encap benchmark
+SEC("xdp")
+int bench_adjust_head(struct xdp_md* ctx) {
+  int delta = (int)sizeof(struct iphdr);
+  if (bpf_xdp_adjust_head(ctx, 0 - delta)) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(ctx, delta)) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_parse_l3_headers(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  bool is_ipv6 = is_ipv6_pckt(data, data_end);
+  __u64 th_off = 0;
+  __u16 pkt_bytes;
+  __u8 protocol;
+  int action = parse_l3_headers(
+      &pckt,
+      &protocol,
+      sizeof(struct ethhdr),
+      &th_off,
+      &pkt_bytes,
+      data,
+      data_end,
+      is_ipv6);
+  if (action >= 0 || pckt.flow.proto == 0) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_parse_quic(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  bool is_ipv6 = is_ipv6_pckt(data, data_end);
+  struct quic_parse_result res = parse_quic(data, data_end, is_ipv6, &pckt);
+  if (res.server_id != BENCH_SERVER_ID) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_parse_udp_stable_rt_hdr(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  bool is_ipv6 = is_ipv6_pckt(data, data_end);
+  struct udp_stable_rt_result res =
+      parse_udp_stable_rt_hdr(data, data_end, is_ipv6, &pckt);
+  if (!res.is_stable_rt_pkt || res.server_id != BENCH_SERVER_ID) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+// checksum of valid ipv4 header (w/ checksum field) folds to 0
+SEC("xdp")
+int bench_ipv4_csum(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct iphdr* iph = data + sizeof(struct ethhdr);
+  __u64 csum = 0;
+  if (iph + 1 > data_end) {
+    return XDP_DROP;
+  }
+  ipv4_csum(iph, sizeof(struct iphdr), &csum);
+  return csum == 0 ? XDP_PASS : XDP_DROP;
+}
+
+SEC("xdp")
+int bench_ipv4_csum_inline(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct iphdr* iph = data + sizeof(struct ethhdr);
+  __u64 csum = 0;
+  if (iph + 1 > data_end) {
+    return XDP_DROP;
+  }
+  ipv4_csum_inline(iph, &csum);
+  return csum == 0 ? XDP_PASS : XDP_DROP;
+}
+
+// ipip (v4 in v4) encap
+SEC("xdp")
+int bench_encap_v4(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  struct real_definition dst;
+  struct ctl_value cval;
+  __u32 pkt_bytes;
+  if (!fill_pckt(data, data_end, false, &pckt, &pkt_bytes)) {
+    return XDP_DROP;
+  }
+  fill_dst(&dst, &cval);
+  if (!encap_v4(ctx, &cval, &pckt, &dst, pkt_bytes)) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(ctx, (int)sizeof(struct iphdr))) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+// ip(6)ip6 encap. encap overwrites original ethernet header, so inner
+// family can't be taken from the packet on the next repeat and each family
+// has its own program
+__attribute__((__always_inline__)) static inline int encap_v6_bench(
+    struct xdp_md* ctx,
+    bool is_ipv6) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  struct real_definition dst;
+  struct ctl_value cval;
+  __u32 pkt_bytes;
+  if (!fill_pckt(data, data_end, is_ipv6, &pckt, &pkt_bytes)) {
+    return XDP_DROP;
+  }
+  fill_dst(&dst, &cval);
+  if (!encap_v6(ctx, &cval, is_ipv6, &pckt, &dst, pkt_bytes)) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(ctx, (int)sizeof(struct ipv6hdr))) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_encap_v4_in_v6(struct xdp_md* ctx) {
+  return encap_v6_bench(ctx, false);
+}
+
+SEC("xdp")
+int bench_encap_v6_in_v6(struct xdp_md* ctx) {
+  return encap_v6_bench(ctx, true);
+}
+
+// gue encap w/ outer udp checksum. needs v4 source in pckt_srcs map
+SEC("xdp")
+int bench_gue_encap_v4(struct xdp_md* ctx) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  struct real_definition dst;
+  struct ctl_value cval;
+  __u32 pkt_bytes;
+  if (!fill_pckt(data, data_end, false, &pckt, &pkt_bytes)) {
+    return XDP_DROP;
+  }
+  fill_dst(&dst, &cval);
+  if (!gue_encap_v4(ctx, &cval, &pckt, &dst, pkt_bytes)) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(
+          ctx, (int)sizeof(struct iphdr) + (int)sizeof(struct udphdr))) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+// gue encap into v6. needs v6 source in pckt_srcs map. inner family is
+// fixed per program for the same reason as in ip(6)ip6 encap
+__attribute__((__always_inline__)) static inline int gue_encap_v6_bench(
+    struct xdp_md* ctx,
+    bool is_ipv6) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  struct packet_description pckt = {};
+  struct real_definition dst;
+  struct ctl_value cval;
+  __u32 pkt_bytes;
+  if (!fill_pckt(data, data_end, is_ipv6, &pckt, &pkt_bytes)) {
+    return XDP_DROP;
+  }
+  fill_dst(&dst, &cval);
+  if (!gue_encap_v6(ctx, &cval, is_ipv6, &pckt, &dst, pkt_bytes)) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(
+          ctx, (int)sizeof(struct ipv6hdr) + (int)sizeof(struct udphdr))) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_gue_encap_v4_in_v6(struct xdp_md* ctx) {
+  return gue_encap_v6_bench(ctx, false);
+}
+
+SEC("xdp")
+int bench_gue_encap_v6_in_v6(struct xdp_md* ctx) {
+  return gue_encap_v6_bench(ctx, true);
+}
+
+// packet too big reply (incl. truncation of original packet). packet must
+// be bigger than ICMP_TOOBIG_SIZE / ICMP6_TOOBIG_SIZE. reply overwrites
+// original ethernet header, so family is fixed per program
+__attribute__((__always_inline__)) static inline int icmp_too_big_bench(
+    struct xdp_md* ctx,
+    bool is_ipv6) {
+  void* data = (void*)(long)ctx->data;
+  void* data_end = (void*)(long)ctx->data_end;
+  int pckt_size = data_end - data;
+  int headroom;
+  int tailroom;
+  if (is_ipv6) {
+    headroom = (int)sizeof(struct ipv6hdr) + (int)sizeof(struct icmp6hdr);
+    tailroom = pckt_size - ICMP6_TOOBIG_SIZE;
+  } else {
+    headroom = (int)sizeof(struct iphdr) + (int)sizeof(struct icmphdr);
+    tailroom = pckt_size - ICMP_TOOBIG_SIZE;
+  }
+  if (tailroom < 0) {
+    return XDP_DROP;
+  }
+  if (send_icmp_too_big(ctx, is_ipv6, pckt_size) != XDP_TX) {
+    return XDP_DROP;
+  }
+  if (bpf_xdp_adjust_head(ctx, headroom) ||
+      bpf_xdp_adjust_tail(ctx, tailroom)) {
+    return XDP_DROP;
+  }
+  return XDP_PASS;
+}
+
+SEC("xdp")
+int bench_icmp_too_big_v4(struct xdp_md* ctx) {
+  return icmp_too_big_bench(ctx, false);
+}
+
+SEC("xdp")
+int bench_icmp_too_big_v6(struct xdp_md* ctx) {
+  return icmp_too_big_bench(ctx, true);
+}
+
+char _license[] SEC("license") = "GPL";
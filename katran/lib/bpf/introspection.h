@@ -24,15 +24,44 @@
 #define QUIC_PACKET_DROP_NO_REAL 2
 
 #ifdef KATRAN_INTROSPECTION
-// Introspection enabled, enable helpers
-#define REPORT_EVENT(xdp, event, data, size, meta_only) \
-  ({ submit_event((xdp), &event_pipe, (event), data, size, meta_only); })
-#define REPORT_TCP_NONSYN_LRUMISS(xdp, data, size, meta_only) \
-  REPORT_EVENT(xdp, TCP_NONSYN_LRUMISS, data, size, meta_only)
-#define REPORT_PACKET_TOOBIG(xdp, data, size, meta_only) \
-  REPORT_EVENT(xdp, PACKET_TOOBIG, data, size, meta_only)
-#define REPORT_QUIC_PACKET_DROP_NO_REAL(xdp, data, size, meta_only) \
-  REPORT_EVENT(xdp, QUIC_PACKET_DROP_NO_REAL, data, size, meta_only)
+// Introspection enabled, enable helpers. pckt (parsed flow) and is_ipv6 are
+// used by per event filters (see event_filters map)
+#ifdef KATRAN_INTROSPECTION_RINGBUF
+// data always points to the beginning of the packet, so ring buffer flavor
+// reads it from the xdp context directly
+#define REPORT_EVENT(xdp, event, data, size, meta_only, pckt, is_ipv6) \
+  ({                                                                  \
+    submit_event_ringbuf(                                             \
+        (xdp), &event_pipe, (event), size, meta_only, pckt, is_ipv6); \
+  })
+#else
+#define REPORT_EVENT(xdp, event, data, size, meta_only, pckt, is_ipv6) \
+  ({                                                                  \
+    submit_event(                                                     \
+        (xdp),                                                        \
+        &event_pipe,                                                  \
+        (event),                                                      \
+        data,                                                         \
+        size,                                                         \
+        meta_only,                                                    \
+        pckt,                                                         \
+        is_ipv6);                                                     \
+  })
+#endif // of KATRAN_INTROSPECTION_RINGBUF
+#define REPORT_TCP_NONSYN_LRUMISS(xdp, data, size, meta_only, pckt, is_ipv6) \
+  REPORT_EVENT(xdp, TCP_NONSYN_LRUMISS, data, size, meta_only, pckt, is_ipv6)
+#define REPORT_PACKET_TOOBIG(xdp, data, size, meta_only, pckt, is_ipv6) \
+  REPORT_EVENT(xdp, PACKET_TOOBIG, data, size, meta_only, pckt, is_ipv6)
+#define REPORT_QUIC_PACKET_DROP_NO_REAL(                 \
+    xdp, data, size, meta_only, pckt, is_ipv6)           \
+  REPORT_EVENT(                                          \
+      xdp,                                               \
+      QUIC_PACKET_DROP_NO_REAL,                          \
+      data,                                              \
+      size,                                              \
+      meta_only,                                         \
+      pckt,                                              \
+      is_ipv6)
 #else
 // Introspection disabled, define helpers to be noop
 #define REPORT_TCP_NONSYN_LRUMISS(...) \
@@ -0,0 +1,40 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <iostream>
+
+#include "katran/lib/KatranSnapshot.h"
+
+DEFINE_string(snapshot, "", "path to katran's snapshot");
+DEFINE_bool(rings, false, "dump ch rings as well");
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  if (FLAGS_snapshot.empty()) {
+    std::cout << "path to snapshot must be specified\n";
+    return 1;
+  }
+  auto snapshot = katran::KatranSnapshot::open(FLAGS_snapshot);
+  if (snapshot.hasError()) {
+    std::cout << "can't open snapshot: " << snapshot.error() << std::endl;
+    return 1;
+  }
+  std::cout << snapshot.value()->dump(FLAGS_rings);
+  return 0;
+}
@@ -376,6 +376,25 @@ static int (*bpf_skb_adjust_room)(
     __u32 mode,
     unsigned long long flags) = (void*)BPF_FUNC_skb_adjust_room;
 
+/* helpers which are newer than the uapi header above; ids are stable kernel
+ * ABI, so they are referenced directly (same as libbpf's bpf_helper_defs.h)
+ */
+static long (*bpf_ringbuf_output)(
+    void* ringbuf,
+    void* data,
+    __u64 size,
+    __u64 flags) = (void*)130;
+static void* (*bpf_ringbuf_reserve)(void* ringbuf, __u64 size, __u64 flags) =
+    (void*)131;
+static void (*bpf_ringbuf_submit)(void* data, __u64 flags) = (void*)132;
+static void (*bpf_ringbuf_discard)(void* data, __u64 flags) = (void*)133;
+static __u64 (*bpf_ringbuf_query)(void* ringbuf, __u64 flags) = (void*)134;
+static long (*bpf_xdp_load_bytes)(
+    void* xdp_md,
+    __u32 offset,
+    void* buf,
+    __u32 len) = (void*)189;
+
 /* Scan the ARCH passed in from ARCH env variable (see Makefile) */
 #if defined(__TARGET_ARCH_x86)
 #define bpf_target_x86
@@ -0,0 +1,58 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <fmt/core.h>
+
+#include "katran/lib/KatranLbStructs.h"
+
+namespace katran {
+namespace testing {
+
+/**
+ * @return uint64_t resident set size of the process in KB (0 if it could not
+ * be read)
+ */
+inline uint64_t rssKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0) {
+      return std::stoull(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+/**
+ * @param int i index of the vip
+ * @return VipKey unique v6 tcp vip for each index
+ */
+inline VipKey makeVip(int i) {
+  VipKey vip;
+  vip.address = fmt::format("fc00::{:x}:{:x}", i >> 16, i & 0xffff);
+  vip.port = 443;
+  vip.proto = 6;
+  return vip;
+}
+
+} // namespace testing
+} // namespace katran
@@ -0,0 +1,225 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// microbenchmark of forwarding plane's helpers (parsing, checksums, encap and
+// icmp generation). every helper is wrapped into its own xdp program (see
+// bpf/helpers_bench.bpf.c) and timed w/ BPF_PROG_TEST_RUN, so regressions
+// of a single helper are visible even if they are lost in the noise of the
+// whole balancer_ingress. reported time is the median of --runs runs of
+// --repeat repetitions each; "net" is the same minus the time of empty
+// program (bench_baseline). must be run as root
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/BpfAdapter.h"
+#include "katran/lib/IpHelpers.h"
+#include "katran/lib/testing/tools/TrafficGenerator.h"
+
+DEFINE_string(
+    bpf_prog,
+    "./helpers_bench.bpf.o",
+    "path to object file w/ helpers benchmark programs");
+DEFINE_int32(repeat, 1000000, "number of repetitions per run");
+DEFINE_int32(runs, 5, "number of runs per benchmark");
+DEFINE_int32(payload_size, 400, "size of l4 payload of the test packets");
+DEFINE_string(filter, "", "run only benchmarks which contain this substring");
+
+namespace {
+
+// must be in sync w/ BENCH_SERVER_ID in helpers_bench.bpf.c
+constexpr uint32_t kServerId = 0x123456;
+constexpr uint8_t kStableRoutingHeader = 0x52;
+constexpr uint32_t kSrcV4Pos = 0;
+constexpr uint32_t kSrcV6Pos = 1;
+constexpr uint32_t kXdpPass = 2;
+constexpr size_t kEthHdrLen = 14;
+constexpr size_t kIpv4HdrLen = 20;
+constexpr size_t kIpv6HdrLen = 40;
+constexpr size_t kUdpHdrLen = 8;
+// biggest packet after encap (or icmp generation) of the test packet
+constexpr size_t kOutputHeadroom = 256;
+
+enum class PcktKind {
+  TCP,
+  QUIC,
+  STABLE_RT,
+};
+
+struct BenchCase {
+  std::string name;
+  std::string prog;
+  PcktKind kind;
+  bool v6;
+};
+
+const std::vector<BenchCase> kCases = {
+    {"baseline", "bench_baseline", PcktKind::TCP, false},
+    {"adjust_head", "bench_adjust_head", PcktKind::TCP, false},
+    {"parse_l3_headers v4", "bench_parse_l3_headers", PcktKind::TCP, false},
+    {"parse_l3_headers v6", "bench_parse_l3_headers", PcktKind::TCP, true},
+    {"parse_quic v4", "bench_parse_quic", PcktKind::QUIC, false},
+    {"parse_quic v6", "bench_parse_quic", PcktKind::QUIC, true},
+    {"parse_udp_stable_rt_hdr v4",
+     "bench_parse_udp_stable_rt_hdr",
+     PcktKind::STABLE_RT,
+     false},
+    {"parse_udp_stable_rt_hdr v6",
+     "bench_parse_udp_stable_rt_hdr",
+     PcktKind::STABLE_RT,
+     true},
+    {"ipv4_csum", "bench_ipv4_csum", PcktKind::TCP, false},
+    {"ipv4_csum_inline", "bench_ipv4_csum_inline", PcktKind::TCP, false},
+    {"ipip encap v4", "bench_encap_v4", PcktKind::TCP, false},
+    {"ipip encap v4 in v6", "bench_encap_v4_in_v6", PcktKind::TCP, false},
+    {"ipip encap v6", "bench_encap_v6_in_v6", PcktKind::TCP, true},
+    {"gue encap v4", "bench_gue_encap_v4", PcktKind::TCP, false},
+    {"gue encap v4 in v6", "bench_gue_encap_v4_in_v6", PcktKind::TCP, false},
+    {"gue encap v6", "bench_gue_encap_v6_in_v6", PcktKind::TCP, true},
+    {"icmp too big v4", "bench_icmp_too_big_v4", PcktKind::TCP, false},
+    {"icmp too big v6", "bench_icmp_too_big_v6", PcktKind::TCP, true},
+};
+
+std::vector<uint8_t> makePacket(PcktKind kind, bool v6) {
+  katran::testing::TrafficSpec spec;
+  spec.vips = {{v6 ? "fc00:1::1" : "10.200.1.1", 443, 1}};
+  spec.srcPrefixes = {{v6 ? "fc00:2::/64" : "172.16.0.0/12"}};
+  spec.tcpShare = kind == PcktKind::TCP ? 1 : 0;
+  spec.quicShare = kind == PcktKind::QUIC ? 1 : 0;
+  spec.udpShare = kind == PcktKind::STABLE_RT ? 1 : 0;
+  spec.quicServerIds = {kServerId};
+  spec.payloadSizes = {{static_cast<uint16_t>(FLAGS_payload_size), 1}};
+  katran::testing::TrafficBuffer buf;
+  katran::testing::TrafficGenerator(spec).generate(1, buf);
+  auto pckt = buf.packet(0);
+  std::vector<uint8_t> result(pckt.begin(), pckt.end());
+  if (kind == PcktKind::STABLE_RT) {
+    // udp payload starts w/ stable routing header and the same server id
+    // schema as quic's cid v2. udp checksum is not checked by the parser
+    auto off = kEthHdrLen + (v6 ? kIpv6HdrLen : kIpv4HdrLen) + kUdpHdrLen;
+    result[off] = kStableRoutingHeader;
+    result[off + 1] = (kServerId >> 16) & 0xff;
+    result[off + 2] = (kServerId >> 8) & 0xff;
+    result[off + 3] = kServerId & 0xff;
+  }
+  return result;
+}
+
+bool setupGueSources(katran::BpfAdapter& adapter) {
+  auto mapFd = adapter.getMapFdByName("pckt_srcs");
+  if (mapFd < 0) {
+    LOG(ERROR) << "can't find pckt_srcs map";
+    return false;
+  }
+  auto srcV4 = katran::IpHelpers::parseAddrToBe("10.0.13.37");
+  auto srcV6 = katran::IpHelpers::parseAddrToBe("fc00:2307::1337");
+  auto key = kSrcV4Pos;
+  if (adapter.bpfUpdateMap(mapFd, &key, &srcV4)) {
+    return false;
+  }
+  key = kSrcV6Pos;
+  return adapter.bpfUpdateMap(mapFd, &key, &srcV6) == 0;
+}
+
+/**
+ * @return median of per packet time (in ns) across runs or -1 on failure
+ */
+double runCase(katran::BpfAdapter& adapter, const BenchCase& bench) {
+  auto progFd = adapter.getProgFdByName(bench.prog);
+  if (progFd < 0) {
+    LOG(ERROR) << "can't find prog " << bench.prog;
+    return -1;
+  }
+  auto pckt = makePacket(bench.kind, bench.v6);
+  std::vector<uint8_t> out(pckt.size() + kOutputHeadroom);
+  std::vector<uint32_t> durations;
+  for (int i = 0; i < FLAGS_runs; i++) {
+    uint32_t sizeOut = out.size();
+    uint32_t retval = 0;
+    uint32_t duration = 0;
+    auto res = adapter.testXdpProg(
+        progFd,
+        FLAGS_repeat,
+        pckt.data(),
+        pckt.size(),
+        out.data(),
+        &sizeOut,
+        &retval,
+        &duration);
+    if (res < 0) {
+      LOG(ERROR) << "test run of " << bench.prog << " failed: " << res;
+      return -1;
+    }
+    if (retval != kXdpPass) {
+      LOG(ERROR) << bench.name << ": helper has not produced expected "
+                 << "result, retval: " << retval;
+      return -1;
+    }
+    durations.push_back(duration);
+  }
+  std::sort(durations.begin(), durations.end());
+  return durations[durations.size() / 2];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_repeat, 0);
+  CHECK_GT(FLAGS_runs, 0);
+  // stable routing header and truncation to icmp6 too big size
+  CHECK_GE(FLAGS_payload_size, 300);
+
+  katran::BpfAdapter adapter(true /* set_limits */);
+  if (adapter.loadBpfProg(FLAGS_bpf_prog)) {
+    LOG(ERROR) << "can't load " << FLAGS_bpf_prog;
+    return 1;
+  }
+  if (!setupGueSources(adapter)) {
+    LOG(ERROR) << "can't set up gue source addresses";
+    return 1;
+  }
+
+  auto baseline = runCase(adapter, kCases[0]);
+  if (baseline < 0) {
+    return 1;
+  }
+  std::cout << fmt::format(
+      "{:<32} {:>10} {:>10}\n", "helper", "ns/pckt", "net ns");
+  bool failed = false;
+  for (const auto& bench : kCases) {
+    if (bench.name.find(FLAGS_filter) == std::string::npos) {
+      continue;
+    }
+    auto ns = runCase(adapter, bench);
+    if (ns < 0) {
+      std::cout << fmt::format("{:<32} {:>10}\n", bench.name, "FAILED");
+      failed = true;
+      continue;
+    }
+    std::cout << fmt::format(
+        "{:<32} {:>10.1f} {:>10.1f}\n", bench.name, ns, ns - baseline);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// per operation benchmark of katran's control plane api: throughput and
+// latency distribution of every call and rss growth for each operation.
+// unlike control_plane_scale_bench (which measures bulk population of huge
+// configs), this one covers incremental updates, as they happen in
+// production: reals are added/removed one by one or in batches of
+// different sizes, hash functions are flipped, quic and src routing
+// mappings are changed. katran runs in testing mode, so nothing is
+// programmed into the kernel and it could be run w/o root
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/KatranLb.h"
+#include "katran/lib/testing/benchmarks/BenchUtils.h"
+
+DEFINE_int32(vips, 512, "number of vips to configure");
+DEFINE_int32(reals_per_vip, 100, "number of reals per vip");
+DEFINE_int32(ch_ring_size, 65537, "size of ch ring per vip (must be prime)");
+DEFINE_string(
+    batch_sizes,
+    "1,10,100,1000",
+    "comma separated batch sizes for modifyRealsForVip");
+DEFINE_int32(quic_reals, 100000, "number of quic server id mappings");
+DEFINE_int32(quic_batch, 1000, "mappings per modifyQuicRealsMapping call");
+DEFINE_int32(src_rules, 1000000, "number of src routing prefixes");
+DEFINE_int32(src_batch, 10000, "prefixes per addSrcRoutingRule call");
+
+namespace {
+
+using katran::testing::makeVip;
+using katran::testing::rssKb;
+
+/**
+ * latencies of the calls of a single operation
+ */
+class OpStats {
+ public:
+  explicit OpStats(std::string name) : name_(std::move(name)) {
+    rssStart_ = rssKb();
+  }
+
+  /**
+   * @param F f call to time
+   * @param uint64_t items number of entries (reals, prefixes etc) changed by
+   * the call
+   */
+  template <typename F>
+  void time(F&& f, uint64_t items = 1) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    latencies_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count());
+    items_ += items;
+  }
+
+  void report() {
+    if (latencies_.empty()) {
+      return;
+    }
+    uint64_t total = 0;
+    for (auto lat : latencies_) {
+      total += lat;
+    }
+    std::sort(latencies_.begin(), latencies_.end());
+    auto pct = [this](double p) {
+      return latencies_[std::min<size_t>(
+                 latencies_.size() * p, latencies_.size() - 1)] /
+          1000.0;
+    };
+    int64_t rssDelta = rssKb() - rssStart_;
+    std::cout << fmt::format(
+        "{:<32} {:>8} calls {:>12.0f} items/s  p50 {:>10.1f}us  p99 "
+        "{:>10.1f}us  max {:>10.1f}us  rss {:>+8} KB\n",
+        name_,
+        latencies_.size(),
+        total > 0 ? items_ * 1e9 / total : 0,
+        pct(0.5),
+        pct(0.99),
+        latencies_.back() / 1000.0,
+        rssDelta);
+  }
+
+ private:
+  std::string name_;
+  std::vector<uint64_t> latencies_;
+  uint64_t items_{0};
+  uint64_t rssStart_{0};
+};
+
+katran::NewReal makeReal(const std::string& prefix, int i) {
+  katran::NewReal real;
+  real.address =
+      fmt::format("{}:{:x}:{:x}", prefix, (i >> 16) & 0xffff, i & 0xffff);
+  real.weight = 10;
+  real.flags = 0;
+  return real;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_vips, 0);
+  CHECK_GT(FLAGS_reals_per_vip, 1);
+  CHECK_GT(FLAGS_quic_batch, 0);
+  CHECK_GT(FLAGS_src_batch, 0);
+
+  std::vector<int> batchSizes;
+  std::vector<folly::StringPiece> parts;
+  folly::split(',', FLAGS_batch_sizes, parts);
+  for (const auto& part : parts) {
+    batchSizes.push_back(folly::to<int>(part));
+    CHECK_GT(batchSizes.back(), 0);
+  }
+  auto maxBatch = *std::max_element(batchSizes.begin(), batchSizes.end());
+
+  katran::KatranConfig config;
+  config.mainInterface = "lo";
+  config.enableHc = false;
+  config.testing = true;
+  config.memlockUnlimited = false;
+  config.maxVips = FLAGS_vips;
+  // real's index 0 is reserved. batch's reals are shared by all the vips.
+  // src routing rules point to a single real
+  config.maxReals = FLAGS_vips * FLAGS_reals_per_vip + maxBatch +
+      FLAGS_quic_reals + 2;
+  config.chRingSize = FLAGS_ch_ring_size;
+  config.maxLpmSrcSize = std::max<uint32_t>(
+      FLAGS_src_rules, katran::kDefaultMaxLpmSrcSize);
+  config.LruSize = 1;
+
+  auto rssStart = rssKb();
+  auto lb = std::make_unique<katran::KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+
+  std::vector<katran::VipKey> vips;
+  for (int i = 0; i < FLAGS_vips; i++) {
+    vips.push_back(makeVip(i));
+  }
+  {
+    OpStats stats("addVip");
+    for (const auto& vip : vips) {
+      stats.time([&]() { CHECK(lb->addVip(vip)); });
+    }
+    stats.report();
+  }
+
+  // every vip has its own set of reals
+  std::vector<std::vector<katran::NewReal>> vipReals(FLAGS_vips);
+  for (int i = 0; i < FLAGS_vips; i++) {
+    for (int j = 0; j < FLAGS_reals_per_vip; j++) {
+      vipReals[i].push_back(makeReal("fc01::", i * FLAGS_reals_per_vip + j));
+    }
+  }
+  {
+    // each call rebuilds vip's ch ring
+    OpStats stats("addRealForVip");
+    for (int j = 0; j < FLAGS_reals_per_vip; j++) {
+      for (int i = 0; i < FLAGS_vips; i++) {
+        stats.time(
+            [&]() { CHECK(lb->addRealForVip(vipReals[i][j], vips[i])); });
+      }
+    }
+    stats.report();
+  }
+
+  std::vector<katran::NewReal> batchReals;
+  for (int i = 0; i < maxBatch; i++) {
+    batchReals.push_back(makeReal("fc02::", i));
+  }
+  for (auto batchSize : batchSizes) {
+    std::vector<katran::NewReal> batch(
+        batchReals.begin(), batchReals.begin() + batchSize);
+    OpStats add(fmt::format("modifyRealsForVip(ADD, {})", batchSize));
+    OpStats del(fmt::format("modifyRealsForVip(DEL, {})", batchSize));
+    for (const auto& vip : vips) {
+      add.time(
+          [&]() {
+            CHECK(lb->modifyRealsForVip(katran::ModifyAction::ADD, batch, vip));
+          },
+          batchSize);
+      del.time(
+          [&]() {
+            CHECK(lb->modifyRealsForVip(katran::ModifyAction::DEL, batch, vip));
+          },
+          batchSize);
+    }
+    add.report();
+    del.report();
+  }
+
+  {
+    OpStats stats("changeHashFunctionForVip");
+    for (auto func :
+         {katran::HashFunction::MaglevV2, katran::HashFunction::Maglev}) {
+      for (const auto& vip : vips) {
+        stats.time([&]() { CHECK(lb->changeHashFunctionForVip(vip, func)); });
+      }
+    }
+    stats.report();
+  }
+
+  {
+    // half of the reals of every vip, so ring is never empty
+    OpStats stats("delRealForVip");
+    for (int j = 0; j < FLAGS_reals_per_vip / 2; j++) {
+      for (int i = 0; i < FLAGS_vips; i++) {
+        stats.time(
+            [&]() { CHECK(lb->delRealForVip(vipReals[i][j], vips[i])); });
+      }
+    }
+    stats.report();
+  }
+
+  std::vector<std::vector<katran::QuicReal>> quicBatches;
+  for (int i = 0; i < FLAGS_quic_reals; i++) {
+    if (i % FLAGS_quic_batch == 0) {
+      quicBatches.emplace_back();
+    }
+    katran::QuicReal real;
+    real.address = makeReal("fc03::", i).address;
+    real.id = i + 1;
+    quicBatches.back().push_back(std::move(real));
+  }
+  {
+    OpStats add(
+        fmt::format("modifyQuicRealsMapping(ADD, {})", FLAGS_quic_batch));
+    for (const auto& batch : quicBatches) {
+      add.time(
+          [&]() {
+            lb->modifyQuicRealsMapping(katran::ModifyAction::ADD, batch);
+          },
+          batch.size());
+    }
+    add.report();
+    OpStats del(
+        fmt::format("modifyQuicRealsMapping(DEL, {})", FLAGS_quic_batch));
+    for (const auto& batch : quicBatches) {
+      del.time(
+          [&]() {
+            lb->modifyQuicRealsMapping(katran::ModifyAction::DEL, batch);
+          },
+          batch.size());
+    }
+    del.report();
+  }
+
+  // distinct /24s starting from 1.0.0.0/24
+  std::vector<std::vector<std::string>> srcBatches;
+  std::vector<std::pair<std::string, std::string>> srcRules;
+  const std::string srcDst = "fc04::1";
+  for (int i = 0; i < FLAGS_src_rules; i++) {
+    if (i % FLAGS_src_batch == 0) {
+      srcBatches.emplace_back();
+    }
+    auto src = fmt::format(
+        "{}.{}.{}.0/24", 1 + (i >> 16), (i >> 8) & 0xff, i & 0xff);
+    srcBatches.back().push_back(src);
+    srcRules.emplace_back(std::move(src), srcDst);
+  }
+  {
+    OpStats add(fmt::format("addSrcRoutingRule({})", FLAGS_src_batch));
+    for (const auto& batch : srcBatches) {
+      add.time(
+          [&]() { CHECK_EQ(lb->addSrcRoutingRule(batch, srcDst), 0); },
+          batch.size());
+    }
+    add.report();
+    OpStats del(fmt::format("delSrcRoutingRule({})", FLAGS_src_batch));
+    for (const auto& batch : srcBatches) {
+      del.time([&]() { CHECK(lb->delSrcRoutingRule(batch)); }, batch.size());
+    }
+    del.report();
+  }
+  {
+    OpStats bulk("addSrcRoutingRulesBulk");
+    bulk.time(
+        [&]() { CHECK_EQ(lb->addSrcRoutingRulesBulk(srcRules, true), 0); },
+        srcRules.size());
+    bulk.report();
+    OpStats clear("clearAllSrcRoutingRules");
+    clear.time(
+        [&]() { CHECK(lb->clearAllSrcRoutingRules()); }, srcRules.size());
+    clear.report();
+  }
+
+  {
+    OpStats stats("delVip");
+    for (const auto& vip : vips) {
+      stats.time([&]() { CHECK(lb->delVip(vip)); });
+    }
+    stats.report();
+  }
+
+  std::cout << fmt::format(
+      "rss: {} KB at start, {} KB at exit\n", rssStart, rssKb());
+  return 0;
+}
@@ -0,0 +1,177 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// scale benchmark of katran's control plane: add/lookup/delete throughput and
+// memory footprint of KatranLb w/ --vips vips and --reals reals in total.
+// katran runs in testing mode, so nothing is programmed into the kernel and
+// it could be run w/o root
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fmt/core.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/KatranLb.h"
+#include "katran/lib/testing/benchmarks/BenchUtils.h"
+
+DEFINE_int32(vips, 65536, "number of vips to configure");
+DEFINE_int32(reals, 1000000, "total number of reals (spread across vips)");
+DEFINE_int32(ch_ring_size, 1031, "size of ch ring per vip (must be prime)");
+DEFINE_int32(lookups, 10000000, "number of lookups for each lookup test");
+
+namespace {
+
+using katran::testing::makeVip;
+using katran::testing::rssKb;
+
+template <typename F>
+double timeIt(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void report(const std::string& op, uint64_t count, double seconds) {
+  std::cout << fmt::format(
+      "{:<24} {:>10} ops in {:>8.3f}s {:>12.0f} ops/s\n",
+      op,
+      count,
+      seconds,
+      seconds > 0 ? count / seconds : 0);
+}
+
+std::string makeReal(int i) {
+  return fmt::format(
+      "10.{}.{}.{}", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK_GT(FLAGS_vips, 0);
+  CHECK_GE(FLAGS_reals, FLAGS_vips);
+
+  katran::KatranConfig config;
+  config.mainInterface = "lo";
+  config.enableHc = false;
+  config.testing = true;
+  config.memlockUnlimited = false;
+  config.maxVips = FLAGS_vips;
+  // real's index 0 is reserved
+  config.maxReals = FLAGS_reals + 1;
+  config.chRingSize = FLAGS_ch_ring_size;
+  config.LruSize = 1;
+
+  auto rssStart = rssKb();
+  auto lb = std::make_unique<katran::KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+
+  std::vector<katran::VipKey> vips;
+  vips.reserve(FLAGS_vips);
+  for (int i = 0; i < FLAGS_vips; i++) {
+    vips.push_back(makeVip(i));
+  }
+  auto t = timeIt([&]() {
+    for (const auto& vip : vips) {
+      CHECK(lb->addVip(vip));
+    }
+  });
+  report("addVip", vips.size(), t);
+
+  // reals are spread evenly, each vip gets its reals in a single batch
+  auto realsPerVip = FLAGS_reals / FLAGS_vips;
+  std::vector<std::vector<katran::NewReal>> vipReals(FLAGS_vips);
+  for (int i = 0; i < FLAGS_reals; i++) {
+    katran::NewReal real;
+    real.address = makeReal(i);
+    real.weight = 10;
+    vipReals[std::min(i / realsPerVip, FLAGS_vips - 1)].push_back(real);
+  }
+  t = timeIt([&]() {
+    for (int i = 0; i < FLAGS_vips; i++) {
+      CHECK(lb->modifyRealsForVip(
+          katran::ModifyAction::ADD, vipReals[i], vips[i]));
+    }
+  });
+  report("modifyRealsForVip(ADD)", FLAGS_reals, t);
+  auto rssPopulated = rssKb();
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> vipDist(0, FLAGS_vips - 1);
+  std::uniform_int_distribution<int> realDist(0, FLAGS_reals - 1);
+  std::vector<int> vipIdx(FLAGS_lookups);
+  std::vector<std::string> realAddrs(FLAGS_lookups);
+  for (int i = 0; i < FLAGS_lookups; i++) {
+    vipIdx[i] = vipDist(gen);
+    realAddrs[i] = makeReal(realDist(gen));
+  }
+  uint64_t sink = 0;
+  t = timeIt([&]() {
+    for (auto idx : vipIdx) {
+      sink += lb->getVipFlags(vips[idx]);
+    }
+  });
+  report("getVipFlags", vipIdx.size(), t);
+  t = timeIt([&]() {
+    for (const auto& addr : realAddrs) {
+      sink += lb->getIndexForReal(addr);
+    }
+  });
+  report("getIndexForReal", realAddrs.size(), t);
+
+  // weight change of a single real per vip
+  for (auto& reals : vipReals) {
+    reals.resize(1);
+    reals[0].weight = 20;
+  }
+  t = timeIt([&]() {
+    for (int i = 0; i < FLAGS_vips; i++) {
+      CHECK(lb->modifyRealsForVip(
+          katran::ModifyAction::ADD, vipReals[i], vips[i]));
+    }
+  });
+  report("modifyRealsForVip(weight)", FLAGS_vips, t);
+
+  t = timeIt([&]() {
+    for (const auto& vip : vips) {
+      CHECK(lb->delVip(vip));
+    }
+  });
+  report("delVip", vips.size(), t);
+
+  std::cout << fmt::format(
+      "rss: {} KB at start, {} KB w/ {} vips and {} reals ({:.1f} bytes per "
+      "real incl. ch rings), {} KB after cleanup\n"
+      "(checksum {})\n",
+      rssStart,
+      rssPopulated,
+      FLAGS_vips,
+      FLAGS_reals,
+      (rssPopulated - rssStart) * 1024.0 / FLAGS_reals,
+      rssKb(),
+      sink);
+  return 0;
+}
@@ -0,0 +1,137 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// benchmark of lru maps scanning: per element syscalls in a single thread
+// (how katran used to walk lru maps) vs batch operations w/ worker per map.
+// creates --maps lru maps w/ --entries flows each, so must be run as root
+
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <fmt/core.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/BaseBpfAdapter.h"
+#include "katran/lib/LruScanner.h"
+
+DEFINE_int32(maps, 16, "number of lru maps (one per forwarding cpu)");
+DEFINE_int32(entries, 1000000, "number of flows in each lru map");
+DEFINE_int32(vips, 64, "number of distinct vips across the flows");
+DEFINE_int32(workers, 0, "max number of workers for batch scan (0 - auto)");
+DEFINE_int32(batch_size, 4096, "number of entries per batch syscall");
+
+namespace {
+
+std::vector<int> createMaps() {
+  std::vector<int> fds;
+  for (int i = 0; i < FLAGS_maps; i++) {
+    int fd = katran::BaseBpfAdapter::createNamedBpfMap(
+        fmt::format("bench_lru_{}", i),
+        BPF_MAP_TYPE_LRU_HASH,
+        sizeof(katran::flow_key),
+        sizeof(katran::real_pos_lru),
+        // lru map must not evict anything while being populated
+        FLAGS_entries * 2,
+        0);
+    CHECK_GE(fd, 0) << "can't create lru map";
+    fds.push_back(fd);
+  }
+  return fds;
+}
+
+void populate(const std::vector<int>& fds) {
+  for (int fd : fds) {
+    for (int i = 0; i < FLAGS_entries; i++) {
+      katran::flow_key key = {};
+      key.src = i;
+      key.dst = i % FLAGS_vips + 1;
+      key.port16[1] = 443;
+      key.proto = 6;
+      katran::real_pos_lru value = {};
+      value.pos = i % 100 + 1;
+      value.atime = i;
+      CHECK_EQ(katran::BaseBpfAdapter::bpfUpdateMap(fd, &key, &value), 0);
+    }
+  }
+}
+
+template <typename F>
+double timeIt(F&& f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  auto fds = createMaps();
+  std::cout << fmt::format(
+      "populating {} maps w/ {} entries each\n", FLAGS_maps, FLAGS_entries);
+  populate(fds);
+
+  uint64_t counted = 0;
+  auto visitor = [&counted](
+                     size_t,
+                     const katran::flow_key*,
+                     const katran::real_pos_lru*,
+                     uint32_t count) {
+    __atomic_fetch_add(&counted, count, __ATOMIC_RELAXED);
+  };
+
+  katran::LruScanner legacy(fds, false, 1);
+  auto legacyTime = timeIt([&]() { legacy.scan(visitor); });
+  auto legacyCount = counted;
+
+  counted = 0;
+  katran::LruScanControl control;
+  katran::LruScanner batch(fds, true, FLAGS_workers, &control);
+  batch.setBatchSize(FLAGS_batch_size);
+  auto batchTime = timeIt([&]() { batch.scan(visitor); });
+
+  std::cout << fmt::format(
+      "per element scan: {} entries in {:.3f}s\n"
+      "batch parallel scan: {} entries in {:.3f}s\n"
+      "speedup: {:.1f}x\n",
+      legacyCount,
+      legacyTime,
+      counted,
+      batchTime,
+      batchTime > 0 ? legacyTime / batchTime : 0);
+
+  // purge of a single vip w/ both approaches
+  auto purgeVip = [](size_t, const katran::flow_key& key,
+                     const katran::real_pos_lru&) { return key.dst == 1; };
+  auto legacyPurge = timeIt([&]() { legacy.purge(purgeVip); });
+  populate(fds);
+  auto batchPurge = timeIt([&]() { batch.purge(purgeVip); });
+  std::cout << fmt::format(
+      "per element purge: {:.3f}s, batch parallel purge: {:.3f}s\n",
+      legacyPurge,
+      batchPurge);
+
+  for (int fd : fds) {
+    close(fd);
+  }
+  return 0;
+}
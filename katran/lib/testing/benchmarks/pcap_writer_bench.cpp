@@ -0,0 +1,124 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// throughput benchmark of katran's capture path: events are pushed into
+// PcapEventQueues (same way as event readers do it) and PcapWriter writes them
+// into a pcap file. runs w/ and w/o batched (vectored) writes, to show how
+// many events per second could be captured w/ each mode
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/FileWriter.h"
+#include "katran/lib/PcapEventQueues.h"
+#include "katran/lib/PcapWriter.h"
+
+DEFINE_int64(events, 5000000, "number of events to capture in each run");
+DEFINE_int32(pckt_size, 128, "captured size of each event");
+DEFINE_int32(queue_size, 4096, "size of the queue between reader and writer");
+DEFINE_int32(batch_bytes, 64 * 1024, "max size of a batch of records");
+DEFINE_string(path, "/tmp/katran_pcap_bench", "where to write pcap file");
+
+namespace {
+
+using katran::monitoring::EventId;
+
+struct RunResult {
+  double seconds;
+  uint64_t captured;
+  uint64_t bytes;
+};
+
+RunResult runCapture(size_t batchBytes) {
+  auto fileWriter = std::make_shared<katran::FileWriter>(FLAGS_path);
+  std::unordered_map<EventId, std::shared_ptr<katran::DataWriter>> writers{
+      {EventId::TCP_NONSYN_LRUMISS, fileWriter},
+  };
+  katran::PcapWriter pcapWriter(writers, 0, FLAGS_pckt_size);
+  pcapWriter.overridePacketLimit(true);
+  pcapWriter.enableEvent(EventId::TCP_NONSYN_LRUMISS);
+  pcapWriter.setBatching(batchBytes, std::chrono::milliseconds(100));
+  auto queues = std::make_shared<katran::PcapEventQueues>(1, FLAGS_queue_size);
+  std::vector<char> pckt(FLAGS_pckt_size, 'k');
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread writerThread([&]() { pcapWriter.runMulti(queues); });
+  uint32_t sinceNotify = 0;
+  for (int64_t i = 0; i < FLAGS_events; i++) {
+    // emulates reader w/ lossless queue: spin untill writer frees a slot
+    while (!queues->push(
+        0,
+        static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS),
+        pckt.data(),
+        1500,
+        FLAGS_pckt_size)) {
+      queues->notify();
+      std::this_thread::yield();
+    }
+    // readers notify writer once per consumed batch
+    if (++sinceNotify == 64) {
+      queues->notify();
+      sinceNotify = 0;
+    }
+  }
+  queues->notify();
+  katran::PcapMsgMeta shutdown;
+  shutdown.setControl(true);
+  shutdown.setShutdown(true);
+  queues->pushControl(std::move(shutdown));
+  writerThread.join();
+  auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  return RunResult{
+      seconds, pcapWriter.packetsCaptured(), fileWriter->writtenBytes()};
+}
+
+void report(const std::string& mode, const RunResult& res) {
+  std::cout << fmt::format(
+      "{:<12} {:>10} events in {:>7.3f}s {:>12.0f} events/s {:>9.1f} MB/s\n",
+      mode,
+      res.captured,
+      res.seconds,
+      res.seconds > 0 ? res.captured / res.seconds : 0,
+      res.seconds > 0 ? res.bytes / res.seconds / 1e6 : 0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  if (FLAGS_pckt_size <= 0 ||
+      FLAGS_pckt_size > static_cast<int>(katran::kMaxPcapEventSize)) {
+    LOG(ERROR) << "pckt_size must be in (0, " << katran::kMaxPcapEventSize
+               << "]";
+    return 1;
+  }
+  report("unbatched", runCapture(0));
+  report("batched", runCapture(FLAGS_batch_bytes));
+  std::remove(FLAGS_path.c_str());
+  return 0;
+}
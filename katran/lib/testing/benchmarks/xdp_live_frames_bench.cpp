@@ -0,0 +1,396 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+// forwarding throughput benchmark of balancer_ingress. unlike perf mode of
+// katran_tester (which times a single packet w/ BPF_PROG_TEST_RUN), packets
+// are injected in live frames mode (BPF_F_TEST_XDP_LIVE_FRAMES): XDP_TX is
+// actually performed, so page recycling, xmit path and lru cache pressure
+// are all accounted for. packets are "received" on one end of the veth pair
+// and sent out to its peer, where they are dropped by trivial xdp prog, so
+// no NIC is required. must be run as root, requires kernel 5.18+
+//
+// traffic is a mix of tcp flows towards a single vip, generated by
+// TrafficGenerator: sources are picked w/ zipf distribution (--zipf_s) from
+// --flows distinct flows, --syn_ratio of packets are syns of new connections
+// (and therefore lru misses). lru is warmed up w/ a single pass over
+// packets before measurement, so only syns (and evictions) miss.
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "katran/lib/BpfAdapter.h"
+#include "katran/lib/KatranLb.h"
+#include "katran/lib/testing/tools/TrafficGenerator.h"
+
+DEFINE_string(balancer_prog, "./balancer.bpf.o", "path to balancer bpf prog");
+DEFINE_string(iface, "katran_lf0", "veth interface packets are received on");
+DEFINE_string(peer, "katran_lf1", "peer of --iface, where packets are sent");
+DEFINE_bool(
+    setup_veth,
+    true,
+    "create veth pair before the run and delete it afterwards");
+DEFINE_int32(cores, 1, "number of cores (0..cores-1) to run benchmark on");
+DEFINE_int32(duration, 10, "duration of the benchmark in seconds");
+DEFINE_int32(flows, 100000, "number of distinct established flows");
+DEFINE_double(zipf_s, 1.0, "zipf exponent of flows popularity. 0 - uniform");
+DEFINE_double(syn_ratio, 0.01, "share of packets which are syns of new flows");
+DEFINE_int32(payload_size, 64, "size of tcp payload");
+DEFINE_int32(pool_size, 65536, "number of pregenerated packets per core");
+DEFINE_int32(
+    burst,
+    1,
+    "number of times each packet is injected in a row. repeats of non syn "
+    "packet always hit lru, so bigger bursts inflate lru hit rate");
+DEFINE_bool(warmup, true, "populate lru w/ packets of each core before run");
+DEFINE_int32(batch_size, 64, "live frames batch size (max 256)");
+DEFINE_int32(reals, 32, "number of reals behind the vip");
+DEFINE_int64(lru_size, 8000000, "size of connection table");
+
+namespace {
+
+constexpr auto kVip = "10.200.1.1";
+constexpr uint16_t kVipPort = 80;
+constexpr uint8_t kTcp = 6;
+
+bool runCmd(const std::string& cmd) {
+  VLOG(2) << "running: " << cmd;
+  auto res = std::system(cmd.c_str());
+  if (res != 0) {
+    LOG(ERROR) << "command failed (" << res << "): " << cmd;
+    return false;
+  }
+  return true;
+}
+
+bool setupVeth() {
+  return runCmd(fmt::format(
+             "ip link add {} type veth peer name {}",
+             FLAGS_iface,
+             FLAGS_peer)) &&
+      runCmd(fmt::format("ip link set dev {} up", FLAGS_iface)) &&
+      runCmd(fmt::format("ip link set dev {} up", FLAGS_peer));
+}
+
+// xdp prog which drops everything. veth accepts xdp frames only if there is
+// xdp prog on the receiving side
+int loadDropProg() {
+  struct bpf_insn insns[] = {
+      {BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_DROP},
+      {BPF_JMP | BPF_EXIT, 0, 0, 0, 0},
+  };
+  return bpf_prog_load(
+      BPF_PROG_TYPE_XDP,
+      "katran_lf_drop",
+      "GPL",
+      insns,
+      sizeof(insns) / sizeof(insns[0]),
+      nullptr);
+}
+
+uint64_t ifaceCounter(const std::string& iface, const std::string& name) {
+  std::ifstream f(
+      fmt::format("/sys/class/net/{}/statistics/{}", iface, name));
+  uint64_t val = 0;
+  f >> val;
+  return val;
+}
+
+katran::testing::TrafficBuffer generatePackets(int core) {
+  katran::testing::TrafficSpec spec;
+  spec.vips = {{kVip, kVipPort, 1}};
+  spec.srcPrefixes = {
+      {"172.16.0.0/12",
+       1,
+       FLAGS_zipf_s > 0 ? katran::testing::SrcDistribution::ZIPF
+                        : katran::testing::SrcDistribution::UNIFORM,
+       FLAGS_zipf_s,
+       static_cast<uint32_t>(FLAGS_flows)}};
+  spec.synRatio = FLAGS_syn_ratio;
+  spec.payloadSizes = {{static_cast<uint16_t>(FLAGS_payload_size), 1}};
+  spec.seed = core;
+  katran::testing::TrafficBuffer packets;
+  katran::testing::TrafficGenerator(spec).generate(FLAGS_pool_size, packets);
+  return packets;
+}
+
+bool pinToCpu(int cpu) {
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  auto res = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  if (res != 0) {
+    LOG(ERROR) << "can't pin to cpu " << cpu << ": " << folly::errnoStr(res);
+    return false;
+  }
+  return true;
+}
+
+struct CoreResult {
+  uint64_t packets{0};
+  bool failed{false};
+};
+
+// injects every packet once, so flows are in lru of the core before
+// measurement
+void warmupCore(
+    int core,
+    int progFd,
+    int ifindex,
+    const katran::testing::TrafficBuffer& packets,
+    CoreResult& result) {
+  if (!pinToCpu(core)) {
+    result.failed = true;
+    return;
+  }
+  for (size_t pos = 0; pos < packets.size(); pos++) {
+    auto pckt = packets.packet(pos);
+    auto res = katran::BaseBpfAdapter::testXdpProgLiveFrames(
+        progFd,
+        1,
+        const_cast<uint8_t*>(pckt.data()),
+        pckt.size(),
+        ifindex,
+        FLAGS_batch_size);
+    if (res != 0) {
+      LOG(ERROR) << "live frames warmup failed on core " << core << ": "
+                 << folly::errnoStr(errno);
+      result.failed = true;
+      return;
+    }
+  }
+}
+
+void runCore(
+    int core,
+    int progFd,
+    int ifindex,
+    const katran::testing::TrafficBuffer& packets,
+    const std::atomic<bool>& stop,
+    CoreResult& result) {
+  if (!pinToCpu(core)) {
+    result.failed = true;
+    return;
+  }
+  size_t pos = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    auto pckt = packets.packet(pos);
+    auto res = katran::BaseBpfAdapter::testXdpProgLiveFrames(
+        progFd,
+        FLAGS_burst,
+        const_cast<uint8_t*>(pckt.data()),
+        pckt.size(),
+        ifindex,
+        FLAGS_batch_size);
+    if (res != 0) {
+      LOG(ERROR) << "live frames test run failed on core " << core << ": "
+                 << folly::errnoStr(errno);
+      result.failed = true;
+      return;
+    }
+    result.packets += FLAGS_burst;
+    pos = pos + 1 == packets.size() ? 0 : pos + 1;
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+  CHECK_GT(FLAGS_cores, 0);
+  CHECK_GT(FLAGS_flows, 0);
+  CHECK_LE(FLAGS_flows, 1 << 20);
+  CHECK_GT(FLAGS_pool_size, 0);
+  CHECK_GT(FLAGS_batch_size, 0);
+  CHECK_LE(FLAGS_batch_size, 256);
+  // katran rewrites headers in place (e.g. during encapsulation) and kernel
+  // does not restore frame's content when page is recycled. page pool is
+  // created per test run, so keeping every run within a single batch
+  // guarantees that each frame starts w/ the original packet
+  CHECK_GT(FLAGS_burst, 0);
+  CHECK_LE(FLAGS_burst, FLAGS_batch_size);
+
+  if (FLAGS_setup_veth && !setupVeth()) {
+    return 1;
+  }
+  auto ifindex = katran::BaseBpfAdapter::getInterfaceIndex(FLAGS_iface);
+  CHECK_GT(ifindex, 0) << "can't resolve ifindex of " << FLAGS_iface;
+  auto dropFd = loadDropProg();
+  CHECK_GE(dropFd, 0) << "can't load xdp drop prog";
+  CHECK_EQ(katran::BaseBpfAdapter::attachXdpProg(dropFd, FLAGS_peer), 0)
+      << "can't attach xdp drop prog to " << FLAGS_peer;
+
+  katran::KatranConfig config;
+  config.mainInterface = FLAGS_iface;
+  config.balancerProgPath = FLAGS_balancer_prog;
+  config.enableHc = false;
+  config.defaultMac = {0x00, 0x00, 0xde, 0xad, 0xbe, 0xaf};
+  config.LruSize = FLAGS_lru_size;
+  for (int i = 0; i < FLAGS_cores; i++) {
+    // per cpu lru is used only on forwarding cores
+    config.forwardingCores.push_back(i);
+  }
+  auto lb = std::make_unique<katran::KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+  lb->loadBpfProgs();
+
+  katran::VipKey vip;
+  vip.address = kVip;
+  vip.port = kVipPort;
+  vip.proto = kTcp;
+  CHECK(lb->addVip(vip));
+  std::vector<katran::NewReal> reals;
+  for (int i = 0; i < FLAGS_reals; i++) {
+    katran::NewReal real;
+    real.address = fmt::format("10.0.{}.{}", i >> 8, i & 0xff);
+    real.weight = 10;
+    reals.push_back(real);
+  }
+  CHECK(lb->modifyRealsForVip(katran::ModifyAction::ADD, reals, vip));
+
+  std::cout << fmt::format(
+      "generating {} packets for each of {} cores\n",
+      FLAGS_pool_size,
+      FLAGS_cores);
+  std::vector<katran::testing::TrafficBuffer> packets;
+  for (int i = 0; i < FLAGS_cores; i++) {
+    packets.push_back(generatePackets(i));
+  }
+
+  auto progFd = lb->getKatranProgFd();
+  std::vector<CoreResult> results(FLAGS_cores);
+  std::vector<std::thread> threads;
+  if (FLAGS_warmup) {
+    for (int i = 0; i < FLAGS_cores; i++) {
+      threads.emplace_back(
+          warmupCore,
+          i,
+          progFd,
+          ifindex,
+          std::cref(packets[i]),
+          std::ref(results[i]));
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    threads.clear();
+    for (const auto& result : results) {
+      if (result.failed) {
+        return 1;
+      }
+    }
+  }
+
+  auto lruBefore = lb->getLruStats();
+  auto lruMissBefore = lb->getLruMissStats();
+  auto totalBefore = lb->getXdpTotalStats();
+  auto txBefore = lb->getXdpTxStats();
+  auto dropBefore = lb->getXdpDropStats();
+  auto passBefore = lb->getXdpPassStats();
+  auto xmitDropBefore = ifaceCounter(FLAGS_iface, "tx_dropped");
+
+  std::atomic<bool> stop{false};
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < FLAGS_cores; i++) {
+    threads.emplace_back(
+        runCore,
+        i,
+        progFd,
+        ifindex,
+        std::cref(packets[i]),
+        std::cref(stop),
+        std::ref(results[i]));
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration));
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  auto seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  auto lru = lb->getLruStats();
+  auto lruMiss = lb->getLruMissStats();
+  auto total = lb->getXdpTotalStats();
+  auto tx = lb->getXdpTxStats();
+  auto drop = lb->getXdpDropStats();
+  auto pass = lb->getXdpPassStats();
+  auto xmitDrops = ifaceCounter(FLAGS_iface, "tx_dropped") - xmitDropBefore;
+
+  uint64_t sent = 0;
+  bool failed = false;
+  for (int i = 0; i < FLAGS_cores; i++) {
+    sent += results[i].packets;
+    failed |= results[i].failed;
+    std::cout << fmt::format(
+        "core {}: {:.3f} Mpps\n", i, results[i].packets / seconds / 1e6);
+  }
+  auto lruTotal = lru.v1 - lruBefore.v1;
+  auto lruMisses = lru.v2 - lruBefore.v2;
+  auto syns = lruMiss.v1 - lruMissBefore.v1;
+  // the hit rate is comparable between runs only w/ the same burst, as
+  // repeats of a packet never miss
+  std::cout << fmt::format(
+      "total: {} packets in {:.3f}s on {} cores: {:.3f} Mpps\n"
+      "traffic: {} distinct packets injected {} times each, {} flows, "
+      "syns {:.2f}% of lru lookups\n"
+      "lru: {} lookups, {} misses ({} syns, {} non syns), hit rate {:.2f}%\n"
+      "xdp: {} total, {} tx, {} drop, {} pass; xmit drops on {}: {}\n",
+      sent,
+      seconds,
+      FLAGS_cores,
+      sent / seconds / 1e6,
+      sent / FLAGS_burst,
+      FLAGS_burst,
+      FLAGS_flows,
+      lruTotal ? 100.0 * syns / lruTotal : 0,
+      lruTotal,
+      lruMisses,
+      syns,
+      lruMiss.v2 - lruMissBefore.v2,
+      lruTotal ? 100.0 * (lruTotal - lruMisses) / lruTotal : 0,
+      total.v1 - totalBefore.v1,
+      tx.v1 - txBefore.v1,
+      drop.v1 - dropBefore.v1,
+      pass.v1 - passBefore.v1,
+      FLAGS_iface,
+      xmitDrops);
+
+  lb.reset();
+  katran::BaseBpfAdapter::detachXdpProg(FLAGS_peer);
+  close(dropFd);
+  if (FLAGS_setup_veth) {
+    runCmd(fmt::format("ip link del dev {}", FLAGS_iface));
+  }
+  return failed ? 1 : 0;
+}
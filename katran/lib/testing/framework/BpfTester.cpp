@@ -21,6 +21,11 @@
 #include <folly/io/IOBuf.h>
 #include <glog/logging.h>
 #include <linux/if_ether.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
 
 namespace katran {
@@ -48,6 +53,28 @@ std::unordered_map<int, std::string> kTcCodes{
 };
 
 constexpr uint32_t kNanosecInSec = 1000000000;
+
+// two-sided 95% quantiles of student's t distribution for 1..29 degrees of
+// freedom. normal approximation is used for larger samples
+constexpr std::array<double, 29> kStudentT95 = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+};
+constexpr double kNormal95 = 1.96;
+
+bool pinToCpu(int cpu) {
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  auto res = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  if (res != 0) {
+    LOG(ERROR) << "can't pin perf tests to cpu " << cpu << ": "
+               << folly::errnoStr(res);
+    return false;
+  }
+  return true;
+}
 } // namespace
 
 BpfTester::BpfTester(const TesterConfig& config)
@@ -417,6 +444,16 @@ void BpfTester::resetTestFixtures(const std::vector<PacketAttributes>& data) {
 std::vector<TestResult> BpfTester::testPerfFromFixture(
     uint32_t repeat,
     const int position) {
+  PerfTestConfig perfConfig;
+  perfConfig.repeat = repeat;
+  perfConfig.warmup = 0;
+  perfConfig.batches = 1;
+  return testPerfFromFixture(perfConfig, position);
+}
+
+std::vector<TestResult> BpfTester::testPerfFromFixture(
+    const PerfTestConfig& perfConfig,
+    const int position) {
   // for inputData format is <pckt_base64, test description>
   int first_index{0}, last_index{0};
   if (position < 0 || position >= config_.testData.size()) {
@@ -426,6 +463,10 @@ std::vector<TestResult> BpfTester::testPerfFromFixture(
     first_index = position;
     last_index = first_index + 1;
   }
+  if (perfConfig.cpu >= 0) {
+    // test run is executed on the cpu of the calling thread
+    pinToCpu(perfConfig.cpu);
+  }
 
   std::vector<TestResult> results;
 
@@ -434,7 +475,7 @@ std::vector<TestResult> BpfTester::testPerfFromFixture(
     auto single_results = runXdpProgPerf(
         config_.testData[i].inputPacket,
         config_.testData[i].description,
-        repeat);
+        perfConfig);
     results.insert(results.end(), single_results.begin(), single_results.end());
   }
   return results;
@@ -443,9 +484,8 @@ std::vector<TestResult> BpfTester::testPerfFromFixture(
 std::vector<TestResult> BpfTester::runXdpProgPerf(
     const std::string& input_packet,
     const std::string& description,
-    uint32_t repeat) {
+    const PerfTestConfig& perfConfig) {
   std::vector<TestResult> results;
-  results.reserve(repeat); // Pre-allocate capacity
 
   auto buf = folly::IOBuf::create(kMaxXdpPcktSize);
   uint32_t output_pckt_size{0};
@@ -456,11 +496,8 @@ std::vector<TestResult> BpfTester::runXdpProgPerf(
   // modified with the first run and the subsequent runs will see the encaped
   // packet. For more acurate perf runs, we call testXdpProg() repeatedly with
   // repeat = 1
-
-  uint32_t total_duration = 0;
-  for (uint32_t run = 0; run < repeat; ++run) {
-    uint32_t duration{0};
-    auto res = adapter_.testXdpProg(
+  auto runOnce = [&](uint32_t& duration) {
+    return adapter_.testXdpProg(
         config_.bpfProgFd,
         1, // repeat = 1
         input_pckt->writableData(),
@@ -469,23 +506,78 @@ std::vector<TestResult> BpfTester::runXdpProgPerf(
         &output_pckt_size,
         nullptr, // retval
         &duration);
+  };
 
-    if (res < 0) {
-      LOG(ERROR) << "failed to run bpf test on run #" << run;
-      break;
+  for (uint32_t run = 0; run < perfConfig.warmup; ++run) {
+    uint32_t duration{0};
+    if (runOnce(duration) < 0) {
+      LOG(ERROR) << "failed to run bpf test on warmup run #" << run;
+      return results;
     }
-    total_duration += duration;
+  }
 
-    if (duration == 0) {
-      duration = 1;
+  uint32_t repeat = perfConfig.repeat;
+  uint32_t batches = std::max(1u, std::min(perfConfig.batches, repeat));
+  uint32_t batchSize = repeat / std::max(1u, batches);
+  // mean ns/packet of each batch
+  std::vector<double> samples;
+  samples.reserve(batches);
+  uint64_t total_duration = 0;
+  uint32_t total_runs = 0;
+  bool failed = false;
+  for (uint32_t batch = 0; batch < batches && !failed; ++batch) {
+    // last batch takes the remainder
+    uint32_t runs = batch + 1 == batches ? repeat - total_runs : batchSize;
+    uint64_t batch_duration = 0;
+    for (uint32_t run = 0; run < runs; ++run) {
+      uint32_t duration{0};
+      if (runOnce(duration) < 0) {
+        LOG(ERROR) << "failed to run bpf test on run #" << total_runs + run;
+        failed = true;
+        runs = run;
+        break;
+      }
+      batch_duration += duration;
     }
+    if (runs > 0) {
+      samples.push_back(static_cast<double>(batch_duration) / runs);
+      total_duration += batch_duration;
+      total_runs += runs;
+    }
+  }
+  if (total_runs == 0) {
+    return results;
+  }
+
+  TestResult result;
+  result.description = description;
+  result.flavor = perfConfig.flavor;
+  result.samples = samples.size();
+  double sum = 0;
+  for (auto sample : samples) {
+    sum += sample;
   }
-  if (repeat > 0) {
-    auto avgDuration = total_duration / repeat;
-    auto pps = kNanosecInSec / avgDuration;
-    auto pps_millions = static_cast<double>(pps) / 1000000.0;
-    results.push_back({description, avgDuration, pps_millions});
+  result.nsPerPacket = sum / samples.size();
+  if (samples.size() > 1) {
+    double sq = 0;
+    for (auto sample : samples) {
+      sq += (sample - result.nsPerPacket) * (sample - result.nsPerPacket);
+    }
+    result.stdDev = std::sqrt(sq / (samples.size() - 1));
+    auto dof = samples.size() - 1;
+    double t = dof <= kStudentT95.size() ? kStudentT95[dof - 1] : kNormal95;
+    double margin = t * result.stdDev / std::sqrt(samples.size());
+    result.ciLow = std::max(0.0, result.nsPerPacket - margin);
+    result.ciHigh = result.nsPerPacket + margin;
+  } else {
+    result.ciLow = result.nsPerPacket;
+    result.ciHigh = result.nsPerPacket;
   }
+  // duration granularity is 1ns
+  result.duration = std::max<uint64_t>(1, total_duration / total_runs);
+  result.pps_millions =
+      static_cast<double>(kNanosecInSec / result.duration) / 1000000.0;
+  results.push_back(std::move(result));
   return results;
 }
 
@@ -33,6 +33,32 @@ struct TestResult {
   std::string description;
   uint32_t duration;
   double pps_millions;
+  // set of fixtures (e.g. "gue" or "tpr") which packet belongs to
+  std::string flavor;
+  // mean of per batch ns/packet and its 95% confidence interval
+  double nsPerPacket{0};
+  double stdDev{0};
+  double ciLow{0};
+  double ciHigh{0};
+  // number of measured batches
+  uint32_t samples{0};
+};
+
+/**
+ * parameters of perf test run
+ */
+struct PerfTestConfig {
+  // number of measured runs for each packet
+  uint32_t repeat{1000000};
+  // number of runs before measurement starts (to warm up caches and maps)
+  uint32_t warmup{10000};
+  // measured runs are split into batches. mean of each batch is a sample for
+  // confidence interval calculation
+  uint32_t batches{30};
+  // cpu to run tests on. -1 - do not pin
+  int cpu{-1};
+  // set of fixtures which is being tested. copied into results
+  std::string flavor;
 };
 
 /**
@@ -164,6 +190,18 @@ class BpfTester {
       uint32_t repeat,
       const int position = -1);
 
+  /**
+   * @param PerfTestConfig& perfConfig parameters of the run
+   * @param int position    of the packet if fixtures vector.
+   * @return std::vector<TestResult> results w/ confidence intervals
+   *
+   * same as above, but calling thread is pinned to perfConfig.cpu and each
+   * packet is warmed up before measurement
+   */
+  std::vector<TestResult> testPerfFromFixture(
+      const PerfTestConfig& perfConfig,
+      const int position = -1);
+
   /**
    * @param IOBuf with packet data to write.
    *
@@ -197,14 +235,14 @@ class BpfTester {
   /**
    * @param const std::string& input_packet base64 encoded input packet
    * @param const std::string& description test description for the results
-   * @param uint32_t repeat how many times to repeat the test
+   * @param PerfTestConfig& perfConfig how many times to repeat the test
    * helper function to run performance tests in a loop with repeat=1 and return
    * results
    */
   std::vector<struct TestResult> runXdpProgPerf(
       const std::string& input_packet,
       const std::string& description,
-      uint32_t repeat);
+      const PerfTestConfig& perfConfig);
 
   TesterConfig config_;
   PcapParser parser_;
@@ -0,0 +1,132 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/testing/framework/PerfResults.h"
+
+#include <map>
+#include <utility>
+
+#include <folly/FileUtil.h>
+#include <folly/json.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+folly::dynamic PerfResults::toJson(const std::vector<TestResult>& results) {
+  auto items = folly::dynamic::array();
+  for (const auto& result : results) {
+    folly::dynamic item = folly::dynamic::object;
+    item["flavor"] = result.flavor;
+    item["description"] = result.description;
+    item["ns_per_packet"] = result.nsPerPacket;
+    item["std_dev"] = result.stdDev;
+    item["ci_low"] = result.ciLow;
+    item["ci_high"] = result.ciHigh;
+    item["samples"] = result.samples;
+    item["mpps"] = result.pps_millions;
+    items.push_back(std::move(item));
+  }
+  folly::dynamic json = folly::dynamic::object;
+  json["version"] = kPerfResultsVersion;
+  json["results"] = std::move(items);
+  return json;
+}
+
+folly::Expected<std::vector<TestResult>, std::string> PerfResults::fromJson(
+    const folly::dynamic& json) {
+  std::vector<TestResult> results;
+  try {
+    if (json["version"].asInt() != kPerfResultsVersion) {
+      return folly::makeUnexpected(std::string("unsupported version"));
+    }
+    for (const auto& item : json["results"]) {
+      TestResult result;
+      result.flavor = item["flavor"].asString();
+      result.description = item["description"].asString();
+      result.nsPerPacket = item["ns_per_packet"].asDouble();
+      result.stdDev = item["std_dev"].asDouble();
+      result.ciLow = item["ci_low"].asDouble();
+      result.ciHigh = item["ci_high"].asDouble();
+      result.samples = item["samples"].asInt();
+      result.pps_millions = item["mpps"].asDouble();
+      result.duration = result.nsPerPacket;
+      results.push_back(std::move(result));
+    }
+  } catch (const std::exception& e) {
+    return folly::makeUnexpected(
+        std::string("malformed perf results: ") + e.what());
+  }
+  return results;
+}
+
+bool PerfResults::write(
+    const std::string& path,
+    const std::vector<TestResult>& results) {
+  auto json = folly::toPrettyJson(toJson(results));
+  if (!folly::writeFile(json, path.c_str())) {
+    LOG(ERROR) << "can't write perf results to " << path;
+    return false;
+  }
+  return true;
+}
+
+folly::Expected<std::vector<TestResult>, std::string> PerfResults::read(
+    const std::string& path) {
+  std::string content;
+  if (!folly::readFile(path.c_str(), content)) {
+    return folly::makeUnexpected("can't read perf results from " + path);
+  }
+  try {
+    return fromJson(folly::parseJson(content));
+  } catch (const std::exception& e) {
+    return folly::makeUnexpected(
+        std::string("malformed perf results: ") + e.what());
+  }
+}
+
+std::vector<PerfRegression> PerfResults::compare(
+    const std::vector<TestResult>& results,
+    const std::vector<TestResult>& baseline,
+    double threshold) {
+  std::map<std::pair<std::string, std::string>, const TestResult*> base;
+  for (const auto& result : baseline) {
+    base[{result.flavor, result.description}] = &result;
+  }
+  std::vector<PerfRegression> regressions;
+  for (const auto& result : results) {
+    auto it = base.find({result.flavor, result.description});
+    if (it == base.end()) {
+      VLOG(2) << "no baseline for " << result.flavor << ": "
+              << result.description;
+      continue;
+    }
+    double baselineNs = it->second->nsPerPacket;
+    if (baselineNs <= 0) {
+      continue;
+    }
+    if (result.ciLow > baselineNs * (1 + threshold)) {
+      regressions.push_back(PerfRegression{
+          result.flavor,
+          result.description,
+          baselineNs,
+          result.nsPerPacket,
+          result.nsPerPacket / baselineNs - 1});
+    }
+  }
+  return regressions;
+}
+
+} // namespace katran
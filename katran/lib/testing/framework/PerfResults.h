@@ -0,0 +1,92 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <folly/Expected.h>
+#include <folly/dynamic.h>
+
+#include "katran/lib/testing/framework/BpfTester.h"
+
+namespace katran {
+
+constexpr int kPerfResultsVersion = 1;
+
+/**
+ * result which is slower than the one from the baseline
+ */
+struct PerfRegression {
+  std::string flavor;
+  std::string description;
+  double baselineNs{0};
+  double currentNs{0};
+  // relative change of ns/packet (0.1 means 10% slower)
+  double change{0};
+};
+
+/**
+ * helpers to store perf test results as json and to compare them against
+ * previously stored baseline. results are matched by flavor and description
+ */
+class PerfResults {
+ public:
+  /**
+   * @return dynamic json representation of the results
+   */
+  static folly::dynamic toJson(const std::vector<TestResult>& results);
+
+  /**
+   * @return vector<TestResult> results from json or error's description
+   */
+  static folly::Expected<std::vector<TestResult>, std::string> fromJson(
+      const folly::dynamic& json);
+
+  /**
+   * @param string path where results are going to be stored
+   * @return bool true on success
+   */
+  static bool write(
+      const std::string& path,
+      const std::vector<TestResult>& results);
+
+  /**
+   * @param string path to the results
+   * @return vector<TestResult> stored results or error's description
+   */
+  static folly::Expected<std::vector<TestResult>, std::string> read(
+      const std::string& path);
+
+  /**
+   * @param vector<TestResult> results of the current run
+   * @param vector<TestResult> baseline results
+   * @param double threshold max allowed relative slowdown (e.g. 0.05)
+   * @return vector<PerfRegression> results which regressed
+   *
+   * result is a regression only if even the lower bound of its confidence
+   * interval is above baseline's ns/packet * (1 + threshold), so noise of a
+   * single run does not fail the comparison. results w/o counterpart in the
+   * baseline are skipped
+   */
+  static std::vector<PerfRegression> compare(
+      const std::vector<TestResult>& results,
+      const std::vector<TestResult>& baseline,
+      double threshold);
+};
+
+} // namespace katran
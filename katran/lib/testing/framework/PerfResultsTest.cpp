@@ -0,0 +1,83 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+
+#include "katran/lib/testing/framework/PerfResults.h"
+
+namespace katran {
+
+namespace {
+TestResult makeResult(
+    const std::string& flavor,
+    const std::string& description,
+    double ns,
+    double margin) {
+  TestResult result;
+  result.flavor = flavor;
+  result.description = description;
+  result.nsPerPacket = ns;
+  result.ciLow = ns - margin;
+  result.ciHigh = ns + margin;
+  result.samples = 30;
+  return result;
+}
+} // namespace
+
+TEST(PerfResultsTest, testJsonRoundTrip) {
+  std::vector<TestResult> results = {
+      makeResult("default", "packet #1", 100.5, 2),
+      makeResult("gue", "packet #2", 50, 1),
+  };
+  auto parsed = PerfResults::fromJson(PerfResults::toJson(results));
+  ASSERT_TRUE(parsed.hasValue());
+  ASSERT_EQ(parsed->size(), results.size());
+  for (size_t i = 0; i < results.size(); i++) {
+    EXPECT_EQ((*parsed)[i].flavor, results[i].flavor);
+    EXPECT_EQ((*parsed)[i].description, results[i].description);
+    EXPECT_DOUBLE_EQ((*parsed)[i].nsPerPacket, results[i].nsPerPacket);
+    EXPECT_DOUBLE_EQ((*parsed)[i].ciLow, results[i].ciLow);
+    EXPECT_DOUBLE_EQ((*parsed)[i].ciHigh, results[i].ciHigh);
+    EXPECT_EQ((*parsed)[i].samples, results[i].samples);
+  }
+  EXPECT_TRUE(PerfResults::fromJson(folly::dynamic::object).hasError());
+}
+
+TEST(PerfResultsTest, testCompare) {
+  std::vector<TestResult> baseline = {
+      makeResult("default", "packet #1", 100, 2),
+      makeResult("default", "packet #2", 100, 2),
+      makeResult("gue", "packet #1", 100, 2),
+  };
+  std::vector<TestResult> results = {
+      // within threshold
+      makeResult("default", "packet #1", 104, 2),
+      // above threshold, but confidence interval is too wide
+      makeResult("default", "packet #2", 110, 10),
+      // regression
+      makeResult("gue", "packet #1", 120, 2),
+      // not in the baseline
+      makeResult("tpr", "packet #1", 1000, 2),
+  };
+  auto regressions = PerfResults::compare(results, baseline, 0.05);
+  ASSERT_EQ(regressions.size(), 1);
+  EXPECT_EQ(regressions[0].flavor, "gue");
+  EXPECT_EQ(regressions[0].description, "packet #1");
+  EXPECT_DOUBLE_EQ(regressions[0].change, 0.2);
+  EXPECT_TRUE(PerfResults::compare(results, baseline, 0.5).empty());
+}
+
+} // namespace katran
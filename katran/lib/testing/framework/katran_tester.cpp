@@ -14,24 +14,32 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <optional>
 #include <thread>
 
 #include <folly/Conv.h>
 #include <folly/File.h>
 #include <folly/FileUtil.h>
 #include <folly/Range.h>
+#include <folly/String.h>
 #include <gflags/gflags.h>
 
 #include "katran/lib/MonitoringStructs.h"
+#include "katran/lib/testing/fixtures/KatranGueTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranHCTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranIcmpTooBigTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranOptionalTestFixtures.h"
+#include "katran/lib/testing/fixtures/KatranTPRTestFixtures.h"
+#include "katran/lib/testing/fixtures/KatranTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranUdpFlowMigrationTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranUdpStableRtTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranXPopDecapTestFixtures.h"
 #include "katran/lib/testing/framework/BpfTester.h"
+#include "katran/lib/testing/framework/PerfResults.h"
+#include "katran/lib/testing/utils/FaultInjectingBpfAdapter.h"
 #include "katran/lib/testing/utils/KatranTestProvision.h"
 #include "katran/lib/testing/utils/KatranTestUtil.h"
 
@@ -72,6 +80,32 @@ DEFINE_bool(
     "run tests for TCP Server-Id based routing (TPR) instead of IPIP or GUE ones");
 DEFINE_int32(repeat, 1000000, "perf test runs for single packet");
 DEFINE_int32(position, -1, "perf test runs for single packet");
+DEFINE_string(
+    perf_flavors,
+    "",
+    "comma separated sets of fixtures for perf tests: default, gue, tpr, "
+    "quic, stable_rt (always runs last). empty - set which is selected by "
+    "--gue/--tpr. sets which loaded balancer prog can't run are rejected");
+DEFINE_int32(
+    perf_warmup,
+    10000,
+    "perf test runs for single packet before measurement");
+DEFINE_int32(
+    perf_batches,
+    30,
+    "number of batches perf test runs are split into. used for confidence "
+    "intervals");
+DEFINE_int32(perf_cpu, 0, "cpu to pin perf tests to. -1 - do not pin");
+DEFINE_string(perf_output, "", "path to json file to store perf results");
+DEFINE_string(
+    perf_baseline,
+    "",
+    "path to json file w/ baseline perf results. tester fails if any result "
+    "is slower than baseline by more than perf_regression_threshold");
+DEFINE_double(
+    perf_regression_threshold,
+    0.05,
+    "max allowed relative slowdown against baseline (0.05 is 5%)");
 DEFINE_bool(iobuf_storage, false, "test iobuf storage for katran monitor");
 DEFINE_int32(
     packet_num,
@@ -125,10 +159,15 @@ void testHcFromFixture(katran::KatranLb& lb, katran::BpfTester& tester) {
   tester.testClsFromFixture(lb.getHealthcheckerProgFd(), ctxs);
 }
 
-void runTestsFromFixture(
+/**
+ * @return false if checks which should fail the tester (e.g. shadow data
+ * plane mismatch) did not pass
+ */
+bool runTestsFromFixture(
     katran::KatranLb& lb,
     katran::BpfTester& tester,
     KatranTestParam& testParam) {
+  bool success = true;
   prepareLbData(lb);
   prepareVipUninitializedLbData(lb);
 
@@ -142,7 +181,22 @@ void runTestsFromFixture(
   if (FLAGS_optional_counter_tests) {
     postTestOptionalLbCounters(lb, FLAGS_healthchecking_prog);
   }
-  testSimulator(lb);
+  if (!testSimulator(lb)) {
+    LOG(ERROR) << "simulation does not match expected reals";
+    success = false;
+  }
+  if (!testBatchedSimulation(lb)) {
+    LOG(ERROR) << "batched simulation does not match single flow simulation";
+    success = false;
+  }
+  if (!testShadowDataPlane(lb)) {
+    LOG(ERROR) << "shadow data plane does not match forwarding plane";
+    success = false;
+  }
+  if (!testForwardingState(lb)) {
+    LOG(ERROR) << "forwarding state does not match configured vips";
+    success = false;
+  }
   if (FLAGS_iobuf_storage) {
     LOG(INFO) << "Test katran monitor";
     testKatranMonitor(lb);
@@ -192,6 +246,7 @@ void runTestsFromFixture(
         katran::testing::udpFlowMigrationTestSecondFixtures, 2);
     testUdpFlowMigrationCounters(lb, udpFlowMigrationParams2);
   }
+  return success;
 }
 
 static const std::vector<KatranFeatureEnum> kAllFeatures = {
@@ -265,59 +320,188 @@ void printPerfResults(std::vector<katran::TestResult>& results) {
 
   // Calculate dynamic column widths
   constexpr int duration_width = 12;
+  constexpr int ci_width = 12;
   constexpr int pps_width = 12;
   constexpr int min_desc_width = 40;
   constexpr int max_desc_width = 80;
 
   // Find the longest description to determine optimal width
+  auto describe = [](const katran::TestResult& result) {
+    return result.flavor.empty()
+        ? result.description
+        : fmt::format("[{}] {}", result.flavor, result.description);
+  };
   int max_desc_len = 0;
   for (const auto& result : results) {
     max_desc_len =
-        std::max(max_desc_len, static_cast<int>(result.description.length()));
+        std::max(max_desc_len, static_cast<int>(describe(result).length()));
   }
 
   int desc_width =
       std::max(min_desc_width, std::min(max_desc_width, max_desc_len));
 
+  auto separator = [&]() {
+    std::cout << "+" << std::string(desc_width + 2, '-') << "+"
+              << std::string(duration_width + 2, '-') << "+"
+              << std::string(ci_width + 2, '-') << "+"
+              << std::string(pps_width + 2, '-') << "+" << std::endl;
+  };
+
   // Print table header
-  std::cout << "+" << std::string(desc_width + 2, '-') << "+"
-            << std::string(duration_width + 2, '-') << "+"
-            << std::string(pps_width + 2, '-') << "+" << std::endl;
+  separator();
   std::cout << fmt::format(
-                   "| {:<{}} | {:>{}} | {:>{}} |",
+                   "| {:<{}} | {:>{}} | {:>{}} | {:>{}} |",
                    "Test Description",
                    desc_width,
                    "Duration",
                    duration_width,
+                   "95% CI",
+                   ci_width,
                    "PPS",
                    pps_width)
             << std::endl;
-  std::cout << "+" << std::string(desc_width + 2, '-') << "+"
-            << std::string(duration_width + 2, '-') << "+"
-            << std::string(pps_width + 2, '-') << "+" << std::endl;
+  separator();
 
   // Print sorted results
   for (const auto& result : results) {
     // Truncate description if it's too long
-    std::string desc = result.description;
+    std::string desc = describe(result);
     if (desc.length() > desc_width) {
       desc = desc.substr(0, desc_width - 3) + "...";
     }
 
     std::cout << fmt::format(
-                     "| {:<{}} | {:>{}} ns | {:>8.2f} Mpps |",
+                     "| {:<{}} | {:>{}} ns | +/- {:>{}.1f} | {:>8.2f} Mpps |",
                      desc,
                      desc_width,
                      result.duration,
                      duration_width - 3,
+                     (result.ciHigh - result.ciLow) / 2,
+                     ci_width - 4,
                      result.pps_millions)
               << std::endl;
   }
 
   // Print table footer
-  std::cout << "+" << std::string(desc_width + 2, '-') << "+"
-            << std::string(duration_width + 2, '-') << "+"
-            << std::string(pps_width + 2, '-') << "+" << std::endl;
+  separator();
+}
+
+/**
+ * flavor's fixtures expect specific encapsulation and data plane features,
+ * so they are run only against the object which has been built for them
+ */
+bool isPerfFlavorSupported(const std::string& flavor, katran::KatranLb& lb) {
+  bool gue = lb.hasFeature(KatranFeatureEnum::GueEncap);
+  std::string reason;
+  if (flavor == "default" && (gue || FLAGS_tpr)) {
+    reason = "needs ipip encap w/o tpr (no --gue, no --tpr)";
+  } else if (flavor == "gue" && !gue) {
+    reason = "loaded balancer prog does not support gue encap";
+  } else if (flavor == "tpr" && (gue || !FLAGS_tpr)) {
+    reason = "needs balancer prog w/ tpr and ipip encap (--tpr)";
+  } else if (flavor == "stable_rt" && !FLAGS_stable_rt) {
+    reason = "needs balancer prog w/ udp stable routing (--stable_rt)";
+  }
+  if (!reason.empty()) {
+    LOG(ERROR) << "perf flavor " << flavor << " " << reason;
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::vector<katran::PacketAttributes>> getPerfFixtures(
+    const std::string& flavor,
+    katran::KatranLb& lb) {
+  if (flavor == "default") {
+    return katran::testing::testFixtures;
+  } else if (flavor == "gue") {
+    return katran::testing::gueTestFixtures;
+  } else if (flavor == "tpr") {
+    return katran::testing::tprTestFixtures;
+  } else if (flavor == "quic") {
+    // quic packets of the encapsulation which is used by the prog
+    const auto& fixtures = lb.hasFeature(KatranFeatureEnum::GueEncap)
+        ? katran::testing::gueTestFixtures
+        : katran::testing::testFixtures;
+    std::vector<katran::PacketAttributes> quic;
+    for (const auto& fixture : fixtures) {
+      if (folly::StringPiece(fixture.description).startsWith("QUIC")) {
+        quic.push_back(fixture);
+      }
+    }
+    return quic;
+  } else if (flavor == "stable_rt") {
+    return katran::testing::udpStableRtFixtures;
+  }
+  return std::nullopt;
+}
+
+int runPerfTests(katran::KatranLb& lb, katran::BpfTester& tester) {
+  std::vector<std::string> flavors;
+  if (FLAGS_perf_flavors.empty()) {
+    flavors.push_back(FLAGS_gue ? "gue" : FLAGS_tpr ? "tpr" : "default");
+  } else {
+    folly::split(',', FLAGS_perf_flavors, flavors, true);
+  }
+  for (const auto& flavor : flavors) {
+    if (!getPerfFixtures(flavor, lb)) {
+      LOG(ERROR) << "unknown perf flavor: " << flavor;
+      return 1;
+    }
+    if (!isPerfFlavorSupported(flavor, lb)) {
+      return 1;
+    }
+  }
+  // stable_rt changes configuration of vips which other flavors use, so it
+  // runs last
+  std::stable_partition(
+      flavors.begin(), flavors.end(), [](const std::string& flavor) {
+        return flavor != "stable_rt";
+      });
+  katran::PerfTestConfig perfConfig;
+  perfConfig.repeat = FLAGS_repeat;
+  perfConfig.warmup = FLAGS_perf_warmup;
+  perfConfig.batches = FLAGS_perf_batches;
+  perfConfig.cpu = FLAGS_perf_cpu;
+  std::vector<katran::TestResult> results;
+  for (const auto& flavor : flavors) {
+    if (flavor == "stable_rt") {
+      prepareLbDataStableRt(lb);
+    }
+    tester.resetTestFixtures(*getPerfFixtures(flavor, lb));
+    perfConfig.flavor = flavor;
+    auto flavorResults = tester.testPerfFromFixture(perfConfig, FLAGS_position);
+    results.insert(results.end(), flavorResults.begin(), flavorResults.end());
+  }
+  printPerfResults(results);
+  if (!FLAGS_perf_output.empty() &&
+      !katran::PerfResults::write(FLAGS_perf_output, results)) {
+    return 1;
+  }
+  if (FLAGS_perf_baseline.empty()) {
+    return 0;
+  }
+  auto baseline = katran::PerfResults::read(FLAGS_perf_baseline);
+  if (baseline.hasError()) {
+    LOG(ERROR) << baseline.error();
+    return 1;
+  }
+  auto regressions = katran::PerfResults::compare(
+      results, baseline.value(), FLAGS_perf_regression_threshold);
+  for (const auto& regression : regressions) {
+    LOG(ERROR) << fmt::format(
+        "perf regression [{}] {}: {:.1f} ns -> {:.1f} ns (+{:.1f}%)",
+        regression.flavor,
+        regression.description,
+        regression.baselineNs,
+        regression.currentNs,
+        regression.change * 100);
+  }
+  if (!regressions.empty()) {
+    return 1;
+  }
+  LOG(INFO) << "no perf regressions against " << FLAGS_perf_baseline;
+  return 0;
 }
 
 int main(int argc, char** argv) {
@@ -366,8 +550,10 @@ int main(int argc, char** argv) {
   kconfig.localMac = kLocalMac;
   kconfig.maxVips = MAX_VIPS;
 
-  auto lb = std::make_unique<katran::KatranLb>(
-      kconfig, std::make_unique<katran::BpfAdapter>(kconfig.memlockUnlimited));
+  auto adapter = std::make_unique<FaultInjectingBpfAdapter>(
+      kconfig.memlockUnlimited);
+  auto& faultInjector = *adapter;
+  auto lb = std::make_unique<katran::KatranLb>(kconfig, std::move(adapter));
   lb->loadBpfProgs();
   listFeatures(*lb);
   auto balancer_prog_fd = lb->getKatranProgFd();
@@ -376,12 +562,16 @@ int main(int argc, char** argv) {
   }
   tester.setBpfProgFd(balancer_prog_fd);
   if (FLAGS_test_from_fixtures) {
-    runTestsFromFixture(*lb, tester, testParam);
+    bool success = runTestsFromFixture(*lb, tester, testParam);
+    if (!testSrcRoutingFailure(*lb, faultInjector)) {
+      LOG(ERROR) << "failed src routing rules load is not rolled back";
+      success = false;
+    }
     if (FLAGS_install_features_mask > 0 || FLAGS_remove_features_mask > 0) {
       // install/remove features will reload prog if provided, therefore
       // reloading again is redundant
       testInstallAndRemoveFeatures(*lb);
-      runTestsFromFixture(*lb, tester, testParam);
+      success &= runTestsFromFixture(*lb, tester, testParam);
     } else if (!FLAGS_reloaded_balancer_prog.empty()) {
       auto res = lb->reloadBalancerProg(FLAGS_reloaded_balancer_prog);
       if (!res) {
@@ -389,9 +579,19 @@ int main(int argc, char** argv) {
         return 1;
       }
       listFeatures(*lb);
-      runTestsFromFixture(*lb, tester, testParam);
+      success &= runTestsFromFixture(*lb, tester, testParam);
     }
-    return 0;
+    if (!testOverlappingRingUpdates(*lb, faultInjector)) {
+      LOG(ERROR) << "pipelined reals' updates reuse index of deleted real";
+      success = false;
+    }
+    // injects packets outside of fixtures, so runs after all the counters
+    // have been checked
+    if (!testEventFilter(*lb)) {
+      LOG(ERROR) << "introspection filter does not match expected events";
+      success = false;
+    }
+    return success ? 0 : 1;
   }
   prepareLbData(*lb, FLAGS_perf_testing);
   if (!FLAGS_pcap_input.empty()) {
@@ -400,8 +600,7 @@ int main(int argc, char** argv) {
   } else if (FLAGS_perf_testing) {
     // for perf tests to work katran must be compiled w -DINLINE_DECAP
     preparePerfTestingLbData(*lb);
-    auto results = tester.testPerfFromFixture(FLAGS_repeat, FLAGS_position);
-    printPerfResults(results);
+    return runPerfTests(*lb, tester);
   }
   return 0;
 }
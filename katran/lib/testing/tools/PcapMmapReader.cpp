@@ -0,0 +1,373 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/testing/tools/PcapMmapReader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+namespace katran {
+
+namespace {
+constexpr uint32_t kPcapMagicUsec = 0xa1b2c3d4;
+constexpr uint32_t kPcapMagicNsec = 0xa1b23c4d;
+constexpr uint32_t kPcapngSectionHeader = 0x0a0d0d0a;
+constexpr uint32_t kPcapngByteOrderMagic = 0x1a2b3c4d;
+constexpr uint32_t kPcapngInterface = 0x00000001;
+constexpr uint32_t kPcapngPacket = 0x00000002;
+constexpr uint32_t kPcapngSimplePacket = 0x00000003;
+constexpr uint32_t kPcapngEnhancedPacket = 0x00000006;
+// block type + block total length + trailing block total length
+constexpr uint32_t kPcapngBlockOverhead = 12;
+constexpr uint16_t kPcapngOptEnd = 0;
+constexpr uint16_t kPcapngOptTsResol = 9;
+constexpr uint64_t kNsecPerSec = 1000000000;
+
+uint32_t maybeSwap(uint32_t val, bool swapped) {
+  return swapped ? __builtin_bswap32(val) : val;
+}
+
+uint64_t toNs(uint64_t ts, uint64_t units) {
+  if (units == kNsecPerSec) {
+    return ts;
+  }
+  return ts / units * kNsecPerSec + ts % units * kNsecPerSec / units;
+}
+} // namespace
+
+PcapMmapReader::~PcapMmapReader() {
+  ::munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+folly::Expected<std::unique_ptr<PcapMmapReader>, std::string>
+PcapMmapReader::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return folly::makeUnexpected(
+        fmt::format("can't open {}: {}", path, folly::errnoStr(errno)));
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return folly::makeUnexpected(
+        fmt::format("can't stat {}: {}", path, folly::errnoStr(errno)));
+  }
+  uint64_t size = st.st_size;
+  if (size < sizeof(uint32_t)) {
+    ::close(fd);
+    return folly::makeUnexpected(
+        fmt::format("{} is too small: {} bytes", path, size));
+  }
+  auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return folly::makeUnexpected(
+        fmt::format("can't mmap {}: {}", path, folly::errnoStr(errno)));
+  }
+  // records are read front to back
+  ::madvise(addr, size, MADV_SEQUENTIAL);
+  std::unique_ptr<PcapMmapReader> reader(
+      new PcapMmapReader(static_cast<const uint8_t*>(addr), size));
+
+  uint32_t magic;
+  std::memcpy(&magic, reader->data_, sizeof(magic));
+  if (magic == kPcapngSectionHeader) {
+    // section header block is parsed by cursor, as file could have many
+    reader->format_ = PcapFormat::PCAPNG;
+    return reader;
+  }
+  if (size < sizeof(pcap_hdr_s)) {
+    return folly::makeUnexpected(std::string("pcap header is truncated"));
+  }
+  pcap_hdr_s hdr;
+  std::memcpy(&hdr, reader->data_, sizeof(hdr));
+  PcapInterface iface;
+  if (magic == kPcapMagicUsec || magic == kPcapMagicNsec) {
+    reader->state_.swapped = false;
+  } else if (
+      __builtin_bswap32(magic) == kPcapMagicUsec ||
+      __builtin_bswap32(magic) == kPcapMagicNsec) {
+    reader->state_.swapped = true;
+  } else {
+    return folly::makeUnexpected(
+        fmt::format("not a pcap or pcapng file (magic {:#x})", magic));
+  }
+  if (maybeSwap(magic, reader->state_.swapped) == kPcapMagicNsec) {
+    iface.tsUnits = kNsecPerSec;
+  }
+  iface.linkType = maybeSwap(hdr.network, reader->state_.swapped);
+  iface.snaplen = maybeSwap(hdr.snaplen, reader->state_.swapped);
+  reader->state_.interfaces.push_back(iface);
+  reader->start_ = sizeof(pcap_hdr_s);
+  return reader;
+}
+
+PcapMmapReader::Cursor PcapMmapReader::cursor() const {
+  return Cursor(*this, start_, size_, state_);
+}
+
+PcapMmapReader::Cursor PcapMmapReader::cursor(const PcapShard& shard) const {
+  return Cursor(*this, shard.begin, shard.end, shard.state);
+}
+
+std::vector<PcapShard> PcapMmapReader::shard(size_t shards) const {
+  std::vector<PcapShard> result;
+  if (shards == 0) {
+    return result;
+  }
+  auto target = (size_ - start_) / shards;
+  auto cur = cursor();
+  PcapRecord record;
+  while (true) {
+    if (!cur.next(record)) {
+      break;
+    }
+    if (result.empty() ||
+        (result.size() < shards &&
+         record.offset >= start_ + target * result.size())) {
+      if (!result.empty()) {
+        result.back().end = record.offset;
+      }
+      PcapShard shard;
+      shard.begin = record.offset;
+      // state before the record (cursor could have just parsed new section
+      // or interface in front of it)
+      shard.state = cur.state_;
+      result.push_back(std::move(shard));
+    }
+    result.back().records++;
+  }
+  if (cur.failed()) {
+    LOG(ERROR) << "pcap file is malformed at offset " << cur.offset();
+  }
+  if (!result.empty()) {
+    result.back().end = cur.offset();
+  }
+  return result;
+}
+
+uint32_t PcapMmapReader::Cursor::read32(uint64_t offset) const {
+  uint32_t val;
+  std::memcpy(&val, reader_->data_ + offset, sizeof(val));
+  return maybeSwap(val, state_.swapped);
+}
+
+uint16_t PcapMmapReader::Cursor::read16(uint64_t offset) const {
+  uint16_t val;
+  std::memcpy(&val, reader_->data_ + offset, sizeof(val));
+  return state_.swapped ? __builtin_bswap16(val) : val;
+}
+
+bool PcapMmapReader::Cursor::fail(const std::string& msg) {
+  LOG(ERROR) << "malformed pcap at offset " << pos_ << ": " << msg;
+  failed_ = true;
+  return false;
+}
+
+bool PcapMmapReader::Cursor::next(PcapRecord& record) {
+  if (failed_ || pos_ >= end_) {
+    return false;
+  }
+  return reader_->format_ == PcapFormat::PCAPNG ? nextPcapng(record)
+                                               : nextPcap(record);
+}
+
+bool PcapMmapReader::Cursor::nextPcap(PcapRecord& record) {
+  if (end_ - pos_ < sizeof(pcaprec_hdr_s)) {
+    return fail("truncated record header");
+  }
+  const auto& iface = state_.interfaces[0];
+  auto tsSec = read32(pos_);
+  auto tsFrac = read32(pos_ + 4);
+  auto inclLen = read32(pos_ + 8);
+  auto origLen = read32(pos_ + 12);
+  if (inclLen > end_ - pos_ - sizeof(pcaprec_hdr_s)) {
+    return fail(fmt::format("truncated record of {} bytes", inclLen));
+  }
+  if (iface.snaplen && inclLen > iface.snaplen) {
+    return fail(fmt::format(
+        "record of {} bytes is bigger than snaplen {}",
+        inclLen,
+        iface.snaplen));
+  }
+  auto* data = reader_->data_ + pos_ + sizeof(pcaprec_hdr_s);
+  record.data = folly::ByteRange(data, inclLen);
+  record.origLen = origLen;
+  record.tsNs = tsSec * kNsecPerSec +
+      (iface.tsUnits == kNsecPerSec ? tsFrac : tsFrac * 1000ULL);
+  record.linkType = iface.linkType;
+  record.offset = pos_;
+  pos_ += sizeof(pcaprec_hdr_s) + inclLen;
+  return true;
+}
+
+bool PcapMmapReader::Cursor::parseSectionHeader(uint32_t blockLen) {
+  // type, length, byte order magic, version and section length
+  if (blockLen < 28) {
+    return fail("truncated section header");
+  }
+  uint32_t bom;
+  std::memcpy(&bom, reader_->data_ + pos_ + 8, sizeof(bom));
+  if (bom == kPcapngByteOrderMagic) {
+    state_.swapped = false;
+  } else if (__builtin_bswap32(bom) == kPcapngByteOrderMagic) {
+    state_.swapped = true;
+  } else {
+    return fail("wrong byte order magic");
+  }
+  // interface ids are per section
+  state_.interfaces.clear();
+  return true;
+}
+
+bool PcapMmapReader::Cursor::parseInterface(
+    const uint8_t* body,
+    uint32_t len) {
+  if (len < 8) {
+    return fail("truncated interface description");
+  }
+  auto bodyOffset = body - reader_->data_;
+  PcapInterface iface;
+  iface.linkType = read16(bodyOffset);
+  iface.snaplen = read32(bodyOffset + 4);
+  for (uint32_t off = 8; off + 4 <= len;) {
+    auto code = read16(bodyOffset + off);
+    auto optLen = read16(bodyOffset + off + 2);
+    if (code == kPcapngOptEnd || off + 4 + optLen > len) {
+      break;
+    }
+    if (code == kPcapngOptTsResol && optLen >= 1) {
+      uint8_t resol = body[off + 4];
+      auto exp = resol & 0x7f;
+      // msb is set: power of 2, otherwise - power of 10
+      if (resol & 0x80) {
+        iface.tsUnits = exp < 64 ? 1ULL << exp : 0;
+      } else {
+        iface.tsUnits = 1;
+        for (int i = 0; i < exp && iface.tsUnits; i++) {
+          iface.tsUnits = iface.tsUnits <= UINT64_MAX / 10 ? iface.tsUnits * 10
+                                                           : 0;
+        }
+      }
+      if (iface.tsUnits == 0) {
+        return fail("unsupported timestamp resolution");
+      }
+    }
+    off += 4 + ((optLen + 3) & ~3u);
+  }
+  state_.interfaces.push_back(iface);
+  return true;
+}
+
+bool PcapMmapReader::Cursor::nextPcapng(PcapRecord& record) {
+  while (pos_ < end_) {
+    if (end_ - pos_ < kPcapngBlockOverhead) {
+      return fail("truncated block");
+    }
+    uint32_t type;
+    std::memcpy(&type, reader_->data_ + pos_, sizeof(type));
+    if (type == kPcapngSectionHeader) {
+      // byte order of the block's length depends on the section itself
+      uint32_t bom;
+      std::memcpy(&bom, reader_->data_ + pos_ + 8, sizeof(bom));
+      state_.swapped = bom != kPcapngByteOrderMagic;
+    }
+    type = maybeSwap(type, state_.swapped);
+    auto blockLen = read32(pos_ + 4);
+    if (blockLen < kPcapngBlockOverhead || blockLen % 4 != 0 ||
+        blockLen > end_ - pos_) {
+      return fail(fmt::format("wrong block length {}", blockLen));
+    }
+    if (read32(pos_ + blockLen - 4) != blockLen) {
+      return fail("block's trailing length mismatch");
+    }
+    const auto* body = reader_->data_ + pos_ + 8;
+    uint32_t bodyLen = blockLen - kPcapngBlockOverhead;
+    auto bodyOffset = pos_ + 8;
+    uint32_t ifaceId = 0;
+    uint32_t capLen = 0;
+    uint32_t origLen = 0;
+    uint64_t ts = 0;
+    const uint8_t* data = nullptr;
+    switch (type) {
+      case kPcapngSectionHeader:
+        if (!parseSectionHeader(blockLen)) {
+          return false;
+        }
+        break;
+      case kPcapngInterface:
+        if (!parseInterface(body, bodyLen)) {
+          return false;
+        }
+        break;
+      case kPcapngEnhancedPacket:
+      case kPcapngPacket:
+        if (bodyLen < 20) {
+          return fail("truncated packet block");
+        }
+        // obsolete packet block has 16 bit interface id and drops count
+        ifaceId = type == kPcapngPacket ? read16(bodyOffset)
+                                        : read32(bodyOffset);
+        ts = (static_cast<uint64_t>(read32(bodyOffset + 4)) << 32) |
+            read32(bodyOffset + 8);
+        capLen = read32(bodyOffset + 12);
+        origLen = read32(bodyOffset + 16);
+        data = body + 20;
+        if (capLen > bodyLen - 20) {
+          return fail(fmt::format("truncated packet of {} bytes", capLen));
+        }
+        break;
+      case kPcapngSimplePacket:
+        if (bodyLen < 4) {
+          return fail("truncated simple packet block");
+        }
+        origLen = read32(bodyOffset);
+        capLen = std::min(origLen, bodyLen - 4);
+        data = body + 4;
+        break;
+      default:
+        // statistics, name resolution, custom blocks etc
+        break;
+    }
+    if (data) {
+      if (ifaceId >= state_.interfaces.size()) {
+        return fail(fmt::format("unknown interface {}", ifaceId));
+      }
+      const auto& iface = state_.interfaces[ifaceId];
+      if (type == kPcapngSimplePacket && iface.snaplen) {
+        capLen = std::min(capLen, iface.snaplen);
+      }
+      record.data = folly::ByteRange(data, capLen);
+      record.origLen = origLen;
+      record.tsNs = toNs(ts, iface.tsUnits);
+      record.linkType = iface.linkType;
+      record.offset = pos_;
+      pos_ += blockLen;
+      return true;
+    }
+    pos_ += blockLen;
+  }
+  return false;
+}
+
+} // namespace katran
@@ -0,0 +1,185 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/Expected.h>
+#include <folly/Range.h>
+
+#include "katran/lib/PcapStructs.h"
+
+namespace katran {
+
+/**
+ * single packet from pcap file. data points into the mapping of the file
+ */
+struct PcapRecord {
+  folly::ByteRange data;
+  uint32_t origLen{0};
+  // timestamp in nanoseconds
+  uint64_t tsNs{0};
+  uint32_t linkType{0};
+  // offset of the record (or pcapng block) in the file
+  uint64_t offset{0};
+};
+
+/**
+ * pcapng's interface description. for classic pcap there is a single one
+ */
+struct PcapInterface {
+  uint32_t linkType{0};
+  uint32_t snaplen{0};
+  // number of timestamp units per second
+  uint64_t tsUnits{1000000};
+};
+
+/**
+ * state which is needed to parse records from the middle of the file
+ */
+struct PcapSectionState {
+  // file (or pcapng section) has different byte order than host
+  bool swapped{false};
+  std::vector<PcapInterface> interfaces;
+};
+
+/**
+ * part of the file w/ whole records in [begin, end)
+ */
+struct PcapShard {
+  uint64_t begin{0};
+  uint64_t end{0};
+  uint64_t records{0};
+  PcapSectionState state;
+};
+
+/**
+ * zero copy reader of pcap and pcapng files. file is mmap'ed and records are
+ * returned as views into the mapping, so they are valid as long as reader is
+ * alive. reader itself is immutable, so any number of cursors could be used
+ * concurrently (e.g. one per shard of the file).
+ */
+class PcapMmapReader {
+ public:
+  PcapMmapReader(const PcapMmapReader&) = delete;
+  PcapMmapReader& operator=(const PcapMmapReader&) = delete;
+  ~PcapMmapReader();
+
+  /**
+   * @param string path to pcap or pcapng file
+   * @return reader or error's description
+   */
+  static folly::Expected<std::unique_ptr<PcapMmapReader>, std::string> open(
+      const std::string& path);
+
+  /**
+   * iterator over records of the file (or of its shard)
+   */
+  class Cursor {
+   public:
+    /**
+     * @param PcapRecord record where next record is going to be stored
+     * @return bool false if there is no more records (or file is malformed,
+     * in this case failed() is true)
+     */
+    bool next(PcapRecord& record);
+
+    bool failed() const {
+      return failed_;
+    }
+
+    /**
+     * @return uint64_t offset in the file of the record which is going to be
+     * read next
+     */
+    uint64_t offset() const {
+      return pos_;
+    }
+
+   private:
+    friend class PcapMmapReader;
+
+    Cursor(
+        const PcapMmapReader& reader,
+        uint64_t begin,
+        uint64_t end,
+        PcapSectionState state)
+        : reader_(&reader), pos_(begin), end_(end), state_(std::move(state)) {}
+
+    bool nextPcap(PcapRecord& record);
+    bool nextPcapng(PcapRecord& record);
+    bool parseSectionHeader(uint32_t blockLen);
+    bool parseInterface(const uint8_t* body, uint32_t len);
+    bool fail(const std::string& msg);
+
+    uint32_t read32(uint64_t offset) const;
+    uint16_t read16(uint64_t offset) const;
+
+    const PcapMmapReader* reader_;
+    uint64_t pos_;
+    uint64_t end_;
+    PcapSectionState state_;
+    bool failed_{false};
+  };
+
+  /**
+   * @return Cursor over all the records of the file
+   */
+  Cursor cursor() const;
+
+  /**
+   * @return Cursor over records of the shard
+   */
+  Cursor cursor(const PcapShard& shard) const;
+
+  /**
+   * @param size_t shards number of parts to split the file into
+   * @return vector<PcapShard> up to "shards" parts of the file w/ roughly
+   * equal size. records carry no index, so this walks through headers of all
+   * the records once (w/o touching packets data)
+   */
+  std::vector<PcapShard> shard(size_t shards) const;
+
+  PcapFormat format() const {
+    return format_;
+  }
+
+  const uint8_t* data() const {
+    return data_;
+  }
+
+  uint64_t size() const {
+    return size_;
+  }
+
+ private:
+  PcapMmapReader(const uint8_t* data, uint64_t size)
+      : data_(data), size_(size) {}
+
+  const uint8_t* data_;
+  uint64_t size_;
+  PcapFormat format_{PcapFormat::PCAP};
+  // offset of the first record
+  uint64_t start_{0};
+  // state at the first record
+  PcapSectionState state_;
+};
+
+} // namespace katran
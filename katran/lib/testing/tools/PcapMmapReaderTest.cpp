@@ -0,0 +1,349 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <folly/FileUtil.h>
+
+#include "katran/lib/testing/tools/PcapMmapReader.h"
+
+namespace katran {
+
+namespace {
+
+// builds pcap/pcapng file in memory in host or swapped byte order
+class FileBuilder {
+ public:
+  explicit FileBuilder(bool swapped = false) : swapped_(swapped) {}
+
+  void u16(uint16_t val) {
+    val = swapped_ ? __builtin_bswap16(val) : val;
+    append(&val, sizeof(val));
+  }
+
+  void u32(uint32_t val) {
+    val = swapped_ ? __builtin_bswap32(val) : val;
+    append(&val, sizeof(val));
+  }
+
+  void append(const void* data, size_t len) {
+    auto ptr = static_cast<const char*>(data);
+    buf_.append(ptr, len);
+  }
+
+  void pad() {
+    buf_.append((4 - buf_.size() % 4) % 4, '\0');
+  }
+
+  // pcapng block w/ body produced by fn
+  template <typename F>
+  void block(uint32_t type, F fn) {
+    auto start = buf_.size();
+    u32(type);
+    u32(0);
+    fn();
+    pad();
+    uint32_t len = buf_.size() - start + 4;
+    u32(len);
+    auto stored = swapped_ ? __builtin_bswap32(len) : len;
+    std::memcpy(&buf_[start + 4], &stored, sizeof(stored));
+  }
+
+  void shb() {
+    block(0x0a0d0d0a, [this] {
+      u32(0x1a2b3c4d);
+      u16(1);
+      u16(0);
+      u32(0xffffffff);
+      u32(0xffffffff);
+    });
+  }
+
+  void idb(uint16_t linkType, int8_t tsResol = -1) {
+    block(1, [this, linkType, tsResol] {
+      u16(linkType);
+      u16(0);
+      u32(0);
+      if (tsResol >= 0) {
+        u16(9);
+        u16(1);
+        buf_.push_back(tsResol);
+        pad();
+        u16(0);
+        u16(0);
+      }
+    });
+  }
+
+  void epb(uint32_t ifaceId, uint64_t ts, const std::string& pckt) {
+    block(6, [this, ifaceId, ts, &pckt] {
+      u32(ifaceId);
+      u32(ts >> 32);
+      u32(ts & 0xffffffff);
+      u32(pckt.size());
+      u32(pckt.size() + 100);
+      append(pckt.data(), pckt.size());
+    });
+  }
+
+  void pcapHeader(uint32_t magic, uint32_t snaplen, uint32_t network) {
+    u32(magic);
+    u16(2);
+    u16(4);
+    u32(0);
+    u32(0);
+    u32(snaplen);
+    u32(network);
+  }
+
+  void pcapRecord(uint32_t sec, uint32_t frac, const std::string& pckt) {
+    u32(sec);
+    u32(frac);
+    u32(pckt.size());
+    u32(pckt.size());
+    append(pckt.data(), pckt.size());
+  }
+
+  const std::string& data() const {
+    return buf_;
+  }
+
+ private:
+  bool swapped_;
+  std::string buf_;
+};
+
+class PcapMmapReaderTest : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    for (const auto& path : paths_) {
+      unlink(path.c_str());
+    }
+  }
+
+  std::unique_ptr<PcapMmapReader> open(const std::string& content) {
+    char path[] = "/tmp/katran_pcap_reader_XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT_GE(fd, 0);
+    close(fd);
+    paths_.push_back(path);
+    EXPECT_TRUE(folly::writeFile(content, path));
+    auto reader = PcapMmapReader::open(path);
+    EXPECT_TRUE(reader.hasValue());
+    return reader.hasValue() ? std::move(reader.value()) : nullptr;
+  }
+
+  std::vector<PcapRecord> readAll(PcapMmapReader::Cursor cursor) {
+    std::vector<PcapRecord> records;
+    PcapRecord record;
+    while (cursor.next(record)) {
+      records.push_back(record);
+    }
+    EXPECT_FALSE(cursor.failed());
+    return records;
+  }
+
+  std::vector<std::string> paths_;
+};
+
+std::string toString(folly::ByteRange range) {
+  return std::string(reinterpret_cast<const char*>(range.data()), range.size());
+}
+
+} // namespace
+
+TEST_F(PcapMmapReaderTest, testPcap) {
+  for (bool swapped : {false, true}) {
+    FileBuilder file(swapped);
+    file.pcapHeader(0xa1b2c3d4, 65535, 1);
+    file.pcapRecord(10, 5, "abc");
+    file.pcapRecord(11, 999999, "defgh");
+    auto reader = open(file.data());
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->format(), PcapFormat::PCAP);
+    auto records = readAll(reader->cursor());
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(toString(records[0].data), "abc");
+    EXPECT_EQ(records[0].tsNs, 10000005000);
+    EXPECT_EQ(records[0].linkType, 1);
+    EXPECT_EQ(records[0].offset, sizeof(pcap_hdr_s));
+    EXPECT_EQ(toString(records[1].data), "defgh");
+    EXPECT_EQ(records[1].tsNs, 11999999000);
+    // records are views into the mapping
+    EXPECT_EQ(
+        records[1].data.data(),
+        reader->data() + records[1].offset + sizeof(pcaprec_hdr_s));
+  }
+}
+
+TEST_F(PcapMmapReaderTest, testPcapNsec) {
+  FileBuilder file;
+  file.pcapHeader(0xa1b23c4d, 65535, 1);
+  file.pcapRecord(10, 123456789, "abc");
+  auto reader = open(file.data());
+  ASSERT_NE(reader, nullptr);
+  auto records = readAll(reader->cursor());
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].tsNs, 10123456789);
+}
+
+TEST_F(PcapMmapReaderTest, testPcapMalformed) {
+  FileBuilder file;
+  file.pcapHeader(0xa1b2c3d4, 4, 1);
+  file.pcapRecord(1, 0, "abc");
+  file.pcapRecord(2, 0, "abcdefgh");
+  auto reader = open(file.data());
+  ASSERT_NE(reader, nullptr);
+  auto cursor = reader->cursor();
+  PcapRecord record;
+  EXPECT_TRUE(cursor.next(record));
+  // bigger than snaplen
+  EXPECT_FALSE(cursor.next(record));
+  EXPECT_TRUE(cursor.failed());
+
+  // truncated record
+  auto truncated = open(file.data().substr(0, file.data().size() - 1));
+  ASSERT_NE(truncated, nullptr);
+  cursor = truncated->cursor();
+  EXPECT_TRUE(cursor.next(record));
+  EXPECT_FALSE(cursor.next(record));
+  EXPECT_TRUE(cursor.failed());
+
+  EXPECT_FALSE(PcapMmapReader::open("/nonexistent/katran.pcap").hasValue());
+}
+
+TEST_F(PcapMmapReaderTest, testPcapng) {
+  for (bool swapped : {false, true}) {
+    FileBuilder file(swapped);
+    file.shb();
+    file.idb(1);
+    // nsec resolution
+    file.idb(101, 9);
+    file.epb(0, 10000005, "abc");
+    // unknown block is skipped
+    file.block(5, [&file] { file.u32(42); });
+    file.epb(1, 10123456789, "defgh");
+    // new section resets interfaces
+    file.shb();
+    file.idb(228, 9);
+    file.epb(0, 1, "x");
+    auto reader = open(file.data());
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->format(), PcapFormat::PCAPNG);
+    auto records = readAll(reader->cursor());
+    ASSERT_EQ(records.size(), 3);
+    EXPECT_EQ(toString(records[0].data), "abc");
+    EXPECT_EQ(records[0].tsNs, 10000005000);
+    EXPECT_EQ(records[0].linkType, 1);
+    EXPECT_EQ(records[0].origLen, 103);
+    EXPECT_EQ(toString(records[1].data), "defgh");
+    EXPECT_EQ(records[1].tsNs, 10123456789);
+    EXPECT_EQ(records[1].linkType, 101);
+    EXPECT_EQ(toString(records[2].data), "x");
+    EXPECT_EQ(records[2].tsNs, 1);
+    EXPECT_EQ(records[2].linkType, 228);
+  }
+}
+
+TEST_F(PcapMmapReaderTest, testPcapngMalformed) {
+  FileBuilder file;
+  file.shb();
+  file.idb(1);
+  file.epb(0, 1, "abc");
+  // unknown interface
+  file.epb(3, 1, "abc");
+  auto reader = open(file.data());
+  ASSERT_NE(reader, nullptr);
+  auto cursor = reader->cursor();
+  PcapRecord record;
+  EXPECT_TRUE(cursor.next(record));
+  EXPECT_FALSE(cursor.next(record));
+  EXPECT_TRUE(cursor.failed());
+
+  // trailing length of the last block is corrupted
+  auto corrupted = file.data();
+  corrupted.back() ^= 0x10;
+  reader = open(corrupted);
+  ASSERT_NE(reader, nullptr);
+  cursor = reader->cursor();
+  EXPECT_TRUE(cursor.next(record));
+  EXPECT_FALSE(cursor.next(record));
+  EXPECT_TRUE(cursor.failed());
+}
+
+TEST_F(PcapMmapReaderTest, testShards) {
+  for (bool pcapng : {false, true}) {
+    FileBuilder file;
+    constexpr int kPackets = 1000;
+    if (pcapng) {
+      file.shb();
+      file.idb(1);
+    } else {
+      file.pcapHeader(0xa1b2c3d4, 65535, 1);
+    }
+    for (int i = 0; i < kPackets; i++) {
+      // variable sizes to get unaligned record boundaries
+      auto pckt = std::string(1 + i % 7, 'a') + std::to_string(i);
+      if (pcapng) {
+        if (i == kPackets / 2) {
+          // shards after this point must carry interface from new section
+          file.shb();
+          file.idb(228);
+        }
+        file.epb(0, i, pckt);
+      } else {
+        file.pcapRecord(i, 0, pckt);
+      }
+    }
+    auto reader = open(file.data());
+    ASSERT_NE(reader, nullptr);
+    auto all = readAll(reader->cursor());
+    ASSERT_EQ(all.size(), kPackets);
+    for (size_t shards : {1, 3, 8, 2000}) {
+      auto parts = reader->shard(shards);
+      ASSERT_LE(parts.size(), shards);
+      ASSERT_FALSE(parts.empty());
+      EXPECT_EQ(parts.front().begin, all.front().offset);
+      EXPECT_EQ(parts.back().end, reader->size());
+      size_t idx = 0;
+      for (size_t i = 0; i < parts.size(); i++) {
+        if (i > 0) {
+          EXPECT_EQ(parts[i].begin, parts[i - 1].end);
+        }
+        auto records = readAll(reader->cursor(parts[i]));
+        EXPECT_EQ(records.size(), parts[i].records);
+        for (const auto& record : records) {
+          ASSERT_LT(idx, all.size());
+          EXPECT_EQ(record.offset, all[idx].offset);
+          EXPECT_EQ(record.linkType, all[idx].linkType);
+          EXPECT_EQ(toString(record.data), toString(all[idx].data));
+          idx++;
+        }
+      }
+      EXPECT_EQ(idx, all.size());
+    }
+    if (pcapng) {
+      EXPECT_EQ(all.back().linkType, 228);
+    }
+  }
+}
+
+} // namespace katran
@@ -17,12 +17,14 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 
 #include <folly/File.h>
 #include <folly/io/IOBuf.h>
 
 #include "katran/lib/PcapStructs.h"
+#include "katran/lib/testing/tools/PcapMmapReader.h"
 
 namespace katran {
 
@@ -46,7 +48,10 @@ class PcapParser {
    *
    * helper function which reads one packet in a time from inputFile and returns
    * IOBuf which contains it. if there is no more packets left in a file
-   * nullptr will be returned.
+   * nullptr will be returned. both pcap and pcapng files are supported.
+   * returned IOBuf is not owning and points into read only mapping of the
+   * input file: it must not be written to and is valid only while parser
+   * is alive
    */
   std::unique_ptr<folly::IOBuf> getPacketFromPcap();
 
@@ -89,12 +94,6 @@ class PcapParser {
   bool writePacket(std::unique_ptr<folly::IOBuf> pckt);
 
  private:
-  /**
-   * flag which indicates that this is a first read from pcap file
-   * (so we would need to read generic pcap header first)
-   */
-  bool firstRead_{true};
-
   /**
    * flag which indicates that this is a first write to pcap file (so we would
    * need to write generic pcap header first).
@@ -108,16 +107,15 @@ class PcapParser {
   std::string outputFileName_;
 
   /**
-   * file objects for pcap files
+   * mmap'ed input file and position of the next packet in it
    */
-  folly::File inputFile_;
-  folly::File outputFile_;
+  std::unique_ptr<PcapMmapReader> reader_;
+  std::optional<PcapMmapReader::Cursor> cursor_;
 
   /**
-   * maximum packet's size declared in generic pcap header. used for sanity
-   * checking.
+   * file object for output pcap file
    */
-  uint32_t snaplen_{0};
+  folly::File outputFile_;
 };
 
 } // namespace katran
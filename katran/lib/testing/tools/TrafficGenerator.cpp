@@ -0,0 +1,519 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/testing/tools/TrafficGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <folly/File.h>
+#include <folly/FileUtil.h>
+#include <folly/IPAddress.h>
+#include <glog/logging.h>
+
+#include "katran/lib/PcapStructs.h"
+#include "katran/lib/testing/tools/PacketBuilder.h"
+
+namespace katran {
+namespace testing {
+
+namespace {
+constexpr size_t kEthHdrLen = 14;
+constexpr size_t kIpv4HdrLen = 20;
+constexpr size_t kIpv6HdrLen = 40;
+constexpr size_t kUdpHdrLen = 8;
+// established flows use ports from [1024, 32768), new ones - [32768, 65536)
+constexpr uint32_t kEstablishedPortBase = 1024;
+constexpr uint32_t kEstablishedPorts = 32768 - kEstablishedPortBase;
+constexpr uint16_t kNewFlowPortBase = 32768;
+constexpr uint16_t kGueSrcPort = 31337;
+constexpr uint8_t kQuicCidV2 = 0x80;
+constexpr size_t kQuicCidLen = 8;
+constexpr size_t kChunk = 4096;
+
+constexpr uint32_t kPcapMagic = 0xa1b2c3d4;
+constexpr uint16_t kPcapVersionMajor = 2;
+constexpr uint16_t kPcapVersionMinor = 4;
+constexpr uint32_t kPcapSnapLen = 65535;
+constexpr uint32_t kPcapEthernet = 1;
+
+// one's complement sum of big endian 16 bit words, not folded
+uint32_t sum16(const uint8_t* data, size_t len) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  if (len & 1) {
+    sum += data[len - 1] << 8;
+  }
+  return sum;
+}
+
+uint16_t fold(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+// sum of the field as it contributes to the checksum of the packet: field
+// which starts at odd offset has its bytes swapped in every word
+uint16_t fieldSum(const uint8_t* packet, size_t offset, size_t len) {
+  auto sum = fold(sum16(packet + offset, len));
+  return (offset & 1) ? static_cast<uint16_t>((sum << 8) | (sum >> 8)) : sum;
+}
+
+uint16_t readBe16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+void writeBe16(uint8_t* p, uint16_t val) {
+  p[0] = val >> 8;
+  p[1] = val & 0xff;
+}
+
+// incremental checksum update (RFC 1624, eqn. 3)
+void adjustChecksum(
+    uint8_t* csum,
+    uint32_t oldSum,
+    uint32_t newSum,
+    bool udp = false) {
+  uint32_t sum = static_cast<uint16_t>(~readBe16(csum)) +
+      static_cast<uint16_t>(~fold(oldSum)) + fold(newSum);
+  uint16_t res = ~fold(sum);
+  // 0 means "no checksum" for udp
+  writeBe16(csum, (udp && res == 0) ? 0xffff : res);
+}
+
+bool isV6(const std::string& addr) {
+  return addr.find(':') != std::string::npos;
+}
+
+uint16_t establishedPort(uint32_t source) {
+  return kEstablishedPortBase +
+      (static_cast<uint64_t>(source) * 2654435761ULL) % kEstablishedPorts;
+}
+} // namespace
+
+TrafficGenerator::AliasTable::AliasTable(const std::vector<double>& weights)
+    : buckets_(weights.size()) {
+  double total = 0;
+  for (auto w : weights) {
+    if (w < 0) {
+      throw std::invalid_argument("negative weight in traffic spec");
+    }
+    total += w;
+  }
+  if (weights.empty() || total <= 0) {
+    throw std::invalid_argument("empty distribution in traffic spec");
+  }
+  std::vector<double> scaled(weights.size());
+  std::vector<uint32_t> small, large;
+  for (size_t i = 0; i < weights.size(); i++) {
+    buckets_[i].index = i;
+    scaled[i] = weights[i] * weights.size() / total;
+    (scaled[i] < 1 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    auto s = small.back();
+    small.pop_back();
+    auto l = large.back();
+    buckets_[s].prob = static_cast<uint32_t>(scaled[s] * 4294967296.0);
+    buckets_[s].alias = l;
+    scaled[l] -= 1 - scaled[s];
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // leftovers are full buckets (up to rounding errors)
+  for (auto v : {&small, &large}) {
+    for (auto i : *v) {
+      buckets_[i].prob = UINT32_MAX;
+      buckets_[i].alias = i;
+    }
+  }
+}
+
+TrafficGenerator::TrafficGenerator(const TrafficSpec& spec)
+    : quicServerIds_(spec.quicServerIds),
+      nextNewFlowPort_(kNewFlowPortBase),
+      rngState_(spec.seed) {
+  if (spec.vips.empty()) {
+    throw std::invalid_argument("traffic spec w/o vips");
+  }
+  if (spec.synRatio < 0 || spec.synRatio > 1) {
+    throw std::invalid_argument("syn ratio must be in [0, 1]");
+  }
+  if (spec.ipipShare < 0 || spec.gueShare < 0 ||
+      spec.ipipShare + spec.gueShare > 1) {
+    throw std::invalid_argument("encapsulated shares must be in [0, 1]");
+  }
+  for (auto id : quicServerIds_) {
+    if (id == 0 || id >= (1 << 24)) {
+      throw std::invalid_argument("quic server id must be in [1, 2^24)");
+    }
+  }
+  buildSources(spec);
+  buildTemplates(spec);
+  for (auto& d : draws_) {
+    d = draw();
+  }
+}
+
+void TrafficGenerator::buildSources(const TrafficSpec& spec) {
+  std::vector<double> weights[2];
+  for (const auto& src : spec.srcPrefixes) {
+    auto network = folly::IPAddress::createNetwork(src.prefix);
+    SrcPool pool;
+    pool.v6 = network.first.isV6();
+    auto hostBits = network.first.bitCount() - network.second;
+    uint64_t capacity = hostBits >= 32 ? kMaxTrafficSources
+                                       : std::min<uint64_t>(
+                                             1ULL << hostBits,
+                                             kMaxTrafficSources);
+    if (src.sources > capacity) {
+      throw std::invalid_argument(
+          "too many sources for prefix " + src.prefix);
+    }
+    pool.sources = src.sources ? src.sources : capacity;
+    if (pool.v6) {
+      auto bytes = network.first.asV6().toByteArray();
+      for (int i = 0; i < 8; i++) {
+        pool.hi = (pool.hi << 8) | bytes[i];
+        pool.lo = (pool.lo << 8) | bytes[i + 8];
+      }
+    } else {
+      pool.lo = network.first.asV4().toLongHBO();
+    }
+    if (src.distribution == SrcDistribution::ZIPF) {
+      std::vector<double> ranks(pool.sources);
+      for (uint32_t i = 0; i < pool.sources; i++) {
+        ranks[i] = 1.0 / std::pow(i + 1, src.zipfS);
+      }
+      pool.zipf = AliasTable(ranks);
+    }
+    families_[pool.v6].pools.push_back(pools_.size());
+    weights[pool.v6].push_back(src.weight);
+    pools_.push_back(std::move(pool));
+  }
+  for (int v6 = 0; v6 < 2; v6++) {
+    if (!weights[v6].empty()) {
+      families_[v6].prefixes = AliasTable(weights[v6]);
+    }
+  }
+}
+
+void TrafficGenerator::buildTemplates(const TrafficSpec& spec) {
+  double kindWeights[kPacketKinds];
+  kindWeights[kTcpSyn] = spec.tcpShare * spec.synRatio;
+  kindWeights[kTcpData] = spec.tcpShare * (1 - spec.synRatio);
+  kindWeights[kUdp] = spec.udpShare;
+  kindWeights[kQuicInitial] = spec.quicShare * spec.synRatio;
+  kindWeights[kQuicShort] = spec.quicShare * (1 - spec.synRatio);
+  kindWeights[kIcmp] = spec.icmpShare;
+  double encapWeights[kEncaps];
+  encapWeights[kNoEncap] = 1 - spec.ipipShare - spec.gueShare;
+  encapWeights[kIpip] = spec.ipipShare;
+  encapWeights[kGue] = spec.gueShare;
+  if (spec.payloadSizes.empty()) {
+    throw std::invalid_argument("traffic spec w/o payload sizes");
+  }
+
+  std::vector<double> weights;
+  for (const auto& vip : spec.vips) {
+    bool v6 = isV6(vip.address);
+    if (vip.weight > 0 && families_[v6].pools.empty()) {
+      throw std::invalid_argument(
+          "no source prefixes of the same family for vip " + vip.address);
+    }
+    for (int kind = 0; kind < kPacketKinds; kind++) {
+      for (int encap = 0; encap < kEncaps; encap++) {
+        for (const auto& size : spec.payloadSizes) {
+          auto weight = vip.weight * kindWeights[kind] * encapWeights[encap] *
+              size.weight;
+          if (weight <= 0) {
+            continue;
+          }
+          templates_.push_back(buildTemplate(
+              spec,
+              vip,
+              v6,
+              static_cast<PacketKind>(kind),
+              static_cast<Encap>(encap),
+              size.size));
+          weights.push_back(weight);
+          maxPacketSize_ =
+              std::max(maxPacketSize_, templates_.back().data.size());
+        }
+      }
+    }
+  }
+  templatesTable_ = AliasTable(weights);
+}
+
+TrafficGenerator::Template TrafficGenerator::buildTemplate(
+    const TrafficSpec& spec,
+    const TrafficVip& vip,
+    bool v6,
+    PacketKind kind,
+    Encap encap,
+    uint16_t payloadSize) {
+  Template t;
+  t.v6 = v6;
+  auto builder = PacketBuilder::newPacket().Eth(spec.srcMac, spec.dstMac);
+  size_t offset = kEthHdrLen;
+  if (encap != kNoEncap) {
+    bool outerV6 = isV6(spec.encapDst);
+    if (outerV6) {
+      builder.IPv6(spec.encapSrc, spec.encapDst);
+    } else {
+      builder.IPv4(spec.encapSrc, spec.encapDst);
+    }
+    offset += outerV6 ? kIpv6HdrLen : kIpv4HdrLen;
+    if (encap == kGue) {
+      builder.UDP(kGueSrcPort, spec.guePort);
+      offset += kUdpHdrLen;
+    }
+  }
+  size_t ipOffset = offset;
+  if (v6) {
+    builder.IPv6("2001:db8::1", vip.address);
+    t.srcOffset = ipOffset + 8;
+    offset += kIpv6HdrLen;
+  } else {
+    builder.IPv4("192.0.2.1", vip.address);
+    t.srcOffset = ipOffset + 12;
+    t.ipCsumOffset = ipOffset + 10;
+    offset += kIpv4HdrLen;
+  }
+  std::string payload(payloadSize, 'k');
+  auto port = establishedPort(0);
+  switch (kind) {
+    case kTcpSyn:
+      builder.TCP(port, vip.port, 0, 0, 8192, TH_SYN);
+      t.l4CsumOffset = offset + 16;
+      break;
+    case kTcpData:
+      builder.TCP(port, vip.port, 0, 0, 8192, TH_ACK);
+      t.l4CsumOffset = offset + 16;
+      break;
+    case kUdp:
+      builder.UDP(port, vip.port);
+      t.l4CsumOffset = offset + 6;
+      break;
+    case kQuicInitial:
+      builder.UDP(port, vip.port)
+          .QUICInitial()
+          .destConnId({0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88})
+          .data(payload)
+          .done();
+      t.l4CsumOffset = offset + 6;
+      break;
+    case kQuicShort: {
+      std::vector<uint8_t> cid(kQuicCidLen, 0);
+      cid[0] = kQuicCidV2;
+      builder.UDP(port, vip.port)
+          .QUICShortHeader()
+          .destConnId(cid)
+          .data(payload)
+          .done();
+      t.l4CsumOffset = offset + 6;
+      if (!quicServerIds_.empty()) {
+        // right after short header's flags
+        t.cidOffset = offset + kUdpHdrLen + 1;
+      }
+      break;
+    }
+    case kIcmp:
+      if (v6) {
+        builder.ICMPv6(ICMPv6Header::ECHO_REQUEST, 0, port, 1);
+      } else {
+        builder.ICMP(ICMPv4Header::ECHO_REQUEST, 0, port, 1);
+      }
+      t.l4CsumOffset = offset + 2;
+      break;
+    default:
+      break;
+  }
+  if (payloadSize && (kind == kTcpData || kind == kUdp || kind == kIcmp)) {
+    builder.payload(payload);
+  }
+  t.data = builder.buildAsBytes();
+  t.newFlow = kind == kTcpSyn || kind == kQuicInitial;
+  t.portOffset = kind == kIcmp ? offset + 4 : offset;
+  t.pseudoHeader = kind != kIcmp || v6;
+  t.udpCsum = kind == kUdp || kind == kQuicInitial || kind == kQuicShort;
+
+  auto* data = t.data.data();
+  if (kind == kIcmp) {
+    // icmp echo's payload is not a part of PacketBuilder's checksum
+    writeBe16(data + t.l4CsumOffset, 0);
+    uint32_t sum = sum16(data + offset, t.data.size() - offset);
+    if (v6) {
+      // pseudo header: addresses, upper layer length and next header
+      sum += sum16(data + ipOffset + 8, 32) + (t.data.size() - offset) +
+          IPPROTO_ICMPV6;
+    }
+    writeBe16(data + t.l4CsumOffset, ~fold(sum));
+  }
+  if (encap == kGue) {
+    // outer udp checksum is not updated while patching inner packet
+    writeBe16(data + ipOffset - kUdpHdrLen + 6, 0);
+  }
+  t.srcSum = fieldSum(data, t.srcOffset, v6 ? 16 : 4);
+  t.portSum = fieldSum(data, t.portOffset, 2);
+  if (t.cidOffset) {
+    t.cidSum = fieldSum(data, t.cidOffset, 4);
+  }
+  return t;
+}
+
+TrafficGenerator::Draw TrafficGenerator::draw() {
+  Draw d;
+  d.tmpl = templatesTable_.sample(nextRandom());
+  const auto& family = families_[templates_[d.tmpl].v6];
+  d.pool = family.pools[family.prefixes.sample(nextRandom())];
+  d.rnd = nextRandom();
+  const auto& pool = pools_[d.pool];
+  if (pool.zipf) {
+    pool.zipf->prefetch(d.rnd);
+  }
+  return d;
+}
+
+size_t TrafficGenerator::writePacket(uint8_t* out) {
+  auto d = draws_[drawPos_];
+  draws_[drawPos_] = draw();
+  drawPos_ = (drawPos_ + 1) % kLookahead;
+  const auto& t = templates_[d.tmpl];
+  const auto& pool = pools_[d.pool];
+  uint32_t source = pool.zipf ? pool.zipf->sample(d.rnd)
+                              : ((d.rnd >> 32) * pool.sources) >> 32;
+
+  std::memcpy(out, t.data.data(), t.data.size());
+  auto* src = out + t.srcOffset;
+  if (t.v6) {
+    uint64_t lo = pool.lo + source;
+    uint64_t hi = pool.hi + (lo < pool.lo);
+    for (int i = 0; i < 8; i++) {
+      src[i] = hi >> (56 - 8 * i);
+      src[i + 8] = lo >> (56 - 8 * i);
+    }
+  } else {
+    uint32_t addr = pool.lo + source;
+    src[0] = addr >> 24;
+    src[1] = addr >> 16;
+    src[2] = addr >> 8;
+    src[3] = addr;
+  }
+  uint16_t port;
+  if (t.newFlow) {
+    port = nextNewFlowPort_;
+    nextNewFlowPort_ =
+        nextNewFlowPort_ == 65535 ? kNewFlowPortBase : nextNewFlowPort_ + 1;
+  } else {
+    port = establishedPort(source);
+  }
+  writeBe16(out + t.portOffset, port);
+  uint32_t oldSum = t.portSum;
+  uint32_t newSum = port;
+  if (t.cidOffset) {
+    auto id = quicServerIds_[source % quicServerIds_.size()];
+    auto* cid = out + t.cidOffset;
+    cid[1] = id >> 16;
+    cid[2] = id >> 8;
+    cid[3] = id;
+    oldSum += t.cidSum;
+    newSum += fieldSum(out, t.cidOffset, 4);
+  }
+
+  auto srcSum = fieldSum(out, t.srcOffset, t.v6 ? 16 : 4);
+  if (t.ipCsumOffset) {
+    adjustChecksum(out + t.ipCsumOffset, t.srcSum, srcSum);
+  }
+  if (t.pseudoHeader) {
+    oldSum += t.srcSum;
+    newSum += srcSum;
+  }
+  adjustChecksum(out + t.l4CsumOffset, oldSum, newSum, t.udpCsum);
+  return t.data.size();
+}
+
+void TrafficGenerator::generate(size_t count, TrafficBuffer& buffer) {
+  auto offset = buffer.data.size();
+  buffer.offsets.reserve(buffer.offsets.size() + count);
+  // packets are usually much smaller than the biggest one, so space is
+  // reserved chunk by chunk
+  for (size_t done = 0; done < count;) {
+    auto n = std::min(kChunk, count - done);
+    buffer.data.resize(offset + n * maxPacketSize_);
+    auto* data = buffer.data.data();
+    for (size_t i = 0; i < n; i++) {
+      offset += writePacket(data + offset);
+      buffer.offsets.push_back(offset);
+    }
+    buffer.data.resize(offset);
+    done += n;
+  }
+}
+
+bool TrafficGenerator::writePcap(const std::string& path, size_t count) {
+  folly::File file;
+  try {
+    file = folly::File(path, O_RDWR | O_CREAT | O_TRUNC);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "exception while opening file " << path << " : " << e.what();
+    return false;
+  }
+  struct pcap_hdr_s hdr {
+    .magic_number = kPcapMagic, .version_major = kPcapVersionMajor,
+    .version_minor = kPcapVersionMinor, .thiszone = 0, .sigfigs = 0,
+    .snaplen = kPcapSnapLen, .network = kPcapEthernet
+  };
+  if (folly::writeFull(file.fd(), &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    LOG(ERROR) << "can't write pcap header to " << path;
+    return false;
+  }
+  auto recSize = sizeof(pcaprec_hdr_s) + maxPacketSize_;
+  std::vector<uint8_t> chunk(kChunk * recSize);
+  for (size_t written = 0; written < count;) {
+    auto n = std::min(kChunk, count - written);
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++, written++) {
+      uint32_t size = writePacket(chunk.data() + len + sizeof(pcaprec_hdr_s));
+      pcaprec_hdr_s rec{
+          .ts_sec = static_cast<uint32_t>(written / 1000000),
+          .ts_usec = static_cast<uint32_t>(written % 1000000),
+          .incl_len = size,
+          .orig_len = size};
+      // records are not aligned
+      std::memcpy(chunk.data() + len, &rec, sizeof(rec));
+      len += sizeof(rec) + size;
+    }
+    if (folly::writeFull(file.fd(), chunk.data(), len) !=
+        static_cast<ssize_t>(len)) {
+      LOG(ERROR) << "can't write packets to " << path;
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace testing
+} // namespace katran
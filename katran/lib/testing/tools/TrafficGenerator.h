@@ -0,0 +1,307 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <folly/Range.h>
+
+namespace katran {
+namespace testing {
+
+// max number of distinct sources in a single prefix
+constexpr uint32_t kMaxTrafficSources = 1 << 22;
+
+enum class SrcDistribution : uint8_t {
+  UNIFORM = 0,
+  ZIPF,
+};
+
+/**
+ * prefix traffic is coming from
+ * @param string prefix e.g. "172.16.0.0/12" or "fc00:2::/64"
+ * @param double weight share of traffic (of the same address family) which
+ * comes from this prefix
+ * @param SrcDistribution distribution of traffic across sources in the prefix.
+ * for zipf, the first address of the prefix is the most popular one
+ * @param double zipfS exponent of zipf distribution
+ * @param uint32_t sources number of distinct sources (starting from the first
+ * address of the prefix). 0 - as many as prefix has, up to kMaxTrafficSources
+ */
+struct TrafficSrcPrefix {
+  std::string prefix;
+  double weight{1};
+  SrcDistribution distribution{SrcDistribution::UNIFORM};
+  double zipfS{1.0};
+  uint32_t sources{0};
+};
+
+struct TrafficVip {
+  std::string address;
+  uint16_t port{80};
+  double weight{1};
+};
+
+struct TrafficPayloadSize {
+  uint16_t size;
+  double weight{1};
+};
+
+/**
+ * description of synthetic traffic mix. shares of protocols are weights, so
+ * only their ratio matters. each source has a single established flow
+ * (w/ the same source port) towards each vip; new flows (tcp syns and quic
+ * initials) use source ports which are never used by established ones.
+ *
+ * @param vector<TrafficVip> vips destinations of the traffic
+ * @param vector<TrafficSrcPrefix> srcPrefixes sources of the traffic. there
+ * must be a prefix of the same address family for each of the vips
+ * @param double tcpShare, udpShare, quicShare mix of l4 protocols
+ * @param double icmpShare share of icmp echo requests to vips
+ * @param double synRatio share of new flows among tcp and quic packets
+ * @param vector<TrafficPayloadSize> payloadSizes distribution of l4 payload
+ * sizes. tcp syns never have payload
+ * @param double ipipShare, gueShare shares of packets which are encapsulated
+ * (e.g. to test inline decap) from encapSrc to encapDst. outer udp checksum
+ * of gue packets is 0
+ * @param vector<uint32_t> quicServerIds server ids for connection ids (v2) of
+ * quic short header packets. server id of a flow is picked by its source.
+ * empty - connection ids w/o server id
+ * @param uint64_t seed for random number generator
+ */
+struct TrafficSpec {
+  std::vector<TrafficVip> vips;
+  std::vector<TrafficSrcPrefix> srcPrefixes;
+  double tcpShare{1};
+  double udpShare{0};
+  double quicShare{0};
+  double icmpShare{0};
+  double synRatio{0};
+  std::vector<TrafficPayloadSize> payloadSizes{{64, 1}};
+  double ipipShare{0};
+  double gueShare{0};
+  std::string encapSrc{"fc00:2307::1"};
+  std::string encapDst{"fc00:1404::1"};
+  uint16_t guePort{6080};
+  std::vector<uint32_t> quicServerIds;
+  std::string srcMac{"0x1"};
+  std::string dstMac{"0x2"};
+  uint64_t seed{0};
+};
+
+/**
+ * packets stored back to back in a single buffer
+ */
+struct TrafficBuffer {
+  std::vector<uint8_t> data;
+  // offset of i-th packet in data. has one extra element: end of the last one
+  std::vector<uint64_t> offsets{0};
+
+  size_t size() const {
+    return offsets.size() - 1;
+  }
+
+  folly::ByteRange packet(size_t i) const {
+    return folly::ByteRange(
+        data.data() + offsets[i], data.data() + offsets[i + 1]);
+  }
+
+  void clear() {
+    data.clear();
+    offsets.assign(1, 0);
+  }
+};
+
+/**
+ * bulk generator of synthetic traffic. every combination of vip, packet type,
+ * encapsulation and payload size is built w/ PacketBuilder once; generation
+ * itself is a copy of such template w/ patched source address, source port
+ * (or icmp echo id) and quic connection id, and w/ incrementally updated
+ * checksums. so it is fast enough for perf tests to never be bottlenecked by
+ * it. generator is not thread safe: use instance (w/ different seed) per
+ * thread.
+ */
+class TrafficGenerator {
+ public:
+  /**
+   * @param TrafficSpec spec of traffic to generate
+   *
+   * throws std::invalid_argument if spec is malformed
+   */
+  explicit TrafficGenerator(const TrafficSpec& spec);
+
+  /**
+   * @param size_t count number of packets to generate
+   * @param TrafficBuffer buffer where packets are appended to
+   */
+  void generate(size_t count, TrafficBuffer& buffer);
+
+  /**
+   * @param string path of pcap file
+   * @param size_t count number of packets to generate
+   * @return bool true on success
+   *
+   * helper function to generate packets straight into pcap file. timestamps
+   * of packets are 1us apart
+   */
+  bool writePcap(const std::string& path, size_t count);
+
+  /**
+   * @return size_t size of the biggest packet generator could produce
+   */
+  size_t maxPacketSize() const {
+    return maxPacketSize_;
+  }
+
+ private:
+  /**
+   * walker's alias table: O(1) sampling from discrete distribution
+   */
+  class AliasTable {
+   public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<double>& weights);
+
+    uint32_t sample(uint64_t rnd) const {
+      const auto& bucket = buckets_[((rnd >> 32) * buckets_.size()) >> 32];
+      return static_cast<uint32_t>(rnd) < bucket.prob ? bucket.index
+                                                      : bucket.alias;
+    }
+
+    void prefetch(uint64_t rnd) const {
+      __builtin_prefetch(&buckets_[((rnd >> 32) * buckets_.size()) >> 32]);
+    }
+
+   private:
+    // kept together, so sampling from big table is a single cache miss
+    struct Bucket {
+      uint32_t index;
+      uint32_t prob;
+      uint32_t alias;
+    };
+    std::vector<Bucket> buckets_;
+  };
+
+  enum PacketKind : uint8_t {
+    kTcpSyn = 0,
+    kTcpData,
+    kUdp,
+    kQuicInitial,
+    kQuicShort,
+    kIcmp,
+    kPacketKinds,
+  };
+
+  enum Encap : uint8_t {
+    kNoEncap = 0,
+    kIpip,
+    kGue,
+    kEncaps,
+  };
+
+  struct SrcPool {
+    bool v6{false};
+    // first address of the pool in host byte order. v4 address is in lo
+    uint64_t hi{0};
+    uint64_t lo{0};
+    uint32_t sources{1};
+    std::optional<AliasTable> zipf;
+  };
+
+  struct SrcFamily {
+    AliasTable prefixes;
+    std::vector<uint32_t> pools;
+  };
+
+  struct Template {
+    std::vector<uint8_t> data;
+    bool v6{false};
+    bool newFlow{false};
+    // offsets of fields to patch. 0 - no such field
+    uint16_t srcOffset{0};
+    uint16_t ipCsumOffset{0};
+    uint16_t portOffset{0};
+    uint16_t cidOffset{0};
+    uint16_t l4CsumOffset{0};
+    // l4 checksum covers source address (as a part of pseudo header)
+    bool pseudoHeader{false};
+    bool udpCsum{false};
+    // one's complement sums of template's src address, port and cid
+    uint32_t srcSum{0};
+    uint32_t portSum{0};
+    uint32_t cidSum{0};
+  };
+
+  /**
+   * random choices for a single packet. they are made kLookahead packets in
+   * advance, so zipf's table (which could be way bigger than cpu cache) is
+   * prefetched by the time it is needed
+   */
+  struct Draw {
+    uint32_t tmpl;
+    uint32_t pool;
+    uint64_t rnd;
+  };
+
+  static constexpr size_t kLookahead = 16;
+
+  void buildTemplates(const TrafficSpec& spec);
+
+  Template buildTemplate(
+      const TrafficSpec& spec,
+      const TrafficVip& vip,
+      bool v6,
+      PacketKind kind,
+      Encap encap,
+      uint16_t payloadSize);
+
+  void buildSources(const TrafficSpec& spec);
+
+  /**
+   * writes next packet into out (which must have at least maxPacketSize()
+   * bytes) and returns its size
+   */
+  size_t writePacket(uint8_t* out);
+
+  Draw draw();
+
+  uint64_t nextRandom() {
+    // splitmix64
+    uint64_t z = (rngState_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  std::vector<Template> templates_;
+  AliasTable templatesTable_;
+  std::vector<SrcPool> pools_;
+  // v4 and v6 sources
+  SrcFamily families_[2];
+  std::vector<uint32_t> quicServerIds_;
+  Draw draws_[kLookahead];
+  size_t drawPos_{0};
+  uint16_t nextNewFlowPort_;
+  size_t maxPacketSize_{0};
+  uint64_t rngState_;
+};
+
+} // namespace testing
+} // namespace katran
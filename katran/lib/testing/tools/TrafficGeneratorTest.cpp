@@ -0,0 +1,299 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#include <folly/FileUtil.h>
+
+#include "katran/lib/PcapStructs.h"
+#include "katran/lib/testing/tools/TrafficGenerator.h"
+
+namespace katran {
+namespace testing {
+
+namespace {
+constexpr uint8_t kIpip = 4;
+constexpr uint8_t kIpv6InIp = 41;
+constexpr uint16_t kGuePort = 6080;
+
+uint32_t sum16(const uint8_t* data, size_t len) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < len; i += 2) {
+    sum += (data[i] << 8) | data[i + 1];
+  }
+  if (len & 1) {
+    sum += data[len - 1] << 8;
+  }
+  return sum;
+}
+
+bool checksumOk(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum == 0xffff;
+}
+
+uint16_t be16(const uint8_t* p) {
+  return (p[0] << 8) | p[1];
+}
+
+struct ParsedPacket {
+  bool v6{false};
+  uint8_t proto{0};
+  bool syn{false};
+  int encap{0};
+  std::string src;
+  uint16_t sport{0};
+  const uint8_t* l4Payload{nullptr};
+  bool checksumsOk{true};
+};
+
+// walks through (possibly encapsulated) packet and validates all checksums
+// of the innermost one
+void parse(const uint8_t* p, size_t len, size_t ip, bool v6, ParsedPacket& r) {
+  size_t l4;
+  uint32_t pseudo;
+  char buf[64];
+  if (v6) {
+    r.proto = p[ip + 6];
+    l4 = ip + 40;
+    pseudo = sum16(p + ip + 8, 32) + (len - l4) + r.proto;
+    inet_ntop(AF_INET6, p + ip + 8, buf, sizeof(buf));
+  } else {
+    r.checksumsOk &= checksumOk(sum16(p + ip, 20));
+    r.proto = p[ip + 9];
+    l4 = ip + 20;
+    pseudo = sum16(p + ip + 12, 8) + (len - l4) + r.proto;
+    inet_ntop(AF_INET, p + ip + 12, buf, sizeof(buf));
+  }
+  if (r.proto == kIpip || r.proto == kIpv6InIp) {
+    r.encap = 1;
+    return parse(p, len, l4, r.proto == kIpv6InIp, r);
+  }
+  if (r.proto == IPPROTO_UDP && be16(p + l4 + 2) == kGuePort) {
+    r.encap = 2;
+    return parse(p, len, l4 + 8, (p[l4 + 8] >> 4) == 6, r);
+  }
+  r.v6 = v6;
+  r.src = buf;
+  if (r.proto == IPPROTO_ICMP) {
+    pseudo = 0;
+    r.sport = be16(p + l4 + 4);
+  } else if (r.proto == IPPROTO_ICMPV6) {
+    r.sport = be16(p + l4 + 4);
+  } else {
+    r.sport = be16(p + l4);
+  }
+  if (r.proto == IPPROTO_TCP) {
+    r.syn = p[l4 + 13] & TH_SYN;
+  }
+  r.l4Payload = p + l4 + (r.proto == IPPROTO_TCP ? 20 : 8);
+  r.checksumsOk &= checksumOk(sum16(p + l4, len - l4) + pseudo);
+}
+
+ParsedPacket parse(folly::ByteRange pckt) {
+  ParsedPacket r;
+  bool v6 = be16(pckt.data() + 12) == ETH_P_IPV6;
+  parse(pckt.data(), pckt.size(), 14, v6, r);
+  return r;
+}
+
+TrafficSpec mixedSpec() {
+  TrafficSpec spec;
+  spec.vips = {{"10.200.1.1", 80, 1}, {"fc00:1::1", 443, 1}};
+  spec.srcPrefixes = {
+      {"172.16.0.0/12", 1, SrcDistribution::ZIPF, 1.0, 10000},
+      {"fc00:2::/64", 1, SrcDistribution::UNIFORM, 0, 1000},
+  };
+  spec.tcpShare = 6;
+  spec.udpShare = 1;
+  spec.quicShare = 2;
+  spec.icmpShare = 1;
+  spec.synRatio = 0.1;
+  spec.payloadSizes = {{0, 1}, {100, 2}, {1000, 1}};
+  spec.ipipShare = 0.1;
+  spec.gueShare = 0.1;
+  return spec;
+}
+} // namespace
+
+TEST(TrafficGeneratorTest, testChecksums) {
+  TrafficGenerator gen(mixedSpec());
+  TrafficBuffer buffer;
+  gen.generate(50000, buffer);
+  ASSERT_EQ(buffer.size(), 50000);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    ASSERT_TRUE(parse(buffer.packet(i)).checksumsOk) << "packet #" << i;
+  }
+}
+
+TEST(TrafficGeneratorTest, testMix) {
+  constexpr size_t kPackets = 100000;
+  TrafficGenerator gen(mixedSpec());
+  TrafficBuffer buffer;
+  gen.generate(kPackets, buffer);
+  std::map<uint8_t, size_t> protos;
+  size_t syns = 0, v6 = 0, ipip = 0, gue = 0;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    auto pckt = parse(buffer.packet(i));
+    protos[pckt.proto == IPPROTO_ICMPV6 ? IPPROTO_ICMP : pckt.proto]++;
+    syns += pckt.syn;
+    v6 += pckt.v6;
+    ipip += pckt.encap == 1;
+    gue += pckt.encap == 2;
+  }
+  auto share = [&](size_t n) { return static_cast<double>(n) / kPackets; };
+  EXPECT_NEAR(share(protos[IPPROTO_TCP]), 0.6, 0.01);
+  // udp and quic
+  EXPECT_NEAR(share(protos[IPPROTO_UDP]), 0.3, 0.01);
+  EXPECT_NEAR(share(protos[IPPROTO_ICMP]), 0.1, 0.01);
+  EXPECT_NEAR(share(syns), 0.06, 0.005);
+  EXPECT_NEAR(share(v6), 0.5, 0.01);
+  EXPECT_NEAR(share(ipip), 0.1, 0.01);
+  EXPECT_NEAR(share(gue), 0.1, 0.01);
+}
+
+TEST(TrafficGeneratorTest, testSources) {
+  TrafficSpec spec;
+  spec.vips = {{"10.200.1.1", 80, 1}};
+  spec.srcPrefixes = {{"10.1.0.0/16", 1, SrcDistribution::ZIPF, 1.0, 100}};
+  TrafficGenerator gen(spec);
+  TrafficBuffer buffer;
+  gen.generate(100000, buffer);
+  std::map<std::string, size_t> sources;
+  std::map<std::string, uint16_t> ports;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    auto pckt = parse(buffer.packet(i));
+    sources[pckt.src]++;
+    // established flow always uses the same port
+    auto it = ports.emplace(pckt.src, pckt.sport).first;
+    EXPECT_EQ(it->second, pckt.sport);
+    EXPECT_LT(pckt.sport, 32768);
+  }
+  EXPECT_EQ(sources.size(), 100);
+  EXPECT_EQ(sources.count("10.1.0.0"), 1);
+  EXPECT_EQ(sources.count("10.1.0.99"), 1);
+  // H(100) ~= 5.19, so the most popular source gets ~19% of the traffic
+  EXPECT_NEAR(sources["10.1.0.0"] / 100000.0, 1 / 5.187, 0.01);
+  EXPECT_GT(sources["10.1.0.1"], sources["10.1.0.50"]);
+}
+
+TEST(TrafficGeneratorTest, testNewFlows) {
+  TrafficSpec spec;
+  spec.vips = {{"10.200.1.1", 80, 1}};
+  spec.srcPrefixes = {{"10.1.0.0/24", 1, SrcDistribution::UNIFORM, 0, 1}};
+  spec.synRatio = 1;
+  TrafficGenerator gen(spec);
+  TrafficBuffer buffer;
+  gen.generate(100, buffer);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    auto pckt = parse(buffer.packet(i));
+    EXPECT_TRUE(pckt.syn);
+    EXPECT_EQ(pckt.sport, 32768 + i);
+  }
+}
+
+TEST(TrafficGeneratorTest, testQuicServerIds) {
+  TrafficSpec spec;
+  spec.vips = {{"fc00:1::1", 443, 1}};
+  spec.srcPrefixes = {{"fc00:2::/120", 1}};
+  spec.tcpShare = 0;
+  spec.quicShare = 1;
+  spec.quicServerIds = {1, 0x123456};
+  TrafficGenerator gen(spec);
+  TrafficBuffer buffer;
+  gen.generate(1000, buffer);
+  std::map<uint32_t, size_t> ids;
+  for (size_t i = 0; i < buffer.size(); i++) {
+    auto pckt = parse(buffer.packet(i));
+    ASSERT_TRUE(pckt.checksumsOk);
+    // short header: flags followed by v2 connection id
+    const auto* cid = pckt.l4Payload + 1;
+    EXPECT_EQ(cid[0], 0x80);
+    ids[(cid[1] << 16) | (cid[2] << 8) | cid[3]]++;
+  }
+  EXPECT_EQ(ids.size(), 2);
+  EXPECT_EQ(ids.count(1), 1);
+  EXPECT_EQ(ids.count(0x123456), 1);
+}
+
+TEST(TrafficGeneratorTest, testSeed) {
+  auto spec = mixedSpec();
+  TrafficBuffer first, second, third;
+  TrafficGenerator(spec).generate(1000, first);
+  TrafficGenerator(spec).generate(1000, second);
+  spec.seed = 1;
+  TrafficGenerator(spec).generate(1000, third);
+  EXPECT_EQ(first.data, second.data);
+  EXPECT_NE(first.data, third.data);
+}
+
+TEST(TrafficGeneratorTest, testInvalidSpec) {
+  TrafficSpec spec;
+  EXPECT_THROW(TrafficGenerator{spec}, std::invalid_argument);
+  spec.vips = {{"fc00:1::1", 443, 1}};
+  spec.srcPrefixes = {{"10.0.0.0/8", 1}};
+  // no v6 sources
+  EXPECT_THROW(TrafficGenerator{spec}, std::invalid_argument);
+  spec.vips = {{"10.200.1.1", 80, 1}};
+  spec.srcPrefixes = {{"10.0.0.0/24", 1, SrcDistribution::UNIFORM, 0, 1000}};
+  EXPECT_THROW(TrafficGenerator{spec}, std::invalid_argument);
+  spec.srcPrefixes[0].sources = 0;
+  spec.ipipShare = 0.7;
+  spec.gueShare = 0.7;
+  EXPECT_THROW(TrafficGenerator{spec}, std::invalid_argument);
+  spec.gueShare = 0;
+  EXPECT_NO_THROW(TrafficGenerator{spec});
+}
+
+TEST(TrafficGeneratorTest, testWritePcap) {
+  char path[] = "/tmp/katran_traffic_gen_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  TrafficGenerator gen(mixedSpec());
+  ASSERT_TRUE(gen.writePcap(path, 10000));
+  std::string content;
+  ASSERT_TRUE(folly::readFile(path, content));
+  unlink(path);
+
+  ASSERT_GE(content.size(), sizeof(pcap_hdr_s));
+  size_t offset = sizeof(pcap_hdr_s);
+  size_t records = 0;
+  while (offset + sizeof(pcaprec_hdr_s) <= content.size()) {
+    pcaprec_hdr_s rec;
+    memcpy(&rec, content.data() + offset, sizeof(rec));
+    EXPECT_EQ(rec.incl_len, rec.orig_len);
+    EXPECT_EQ(rec.ts_usec, records);
+    offset += sizeof(rec) + rec.incl_len;
+    records++;
+  }
+  EXPECT_EQ(offset, content.size());
+  EXPECT_EQ(records, 10000);
+}
+
+} // namespace testing
+} // namespace katran
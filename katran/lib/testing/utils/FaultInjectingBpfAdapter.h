@@ -0,0 +1,83 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include "katran/lib/BpfAdapter.h"
+
+namespace katran {
+namespace testing {
+
+/**
+ * BpfAdapter, which could fail or hold lookups of specified maps. allows to
+ * test failure paths and interleavings of KatranLb against real forwarding
+ * plane
+ */
+class FaultInjectingBpfAdapter : public BpfAdapter {
+ public:
+  using BpfAdapter::BpfAdapter;
+
+  /**
+   * @param unordered_set<string> names of the maps, which fd lookups fail.
+   * empty set disables fault injection
+   */
+  void setFailedMaps(std::unordered_set<std::string> names) {
+    failedMaps_ = std::move(names);
+  }
+
+  /**
+   * @param string name of the map, which fd lookups (from any thread) wait
+   * until unblockMaps is called
+   */
+  void blockMap(const std::string& name) {
+    std::lock_guard<std::mutex> lock(blockedMutex_);
+    blockedMap_ = name;
+  }
+
+  void unblockMaps() {
+    {
+      std::lock_guard<std::mutex> lock(blockedMutex_);
+      blockedMap_.clear();
+    }
+    blockedCv_.notify_all();
+  }
+
+  int getMapFdByName(const std::string& name) override {
+    {
+      std::unique_lock<std::mutex> lock(blockedMutex_);
+      blockedCv_.wait(lock, [&]() { return blockedMap_ != name; });
+    }
+    if (failedMaps_.count(name)) {
+      errno = EBADF;
+      return -1;
+    }
+    return BpfAdapter::getMapFdByName(name);
+  }
+
+ private:
+  std::unordered_set<std::string> failedMaps_;
+  std::string blockedMap_;
+  std::mutex blockedMutex_;
+  std::condition_variable blockedCv_;
+};
+
+} // namespace testing
+} // namespace katran
@@ -21,13 +21,66 @@
 #include "katran/lib/testing/fixtures/KatranTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranUdpStableRtTestFixtures.h"
 #include "katran/lib/testing/fixtures/KatranXPopDecapTestFixtures.h"
+#include "katran/lib/testing/tools/PacketBuilder.h"
 
 #include <folly/File.h>
 #include <folly/FileUtil.h>
+#include <folly/synchronization/Baton.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "katran/lib/KatranLbAsync.h"
 
 namespace katran {
 namespace testing {
 
+namespace {
+// how long it takes for event to go from forwarding plane to pcap writer
+constexpr auto kMonitorFlushTime = std::chrono::seconds(1);
+constexpr auto kMonitorRestartTime = std::chrono::milliseconds(100);
+constexpr uint32_t kMaxXdpPcktSize = 4096;
+constexpr auto kRingUpdateTimeout = std::chrono::seconds(5);
+
+/**
+ * records indexes of added reals and signals when marker real is deleted
+ */
+class RealsIdRecorder : public katran::KatranLb::RealsIdCallback {
+ public:
+  explicit RealsIdRecorder(const folly::IPAddress& marker) : marker_(marker) {}
+
+  void onRealAdded(const folly::IPAddress& /* unused */, uint32_t id) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    added_.push_back(id);
+  }
+
+  void onRealDeleted(const folly::IPAddress& real, uint32_t /* unused */)
+      override {
+    if (real == marker_) {
+      markerDeleted_.post();
+    }
+  }
+
+  bool waitForMarker() {
+    return markerDeleted_.try_wait_for(kRingUpdateTimeout);
+  }
+
+  bool hasAdded(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::find(added_.begin(), added_.end(), id) != added_.end();
+  }
+
+ private:
+  folly::IPAddress marker_;
+  folly::Baton<> markerDeleted_;
+  std::mutex mutex_;
+  std::vector<uint32_t> added_;
+};
+} // namespace
+
 bool testSimulator(katran::KatranLb& lb) {
   bool success{true};
   // udp, v4 vip v4 real
@@ -124,6 +177,315 @@ bool testSimulator(katran::KatranLb& lb) {
   return success;
 }
 
+bool testBatchedSimulation(katran::KatranLb& lb) {
+  bool success{true};
+  // results must be in the same order as flows
+  std::vector<std::pair<katran::KatranFlow, std::string>> flowsAndReals = {
+      {{"172.16.0.1", "10.200.1.1", 31337, 80, kUdp}, "10.0.0.2"},
+      {{"aaaa", "bbbb", 31337, 80, kTcp}, ""},
+      {{"172.16.0.1", "10.200.1.3", 31337, 80, kTcp}, "fc00::2"},
+      {{"fc00:2::1", "fc00:1::2", 31337, 80, kTcp}, ""},
+      {{"fc00:2::1", "fc00:1::1", 31337, 80, kTcp}, "fc00::3"},
+      {{"172.16.0.1", "10.200.1.1", 31337, 80, kTcp}, "10.0.0.2"},
+  };
+  std::vector<katran::KatranFlow> flows;
+  for (const auto& flowAndReal : flowsAndReals) {
+    flows.push_back(flowAndReal.first);
+  }
+  auto reals = lb.getRealsForFlows(flows);
+  if (reals.size() != flows.size()) {
+    LOG(ERROR) << "batched simulation returned " << reals.size()
+               << " results for " << flows.size() << " flows";
+    return false;
+  }
+  for (size_t i = 0; i < flows.size(); i++) {
+    if (reals[i] != flowsAndReals[i].second) {
+      VLOG(2) << "real: " << reals[i];
+      LOG(ERROR) << "batched simulation is incorrect for flow #" << i;
+      success = false;
+    }
+  }
+  return success;
+}
+
+bool testShadowDataPlane(katran::KatranLb& lb) {
+  // flows per vip which are checked against forwarding plane
+  constexpr int kFlowsPerVip = 256;
+  // vips where forwarding plane could route a flow w/o consistent hashing
+  constexpr uint32_t kNotReplicatedFlags =
+      kQuicVip | kLocalVip | kUdpStableRouting | kUdpFlowMigration;
+  auto shadow = lb.getShadowDataPlane();
+  // fixed seed, so failures are reproducible
+  std::mt19937 gen(31337);
+  std::vector<katran::KatranFlow> flows;
+  for (const auto& vip : lb.getAllVips()) {
+    if (lb.getVipFlags(vip) & kNotReplicatedFlags) {
+      continue;
+    }
+    auto vipAddr = folly::IPAddress(vip.address);
+    for (int i = 0; i < kFlowsPerVip; i++) {
+      // random src, so flow never hits an existing lru entry
+      std::string src;
+      if (vipAddr.isV4()) {
+        src = folly::IPAddressV4::fromLongHBO(gen()).str();
+      } else {
+        std::array<uint8_t, 16> bytes;
+        for (auto& byte : bytes) {
+          byte = gen();
+        }
+        src = folly::IPAddressV6::fromBinary(
+                  folly::ByteRange(bytes.data(), bytes.size()))
+                  .str();
+      }
+      flows.push_back(katran::KatranFlow{
+          .src = src,
+          .dst = vip.address,
+          .srcPort = static_cast<uint16_t>(gen()),
+          .dstPort = vip.port ? vip.port : static_cast<uint16_t>(gen()),
+          .proto = vip.proto,
+      });
+    }
+  }
+  auto expected = lb.getRealsForFlows(flows);
+  auto reals = shadow->getRealsForFlows(flows);
+  int mismatches = 0;
+  for (size_t i = 0; i < flows.size(); i++) {
+    if (reals[i] != expected[i]) {
+      VLOG(2) << "flow " << flows[i].src << ":" << flows[i].srcPort << " -> "
+              << flows[i].dst << ":" << flows[i].dstPort
+              << " proto: " << static_cast<int>(flows[i].proto)
+              << " shadow: " << reals[i] << " bpf: " << expected[i];
+      mismatches++;
+    }
+  }
+  if (mismatches) {
+    LOG(INFO) << "shadow data plane does not match forwarding plane for "
+              << mismatches << " out of " << flows.size() << " flows";
+    return false;
+  }
+  LOG(INFO) << "shadow data plane matches forwarding plane for "
+            << flows.size() << " flows";
+  return true;
+}
+
+bool testForwardingState(katran::KatranLb& lb) {
+  // v6 vip w/ zeroed low 96 bits: its key in vip_map is the same as for v4 vip
+  katran::VipKey v6Vip;
+  v6Vip.address = "2a03:2880::";
+  v6Vip.port = 80;
+  v6Vip.proto = kTcp;
+  if (!lb.addVip(v6Vip)) {
+    LOG(ERROR) << "can't add vip " << v6Vip.address;
+    return false;
+  }
+  bool success{true};
+  auto state = lb.readForwardingState();
+  for (const auto& vip : lb.getAllVips()) {
+    auto it = std::find_if(
+        state.vips.begin(), state.vips.end(), [&](const auto& fwVip) {
+          return fwVip.vip == vip;
+        });
+    if (it == state.vips.end()) {
+      LOG(ERROR) << "vip " << vip.address << ":" << vip.port
+                 << " is not restored from forwarding plane";
+      success = false;
+    } else if (it->flags != lb.getVipFlags(vip)) {
+      LOG(ERROR) << "flags of vip " << vip.address << ":" << vip.port
+                 << " restored from forwarding plane do not match";
+      success = false;
+    }
+  }
+  if (state.vips.size() != lb.getAllVips().size()) {
+    LOG(ERROR) << "forwarding plane has " << state.vips.size()
+               << " vips, expected: " << lb.getAllVips().size();
+    success = false;
+  }
+  lb.delVip(v6Vip);
+  return success;
+}
+
+bool testSrcRoutingFailure(
+    katran::KatranLb& lb,
+    FaultInjectingBpfAdapter& adapter) {
+  if (!lb.hasFeature(katran::KatranFeatureEnum::SrcRouting)) {
+    return true;
+  }
+  bool success{true};
+  auto rules = lb.getSrcRoutingRule();
+  auto numReals = lb.getNumToRealMap().size();
+  auto fwRules = lb.readForwardingState().srcRouting;
+  // v6 table could not be written (or swapped in) after v4 one has been
+  adapter.setFailedMaps(
+      {katran::KatranLbMaps::lpm_src_v6, katran::KatranLbMaps::lpm_src_v6_maps});
+  auto res = lb.addSrcRoutingRulesBulk(
+      {{"10.10.0.0/16", "10.0.0.9"}, {"fc00:10::/64", "10.0.0.9"}}, true);
+  adapter.setFailedMaps({});
+  if (res != katran::kError) {
+    LOG(ERROR) << "src routing rules were loaded w/ failed map";
+    return false;
+  }
+  if (lb.getSrcRoutingRule() != rules ||
+      lb.getNumToRealMap().size() != numReals ||
+      lb.readForwardingState().srcRouting != fwRules) {
+    LOG(ERROR) << "failed src routing rules load changed the state";
+    success = false;
+  }
+  // the same rules, so the rest of the tests are not affected
+  std::vector<std::pair<std::string, std::string>> sameRules(
+      rules.begin(), rules.end());
+  if (lb.addSrcRoutingRulesBulk(sameRules, true) != 0 ||
+      lb.getSrcRoutingRule() != rules ||
+      lb.readForwardingState().srcRouting != fwRules) {
+    LOG(ERROR) << "src routing rules could not be replaced after failure";
+    success = false;
+  }
+  return success;
+}
+
+bool testOverlappingRingUpdates(
+    katran::KatranLb& lb,
+    FaultInjectingBpfAdapter& adapter) {
+  bool success{true};
+  katran::VipKey vip;
+  vip.address = "10.200.1.90";
+  vip.port = kVipPort;
+  vip.proto = kTcp;
+  auto fillerVip = vip;
+  fillerVip.address = "10.200.1.91";
+  if (!lb.addVip(vip) || !lb.addVip(fillerVip)) {
+    LOG(ERROR) << "can't add vips for overlapping ring updates test";
+    return false;
+  }
+  katran::NewReal deleted;
+  deleted.address = "10.100.0.1";
+  deleted.weight = 10;
+  lb.addRealForVip(deleted, vip);
+  auto deletedNum = lb.getIndexForReal(deleted.address);
+  // katran_tester runs w/ default number of reals (index 0 is reserved).
+  // once every free index is taken, index of deleted real is the only one
+  // which could be handed out
+  auto freeNums =
+      katran::kDefaultMaxReals - 1 - lb.getNumToRealMap().size();
+  std::vector<katran::NewReal> fillers;
+  for (size_t i = 0; i < freeNums; i++) {
+    katran::NewReal real;
+    real.address =
+        "10.101." + std::to_string(i / 256) + "." + std::to_string(i % 256);
+    real.weight = 1;
+    fillers.push_back(real);
+  }
+  lb.modifyRealsForVip(katran::ModifyAction::ADD, fillers, fillerVip);
+  katran::NewReal added;
+  added.address = "10.100.0.2";
+  added.weight = 10;
+  RealsIdRecorder recorder(folly::IPAddress(fillers.back().address));
+  lb.addRealsIdCallback(&recorder);
+  {
+    katran::KatranLbAsync asyncLb(lb);
+    // ring w/o deleted real is being programmed, while next updates are
+    // computed
+    adapter.blockMap(katran::KatranLbMaps::ch_rings);
+    auto delFuture = asyncLb.delRealForVip(deleted, vip);
+    auto addFuture = asyncLb.addRealForVip(added, vip);
+    // marker is computed after addition
+    auto markerFuture = asyncLb.delRealForVip(fillers.back(), fillerVip);
+    auto computed = recorder.waitForMarker();
+    auto reused = recorder.hasAdded(deletedNum);
+    adapter.unblockMaps();
+    std::move(delFuture).get();
+    std::move(addFuture).get();
+    std::move(markerFuture).get();
+    if (!computed) {
+      LOG(ERROR) << "overlapping reals' updates have not been computed";
+      success = false;
+    } else if (reused) {
+      LOG(ERROR) << "index of deleted real is reused before ch ring w/o it "
+                 << "is programmed";
+      success = false;
+    }
+  }
+  lb.removeRealsIdCallback(&recorder);
+  // once ring is programmed, index is back in the pool
+  lb.addRealForVip(added, vip);
+  if (lb.getIndexForReal(added.address) < 0) {
+    LOG(ERROR) << "index of deleted real has not been released";
+    success = false;
+  }
+  lb.delVip(fillerVip);
+  lb.delVip(vip);
+  return success;
+}
+
+bool testEventFilter(katran::KatranLb& lb) {
+  constexpr auto kEvent = katran::monitoring::EventId::TCP_NONSYN_LRUMISS;
+  auto prevFilter = lb.getKatranMonitorEventFilter(kEvent);
+  if (!prevFilter.has_value()) {
+    LOG(INFO) << "introspection filters are not supported. skipping";
+    return true;
+  }
+  bool success{true};
+  // 10.200.1.2 ignores dst port, so flow's dst port is zeroed before the
+  // event is reported
+  katran::EventFilterConfig filter;
+  katran::VipKey vip;
+  vip.address = "10.200.1.2";
+  vip.port = 42;
+  vip.proto = kTcp;
+  filter.vip = vip;
+  filter.src = folly::IPAddress::createNetwork("192.168.100.0/24");
+  if (!lb.setKatranMonitorEventFilter(kEvent, filter)) {
+    LOG(ERROR) << "can't set introspection filter";
+    return false;
+  }
+  struct FilterCase {
+    std::string src;
+    uint16_t dport;
+    bool reported;
+  };
+  // every packet is a non syn one from a new flow, i.e. lru miss
+  std::vector<FilterCase> cases = {
+      {"192.168.100.1", 42, true},
+      {"192.168.100.2", 43, false},
+      {"192.168.101.1", 42, false},
+  };
+  std::vector<uint8_t> out(kMaxXdpPcktSize);
+  for (const auto& c : cases) {
+    auto pckt = PacketBuilder::newPacket()
+                    .Eth("0x1", "0x2")
+                    .IPv4(c.src, vip.address)
+                    .TCP(31337, c.dport, 0, 0, 8192, TH_ACK)
+                    .payload("katran test pkt")
+                    .buildAsBytes();
+    lb.restartKatranMonitor(kMonitorLimit);
+    std::this_thread::sleep_for(kMonitorRestartTime);
+    uint32_t outSize{0};
+    uint32_t retval{0};
+    auto res = katran::BaseBpfAdapter::testXdpProg(
+        lb.getKatranProgFd(),
+        1,
+        pckt.data(),
+        pckt.size(),
+        out.data(),
+        &outSize,
+        &retval);
+    if (res != 0) {
+      LOG(ERROR) << "can't run balancer prog for filter test";
+      success = false;
+      continue;
+    }
+    std::this_thread::sleep_for(kMonitorFlushTime);
+    auto reported = lb.getKatranMonitorStats().amount;
+    if (reported != (c.reported ? 1 : 0)) {
+      LOG(ERROR) << "introspection filter mismatch for packet from " << c.src
+                 << " to port " << c.dport << ": " << reported
+                 << " events reported";
+      success = false;
+    }
+  }
+  lb.setKatranMonitorEventFilter(kEvent, *prevFilter);
+  return success;
+}
+
 KatranTestParam createDefaultTestParam(TestMode testMode) {
   katran::VipKey vip;
   vip.address = "10.200.1.1";
@@ -18,12 +18,43 @@
 #include <string>
 #include <vector>
 #include "katran/lib/KatranLb.h"
+#include "katran/lib/testing/utils/FaultInjectingBpfAdapter.h"
 #include "katran/lib/testing/utils/KatranTestProvision.h"
 
 namespace katran {
 namespace testing {
 
 bool testSimulator(katran::KatranLb& lb);
+/**
+ * @return false if getRealsForFlows does not return the same reals as
+ * expected for single flow simulations, in the same order as flows
+ */
+bool testBatchedSimulation(katran::KatranLb& lb);
+bool testShadowDataPlane(katran::KatranLb& lb);
+/**
+ * @return false if vips read back from forwarding plane (w/ address family
+ * and flags) do not match vips configured in lb
+ */
+bool testForwardingState(katran::KatranLb& lb);
+/**
+ * @return false if failed bulk load of src routing rules (v6 map fails)
+ * changes rules or reals either in lb or in forwarding plane
+ */
+bool testSrcRoutingFailure(
+    katran::KatranLb& lb,
+    FaultInjectingBpfAdapter& adapter);
+/**
+ * @return false if index of real, deleted by pipelined update, is reused
+ * before ch ring of this update is programmed into forwarding plane
+ */
+bool testOverlappingRingUpdates(
+    katran::KatranLb& lb,
+    FaultInjectingBpfAdapter& adapter);
+/**
+ * @return false if introspection filter (w/ vip which ignores dst port and
+ * src prefix) does not pick expected events in forwarding plane
+ */
+bool testEventFilter(katran::KatranLb& lb);
 KatranTestParam createDefaultTestParam(TestMode testMode);
 KatranTestParam createTPRTestParam();
 KatranTestParam createUdpStableRtTestParam();
@@ -0,0 +1,289 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "katran/lib/BpfLoader.h"
+
+extern "C" {
+#include <bpf/btf.h>
+}
+
+namespace katran {
+
+namespace {
+// set to path of balancer's bpf object to run tests which load it
+constexpr const char* kBpfProgEnv = "KATRAN_TEST_BPF_PROG";
+const std::string kProgName = "balancer_ingress";
+
+struct BtfDeleter {
+  void operator()(struct ::btf* btf) const {
+    ::btf__free(btf);
+  }
+};
+using BtfPtr = std::unique_ptr<struct ::btf, BtfDeleter>;
+
+struct Layout {
+  // id of struct { u32 addr; u16 port; u8 proto; } or its variation
+  uint32_t structId;
+  // id of u32[4]
+  uint32_t arrayId;
+};
+
+/**
+ * builds BTF w/ a struct, which looks like flow key, and an array. struct's
+ * members and array's size could be altered to get incompatible layouts
+ */
+Layout addLayout(
+    struct ::btf* btf,
+    const std::string& structName,
+    const std::string& portName = "port",
+    uint32_t portOffset = 32,
+    uint32_t arrayElems = 4,
+    bool typedefs = false) {
+  auto u8 = ::btf__add_int(btf, "u8", 1, 0);
+  auto u16 = ::btf__add_int(btf, "u16", 2, 0);
+  auto u32 = ::btf__add_int(btf, "u32", 4, 0);
+  if (typedefs) {
+    u32 = ::btf__add_typedef(btf, "__be32", u32);
+  }
+  Layout layout;
+  layout.structId = ::btf__add_struct(btf, structName.c_str(), 8);
+  ::btf__add_field(btf, "addr", u32, 0, 0);
+  ::btf__add_field(btf, portName.c_str(), u16, portOffset, 0);
+  ::btf__add_field(btf, "proto", u8, 56, 0);
+  layout.arrayId = ::btf__add_array(btf, u32, u32, arrayElems);
+  return layout;
+}
+
+struct ::bpf_map_info makeMapInfo(uint32_t keyId = 0, uint32_t valueId = 0) {
+  struct ::bpf_map_info info = {};
+  info.type = BPF_MAP_TYPE_HASH;
+  info.key_size = 8;
+  info.value_size = 16;
+  info.max_entries = 1024;
+  info.btf_key_type_id = keyId;
+  info.btf_value_type_id = valueId;
+  return info;
+}
+
+bool isFdOpen(int fd) {
+  return ::fcntl(fd, F_GETFD) != -1;
+}
+} // namespace
+
+TEST(BpfLoaderTest, testBtfTypesEqualSameLayout) {
+  BtfPtr a(::btf__new_empty());
+  BtfPtr b(::btf__new_empty());
+  auto aLayout = addLayout(a.get(), "flow_key");
+  // names of types and typedefs do not matter
+  auto bLayout = addLayout(b.get(), "flow_key_v2", "port", 32, 4, true);
+  ASSERT_TRUE(BpfLoader::btfTypesEqual(
+      a.get(), aLayout.structId, b.get(), bLayout.structId));
+  ASSERT_TRUE(BpfLoader::btfTypesEqual(
+      a.get(), aLayout.arrayId, b.get(), bLayout.arrayId));
+}
+
+TEST(BpfLoaderTest, testBtfTypesEqualDifferentLayout) {
+  BtfPtr a(::btf__new_empty());
+  auto base = addLayout(a.get(), "flow_key");
+  auto renamed = addLayout(a.get(), "flow_key", "dport");
+  auto moved = addLayout(a.get(), "flow_key", "port", 40);
+  auto longer = addLayout(a.get(), "flow_key", "port", 32, 5);
+  ASSERT_FALSE(BpfLoader::btfTypesEqual(
+      a.get(), base.structId, a.get(), renamed.structId));
+  ASSERT_FALSE(BpfLoader::btfTypesEqual(
+      a.get(), base.structId, a.get(), moved.structId));
+  ASSERT_FALSE(
+      BpfLoader::btfTypesEqual(a.get(), base.arrayId, a.get(), longer.arrayId));
+  ASSERT_FALSE(
+      BpfLoader::btfTypesEqual(a.get(), base.structId, a.get(), base.arrayId));
+}
+
+TEST(BpfLoaderTest, testCheckMapCompatibilityCompatible) {
+  BtfPtr loaded(::btf__new_empty());
+  BtfPtr staged(::btf__new_empty());
+  auto loadedLayout = addLayout(loaded.get(), "flow_key");
+  auto stagedLayout = addLayout(staged.get(), "flow_key", "port", 32, 4, true);
+  auto errors = BpfLoader::checkMapCompatibility(
+      "test_map",
+      makeMapInfo(loadedLayout.structId, loadedLayout.arrayId),
+      loaded.get(),
+      makeMapInfo(stagedLayout.structId, stagedLayout.arrayId),
+      staged.get());
+  ASSERT_TRUE(errors.empty());
+  // w/o BTF only sizes are compared
+  errors = BpfLoader::checkMapCompatibility(
+      "test_map", makeMapInfo(), nullptr, makeMapInfo(), nullptr);
+  ASSERT_TRUE(errors.empty());
+}
+
+TEST(BpfLoaderTest, testCheckMapCompatibilityIncompatible) {
+  auto staged = makeMapInfo();
+  staged.value_size = 32;
+  staged.max_entries = 2048;
+  auto errors = BpfLoader::checkMapCompatibility(
+      "test_map", makeMapInfo(), nullptr, staged, nullptr);
+  ASSERT_EQ(errors.size(), 2);
+  ASSERT_EQ(errors[0], "test_map: value size mismatch, loaded 16 new 32");
+  ASSERT_EQ(errors[1], "test_map: max entries mismatch, loaded 1024 new 2048");
+
+  // same sizes, but different layout of the key
+  BtfPtr loadedBtf(::btf__new_empty());
+  BtfPtr stagedBtf(::btf__new_empty());
+  auto loadedLayout = addLayout(loadedBtf.get(), "flow_key");
+  auto stagedLayout = addLayout(stagedBtf.get(), "flow_key", "port", 40);
+  errors = BpfLoader::checkMapCompatibility(
+      "test_map",
+      makeMapInfo(loadedLayout.structId, loadedLayout.arrayId),
+      loadedBtf.get(),
+      makeMapInfo(stagedLayout.structId, stagedLayout.arrayId),
+      stagedBtf.get());
+  ASSERT_EQ(errors.size(), 1);
+  ASSERT_EQ(errors[0], "test_map: BTF of key does not match");
+}
+
+TEST(BpfLoaderTest, testStagingWithoutObject) {
+  BpfLoader loader;
+  ASSERT_LT(loader.getStagedProgFdByName(kProgName), 0);
+  ASSERT_LT(loader.getPreviousProgFdByName(kProgName), 0);
+  ASSERT_NE(loader.commitStagedBpf(), 0);
+  ASSERT_NE(loader.rollbackBpf(), 0);
+  std::vector<std::string> errors;
+  ASSERT_NE(loader.stageBpfFromFile("/nonexistent/balancer.o", errors), 0);
+  ASSERT_FALSE(errors.empty());
+  ASSERT_NE(loader.commitStagedBpf(), 0);
+  loader.discardStagedBpf();
+}
+
+TEST(BpfLoaderTest, testStageCommitRollback) {
+  auto path = std::getenv(kBpfProgEnv);
+  if (!path) {
+    GTEST_SKIP() << kBpfProgEnv << " is not set";
+  }
+  BpfLoader loader;
+  if (loader.loadBpfFile(path, BPF_PROG_TYPE_XDP)) {
+    GTEST_SKIP() << "can't load " << path;
+  }
+  auto stage = [&]() {
+    std::vector<std::string> errors;
+    EXPECT_EQ(loader.stageBpfFromFile(path, errors, BPF_PROG_TYPE_XDP), 0);
+    EXPECT_TRUE(errors.empty());
+    return loader.getStagedProgFdByName(kProgName);
+  };
+  auto first = loader.getProgFdByName(kProgName);
+  ASSERT_GE(first, 0);
+
+  // staged program does not replace the current one until commit
+  auto second = stage();
+  ASSERT_GE(second, 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), first);
+  ASSERT_LT(loader.getPreviousProgFdByName(kProgName), 0);
+  ASSERT_EQ(loader.commitStagedBpf(), 0);
+  ASSERT_LT(loader.getStagedProgFdByName(kProgName), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), second);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), first);
+
+  // rollback could be undone by another rollback
+  ASSERT_EQ(loader.rollbackBpf(), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), first);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), second);
+  ASSERT_EQ(loader.rollbackBpf(), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), second);
+
+  // program replaced by the first commit is unloaded by the next one
+  auto third = stage();
+  ASSERT_GE(third, 0);
+  ASSERT_EQ(loader.commitStagedBpf(), 0);
+  ASSERT_FALSE(isFdOpen(first));
+  ASSERT_EQ(loader.getProgFdByName(kProgName), third);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), second);
+
+  // after rollback current program is kept and the one rolled back from is
+  // unloaded by the next commit
+  ASSERT_EQ(loader.rollbackBpf(), 0);
+  auto fourth = stage();
+  ASSERT_GE(fourth, 0);
+  loader.discardStagedBpf();
+  ASSERT_FALSE(isFdOpen(fourth));
+  ASSERT_EQ(loader.getProgFdByName(kProgName), second);
+  fourth = stage();
+  ASSERT_EQ(loader.commitStagedBpf(), 0);
+  ASSERT_FALSE(isFdOpen(third));
+  ASSERT_TRUE(isFdOpen(second));
+  ASSERT_EQ(loader.getProgFdByName(kProgName), fourth);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), second);
+}
+
+TEST(BpfLoaderTest, testUpgradeFromOtherPath) {
+  auto path = std::getenv(kBpfProgEnv);
+  if (!path) {
+    GTEST_SKIP() << kBpfProgEnv << " is not set";
+  }
+  // the same object under another path
+  auto otherPath =
+      "/tmp/katran_bpf_loader_test." + std::to_string(::getpid()) + ".o";
+  {
+    std::ifstream src(path, std::ios::binary);
+    std::ofstream dst(otherPath, std::ios::binary);
+    dst << src.rdbuf();
+  }
+  BpfLoader loader;
+  if (loader.loadBpfFile(path, BPF_PROG_TYPE_XDP)) {
+    ::unlink(otherPath.c_str());
+    GTEST_SKIP() << "can't load " << path;
+  }
+  auto stage = [&](const std::string& objPath) {
+    std::vector<std::string> errors;
+    EXPECT_EQ(loader.stageBpfFromFile(objPath, errors, BPF_PROG_TYPE_XDP), 0);
+    EXPECT_TRUE(errors.empty());
+    return loader.getStagedProgFdByName(kProgName);
+  };
+  auto first = loader.getProgFdByName(kProgName);
+  auto second = stage(otherPath);
+  ::unlink(otherPath.c_str());
+  ASSERT_GE(second, 0);
+  ASSERT_EQ(loader.commitStagedBpf(), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), second);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), first);
+  ASSERT_TRUE(isFdOpen(first));
+
+  // object loaded from the first path becomes current again
+  ASSERT_EQ(loader.rollbackBpf(), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), first);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), second);
+
+  // object rolled back from is unloaded by the next commit, even though the
+  // new object is loaded from the path of the current one
+  auto third = stage(path);
+  ASSERT_GE(third, 0);
+  ASSERT_EQ(loader.commitStagedBpf(), 0);
+  ASSERT_FALSE(isFdOpen(second));
+  ASSERT_TRUE(isFdOpen(first));
+  ASSERT_EQ(loader.getProgFdByName(kProgName), third);
+  ASSERT_EQ(loader.getPreviousProgFdByName(kProgName), first);
+  ASSERT_EQ(loader.rollbackBpf(), 0);
+  ASSERT_EQ(loader.getProgFdByName(kProgName), first);
+}
+
+} // namespace katran
@@ -3,11 +3,14 @@
 #include "katran/lib/EventPipeCallback.h"
 #include <fcntl.h>
 #include <folly/io/async/EventBase.h>
+#include <folly/synchronization/Baton.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <chrono>
+#include <thread>
 #include <vector>
 #include "katran/lib/PcapStructs.h"
+#include "katran/lib/QueuedClientSubscription.h"
 
 using namespace ::testing;
 using namespace ::katran;
@@ -40,6 +43,17 @@ class MockClientSubscription : public ClientSubscriptionIf {
   std::vector<Event> sent_events_;
 };
 
+// blocks in sendEvent until released, as client w/ full send buffer would
+class BlockingClientSubscription : public MockClientSubscription {
+ public:
+  void sendEvent(const Event& event) override {
+    released_.wait();
+    MockClientSubscription::sendEvent(event);
+  }
+
+  folly::Baton<> released_;
+};
+
 class MockAsyncWriteCallback : public folly::AsyncWriter::WriteCallback {
  public:
   MockAsyncWriteCallback() = default;
@@ -113,6 +127,69 @@ class EventPipeCallbackTest : public Test {
     return e;
   }
 
+  // slow client is behind the queue, fast one gets events right from the
+  // callback
+  void checkSlowClient(SlowClientPolicy policy) {
+    constexpr uint32_t kNumEvents = 5;
+    auto fastSubscription = std::make_shared<MockClientSubscription>();
+    auto slowSubscription = std::make_shared<BlockingClientSubscription>();
+    auto queued = QueuedClientSubscription::create(slowSubscription, 2, policy);
+
+    ClientSubscriptionMap subsmap;
+    subsmap.insert({1, fastSubscription});
+    subsmap.insert({2, queued});
+    eventPipeCb_ = std::make_unique<EventPipeCallback>(
+        EventId::TCP_NONSYN_LRUMISS,
+        folly::Synchronized<ClientSubscriptionMap>(std::move(subsmap)));
+    eventPipeCb_->enable();
+    reader_->setReadCB(eventPipeCb_.get());
+
+    // pktsize is used to tell events apart
+    std::vector<Event> events;
+    for (uint32_t i = 0; i < kNumEvents; i++) {
+      events.push_back(getEvent(200 + i, kDefaultRaw));
+      writer_->write(nullptr, events[i].data.c_str(), events[i].data.size());
+    }
+    writer_->closeOnEmpty();
+    evb_.loop();
+    evb_.loop();
+
+    // fast client got everything while slow one is still stuck w/ first event
+    // no ASSERTs before slow client is released, as it would hang on exit
+    EXPECT_EQ(fastSubscription->sent_events_.size(), kNumEvents);
+    for (uint32_t i = 0; i < fastSubscription->sent_events_.size(); i++) {
+      EXPECT_EQ(fastSubscription->sent_events_[i].data, events[i].data);
+    }
+    EXPECT_GT(queued->getStats().dropped, 0);
+
+    slowSubscription->released_.post();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    SubscriberStats stats;
+    do {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      stats = queued->getStats();
+    } while (stats.delivered + stats.dropped < kNumEvents &&
+             std::chrono::steady_clock::now() < deadline);
+    queued->stop();
+
+    EXPECT_EQ(stats.delivered + stats.dropped, kNumEvents);
+    EXPECT_EQ(stats.lag, 0);
+    EXPECT_LE(stats.maxLag, 2);
+    auto& received = slowSubscription->sent_events_;
+    ASSERT_EQ(received.size(), stats.delivered);
+    ASSERT_FALSE(received.empty());
+    for (const auto& event : received) {
+      EXPECT_EQ(event.data, events[event.pktsize - 200].data);
+    }
+    if (policy == SlowClientPolicy::SKIP) {
+      // the newest event is never dropped
+      EXPECT_EQ(received.back().pktsize, 200 + kNumEvents - 1);
+    } else {
+      // the oldest event is never dropped
+      EXPECT_EQ(received.front().pktsize, 200);
+    }
+  }
+
   folly::EventBase evb_;
   int pipeFds_[2];
   folly::AsyncPipeReader::UniquePtr reader_{nullptr};
@@ -195,3 +272,11 @@ TEST_F(EventPipeCallbackTest, LargeWriteTest) {
     EXPECT_EQ(expect_event.data, sent_event.data);
   }
 }
+
+TEST_F(EventPipeCallbackTest, SlowClientDrop) {
+  checkSlowClient(SlowClientPolicy::DROP);
+}
+
+TEST_F(EventPipeCallbackTest, SlowClientSkip) {
+  checkSlowClient(SlowClientPolicy::SKIP);
+}
@@ -0,0 +1,334 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "katran/lib/BalancerStructs.h"
+#include "katran/lib/KatranEventReader.h"
+#include "katran/lib/PcapEventQueues.h"
+#include "katran/lib/RingBufferEventReader.h"
+
+extern "C" {
+#include <bpf/bpf.h>
+}
+
+namespace katran {
+
+namespace {
+// size of records which are written into ring buffer by the test program
+constexpr uint32_t kRecordSize = 64;
+constexpr uint32_t kRingSize = 64 * 1024;
+constexpr uint32_t kSource = 0;
+
+std::vector<char> makeRecord(
+    uint32_t event,
+    uint32_t pktSize,
+    uint32_t dataLen,
+    const std::string& data,
+    bool withKtime = false,
+    uint64_t ktimeNs = 0) {
+  std::vector<char> record(kRecordSize, 0);
+  struct event_metadata md = {};
+  md.event = event | (withKtime ? kEventFlagKtime : 0);
+  md.pkt_size = pktSize;
+  md.data_len = dataLen;
+  size_t offset = sizeof(md);
+  std::memcpy(record.data(), &md, sizeof(md));
+  if (withKtime) {
+    std::memcpy(record.data() + offset, &ktimeNs, sizeof(ktimeNs));
+    offset += sizeof(ktimeNs);
+  }
+  std::memcpy(record.data() + offset, data.data(), data.size());
+  return record;
+}
+
+std::vector<PcapEvent> drainEvents(PcapEventQueues& queues) {
+  std::vector<PcapEvent> events;
+  queues.drain(
+      kRecordSize, [&](const PcapEvent& event) { events.push_back(event); });
+  return events;
+}
+
+/**
+ * xdp program which copies first kRecordSize bytes of the packet into ring
+ * buffer w/ bpf_ringbuf_output. helpers can't read packet directly, so data
+ * goes through the stack
+ */
+int loadRingBufOutputProg(int mapFd) {
+  auto insn = [](uint8_t code,
+                 uint8_t dst,
+                 uint8_t src,
+                 int16_t off,
+                 int32_t imm) {
+    struct bpf_insn i = {};
+    i.code = code;
+    i.dst_reg = dst;
+    i.src_reg = src;
+    i.off = off;
+    i.imm = imm;
+    return i;
+  };
+  constexpr int16_t kWords = kRecordSize / sizeof(uint64_t);
+  std::vector<struct bpf_insn> prog = {
+      // r2 = data; r3 = data_end
+      insn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0),
+      insn(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0),
+      // if (data + kRecordSize > data_end) return XDP_PASS
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+      insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, kRecordSize),
+      insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 2 * kWords + 7, 0),
+  };
+  for (int16_t word = 0; word < kWords; word++) {
+    int16_t off = word * sizeof(uint64_t);
+    prog.push_back(insn(BPF_LDX | BPF_MEM | BPF_DW, 5, 2, off, 0));
+    prog.push_back(
+        insn(BPF_STX | BPF_MEM | BPF_DW, 10, 5, off - kRecordSize, 0));
+  }
+  std::vector<struct bpf_insn> output = {
+      // bpf_ringbuf_output(map, fp - kRecordSize, kRecordSize, 0)
+      insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, mapFd),
+      insn(0, 0, 0, 0, 0),
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+      insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -kRecordSize),
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, kRecordSize),
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 0),
+      insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ringbuf_output),
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  };
+  prog.insert(prog.end(), output.begin(), output.end());
+  return bpf_prog_load(
+      BPF_PROG_TYPE_XDP,
+      "ringbuf_test",
+      "GPL",
+      prog.data(),
+      prog.size(),
+      nullptr);
+}
+
+class TestRingBufferReader : public RingBufferEventReader {
+ public:
+  ~TestRingBufferReader() override {
+    stop();
+  }
+
+  void handleRingBufferEvent(const char* data, size_t size) noexcept
+      override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.emplace_back(data, size);
+  }
+
+  void handleRingBufferBatchEnd() noexcept override {
+    batches_++;
+  }
+
+  std::vector<std::string> records() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_;
+  }
+
+  std::atomic<uint32_t> batches_{0};
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::string> records_;
+};
+} // namespace
+
+class RingBufferEventReaderTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    mapFd_ = bpf_map_create(
+        BPF_MAP_TYPE_RINGBUF, "test_ringbuf", 0, 0, kRingSize, nullptr);
+    if (mapFd_ < 0) {
+      GTEST_SKIP() << "ring buffer is not supported: " << mapFd_;
+    }
+    progFd_ = loadRingBufOutputProg(mapFd_);
+    if (progFd_ < 0) {
+      GTEST_SKIP() << "can't load test program: " << progFd_;
+    }
+  }
+
+  void TearDown() override {
+    if (progFd_ >= 0) {
+      ::close(progFd_);
+    }
+    if (mapFd_ >= 0) {
+      ::close(mapFd_);
+    }
+  }
+
+  void produce(const std::vector<char>& record) {
+    LIBBPF_OPTS(
+        bpf_test_run_opts,
+        opts,
+        .data_in = record.data(),
+        .data_size_in = static_cast<uint32_t>(record.size()),
+        .repeat = 1);
+    ASSERT_EQ(bpf_prog_test_run_opts(progFd_, &opts), 0);
+  }
+
+  template <typename F>
+  bool waitFor(F&& condition) {
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+ protected:
+  int mapFd_{-1};
+  int progFd_{-1};
+};
+
+TEST_F(RingBufferEventReaderTest, testOpenValidation) {
+  TestRingBufferReader reader;
+  // poll timeout bounds delivery latency and must be set
+  EXPECT_FALSE(reader.open(mapFd_, 0));
+  EXPECT_TRUE(reader.open(mapFd_, 10));
+  EXPECT_FALSE(reader.open(mapFd_, 10));
+}
+
+TEST_F(RingBufferEventReaderTest, testConsumesRecords) {
+  TestRingBufferReader reader;
+  ASSERT_TRUE(reader.open(mapFd_, 10));
+  constexpr int kRecords = 10;
+  for (int i = 0; i < kRecords; i++) {
+    produce(makeRecord(i, 100, 20, "record " + std::to_string(i)));
+  }
+  // records are committed w/o wakeups and are picked up on poll's timeout
+  ASSERT_TRUE(waitFor([&]() { return reader.getConsumed() == kRecords; }));
+  auto records = reader.records();
+  ASSERT_EQ(records.size(), kRecords);
+  for (int i = 0; i < kRecords; i++) {
+    ASSERT_EQ(records[i].size(), kRecordSize);
+    struct event_metadata md;
+    std::memcpy(&md, records[i].data(), sizeof(md));
+    // ring buffer preserves order of the records
+    EXPECT_EQ(md.event, i);
+  }
+  EXPECT_GE(reader.batches_.load(), 1);
+}
+
+TEST_F(RingBufferEventReaderTest, testStopIsIdempotent) {
+  TestRingBufferReader reader;
+  ASSERT_TRUE(reader.open(mapFd_, 10));
+  reader.stop();
+  reader.stop();
+  // records which are committed after stop are not consumed
+  produce(makeRecord(1, 100, 20, "late"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(reader.getConsumed(), 0);
+}
+
+TEST_F(RingBufferEventReaderTest, testDestroyWhileConsuming) {
+  // consumer thread must be stopped before derived part of the reader is
+  // destroyed, while records keep coming
+  for (int run = 0; run < 10; run++) {
+    auto reader = std::make_unique<TestRingBufferReader>();
+    ASSERT_TRUE(reader->open(mapFd_, 1));
+    for (int i = 0; i < 10; i++) {
+      produce(makeRecord(i, 100, 20, "record"));
+    }
+    reader.reset();
+  }
+}
+
+TEST_F(RingBufferEventReaderTest, testKatranReaderEnqueuesEvents) {
+  auto queues = std::make_shared<PcapEventQueues>(1, 16);
+  auto reader = std::make_unique<KatranRingBufferEventReader>(queues, kSource);
+  ASSERT_TRUE(reader->open(mapFd_, 10));
+  produce(makeRecord(1, 100, 20, "kiwi fruit not the bird", true, 12345));
+  ASSERT_TRUE(waitFor([&]() { return reader->getConsumed() == 1; }));
+  reader.reset();
+  auto events = drainEvents(*queues);
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].event, 1);
+  EXPECT_EQ(events[0].origLen, 100);
+  EXPECT_EQ(events[0].capturedLen, 20);
+  EXPECT_EQ(events[0].ktimeNs, 12345);
+  EXPECT_EQ(std::memcmp(events[0].data, "kiwi fruit not the b", 20), 0);
+}
+
+class KatranEventReaderTest : public ::testing::Test {
+ public:
+  KatranEventReaderTest()
+      : queues_(std::make_shared<PcapEventQueues>(1, 16)),
+        reader_(queues_, kSource) {}
+
+ protected:
+  std::shared_ptr<PcapEventQueues> queues_;
+  KatranEventReader reader_;
+};
+
+TEST_F(KatranEventReaderTest, testEventWithoutKtime) {
+  auto record = makeRecord(2, 1500, 10, "0123456789");
+  reader_.handlePerfBufferEvent(0, record.data(), record.size());
+  auto events = drainEvents(*queues_);
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].event, 2);
+  EXPECT_EQ(events[0].origLen, 1500);
+  EXPECT_EQ(events[0].capturedLen, 10);
+  EXPECT_EQ(events[0].ktimeNs, 0);
+  EXPECT_EQ(std::memcmp(events[0].data, "0123456789", 10), 0);
+}
+
+TEST_F(KatranEventReaderTest, testEventWithKtime) {
+  auto record = makeRecord(2, 1500, 10, "0123456789", true, 42);
+  reader_.handlePerfBufferEvent(0, record.data(), record.size());
+  auto events = drainEvents(*queues_);
+  ASSERT_EQ(events.size(), 1);
+  // flag is not a part of event id
+  EXPECT_EQ(events[0].event, 2);
+  EXPECT_EQ(events[0].ktimeNs, 42);
+  EXPECT_EQ(events[0].capturedLen, 10);
+  EXPECT_EQ(std::memcmp(events[0].data, "0123456789", 10), 0);
+}
+
+TEST_F(KatranEventReaderTest, testDataIsBoundedByRecordSize) {
+  auto record = makeRecord(0, 1500, 100, "0123456789");
+  auto size = sizeof(struct event_metadata) + 10;
+  reader_.handlePerfBufferEvent(0, record.data(), size);
+  auto events = drainEvents(*queues_);
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].capturedLen, 10);
+}
+
+TEST_F(KatranEventReaderTest, testTruncatedRecordsAreSkipped) {
+  auto record = makeRecord(0, 1500, 10, "0123456789", true, 42);
+  // too short for metadata
+  reader_.handlePerfBufferEvent(0, record.data(), 4);
+  // flagged, but too short for timestamp
+  reader_.handlePerfBufferEvent(
+      0, record.data(), sizeof(struct event_metadata) + 4);
+  EXPECT_TRUE(drainEvents(*queues_).empty());
+}
+
+} // namespace katran
@@ -0,0 +1,98 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fmt/core.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "katran/lib/KatranLbAsync.h"
+
+namespace katran {
+
+class KatranLbAsyncTest : public ::testing::Test {
+ protected:
+  KatranLbAsyncTest() {
+    KatranConfig config;
+    config.mainInterface = "eth0";
+    config.enableHc = false;
+    config.testing = true;
+    config.memlockUnlimited = false;
+    config.chRingSize = 1031;
+    config.LruSize = 1;
+    lb = std::make_unique<KatranLb>(
+        config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+    asyncLb = std::make_unique<KatranLbAsync>(*lb);
+    vip.address = "fc01::1";
+    vip.port = 443;
+    vip.proto = 6;
+  }
+
+  std::unique_ptr<KatranLb> lb;
+  std::unique_ptr<KatranLbAsync> asyncLb;
+  VipKey vip;
+};
+
+TEST_F(KatranLbAsyncTest, testPerVipOrdering) {
+  auto added = asyncLb->addVip(vip);
+  std::vector<folly::SemiFuture<bool>> updates;
+  // flapping reals: every real ends up deleted except the last one
+  for (int i = 0; i < 100; i++) {
+    NewReal real;
+    real.address = fmt::format("10.0.0.{}", i % 10 + 1);
+    real.weight = i + 1;
+    updates.push_back(asyncLb->addRealForVip(real, vip));
+    if (i < 99) {
+      updates.push_back(asyncLb->delRealForVip(real, vip));
+    }
+  }
+  ASSERT_TRUE(std::move(added).get());
+  for (auto& update : updates) {
+    ASSERT_TRUE(std::move(update).get());
+  }
+  auto reals = asyncLb->run([this](KatranLb& klb) {
+                      return klb.getRealsForVip(vip);
+                    }).get();
+  ASSERT_EQ(reals.size(), 1);
+  ASSERT_EQ(reals[0].address, "10.0.0.10");
+  ASSERT_EQ(reals[0].weight, 100);
+  ASSERT_EQ(asyncLb->getRingUpdates(), 199);
+  ASSERT_EQ(asyncLb->getFailedRingUpdates(), 0);
+}
+
+TEST_F(KatranLbAsyncTest, testOperationsAfterDelete) {
+  NewReal real;
+  real.address = "10.0.0.1";
+  real.weight = 1;
+  auto added = asyncLb->addVip(vip);
+  auto realAdded = asyncLb->addRealForVip(real, vip);
+  auto deleted = asyncLb->delVip(vip);
+  auto realAddedAfterDelete = asyncLb->addRealForVip(real, vip);
+  asyncLb->flush().get();
+  ASSERT_TRUE(std::move(added).get());
+  ASSERT_TRUE(std::move(realAdded).get());
+  ASSERT_TRUE(std::move(deleted).get());
+  ASSERT_FALSE(std::move(realAddedAfterDelete).get());
+  ASSERT_EQ(lb->getIndexForReal(real.address), -1);
+}
+
+TEST_F(KatranLbAsyncTest, testExceptionsArePropagated) {
+  auto res = asyncLb->run(
+      [this](KatranLb& klb) { return klb.getRealsForVip(vip); });
+  ASSERT_THROW(std::move(res).get(), std::invalid_argument);
+}
+
+} // namespace katran
@@ -16,6 +16,9 @@
 
 #include <fmt/core.h>
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstdio>
+#include <sstream>
 
 #include "katran/lib/KatranLb.h"
 
@@ -59,6 +62,7 @@ class KatranLbTest : public ::testing::Test {
     lb = std::make_unique<KatranLb>(
         katranConfig,
         std::make_unique<katran::BpfAdapter>(katranConfig.memlockUnlimited));
+    config = katranConfig;
   }
 
   void SetUp() override {
@@ -98,6 +102,7 @@ class KatranLbTest : public ::testing::Test {
   };
 
   std::unique_ptr<KatranLb> lb;
+  KatranConfig config;
   VipKey v1;
   VipKey v2;
   NewReal r1;
@@ -218,6 +223,24 @@ TEST_F(KatranLbTest, getVipFlags) {
   ASSERT_EQ(lb->getVipFlags(v1), 2307);
 };
 
+TEST_F(KatranLbTest, vipKeysAreCanonical) {
+  VipKey v;
+  v.address = "fc01:0:0::1";
+  v.port = v1.port;
+  v.proto = v1.proto;
+  ASSERT_TRUE(lb->addVip(v1));
+  // the same address in a different textual form is the same vip
+  ASSERT_FALSE(lb->addVip(v));
+  ASSERT_TRUE(lb->addRealForVip(r1, v));
+  ASSERT_EQ(lb->getRealsForVip(v1).size(), 1);
+  v.address = "fc01::";
+  ASSERT_EQ(lb->getVipFlags(v1), 0);
+  ASSERT_THROW(lb->getVipFlags(v), std::invalid_argument);
+  v.address = "not an address";
+  ASSERT_FALSE(lb->addHcKey(v));
+  ASSERT_TRUE(lb->delVip(v1));
+}
+
 TEST_F(KatranLbTest, getAllVips) {
   lb->addVip(v1);
   lb->addVip(v2);
@@ -445,6 +468,253 @@ TEST_F(KatranLbTest, addFewInvalidNets) {
   ASSERT_EQ(lb->getSrcRoutingRuleSize(), 7);
 };
 
+TEST_F(KatranLbTest, bulkLoadSrcRules) {
+  std::vector<std::pair<std::string, std::string>> rules;
+  for (int i = 0; i < 6; i++) {
+    rules.emplace_back(fmt::format("10.0.{}.0/24", i), "fc00::1");
+  }
+  rules.emplace_back("fc00:1::/64", "192.168.1.1");
+  rules.emplace_back("aaa", "fc00::1");
+  rules.emplace_back("10.1.0.0/24", "bbb");
+  // same prefix specified twice: last one wins
+  rules.emplace_back("10.0.0.0/24", "192.168.1.1");
+  ASSERT_EQ(lb->addSrcRoutingRulesBulk(rules, false, 4), 2);
+  ASSERT_EQ(lb->getSrcRoutingRuleSize(), 7);
+  auto src_rules = lb->getSrcRoutingRule();
+  ASSERT_EQ(src_rules["10.0.0.0/24"], "192.168.1.1");
+  ASSERT_EQ(src_rules["10.0.1.0/24"], "fc00::1");
+  ASSERT_EQ(src_rules["fc00:1::/64"], "192.168.1.1");
+  // over the limit of 10 rules; whole batch is rejected
+  std::vector<std::pair<std::string, std::string>> extra;
+  for (int i = 0; i < 4; i++) {
+    extra.emplace_back(fmt::format("10.2.{}.0/24", i), "fc00::1");
+  }
+  ASSERT_EQ(lb->addSrcRoutingRulesBulk(extra), -1);
+  ASSERT_EQ(lb->getSrcRoutingRuleSize(), 7);
+};
+
+TEST_F(KatranLbTest, bulkReplaceSrcRules) {
+  std::vector<std::string> srcs;
+  for (int i = 0; i < 8; i++) {
+    srcs.push_back(fmt::format("10.0.{}.0/24", i));
+  }
+  ASSERT_EQ(lb->addSrcRoutingRule(srcs, "fc00::1"), 0);
+  auto reals_before = lb->getNumToRealMap().size();
+  std::stringstream input;
+  input << "# comment line\n"
+        << "10.0.0.0/24 fc00::2\n"
+        << "\n"
+        << "10.3.0.0/16 fc00::2 # trailing comment\n"
+        << "10.4.0.0/16\n";
+  // 8 old rules + 2 new ones would not fit, but replace drops old rules
+  ASSERT_EQ(lb->loadSrcRoutingRules(input, true), 1);
+  ASSERT_EQ(lb->getSrcRoutingRuleSize(), 2);
+  auto src_rules = lb->getSrcRoutingRule();
+  ASSERT_EQ(src_rules["10.0.0.0/24"], "fc00::2");
+  ASSERT_EQ(src_rules["10.3.0.0/16"], "fc00::2");
+  // fc00::1 is not referenced anymore and must be released
+  ASSERT_EQ(lb->getNumToRealMap().size(), reals_before);
+  ASSERT_EQ(lb->loadSrcRoutingRulesFromFile("/non/existing/file"), -1);
+};
+
+TEST_F(KatranLbTest, restoreState) {
+  KatranLb::ForwardingState state;
+  state.reals[1] = {folly::IPAddress("10.0.0.1"), 0};
+  state.reals[2] = {folly::IPAddress("10.0.0.2"), 0};
+  state.reals[5] = {folly::IPAddress("fc00::5"), 0};
+  // same address at two indexes
+  state.reals[7] = {folly::IPAddress("10.0.0.1"), 0};
+  KatranLb::FwStateVip vip1;
+  vip1.vip = v1;
+  vip1.vipNum = 3;
+  vip1.chRing.resize(65537);
+  for (int i = 0; i < 65537; i++) {
+    vip1.chRing[i] = i % 2 + 1;
+  }
+  // position which points to unknown real
+  vip1.chRing[10] = 9;
+  auto vip2 = vip1;
+  vip2.vip = v2;
+  state.vips = {vip1, vip2};
+  state.serverIds[100] = 5;
+  state.serverIds[101] = 42;
+  state.srcRouting[folly::IPAddress::createNetwork("10.9.0.0/16")] = 2;
+
+  auto res = lb->restoreState(state);
+  ASSERT_EQ(res.vips, 1);
+  ASSERT_EQ(res.reals, 3);
+  ASSERT_EQ(res.serverIds, 1);
+  ASSERT_EQ(res.srcRoutingRules, 1);
+  ASSERT_EQ(res.errors.size(), 4);
+
+  auto reals = lb->getRealsForVip(v1);
+  ASSERT_EQ(reals.size(), 2);
+  ASSERT_EQ(reals[0].weight + reals[1].weight, 65536);
+  ASSERT_EQ(lb->getIndexForReal("10.0.0.2"), 2);
+  ASSERT_EQ(lb->getQuicRealsMapping().size(), 1);
+  ASSERT_EQ(lb->getSrcRoutingRule()["10.9.0.0/16"], "10.0.0.2");
+  // restored indexes are not reused
+  ASSERT_TRUE(lb->addVip(v2));
+  NewReal real;
+  real.address = "10.0.0.9";
+  real.weight = 1;
+  ASSERT_TRUE(lb->addRealForVip(real, v2));
+  ASSERT_EQ(lb->getIndexForReal("10.0.0.9"), 3);
+  // restore is allowed only into empty state
+  ASSERT_EQ(lb->restoreState(state).vips, 0);
+};
+
+TEST_F(KatranLbTest, snapshotSaveAndLoad) {
+  auto path = fmt::format("/tmp/katran_snapshot_test.{}", getpid());
+  ASSERT_TRUE(lb->addVip(v1));
+  ASSERT_TRUE(lb->addVip(v2));
+  ASSERT_TRUE(lb->changeHashFunctionForVip(v2, HashFunction::MaglevV2));
+  ASSERT_TRUE(lb->addRealForVip(r1, v1));
+  ASSERT_TRUE(lb->addRealForVip(r2, v1));
+  ASSERT_TRUE(lb->addRealForVip(r2, v2));
+  lb->modifyQuicRealsMapping(ModifyAction::ADD, {QuicReal{"fc00::1", 42}});
+  std::vector<std::string> srcs = {"10.0.0.0/8"};
+  ASSERT_EQ(lb->addSrcRoutingRule(srcs, "192.168.1.1"), 0);
+  ASSERT_TRUE(lb->saveSnapshot(path));
+
+  auto restored = std::make_unique<KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+  auto res = restored->loadSnapshot(path);
+  ASSERT_EQ(res.errors.size(), 0);
+  ASSERT_EQ(res.vips, 2);
+  ASSERT_EQ(res.reals, 2);
+  ASSERT_EQ(res.serverIds, 1);
+  ASSERT_EQ(res.srcRoutingRules, 1);
+  ASSERT_EQ(
+      restored->getIndexForReal("192.168.1.1"),
+      lb->getIndexForReal("192.168.1.1"));
+  ASSERT_EQ(restored->getIndexForReal("fc00::1"), lb->getIndexForReal("fc00::1"));
+  auto reals = restored->getRealsForVip(v1);
+  ASSERT_EQ(reals.size(), 2);
+  for (const auto& real : reals) {
+    ASSERT_EQ(real.weight, real.address == r1.address ? r1.weight : r2.weight);
+  }
+  ASSERT_EQ(restored->getQuicRealsMapping().size(), 1);
+  ASSERT_EQ(restored->getSrcRoutingRule()["10.0.0.0/8"], "192.168.1.1");
+
+  // corrupted snapshot must be rejected
+  {
+    FILE* f = fopen(path.c_str(), "r+");
+    ASSERT_NE(f, nullptr);
+    fseek(f, -1, SEEK_END);
+    int c = fgetc(f);
+    fseek(f, -1, SEEK_END);
+    fputc(c ^ 0xff, f);
+    fclose(f);
+  }
+  auto corrupted = std::make_unique<KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+  res = corrupted->loadSnapshot(path);
+  ASSERT_EQ(res.vips, 0);
+  ASSERT_EQ(res.errors.size(), 1);
+  unlink(path.c_str());
+};
+
+TEST_F(KatranLbTest, periodicSnapshot) {
+  ASSERT_FALSE(lb->saveSnapshotIfDue());
+  auto snapshotConfig = config;
+  snapshotConfig.snapshotPath =
+      fmt::format("/tmp/katran_periodic_snapshot_test.{}", getpid());
+  snapshotConfig.snapshotIntervalMs = 3600 * 1000;
+  snapshotConfig.realsUpdateCoalesceWindowMs = 3600 * 1000;
+  auto slb = std::make_unique<KatranLb>(
+      snapshotConfig,
+      std::make_unique<katran::BpfAdapter>(snapshotConfig.memlockUnlimited));
+  ASSERT_TRUE(slb->addVip(v1));
+  ASSERT_TRUE(slb->addRealForVip(r1, v1));
+  ASSERT_TRUE(slb->saveSnapshotIfDue());
+  // interval has not passed yet
+  ASSERT_FALSE(slb->saveSnapshotIfDue());
+  // coalesced changes are not forced into periodic snapshot
+  ASSERT_EQ(slb->getNumPendingRealsUpdates(), 1);
+
+  auto restored = std::make_unique<KatranLb>(
+      config, std::make_unique<katran::BpfAdapter>(config.memlockUnlimited));
+  auto res = restored->loadSnapshot(snapshotConfig.snapshotPath);
+  ASSERT_EQ(res.errors.size(), 0);
+  ASSERT_EQ(res.vips, 1);
+  ASSERT_EQ(restored->getRealsForVip(v1).size(), 0);
+  unlink(snapshotConfig.snapshotPath.c_str());
+};
+
+TEST_F(KatranLbTest, statsEngine) {
+  ASSERT_EQ(lb->getStatsSnapshot(), nullptr);
+  ASSERT_TRUE(lb->addVip(v1));
+  ASSERT_TRUE(lb->startStatsEngine(std::chrono::milliseconds(10)));
+  ASSERT_FALSE(lb->startStatsEngine());
+  auto snapshot = lb->getStatsSnapshot();
+  ASSERT_NE(snapshot, nullptr);
+  ASSERT_EQ(snapshot->stats.size(), 512 * 2);
+  ASSERT_EQ(snapshot->realsStats.size(), kMaxRealTest);
+  ASSERT_EQ(lb->getStatsForVip(v1).v1, 0);
+  ASSERT_EQ(lb->getRealStats(1).v2, 0);
+  lb->stopStatsEngine();
+  ASSERT_EQ(lb->getStatsSnapshot(), nullptr);
+};
+
+TEST_F(KatranLbTest, lruScanControl) {
+  LruScanControl control;
+  auto stats = lb->analyzeLru(&control);
+  ASSERT_TRUE(stats.error.empty());
+  ASSERT_EQ(stats.perVipStats.size(), 0);
+  ASSERT_EQ(control.scannedEntries, 0);
+  // w/o batch operations sampling falls back to the full scan
+  auto estimated = lb->estimateLru(1024, &control);
+  ASSERT_FALSE(estimated.sampled);
+  ASSERT_EQ(estimated.sampledFraction, 1.0);
+  VipKey invalid;
+  invalid.address = "not-an-ip";
+  ASSERT_EQ(lb->purgeVipLru(invalid, &control).error, "invalid vip address");
+  ASSERT_EQ(
+      lb->purgeVipLruForReal(invalid, 1, &control).error,
+      "invalid vip address");
+};
+
+TEST_F(KatranLbTest, analyzeRemap) {
+  ASSERT_TRUE(lb->addVip(v1));
+  std::vector<NewReal> reals(4);
+  for (int i = 0; i < reals.size(); i++) {
+    reals[i].address = fmt::format("10.2.0.{}", i + 1);
+    reals[i].weight = 10;
+  }
+  ASSERT_TRUE(lb->modifyRealsForVip(ModifyAction::ADD, reals, v1));
+  auto numToReals = lb->getNumToRealMap();
+
+  KatranLb::RemapChange drain{ModifyAction::DEL, v1, {reals[0]}};
+  NewReal newReal{"10.2.0.5", 10, 0};
+  KatranLb::RemapChange add{ModifyAction::ADD, v1, {newReal}};
+  auto resp = lb->analyzeRemap({drain, add});
+  ASSERT_TRUE(resp.error.empty());
+  ASSERT_EQ(resp.vips.size(), 1);
+  auto& stats = resp.vips[0];
+  ASSERT_EQ(stats.vip, "fc01::1-443-6");
+  // there are no lru maps in testing mode. accounting of lru entries is
+  // covered by LruRemapCounterTest
+  ASSERT_EQ(stats.flows, 0);
+  ASSERT_EQ(stats.flowsMoved, 0);
+  auto& drained = stats.reals[reals[0].address];
+  ASSERT_NEAR(drained.ringShareBefore, 0.25, 0.05);
+  ASSERT_EQ(drained.ringShareAfter, 0);
+  ASSERT_NEAR(stats.reals[newReal.address].ringShareAfter, 0.25, 0.05);
+  ASSERT_GE(stats.ringChanged, drained.ringShareBefore);
+  ASSERT_LT(stats.ringChanged, 1.0);
+
+  // nothing is applied
+  ASSERT_EQ(lb->getRealsForVip(v1).size(), reals.size());
+  ASSERT_EQ(lb->getNumToRealMap(), numToReals);
+
+  VipKey unknown = v2;
+  auto unknownResp =
+      lb->analyzeRemap({KatranLb::RemapChange{ModifyAction::DEL, unknown}});
+  ASSERT_FALSE(unknownResp.error.empty());
+  ASSERT_EQ(unknownResp.vips.size(), 0);
+}
+
 TEST_F(KatranLbTest, addInvalidDecapDst) {
   ASSERT_FALSE(lb->addInlineDecapDst("asd"));
 }
@@ -475,4 +745,61 @@ TEST_F(KatranLbTest, addMaxDecapDst) {
   ASSERT_EQ(lb->getInlineDecapDst().size(), 4);
 }
 
+TEST_F(KatranLbTest, coalescedRealsUpdates) {
+  auto coalescingConfig = config;
+  coalescingConfig.realsUpdateCoalesceWindowMs = 3600 * 1000;
+  auto clb = std::make_unique<KatranLb>(
+      coalescingConfig,
+      std::make_unique<katran::BpfAdapter>(coalescingConfig.memlockUnlimited));
+  ASSERT_TRUE(clb->addVip(v1));
+  ASSERT_TRUE(clb->addVip(v2));
+  // flapping real: added, removed and re-added w/ different weight
+  ASSERT_TRUE(clb->addRealForVip(r1, v1));
+  ASSERT_TRUE(clb->delRealForVip(r1, v1));
+  auto r1Heavy = r1;
+  r1Heavy.weight = 20;
+  ASSERT_TRUE(clb->addRealForVip(r1Heavy, v1));
+  ASSERT_TRUE(clb->addRealForVip(r2, v1));
+  // added and then removed during the same window
+  ASSERT_TRUE(clb->addRealForVip(r2, v2));
+  ASSERT_TRUE(clb->delRealForVip(r2, v2));
+  ASSERT_EQ(clb->getNumPendingRealsUpdates(), 2);
+  ASSERT_EQ(clb->getRealsForVip(v1).size(), 0);
+  ASSERT_EQ(clb->getIndexForReal(r1.address), -1);
+
+  auto stats = clb->getKatranLbStats();
+  ASSERT_EQ(stats.realsUpdatesCoalesced, 6);
+  ASSERT_EQ(stats.realsChangesMerged, 3);
+  ASSERT_EQ(stats.coalescedRingUpdates, 0);
+
+  // window has not expired yet
+  ASSERT_EQ(clb->flushPendingRealsUpdates(), 0);
+  ASSERT_EQ(clb->flushPendingRealsUpdates(true), 2);
+  ASSERT_EQ(clb->getNumPendingRealsUpdates(), 0);
+  auto reals = clb->getRealsForVip(v1);
+  ASSERT_EQ(reals.size(), 2);
+  for (const auto& real : reals) {
+    ASSERT_EQ(
+        real.weight, real.address == r1.address ? r1Heavy.weight : r2.weight);
+  }
+  ASSERT_EQ(clb->getRealsForVip(v2).size(), 0);
+  stats = clb->getKatranLbStats();
+  ASSERT_EQ(stats.coalescedRingUpdates, 1);
+
+  // pending changes of deleted vip are dropped
+  ASSERT_TRUE(clb->delRealForVip(r2, v1));
+  ASSERT_TRUE(clb->delVip(v1));
+  ASSERT_EQ(clb->getNumPendingRealsUpdates(), 0);
+  ASSERT_EQ(clb->getIndexForReal(r2.address), -1);
+}
+
+TEST_F(KatranLbTest, upgradeBalancerProgInTestingMode) {
+  KatranFlow flow{"10.0.0.1", v1.address, 31337, v1.port, v1.proto};
+  auto res = lb->upgradeBalancerProg("./balancer.bpf.o", {flow});
+  ASSERT_FALSE(res.upgraded);
+  ASSERT_EQ(res.flowsTested, 0);
+  ASSERT_EQ(res.errors.size(), 1);
+  ASSERT_FALSE(lb->rollbackBalancerProg());
+}
+
 } // namespace katran
@@ -0,0 +1,200 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <cstring>
+#include <memory>
+
+#include <folly/IPAddress.h>
+
+#include "katran/lib/BalancerStructs.h"
+#include "katran/lib/KatranMonitor.h"
+
+extern "C" {
+#include <bpf/bpf.h>
+}
+
+namespace katran {
+
+namespace {
+// must be in sync w/ event_filters map in control_data_maps.h
+constexpr uint32_t kFiltersMapSize = 16;
+constexpr uint32_t kRingSize = 64 * 1024;
+constexpr uint32_t kBufferSize = 64 * 1024;
+constexpr uint8_t kTcp = 6;
+constexpr auto kEvent = monitoring::EventId::TCP_NONSYN_LRUMISS;
+
+VipKey makeVip(const std::string& address, uint16_t port) {
+  VipKey vip;
+  vip.address = address;
+  vip.port = port;
+  vip.proto = kTcp;
+  return vip;
+}
+} // namespace
+
+class KatranMonitorTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    ringFd_ = bpf_map_create(
+        BPF_MAP_TYPE_RINGBUF, "test_ringbuf", 0, 0, kRingSize, nullptr);
+    if (ringFd_ < 0) {
+      GTEST_SKIP() << "ring buffer is not supported: " << ringFd_;
+    }
+    filtersFd_ = bpf_map_create(
+        BPF_MAP_TYPE_ARRAY,
+        "event_filters",
+        sizeof(uint32_t),
+        sizeof(struct event_filter),
+        kFiltersMapSize,
+        nullptr);
+    ASSERT_GE(filtersFd_, 0);
+    KatranMonitorConfig config;
+    config.mapFd = ringFd_;
+    config.filtersMapFd = filtersFd_;
+    config.storage = PcapStorageFormat::IOBUF;
+    config.bufferSize = kBufferSize;
+    monitor_ = std::make_unique<KatranMonitor>(config);
+  }
+
+  void TearDown() override {
+    monitor_.reset();
+    if (filtersFd_ >= 0) {
+      ::close(filtersFd_);
+    }
+    if (ringFd_ >= 0) {
+      ::close(ringFd_);
+    }
+  }
+
+  struct event_filter readFilter(monitoring::EventId event) {
+    uint32_t key = static_cast<uint32_t>(event);
+    struct event_filter value = {};
+    EXPECT_EQ(bpf_map_lookup_elem(filtersFd_, &key, &value), 0);
+    return value;
+  }
+
+ protected:
+  int ringFd_{-1};
+  int filtersFd_{-1};
+  std::unique_ptr<KatranMonitor> monitor_;
+};
+
+TEST_F(KatranMonitorTest, testDefaultFilter) {
+  // zeroed entry reports every event
+  auto filter = monitor_->getEventFilter(kEvent);
+  ASSERT_TRUE(filter.has_value());
+  EXPECT_EQ(filter->sampleRate, 0);
+  EXPECT_FALSE(filter->vip.has_value());
+  EXPECT_FALSE(filter->src.has_value());
+}
+
+TEST_F(KatranMonitorTest, testV4Filter) {
+  EventFilterConfig filter;
+  filter.sampleRate = 10;
+  filter.vip = makeVip("10.200.1.2", 42);
+  // host bits of the prefix are not compared in forwarding plane
+  filter.src = folly::CIDRNetwork(folly::IPAddress("192.168.100.77"), 24);
+  ASSERT_TRUE(monitor_->setEventFilter(kEvent, filter));
+
+  auto value = readFilter(kEvent);
+  EXPECT_EQ(value.sample_rate, 10);
+  EXPECT_EQ(value.vip, inet_addr("10.200.1.2"));
+  EXPECT_EQ(value.vip_port, htons(42));
+  EXPECT_EQ(value.vip_proto, kTcp);
+  EXPECT_EQ(value.src, inet_addr("192.168.100.0"));
+  EXPECT_EQ(value.src_prefixlen, 24);
+
+  auto res = monitor_->getEventFilter(kEvent);
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->sampleRate, 10);
+  ASSERT_TRUE(res->vip.has_value());
+  EXPECT_EQ(*res->vip, makeVip("10.200.1.2", 42));
+  ASSERT_TRUE(res->src.has_value());
+  EXPECT_EQ(
+      *res->src, folly::IPAddress::createNetwork("192.168.100.0/24"));
+  // other events are not affected
+  auto other = monitor_->getEventFilter(monitoring::EventId::PACKET_TOOBIG);
+  ASSERT_TRUE(other.has_value());
+  EXPECT_FALSE(other->vip.has_value());
+}
+
+TEST_F(KatranMonitorTest, testV6Filter) {
+  EventFilterConfig filter;
+  filter.vip = makeVip("fc00:1::1", 0);
+  filter.src = folly::IPAddress::createNetwork("fc00:2307::/64");
+  ASSERT_TRUE(monitor_->setEventFilter(kEvent, filter));
+
+  auto res = monitor_->getEventFilter(kEvent);
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->sampleRate, 0);
+  ASSERT_TRUE(res->vip.has_value());
+  EXPECT_EQ(*res->vip, makeVip("fc00:1::1", 0));
+  ASSERT_TRUE(res->src.has_value());
+  EXPECT_EQ(*res->src, folly::IPAddress::createNetwork("fc00:2307::/64"));
+}
+
+TEST_F(KatranMonitorTest, testSampleRateKeepsFilter) {
+  EventFilterConfig filter;
+  filter.vip = makeVip("10.200.1.1", 80);
+  ASSERT_TRUE(monitor_->setEventFilter(kEvent, filter));
+  ASSERT_TRUE(monitor_->setEventSampleRate(kEvent, 100));
+
+  auto res = monitor_->getEventFilter(kEvent);
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->sampleRate, 100);
+  ASSERT_TRUE(res->vip.has_value());
+  EXPECT_EQ(*res->vip, makeVip("10.200.1.1", 80));
+  EXPECT_FALSE(res->src.has_value());
+}
+
+TEST_F(KatranMonitorTest, testInvalidFilter) {
+  EventFilterConfig filter;
+  filter.sampleRate = 5;
+  ASSERT_TRUE(monitor_->setEventFilter(kEvent, filter));
+
+  EventFilterConfig invalid;
+  invalid.vip = makeVip("not an address", 80);
+  EXPECT_FALSE(monitor_->setEventFilter(kEvent, invalid));
+  invalid.vip.reset();
+  invalid.src = folly::CIDRNetwork(folly::IPAddress("192.168.1.0"), 33);
+  EXPECT_FALSE(monitor_->setEventFilter(kEvent, invalid));
+  EXPECT_FALSE(
+      monitor_->setEventFilter(monitoring::EventId::UNKNOWN, filter));
+  EXPECT_FALSE(
+      monitor_->getEventFilter(monitoring::EventId::UNKNOWN).has_value());
+
+  // previous filter is kept
+  auto res = monitor_->getEventFilter(kEvent);
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->sampleRate, 5);
+  EXPECT_FALSE(res->src.has_value());
+}
+
+TEST_F(KatranMonitorTest, testNoFiltersMap) {
+  KatranMonitorConfig config;
+  config.mapFd = ringFd_;
+  config.storage = PcapStorageFormat::IOBUF;
+  config.bufferSize = kBufferSize;
+  KatranMonitor monitor(config);
+  EXPECT_FALSE(monitor.setEventFilter(kEvent, EventFilterConfig()));
+  EXPECT_FALSE(monitor.setEventSampleRate(kEvent, 10));
+  EXPECT_FALSE(monitor.getEventFilter(kEvent).has_value());
+}
+
+} // namespace katran
@@ -0,0 +1,183 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <array>
+#include <vector>
+
+#include <folly/Conv.h>
+
+#include "katran/lib/KatranShadowDataPlane.h"
+#include "katran/lib/tests/common/ShadowDataPlaneTestUtil.h"
+
+namespace katran {
+
+namespace {
+// vip's flags from balancer_consts.h
+constexpr uint32_t kHashNoSrcPort = 1 << 0;
+constexpr uint32_t kHashDportOnly = 1 << 3;
+constexpr uint32_t kSrcRouting = 1 << 4;
+// values of jhash from linux_includes/jhash.h for the same input
+constexpr uint32_t kJhash16Bytes = 818810219;
+constexpr uint32_t kJhash7Bytes = 4129260859;
+// jhash_2words for 10.0.0.1:31337 -> *:80 w/ INIT_JHASH_SEED
+constexpr uint32_t kV4FlowHash = 2174917263;
+
+folly::IPAddress realAddress(uint32_t num) {
+  return folly::IPAddress(folly::to<std::string>("10.1.0.", num));
+}
+} // namespace
+
+class KatranShadowDataPlaneTest : public ::testing::Test {
+ protected:
+  KatranShadowDataPlaneTest() : shadow(kRingSize, kMaxVips, true) {}
+
+  void SetUp() override {
+    ring = makeRing();
+    for (uint32_t num = 1; num <= kNumReals; num++) {
+      shadow.addReal(num, realAddress(num));
+    }
+  }
+
+  KatranShadowDataPlane shadow;
+  std::vector<int> ring;
+};
+
+TEST(KatranShadowDataPlaneHashTest, testJhashMatchesKernel) {
+  std::array<uint8_t, 16> key;
+  for (size_t i = 0; i < key.size(); i++) {
+    key[i] = i;
+  }
+  EXPECT_EQ(bpfJhash(key.data(), 16, kMaxVips), kJhash16Bytes);
+  EXPECT_EQ(bpfJhash(key.data(), 7, 1), kJhash7Bytes);
+  EXPECT_EQ(
+      bpfJhash2Words(
+          folly::IPAddressV4("10.0.0.1").toLong(),
+          0x5000697a,
+          kMaxVips * kRingSize),
+      kV4FlowHash);
+}
+
+TEST_F(KatranShadowDataPlaneTest, testRingPosition) {
+  ASSERT_TRUE(shadow.addVip(makeVip("10.200.1.1", 80, kTcp), 0, ring));
+  auto real = shadow.getRealForFlow(
+      folly::IPAddress("10.0.0.1"),
+      folly::IPAddress("10.200.1.1"),
+      31337,
+      80,
+      kTcp);
+  ASSERT_NE(real, nullptr);
+  EXPECT_EQ(*real, realAddress(ring[kV4FlowHash % kRingSize]));
+}
+
+TEST_F(KatranShadowDataPlaneTest, testNoMatch) {
+  ASSERT_TRUE(shadow.addVip(makeVip("10.200.1.1", 80, kTcp), 0, ring));
+  // wrong port, proto, address and family mismatch
+  EXPECT_EQ(shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, 81, kTcp}), "");
+  EXPECT_EQ(shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, 80, kUdp}), "");
+  EXPECT_EQ(shadow.getRealForFlow({"10.0.0.1", "10.200.1.2", 1, 80, kTcp}), "");
+  EXPECT_EQ(shadow.getRealForFlow({"fc00::1", "10.200.1.1", 1, 80, kTcp}), "");
+  EXPECT_EQ(shadow.getRealForFlow({"aaaa", "bbbb", 1, 80, kTcp}), "");
+  EXPECT_NE(shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, 80, kTcp}), "");
+}
+
+TEST_F(KatranShadowDataPlaneTest, testUnsetRingPosition) {
+  std::vector<int> emptyRing(kRingSize, -1);
+  ASSERT_TRUE(shadow.addVip(makeVip("fc00:1::1", 80, kTcp), 0, emptyRing));
+  EXPECT_EQ(
+      shadow.getRealForFlow({"fc00:2::1", "fc00:1::1", 31337, 80, kTcp}), "");
+  // ring must be of RING_SIZE
+  EXPECT_FALSE(shadow.addVip(
+      makeVip("fc00:1::2", 80, kTcp), 0, std::vector<int>(kRingSize - 1)));
+}
+
+TEST_F(KatranShadowDataPlaneTest, testPortZeroVip) {
+  ASSERT_TRUE(shadow.addVip(makeVip("10.200.1.1", 0, kUdp), 0, ring));
+  // port 0 vip ignores dst port
+  auto real = shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, 53, kUdp});
+  ASSERT_NE(real, "");
+  for (uint16_t port = 1; port < 1000; port++) {
+    EXPECT_EQ(
+        shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, port, kUdp}),
+        real);
+  }
+}
+
+TEST_F(KatranShadowDataPlaneTest, testHashFlags) {
+  ASSERT_TRUE(
+      shadow.addVip(makeVip("10.200.1.1", 80, kTcp), kHashNoSrcPort, ring));
+  ASSERT_TRUE(
+      shadow.addVip(makeVip("10.200.1.2", 80, kTcp), kHashDportOnly, ring));
+  auto noSrcPortReal =
+      shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", 1, 80, kTcp});
+  auto dportOnlyReal =
+      shadow.getRealForFlow({"10.0.0.1", "10.200.1.2", 1, 80, kTcp});
+  for (uint32_t i = 1; i < 1000; i++) {
+    auto src = folly::IPAddressV4::fromLongHBO(0x0a000000 + i).str();
+    auto srcPort = static_cast<uint16_t>(i * 7);
+    EXPECT_EQ(
+        shadow.getRealForFlow({"10.0.0.1", "10.200.1.1", srcPort, 80, kTcp}),
+        noSrcPortReal);
+    EXPECT_EQ(
+        shadow.getRealForFlow({src, "10.200.1.2", srcPort, 80, kTcp}),
+        dportOnlyReal);
+  }
+}
+
+TEST_F(KatranShadowDataPlaneTest, testSrcRouting) {
+  ASSERT_TRUE(
+      shadow.addVip(makeVip("10.200.1.1", 80, kTcp), kSrcRouting, ring));
+  ASSERT_TRUE(
+      shadow.addVip(makeVip("fc00:1::1", 80, kTcp), kSrcRouting, ring));
+  shadow.addSrcRoutingRule(
+      folly::IPAddress::createNetwork("192.168.0.0/16"), 1);
+  shadow.addSrcRoutingRule(
+      folly::IPAddress::createNetwork("192.168.1.0/24"), 2);
+  shadow.addSrcRoutingRule(folly::IPAddress::createNetwork("fc00:2::/32"), 3);
+  shadow.addSrcRoutingRule(
+      folly::IPAddress::createNetwork("fc00:2:0:0:1::/80"), 1);
+  // longest prefix wins
+  EXPECT_EQ(
+      shadow.getRealForFlow({"192.168.2.1", "10.200.1.1", 1, 80, kTcp}),
+      realAddress(1).str());
+  EXPECT_EQ(
+      shadow.getRealForFlow({"192.168.1.1", "10.200.1.1", 1, 80, kTcp}),
+      realAddress(2).str());
+  EXPECT_EQ(
+      shadow.getRealForFlow({"fc00:2::1", "fc00:1::1", 1, 80, kTcp}),
+      realAddress(3).str());
+  EXPECT_EQ(
+      shadow.getRealForFlow({"fc00:2::1:0:0:1", "fc00:1::1", 1, 80, kTcp}),
+      realAddress(1).str());
+
+  // w/o LPM_SRC_LOOKUP flows are routed w/ consistent hashing
+  KatranShadowDataPlane noSrcRouting(kRingSize, kMaxVips, false);
+  noSrcRouting.addReal(1, realAddress(1));
+  noSrcRouting.addReal(2, realAddress(2));
+  noSrcRouting.addReal(3, realAddress(3));
+  ASSERT_TRUE(
+      noSrcRouting.addVip(makeVip("10.0.0.1", 80, kTcp), kSrcRouting, ring));
+  auto real = noSrcRouting.getRealForFlow(
+      folly::IPAddress("10.0.0.1"),
+      folly::IPAddress("10.0.0.1"),
+      31337,
+      80,
+      kTcp);
+  ASSERT_NE(real, nullptr);
+  EXPECT_EQ(*real, realAddress(ring[kV4FlowHash % kRingSize]));
+}
+
+} // namespace katran
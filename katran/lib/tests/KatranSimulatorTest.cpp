@@ -0,0 +1,230 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "katran/lib/KatranSimulator.h"
+
+extern "C" {
+#include <bpf/bpf.h>
+}
+
+namespace katran {
+
+namespace {
+constexpr int kNumFlows = 256;
+// offset of ipv4 header's daddr in the packet
+constexpr int16_t kDaddrOffset = 14 + 16;
+
+struct bpf_insn
+insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+  struct bpf_insn i = {};
+  i.code = code;
+  i.dst_reg = dst;
+  i.src_reg = src;
+  i.off = off;
+  i.imm = imm;
+  return i;
+}
+
+int loadXdpProg(const std::vector<struct bpf_insn>& prog) {
+  return bpf_prog_load(
+      BPF_PROG_TYPE_XDP,
+      "simulator_test",
+      "GPL",
+      prog.data(),
+      prog.size(),
+      nullptr);
+}
+
+/**
+ * xdp program which returns packet as is w/ specified verdict
+ */
+int loadVerdictProg(int32_t verdict) {
+  return loadXdpProg({
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, verdict),
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  });
+}
+
+/**
+ * xdp program which replaces ipv4 daddr of the packet w/ id of the cpu it
+ * runs on and sends it back, so simulator reports the cpu as the real
+ */
+int loadCpuProg() {
+  return loadXdpProg({
+      // r2 = data; r3 = data_end
+      insn(BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0),
+      insn(BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0),
+      // if (data + kDaddrOffset + 4 > data_end) return XDP_DROP
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+      insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, kDaddrOffset + 4),
+      insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 5, 0),
+      // daddr = bpf_get_smp_processor_id(); return XDP_TX
+      insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 2, 0, 0),
+      insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_smp_processor_id),
+      insn(BPF_STX | BPF_MEM | BPF_W, 6, 0, kDaddrOffset, 0),
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_TX),
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+      insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_DROP),
+      insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  });
+}
+
+/**
+ * @return cpu reported by loadCpuProg's program. cpu id is written in host
+ * byte order, so on little endian host it is the first octet of the address
+ */
+int reportedCpu(const std::string& real) {
+  if (real.empty()) {
+    return -1;
+  }
+  return std::stoi(real.substr(0, real.find('.')));
+}
+
+std::vector<uint32_t> allowedCpus() {
+  std::vector<uint32_t> cpus;
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuSet) == 0) {
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &cpuSet)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+std::vector<KatranFlow> makeFlows() {
+  std::vector<KatranFlow> flows;
+  for (int i = 0; i < kNumFlows; i++) {
+    KatranFlow flow;
+    flow.src = "192.168.1." + std::to_string(i);
+    flow.dst = "10.0." + std::to_string(i / 100) + "." +
+        std::to_string(i % 100);
+    flow.srcPort = 31337 + i;
+    flow.dstPort = 80;
+    flow.proto = IPPROTO_TCP;
+    flows.push_back(flow);
+  }
+  // ipv6 flows are interleaved w/ ipv4 ones
+  for (int i = 0; i < kNumFlows; i += 4) {
+    flows[i].src = "fc00:2::" + std::to_string(i + 1);
+    flows[i].dst = "fc00:1::" + std::to_string(i + 1);
+  }
+  return flows;
+}
+} // namespace
+
+class KatranSimulatorTest : public ::testing::Test {
+ public:
+  void TearDown() override {
+    if (progFd_ >= 0) {
+      ::close(progFd_);
+    }
+  }
+
+  void load(int progFd) {
+    progFd_ = progFd;
+    if (progFd_ < 0) {
+      GTEST_SKIP() << "can't load xdp program: " << progFd_;
+    }
+  }
+
+ protected:
+  int progFd_{-1};
+};
+
+TEST_F(KatranSimulatorTest, testRealsForFlowsKeepOrder) {
+  load(loadVerdictProg(XDP_TX));
+  if (IsSkipped()) {
+    return;
+  }
+  KatranSimulator simulator(progFd_, 4);
+  EXPECT_TRUE(simulator.getRealsForFlows({}).empty());
+  // program sends packet back as is, so flow's dst is reported as the real
+  auto flows = makeFlows();
+  auto reals = simulator.getRealsForFlows(flows);
+  ASSERT_EQ(reals.size(), flows.size());
+  for (size_t i = 0; i < flows.size(); i++) {
+    EXPECT_EQ(reals[i], flows[i].dst) << i;
+    EXPECT_EQ(reals[i], simulator.getRealForFlow(flows[i])) << i;
+  }
+}
+
+TEST_F(KatranSimulatorTest, testDroppedFlows) {
+  load(loadVerdictProg(XDP_DROP));
+  if (IsSkipped()) {
+    return;
+  }
+  KatranSimulator simulator(progFd_);
+  auto flows = makeFlows();
+  // invalid flow doesn't affect the others
+  flows[1].src = "not an address";
+  auto reals = simulator.getRealsForFlows(flows);
+  ASSERT_EQ(reals.size(), flows.size());
+  for (const auto& real : reals) {
+    EXPECT_TRUE(real.empty());
+  }
+}
+
+TEST_F(KatranSimulatorTest, testCpuPlacement) {
+  load(loadCpuProg());
+  if (IsSkipped()) {
+    return;
+  }
+  auto cpus = allowedCpus();
+  ASSERT_FALSE(cpus.empty());
+  std::set<int> allowed(cpus.begin(), cpus.end());
+  KatranSimulator simulator(progFd_);
+
+  std::vector<KatranFlow> flows;
+  for (const auto& flow : makeFlows()) {
+    if (flow.dst.find(':') == std::string::npos) {
+      flows.push_back(flow);
+    }
+  }
+  // single flow simulations run on the first allowed cpu
+  EXPECT_EQ(
+      reportedCpu(simulator.getRealForFlow(flows[0])),
+      static_cast<int>(cpus[0]));
+
+  // batched flows run only on allowed cpus, and the same flow always runs on
+  // the same one, so it hits the same per-CPU LRU
+  auto reals = simulator.getRealsForFlows(flows);
+  auto again = simulator.getRealsForFlows(flows);
+  ASSERT_EQ(reals.size(), flows.size());
+  std::set<int> used;
+  for (size_t i = 0; i < flows.size(); i++) {
+    auto cpu = reportedCpu(reals[i]);
+    EXPECT_TRUE(allowed.count(cpu)) << cpu;
+    EXPECT_EQ(cpu, reportedCpu(again[i]));
+    used.insert(cpu);
+  }
+  // w/ one thread per allowed cpu flows are spread between them
+  if (cpus.size() > 1) {
+    EXPECT_GT(used.size(), 1u);
+  }
+}
+
+} // namespace katran
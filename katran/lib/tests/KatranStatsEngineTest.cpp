@@ -0,0 +1,161 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <cstring>
+
+#include "katran/lib/KatranStatsEngine.h"
+
+namespace katran {
+
+namespace {
+constexpr uint32_t kNumCpus = 4;
+constexpr int kStatsFd = 1;
+constexpr int kRealsStatsFd = 2;
+constexpr int kLruMissStatsFd = 3;
+constexpr int kQuicStatsFd = 4;
+constexpr uint64_t kSecNs = 1000000000;
+} // namespace
+
+class KatranStatsEngineTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    config.statsFd = kStatsFd;
+    config.statsSize = 8;
+    config.realsStatsFd = kRealsStatsFd;
+    config.realsStatsSize = 16;
+    config.lruMissStatsFd = kLruMissStatsFd;
+    config.lruMissStatsSize = 16;
+    config.quicStatsFd = kQuicStatsFd;
+    config.numCpus = kNumCpus;
+  }
+
+  // every cpu reports (key + 1) * multiplier packets and 100 times more bytes
+  KatranStatsEngine::PerCpuReader makeReader() {
+    return [this](
+               int fd,
+               uint32_t first,
+               uint32_t count,
+               size_t valueSize,
+               void* values) {
+      reads++;
+      if (fd == failingFd) {
+        return -1;
+      }
+      auto out = static_cast<uint64_t*>(values);
+      size_t words = valueSize / sizeof(uint64_t);
+      std::memset(out, 0, count * kNumCpus * valueSize);
+      for (uint32_t key = 0; key < count; key++) {
+        for (uint32_t cpu = 0; cpu < kNumCpus; cpu++) {
+          auto value = out + (key * kNumCpus + cpu) * words;
+          value[0] = (first + key + 1) * multiplier;
+          if (words > 1) {
+            value[1] = (first + key + 1) * multiplier * 100;
+          }
+          if (fd == kQuicStatsFd) {
+            reinterpret_cast<lb_quic_packets_stats*>(value)
+                ->cid_invalid_server_id_sample = cpu == 1 ? 42 : 0;
+          }
+        }
+      }
+      return 0;
+    };
+  }
+
+  KatranStatsEngineConfig config;
+  uint64_t multiplier{1};
+  int failingFd{-1};
+  std::atomic<uint32_t> reads{0};
+};
+
+TEST_F(KatranStatsEngineTest, testAggregatesAcrossCpus) {
+  KatranStatsEngine engine(config, makeReader());
+  ASSERT_EQ(engine.getSnapshot(), nullptr);
+  ASSERT_TRUE(engine.poll(kSecNs));
+  auto snapshot = engine.getSnapshot();
+  ASSERT_NE(snapshot, nullptr);
+  ASSERT_EQ(snapshot->stats.size(), 8);
+  ASSERT_EQ(snapshot->realsStats.size(), 16);
+  // decap_vip_stats is not configured
+  ASSERT_EQ(snapshot->decapVipStats.size(), 0);
+  ASSERT_EQ(snapshot->stats[3].v1, 4 * kNumCpus);
+  ASSERT_EQ(snapshot->stats[3].v2, 400 * kNumCpus);
+  ASSERT_EQ(snapshot->realsStats[15].v1, 16 * kNumCpus);
+  ASSERT_EQ(snapshot->lruMissStats[0], kNumCpus);
+  ASSERT_EQ(snapshot->quicStats.ch_routed, kNumCpus);
+  ASSERT_EQ(snapshot->quicStats.cid_invalid_server_id_sample, 42);
+  // tpr_stats_map is not configured
+  ASSERT_EQ(snapshot->tprStats.ch_routed, 0);
+  // first snapshot has no rates
+  ASSERT_EQ(snapshot->intervalNs, 0);
+  ASSERT_EQ(snapshot->statsRates[3].v1, 0);
+
+  ASSERT_EQ(snapshot->lookup("stats", 3)->v1, 4 * kNumCpus);
+  ASSERT_EQ(snapshot->lookup("reals_stats", 1)->v2, 200 * kNumCpus);
+  ASSERT_FALSE(snapshot->lookup("stats", 8).has_value());
+  ASSERT_FALSE(snapshot->lookup("decap_vip_stats", 0).has_value());
+  ASSERT_FALSE(snapshot->lookup("unknown", 0).has_value());
+}
+
+TEST_F(KatranStatsEngineTest, testCalculatesRates) {
+  KatranStatsEngine engine(config, makeReader());
+  ASSERT_TRUE(engine.poll(kSecNs));
+  auto first = engine.getSnapshot();
+  multiplier = 3;
+  ASSERT_TRUE(engine.poll(3 * kSecNs));
+  auto second = engine.getSnapshot();
+  // previously published snapshot is immutable
+  ASSERT_EQ(first->stats[0].v1, kNumCpus);
+  ASSERT_EQ(second->intervalNs, 2 * kSecNs);
+  // (3 - 1) * kNumCpus packets over 2 seconds
+  ASSERT_EQ(second->statsRates[0].v1, kNumCpus);
+  ASSERT_EQ(second->statsRates[0].v2, 100 * kNumCpus);
+  ASSERT_EQ(second->realsRates[1].v1, 2 * kNumCpus);
+  // counters which went backward do not produce rates
+  multiplier = 1;
+  ASSERT_TRUE(engine.poll(4 * kSecNs));
+  ASSERT_EQ(engine.getSnapshot()->statsRates[0].v1, 0);
+}
+
+TEST_F(KatranStatsEngineTest, testKeepsPreviousValuesOnFailure) {
+  KatranStatsEngine engine(config, makeReader());
+  ASSERT_TRUE(engine.poll(kSecNs));
+  multiplier = 2;
+  failingFd = kRealsStatsFd;
+  ASSERT_FALSE(engine.poll(2 * kSecNs));
+  auto snapshot = engine.getSnapshot();
+  ASSERT_EQ(engine.getFailedReads(), 1);
+  ASSERT_EQ(snapshot->stats[0].v1, 2 * kNumCpus);
+  ASSERT_EQ(snapshot->realsStats[0].v1, kNumCpus);
+  ASSERT_EQ(snapshot->realsRates[0].v1, 0);
+}
+
+TEST_F(KatranStatsEngineTest, testStartAndStop) {
+  config.interval = std::chrono::milliseconds(1);
+  KatranStatsEngine engine(config, makeReader());
+  engine.start();
+  // first poll is synchronous
+  ASSERT_NE(engine.getSnapshot(), nullptr);
+  while (reads < 20) {
+    std::this_thread::yield();
+  }
+  engine.stop();
+  uint32_t readsAfterStop = reads;
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_EQ(reads, readsAfterStop);
+}
+
+} // namespace katran
@@ -0,0 +1,203 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <folly/Conv.h>
+#include <folly/IPAddress.h>
+
+#include "katran/lib/LruRemapCounter.h"
+#include "katran/lib/tests/common/ShadowDataPlaneTestUtil.h"
+
+namespace katran {
+
+namespace {
+// real which replaces real #1 in the new ring
+constexpr int kNewReal = 4;
+
+/**
+ * lru key in the same (network) byte order as in forwarding plane's lru
+ */
+flow_key makeKey(
+    const std::string& src,
+    uint16_t srcPort,
+    const std::string& dst,
+    uint16_t dstPort,
+    uint8_t proto) {
+  flow_key key = {};
+  folly::IPAddress srcAddr(src);
+  folly::IPAddress dstAddr(dst);
+  if (srcAddr.isV4()) {
+    key.src = srcAddr.asV4().toLong();
+    key.dst = dstAddr.asV4().toLong();
+  } else {
+    std::memcpy(key.srcv6, srcAddr.asV6().toBinary().data(), 16);
+    std::memcpy(key.dstv6, dstAddr.asV6().toBinary().data(), 16);
+  }
+  key.port16[0] = htons(srcPort);
+  key.port16[1] = htons(dstPort);
+  key.proto = proto;
+  return key;
+}
+} // namespace
+
+class LruRemapCounterTest : public ::testing::Test {
+ protected:
+  LruRemapCounterTest() : shadow(kRingSize, kMaxVips, false) {}
+
+  void SetUp() override {
+    // real at position i is (i % kNumReals) + 1. in the new ring real #1 is
+    // replaced w/ kNewReal
+    ring = makeRing();
+    std::vector<int> newRing(kRingSize);
+    for (uint32_t i = 0; i < kRingSize; i++) {
+      newRing[i] = ring[i] == 1 ? kNewReal : ring[i];
+    }
+    for (const auto& vip : {v4Vip, v6Vip, zeroTailV6Vip, portZeroVip}) {
+      ASSERT_TRUE(shadow.addVip(vip, 0, ring));
+      newRings[vip] = newRing;
+    }
+  }
+
+  /**
+   * @return real which flow is using now, according to the current ring
+   */
+  int currentReal(const flow_key& key, const std::string& src) {
+    KatranShadowDataPlane::FlowMatch match;
+    bool isV6 = src.find(':') != std::string::npos;
+    folly::IPAddress dst = isV6
+        ? folly::IPAddress(folly::IPAddressV6::fromBinary(folly::ByteRange(
+              reinterpret_cast<const uint8_t*>(key.dstv6), 16)))
+        : folly::IPAddress(folly::IPAddressV4::fromLong(key.dst));
+    EXPECT_TRUE(shadow.matchFlow(
+        folly::IPAddress(src),
+        dst,
+        ntohs(key.port16[0]),
+        ntohs(key.port16[1]),
+        key.proto,
+        match));
+    return ring[match.ringPos];
+  }
+
+  const CompactVipKey v4Vip = makeVip("10.200.1.1", 80, kTcp);
+  const CompactVipKey v6Vip = makeVip("fc00:1::1", 80, kTcp);
+  // lru key of its flows looks like key of v4 flow
+  const CompactVipKey zeroTailV6Vip = makeVip("2a03:2880::", 80, kTcp);
+  const CompactVipKey portZeroVip = makeVip("10.200.1.2", 0, kUdp);
+  // vip which is not affected by the change, but would match portZeroVip
+  const CompactVipKey unaffectedVip = makeVip("10.200.1.2", 53, kUdp);
+
+  KatranShadowDataPlane shadow;
+  LruRemapCounter::ChRings newRings;
+  std::vector<int> ring;
+};
+
+TEST_F(LruRemapCounterTest, testMovedFlows) {
+  constexpr int kNumFlows = 300;
+  LruRemapCounter counter(shadow, newRings, {}, 2);
+  std::vector<flow_key> keys;
+  std::vector<real_pos_lru> values;
+  uint64_t expectedMoved = 0;
+  for (int i = 0; i < kNumFlows; i++) {
+    auto src = folly::to<std::string>("10.0.", i / 256, ".", i % 256);
+    keys.push_back(makeKey(src, 31337 + i, "10.200.1.1", 80, kTcp));
+    int real = currentReal(keys.back(), src);
+    values.push_back(real_pos_lru{static_cast<uint32_t>(real), 0});
+    if (real == 1) {
+      expectedMoved++;
+    }
+  }
+  // flow which is pinned by lru to real #2, while new ring points to new
+  // real, is moved as well
+  auto src = std::string("10.1.0.1");
+  for (int port = 1; keys.size() == static_cast<size_t>(kNumFlows); port++) {
+    auto key = makeKey(src, port, "10.200.1.1", 80, kTcp);
+    if (currentReal(key, src) == 1) {
+      keys.push_back(key);
+      values.push_back(real_pos_lru{2, 0});
+    }
+  }
+  expectedMoved++;
+
+  // entries could be accounted in several chunks
+  counter.accountEntries(0, keys.data(), values.data(), kNumFlows / 2);
+  counter.accountEntries(
+      0,
+      keys.data() + kNumFlows / 2,
+      values.data() + kNumFlows / 2,
+      keys.size() - kNumFlows / 2);
+  const auto* counters = counter.getCounters(0, v4Vip);
+  ASSERT_NE(counters, nullptr);
+  EXPECT_EQ(counters->flows, keys.size());
+  EXPECT_GT(expectedMoved, 1);
+  EXPECT_LT(expectedMoved, keys.size());
+  EXPECT_EQ(counters->moved, expectedMoved);
+  EXPECT_EQ(counters->movedIn.at(kNewReal), expectedMoved);
+  EXPECT_EQ(counters->movedOut.at(1), expectedMoved - 1);
+  EXPECT_EQ(counters->movedOut.at(2), 1);
+  EXPECT_EQ(counters->after.count(1), 0);
+  EXPECT_EQ(counters->after.at(kNewReal), expectedMoved);
+  EXPECT_EQ(
+      counters->before.at(1) + counters->before.at(2) + counters->before.at(3),
+      keys.size());
+
+  // counters are per map
+  EXPECT_EQ(counter.getCounters(1, v4Vip), nullptr);
+  EXPECT_EQ(counter.getCounters(0, v6Vip), nullptr);
+}
+
+TEST_F(LruRemapCounterTest, testVipMatching) {
+  LruRemapCounter::VipSet unaffected;
+  unaffected.insert(unaffectedVip);
+  LruRemapCounter counter(shadow, newRings, std::move(unaffected), 1);
+  std::vector<flow_key> keys = {
+      // flows of the unaffected vip are skipped, even though they match
+      // affected port 0 vip in the shadow
+      makeKey("10.0.0.1", 1000, "10.200.1.2", 53, kUdp),
+      makeKey("10.0.0.2", 1000, "10.200.1.2", 53, kUdp),
+      // flow of port 0 vip
+      makeKey("10.0.0.3", 1000, "10.200.1.2", 54, kUdp),
+      // flows w/o vip
+      makeKey("10.0.0.4", 1000, "10.200.1.3", 80, kTcp),
+      makeKey("10.0.0.5", 1000, "10.200.1.1", 80, kUdp),
+      // ipv6 flows
+      makeKey("fc00:2::1", 1000, "fc00:1::1", 80, kTcp),
+      makeKey("fc00:2::1", 1000, "2a03:2880::", 80, kTcp),
+  };
+  std::vector<real_pos_lru> values(keys.size(), real_pos_lru{1, 0});
+  counter.accountEntries(0, keys.data(), values.data(), keys.size());
+
+  const auto* portZero = counter.getCounters(0, portZeroVip);
+  ASSERT_NE(portZero, nullptr);
+  EXPECT_EQ(portZero->flows, 1);
+  EXPECT_EQ(counter.getCounters(0, unaffectedVip), nullptr);
+  EXPECT_EQ(counter.getCounters(0, v4Vip), nullptr);
+  const auto* v6 = counter.getCounters(0, v6Vip);
+  ASSERT_NE(v6, nullptr);
+  EXPECT_EQ(v6->flows, 1);
+  const auto* zeroTailV6 = counter.getCounters(0, zeroTailV6Vip);
+  ASSERT_NE(zeroTailV6, nullptr);
+  EXPECT_EQ(zeroTailV6->flows, 1);
+  // lru pins every flow to real #1, which is not in the new ring
+  EXPECT_EQ(portZero->moved, 1);
+  EXPECT_EQ(v6->moved, 1);
+}
+
+} // namespace katran
@@ -0,0 +1,82 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+
+#include "katran/lib/LruScanner.h"
+
+namespace katran {
+
+TEST(LruScannerTest, testEstimateTotalEmptySample) {
+  auto estimate = LruScanner::estimateTotal({}, {}, 1024);
+  ASSERT_EQ(estimate.value, 0);
+  ASSERT_EQ(estimate.stdErr, 0);
+}
+
+TEST(LruScannerTest, testEstimateTotalFullScan) {
+  // all buckets have been read: estimation is exact
+  auto estimate = LruScanner::estimateTotal({10, 20, 30}, {8, 8, 16}, 32);
+  ASSERT_DOUBLE_EQ(estimate.value, 60);
+  ASSERT_DOUBLE_EQ(estimate.stdErr, 0);
+}
+
+TEST(LruScannerTest, testEstimateTotalUniform) {
+  // every bucket holds exactly 2 entries: no variance
+  auto estimate =
+      LruScanner::estimateTotal({32, 64, 16}, {16, 32, 8}, 1024 * 1024);
+  ASSERT_DOUBLE_EQ(estimate.value, 2 * 1024 * 1024);
+  ASSERT_DOUBLE_EQ(estimate.stdErr, 0);
+}
+
+TEST(LruScannerTest, testEstimateTotalCoverage) {
+  // population: 1M buckets w/ random occupancy. confidence interval of the
+  // estimation from 100 random windows must cover real total most of the time
+  constexpr int kBuckets = 1 << 20;
+  constexpr int kWindow = 64;
+  std::mt19937 rng(42);
+  std::poisson_distribution<int> occupancy(3);
+  std::vector<int> population(kBuckets);
+  double realTotal = 0;
+  for (auto& bucket : population) {
+    bucket = occupancy(rng);
+    realTotal += bucket;
+  }
+  std::uniform_int_distribution<int> start(0, kBuckets - kWindow);
+  int covered = 0;
+  constexpr int kRuns = 200;
+  for (int run = 0; run < kRuns; run++) {
+    std::vector<double> sampled;
+    std::vector<double> buckets;
+    for (int w = 0; w < 100; w++) {
+      int first = start(rng);
+      double sum = 0;
+      for (int i = first; i < first + kWindow; i++) {
+        sum += population[i];
+      }
+      sampled.push_back(sum);
+      buckets.push_back(kWindow);
+    }
+    auto estimate = LruScanner::estimateTotal(sampled, buckets, kBuckets);
+    if (std::abs(estimate.value - realTotal) <= 1.96 * estimate.stdErr) {
+      covered++;
+    }
+  }
+  ASSERT_GE(covered, kRuns * 0.9);
+}
+
+} // namespace katran
@@ -3,8 +3,10 @@
 #include "katran/lib/MonitoringServiceCore.h"
 #include <fcntl.h>
 #include <folly/Random.h>
+#include <folly/synchronization/Baton.h>
 #include <gtest/gtest.h>
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <mutex>
 
@@ -50,6 +52,14 @@ class MockMonitoringServiceCore : public MonitoringServiceCore {
     return true;
   }
 
+  // hands event to the client's queue, as event pipe callback does
+  void sendToClient(ClientId cid, const Event& event) {
+    auto queues = client_queues_.rlock();
+    auto clientAndQueue = queues->find(cid);
+    ASSERT_TRUE(clientAndQueue != queues->end());
+    clientAndQueue->second->sendEvent(event);
+  }
+
  private:
   std::unordered_map<
       EventId,
@@ -76,6 +86,17 @@ class MockClientSubscription : public ClientSubscriptionIf {
   std::vector<Event> sent_events_;
 };
 
+// blocks in sendEvent until released, as client w/ full send buffer would
+class BlockingClientSubscription : public MockClientSubscription {
+ public:
+  void sendEvent(const Event& event) override {
+    released_.wait();
+    MockClientSubscription::sendEvent(event);
+  }
+
+  folly::Baton<> released_;
+};
+
 class TestMonitoringServiceCore : public Test {
  public:
   void SetUp() override {
@@ -83,6 +104,43 @@ class TestMonitoringServiceCore : public Test {
     EXPECT_TRUE(core->initialize(nullptr));
   }
   std::shared_ptr<MockMonitoringServiceCore> core{nullptr};
+
+  ClientId subscribe(std::shared_ptr<ClientSubscriptionIf> sub) {
+    EventIds eventIds = {
+        EventId::TCP_NONSYN_LRUMISS,
+    };
+    auto res = core->acceptSubscription(eventIds);
+    EXPECT_EQ(res.status, ResponseStatus::OK);
+    EXPECT_TRUE(res.cid.has_value());
+    EXPECT_TRUE(res.sub_cb.has_value());
+    EXPECT_TRUE(res.subscribed_events.has_value());
+    EXPECT_TRUE(res.sub_cb.value()->onClientSubscribed(
+        *res.cid, sub, *res.subscribed_events));
+    return *res.cid;
+  }
+
+  // sends numEvents events to a client which is stuck on the first one,
+  // then releases it and returns its counters once everything is accounted
+  SubscriberStats sendToSlowClient(uint32_t numEvents) {
+    auto sub = std::make_shared<BlockingClientSubscription>();
+    auto cid = subscribe(sub);
+    for (uint32_t i = 0; i < numEvents; i++) {
+      core->sendToClient(
+          cid,
+          Event{.id = EventId::TCP_NONSYN_LRUMISS, .pktsize = i, .data = "x"});
+    }
+    sub->released_.post();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    SubscriberStats stats;
+    do {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      stats = *core->get_client_stats(cid);
+    } while (stats.delivered + stats.dropped < numEvents &&
+             std::chrono::steady_clock::now() < deadline);
+    core->onClientCanceled(cid);
+    EXPECT_EQ(sub->sent_events_.size(), stats.delivered);
+    return stats;
+  }
 };
 
 TEST_F(TestMonitoringServiceCore, SimpleAcceptSubscription) {
@@ -190,3 +248,47 @@ TEST_F(TestMonitoringServiceCore, SubscribeAndCancel) {
   res.sub_cb.value()->onClientCanceled(cid);
   EXPECT_FALSE(core->has_client(cid));
 }
+
+TEST_F(TestMonitoringServiceCore, ClientStats) {
+  EXPECT_FALSE(core->get_client_stats(0).has_value());
+  auto submock = std::make_shared<MockClientSubscription>();
+  auto cid = subscribe(submock);
+  auto stats = core->get_client_stats(cid);
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_EQ(stats->delivered, 0);
+  EXPECT_EQ(stats->dropped, 0);
+  EXPECT_EQ(stats->lag, 0);
+
+  core->sendToClient(
+      cid, Event{.id = EventId::TCP_NONSYN_LRUMISS, .pktsize = 1, .data = "x"});
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (core->get_client_stats(cid)->delivered == 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stats = core->get_client_stats(cid);
+  EXPECT_EQ(stats->delivered, 1);
+  EXPECT_EQ(stats->dropped, 0);
+  EXPECT_EQ(stats->lag, 0);
+  EXPECT_EQ(stats->maxLag, 1);
+  ASSERT_EQ(submock->sent_events_.size(), 1);
+  EXPECT_EQ(submock->sent_events_[0].data, "x");
+
+  core->onClientCanceled(cid);
+  EXPECT_FALSE(core->get_client_stats(cid).has_value());
+}
+
+TEST_F(TestMonitoringServiceCore, SubscriberQueue) {
+  constexpr uint32_t kNumEvents = 10;
+  // default queue fits all the events
+  auto stats = sendToSlowClient(kNumEvents);
+  EXPECT_EQ(stats.delivered, kNumEvents);
+  EXPECT_EQ(stats.dropped, 0);
+
+  // one event is being sent, one is queued, the rest are dropped
+  core->set_subscriber_queue(1, SlowClientPolicy::DROP);
+  stats = sendToSlowClient(kNumEvents);
+  EXPECT_EQ(stats.delivered + stats.dropped, kNumEvents);
+  EXPECT_GE(stats.dropped, kNumEvents - 2);
+  EXPECT_LE(stats.maxLag, 1);
+}
@@ -19,8 +19,10 @@
 #include <folly/portability/GMock.h>
 #include <gtest/gtest.h>
 #include <cstring>
+#include <string>
 #include <thread>
 #include "katran/lib/DataWriter.h"
+#include "katran/lib/PcapEventQueues.h"
 #include "katran/lib/PcapStructs.h"
 
 using namespace ::testing;
@@ -51,6 +53,17 @@ class MockDataWriter : public DataWriter {
   MOCK_METHOD0(writtenBytes, std::size_t());
 };
 
+class MockBatchDataWriter : public MockDataWriter {
+ public:
+  MOCK_METHOD2(writeDataBatch, void(const struct iovec*, std::size_t));
+
+  using DataWriter::writeDataBatch;
+
+  bool supportsBatching() const override {
+    return true;
+  }
+};
+
 class PcapWriterTest : public Test {
  public:
   PcapWriterTest() = default;
@@ -193,4 +206,282 @@ TEST_F(PcapWriterTest, MultiWriter) {
   readerThread.join();
 }
 
+TEST_F(PcapWriterTest, MultiWriterEventQueues) {
+  auto queues = std::make_shared<PcapEventQueues>(2, 10);
+  auto writer1 = std::make_shared<MockDataWriter>();
+  auto writer2 = std::make_shared<MockDataWriter>();
+  std::unordered_map<EventId, std::shared_ptr<DataWriter>> writers{
+      {EventId::TCP_NONSYN_LRUMISS, writer1},
+      {EventId::PACKET_TOOBIG, writer2},
+  };
+  auto pcapWriter = std::make_unique<PcapWriter>(writers, 10, 100);
+  pcapWriter->enableEvent(EventId::TCP_NONSYN_LRUMISS);
+  pcapWriter->enableEvent(EventId::PACKET_TOOBIG);
+
+  const char* msg1 = "kiwi fruit not the bird";
+  const char* msg2 = "chocolate beats coffee";
+
+  expectPcapHeader(*writer1);
+  expectPcapHeader(*writer2);
+
+  EXPECT_CALL(*writer1, writeData(_, _))
+      .Times(2)
+      .WillOnce(Invoke([&](const void* ptr, std::size_t size) {
+        EXPECT_EQ(size, sizeof(pcaprec_hdr_s));
+        auto rechdr = reinterpret_cast<const pcaprec_hdr_s*>(ptr);
+        EXPECT_EQ(rechdr->incl_len, 20);
+        EXPECT_EQ(rechdr->orig_len, 23);
+      }))
+      .WillOnce(Invoke([&](const void* ptr, std::size_t size) {
+        EXPECT_EQ(size, 20);
+        auto msg = reinterpret_cast<const char*>(ptr);
+        EXPECT_EQ(std::strncmp(msg, msg1, 20), 0);
+      }));
+
+  EXPECT_CALL(*writer2, writeData(_, _))
+      .Times(2)
+      .WillOnce(Invoke([&](const void* ptr, std::size_t size) {
+        EXPECT_EQ(size, sizeof(pcaprec_hdr_s));
+        auto rechdr = reinterpret_cast<const pcaprec_hdr_s*>(ptr);
+        EXPECT_EQ(rechdr->incl_len, 19);
+        EXPECT_EQ(rechdr->orig_len, 22);
+      }))
+      .WillOnce(Invoke([&](const void* ptr, std::size_t size) {
+        EXPECT_EQ(size, 19);
+        auto msg = reinterpret_cast<const char*>(ptr);
+        EXPECT_EQ(std::strncmp(msg, msg2, 19), 0);
+      }));
+
+  auto readerThread = std::thread([&] { pcapWriter->runMulti(queues); });
+
+  // every source is used by its own thread
+  auto source0 = std::thread([&] {
+    EXPECT_TRUE(queues->push(
+        0, static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS), msg1, 23, 20));
+    queues->notify();
+  });
+  auto source1 = std::thread([&] {
+    EXPECT_TRUE(queues->push(
+        1, static_cast<uint32_t>(EventId::PACKET_TOOBIG), msg2, 22, 19));
+    // not enabled event must be skipped by writer
+    EXPECT_TRUE(queues->push(
+        1,
+        static_cast<uint32_t>(EventId::QUIC_PACKET_DROP_NO_REAL),
+        msg2,
+        22,
+        19));
+    queues->notify();
+  });
+  source0.join();
+  source1.join();
+
+  PcapMsgMeta shutdown;
+  shutdown.setControl(true);
+  shutdown.setShutdown(true);
+  queues->pushControl(std::move(shutdown));
+
+  readerThread.join();
+  EXPECT_EQ(pcapWriter->packetsCaptured(), 2);
+  EXPECT_EQ(queues->getDrops(), 0);
+}
+
+TEST_F(PcapWriterTest, EventQueuesOverflow) {
+  // one slot of the ring is always unused
+  PcapEventQueues queues(1, 3);
+  const char* msg = "kiwi fruit not the bird";
+  EXPECT_TRUE(queues.push(0, 0, msg, 23, 23));
+  EXPECT_TRUE(queues.push(0, 0, msg, 23, 23));
+  EXPECT_FALSE(queues.push(0, 0, msg, 23, 23));
+  EXPECT_EQ(queues.getDrops(), 1);
+
+  size_t consumed = queues.drain(1, [&](const PcapEvent& event) {
+    EXPECT_EQ(event.capturedLen, 23);
+    auto data = reinterpret_cast<const char*>(event.data);
+    EXPECT_EQ(std::strncmp(data, msg, 23), 0);
+  });
+  EXPECT_EQ(consumed, 1);
+  EXPECT_TRUE(queues.push(0, 0, msg, 23, 23));
+}
+
+TEST_F(PcapWriterTest, BatchedWrites) {
+  auto queues = std::make_shared<PcapEventQueues>(1, 10);
+  auto writer = std::make_shared<MockBatchDataWriter>();
+  std::unordered_map<EventId, std::shared_ptr<DataWriter>> writers{
+      {EventId::TCP_NONSYN_LRUMISS, writer},
+  };
+  auto pcapWriter = std::make_unique<PcapWriter>(writers, 10, 100);
+  pcapWriter->enableEvent(EventId::TCP_NONSYN_LRUMISS);
+
+  const char* msg = "kiwi fruit not the bird";
+  expectPcapHeader(*writer);
+  // all records must go w/ a single batch, not record by record
+  EXPECT_CALL(*writer, writeData(_, _)).Times(0);
+  EXPECT_CALL(*writer, writeDataBatch(_, _))
+      .Times(1)
+      .WillOnce(Invoke([&](const struct iovec* iov, std::size_t iovcnt) {
+        std::string data;
+        for (std::size_t i = 0; i < iovcnt; i++) {
+          data.append(
+              reinterpret_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+        }
+        ASSERT_EQ(data.size(), 3 * (sizeof(pcaprec_hdr_s) + 20));
+        for (int rec = 0; rec < 3; rec++) {
+          auto offset = rec * (sizeof(pcaprec_hdr_s) + 20);
+          auto rechdr =
+              reinterpret_cast<const pcaprec_hdr_s*>(data.data() + offset);
+          EXPECT_EQ(rechdr->incl_len, 20);
+          EXPECT_EQ(rechdr->orig_len, 23);
+          EXPECT_EQ(
+              std::strncmp(
+                  data.data() + offset + sizeof(pcaprec_hdr_s), msg, 20),
+              0);
+        }
+      }));
+
+  // queued before writer starts, so they are consumed w/ the same batch
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(queues->push(
+        0, static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS), msg, 23, 20));
+  }
+  PcapMsgMeta shutdown;
+  shutdown.setControl(true);
+  shutdown.setShutdown(true);
+  queues->pushControl(std::move(shutdown));
+
+  pcapWriter->runMulti(queues);
+  EXPECT_EQ(pcapWriter->packetsCaptured(), 3);
+}
+
+TEST_F(PcapWriterTest, ShutdownFlushesPendingRecords) {
+  // more events than writer drains on shutdown
+  constexpr uint32_t kNumEvents = 32 * 1024;
+  auto queues = std::make_shared<PcapEventQueues>(1, kNumEvents + 1);
+  auto writer = std::make_shared<MockBatchDataWriter>();
+  std::unordered_map<EventId, std::shared_ptr<DataWriter>> writers{
+      {EventId::TCP_NONSYN_LRUMISS, writer},
+  };
+  auto pcapWriter = std::make_unique<PcapWriter>(writers, kNumEvents, 100);
+  pcapWriter->enableEvent(EventId::TCP_NONSYN_LRUMISS);
+  // records are flushed only when forced
+  pcapWriter->setBatching(1 << 30, std::chrono::hours(1));
+
+  const char* msg = "kiwi fruit not the bird";
+  expectPcapHeader(*writer);
+  size_t written = 0;
+  EXPECT_CALL(*writer, writeDataBatch(_, _))
+      .WillRepeatedly(
+          Invoke([&](const struct iovec* iov, std::size_t iovcnt) {
+            for (std::size_t i = 0; i < iovcnt; i++) {
+              written += iov[i].iov_len;
+            }
+          }));
+  for (uint32_t i = 0; i < kNumEvents; i++) {
+    ASSERT_TRUE(queues->push(
+        0, static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS), msg, 23, 23));
+  }
+  PcapMsgMeta shutdown;
+  shutdown.setControl(true);
+  shutdown.setShutdown(true);
+  queues->pushControl(std::move(shutdown));
+  pcapWriter->runMulti(queues);
+
+  // every captured record reaches the writer, even if drain stopped early
+  auto captured = pcapWriter->packetsCaptured();
+  EXPECT_GT(captured, 0u);
+  EXPECT_LT(captured, kNumEvents);
+  EXPECT_EQ(written, captured * (sizeof(pcaprec_hdr_s) + 23));
+}
+
+TEST_F(PcapWriterTest, PcapngOutput) {
+  auto queues = std::make_shared<PcapEventQueues>(1, 10);
+  auto writer = std::make_shared<MockDataWriter>();
+  std::unordered_map<EventId, std::shared_ptr<DataWriter>> writers{
+      {EventId::TCP_NONSYN_LRUMISS, writer},
+  };
+  auto pcapWriter = std::make_unique<PcapWriter>(writers, 10, 100);
+  pcapWriter->enableEvent(EventId::TCP_NONSYN_LRUMISS);
+  pcapWriter->setFormat(PcapFormat::PCAPNG);
+  pcapWriter->setEventComment(EventId::TCP_NONSYN_LRUMISS, "vip 10.0.0.1");
+
+  std::string header;
+  std::string data;
+  EXPECT_CALL(*writer, available(_)).WillRepeatedly(Return(true));
+  EXPECT_CALL(*writer, writeHeader(_, _))
+      .Times(1)
+      .WillOnce(Invoke([&](const void* ptr, std::size_t size) {
+        header.append(reinterpret_cast<const char*>(ptr), size);
+      }));
+  EXPECT_CALL(*writer, writeData(_, _))
+      .WillRepeatedly(Invoke([&](const void* ptr, std::size_t size) {
+        data.append(reinterpret_cast<const char*>(ptr), size);
+      }));
+
+  const char* msg = "kiwi fruit not the bird";
+  // first event has timestamp from the forwarding plane, second one does not
+  EXPECT_TRUE(queues->push(
+      0,
+      static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS),
+      msg,
+      23,
+      21,
+      1000));
+  EXPECT_TRUE(queues->push(
+      0, static_cast<uint32_t>(EventId::TCP_NONSYN_LRUMISS), msg, 23, 20));
+  PcapMsgMeta shutdown;
+  shutdown.setControl(true);
+  shutdown.setShutdown(true);
+  queues->pushControl(std::move(shutdown));
+  pcapWriter->runMulti(queues);
+  EXPECT_EQ(pcapWriter->packetsCaptured(), 2);
+
+  // section header block followed by interface description block
+  ASSERT_GE(header.size(), sizeof(pcapng_shb_s) + sizeof(pcapng_idb_s));
+  auto shb = reinterpret_cast<const pcapng_shb_s*>(header.data());
+  EXPECT_EQ(shb->block_type, 0x0A0D0D0A);
+  EXPECT_EQ(shb->byte_order_magic, 0x1A2B3C4D);
+  EXPECT_EQ(shb->block_total_length, sizeof(pcapng_shb_s) + 4);
+  auto idb = reinterpret_cast<const pcapng_idb_s*>(
+      header.data() + shb->block_total_length);
+  EXPECT_EQ(idb->block_type, 1);
+  EXPECT_EQ(idb->link_type, 1);
+  EXPECT_EQ(idb->snaplen, 100);
+  EXPECT_EQ(idb->block_total_length % 4, 0);
+  EXPECT_EQ(header.size(), shb->block_total_length + idb->block_total_length);
+  EXPECT_NE(header.find("vip 10.0.0.1"), std::string::npos);
+  EXPECT_NE(
+      header.find(monitoring::toString(EventId::TCP_NONSYN_LRUMISS)),
+      std::string::npos);
+
+  // enhanced packet blocks are padded to 32 bits
+  size_t offset = 0;
+  uint64_t prevTs = 0;
+  for (uint32_t capturedLen : {21, 20}) {
+    ASSERT_GE(data.size(), offset + sizeof(pcapng_epb_s));
+    auto epb = reinterpret_cast<const pcapng_epb_s*>(data.data() + offset);
+    EXPECT_EQ(epb->block_type, 6);
+    EXPECT_EQ(epb->interface_id, 0);
+    EXPECT_EQ(epb->captured_len, capturedLen);
+    EXPECT_EQ(epb->orig_len, 23);
+    EXPECT_EQ(
+        epb->block_total_length,
+        sizeof(pcapng_epb_s) + ((capturedLen + 3) & ~3) + 4);
+    EXPECT_EQ(
+        std::strncmp(
+            data.data() + offset + sizeof(pcapng_epb_s), msg, capturedLen),
+        0);
+    uint32_t trailer;
+    std::memcpy(
+        &trailer,
+        data.data() + offset + epb->block_total_length - 4,
+        sizeof(trailer));
+    EXPECT_EQ(trailer, epb->block_total_length);
+    uint64_t ts = (uint64_t(epb->ts_high) << 32) | epb->ts_low;
+    // event from the forwarding plane happened before the one w/o timestamp
+    EXPECT_GT(ts, prevTs);
+    prevTs = ts;
+    offset += epb->block_total_length;
+  }
+  EXPECT_EQ(offset, data.size());
+}
+
 } // namespace katran
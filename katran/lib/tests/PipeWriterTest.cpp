@@ -94,3 +94,25 @@ TEST_F(PipeWriterTest, WriteAfterStop) {
   EXPECT_EQ(pipeWriter.getWrites(), 1);
   EXPECT_EQ(pipeWriter.getErrs(), 0);
 }
+
+TEST_F(PipeWriterTest, ChainWrite) {
+  katran::PipeWriter pipeWriter;
+  reader_->setReadCB(&readCallback_);
+  pipeWriter.setWriterDestination(writer_);
+  auto chain = folly::IOBuf::copyBuffer("ramen");
+  chain->prependChain(folly::IOBuf::copyBuffer(" udon"));
+  pipeWriter.writeDataBatch(std::move(chain));
+  evb_.loopOnce();
+  pipeWriter.stop();
+  EXPECT_EQ(readCallback_.getData(), "ramen udon");
+  EXPECT_FALSE(readCallback_.error_);
+  EXPECT_EQ(pipeWriter.getWrites(), 1);
+  EXPECT_EQ(pipeWriter.getErrs(), 0);
+}
+
+TEST_F(PipeWriterTest, BatchingIsOptIn) {
+  katran::PipeWriter pipeWriter;
+  EXPECT_FALSE(pipeWriter.supportsBatching());
+  pipeWriter.setBatching(true);
+  EXPECT_TRUE(pipeWriter.supportsBatching());
+}
@@ -0,0 +1,217 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "katran/lib/RotatingFileWriter.h"
+#include <folly/FileUtil.h>
+#include <folly/compression/Compression.h>
+#include <folly/testing/TestUtil.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace ::testing;
+
+namespace katran {
+
+namespace {
+constexpr folly::StringPiece kHeader = "HDR:";
+
+std::string readFile(const std::string& name) {
+  std::string content;
+  EXPECT_TRUE(folly::readFile(name.c_str(), content)) << name;
+  return content;
+}
+
+bool fileExists(const std::string& name) {
+  return ::access(name.c_str(), F_OK) == 0;
+}
+} // namespace
+
+class RotatingFileWriterTest : public Test {
+ public:
+  std::string basename() const {
+    return (tmpDir_.path() / "capture").string();
+  }
+
+  std::string fileName(uint64_t seq) const {
+    return basename() + "." + std::to_string(seq);
+  }
+
+  void writeHeader(RotatingFileWriter& writer) {
+    writer.writeHeader(kHeader.data(), kHeader.size());
+  }
+
+ protected:
+  folly::test::TemporaryDirectory tmpDir_;
+};
+
+TEST_F(RotatingFileWriterTest, testSizeRotation) {
+  RotatingFileWriter writer(basename(), 10, std::chrono::seconds(0), 0, false);
+  writeHeader(writer);
+  std::string record = "0123456789";
+  // first record fills the file up: rotation happens before the second one
+  writer.writeData(record.data(), record.size());
+  EXPECT_EQ(writer.currentFile(), fileName(0));
+  writer.writeData(record.data(), record.size());
+  EXPECT_EQ(writer.currentFile(), fileName(1));
+  struct iovec iov[2] = {
+      {record.data(), 5},
+      {record.data() + 5, 5},
+  };
+  writer.writeDataBatch(iov, 2);
+  EXPECT_EQ(writer.currentFile(), fileName(2));
+  writer.stop();
+
+  // every file starts w/ the header and records are never split
+  for (uint64_t seq = 0; seq < 3; seq++) {
+    EXPECT_EQ(readFile(fileName(seq)), kHeader.str() + record);
+  }
+  EXPECT_FALSE(fileExists(fileName(3)));
+  EXPECT_EQ(writer.writtenBytes(), 3 * (kHeader.size() + record.size()));
+}
+
+TEST_F(RotatingFileWriterTest, testAgeRotation) {
+  RotatingFileWriter writer(basename(), 0, std::chrono::seconds(1), 0, false);
+  writeHeader(writer);
+  std::string record = "kiwi";
+  writer.writeData(record.data(), record.size());
+  writer.writeData(record.data(), record.size());
+  EXPECT_EQ(writer.currentFile(), fileName(0));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  writer.writeData(record.data(), record.size());
+  EXPECT_EQ(writer.currentFile(), fileName(1));
+  writer.stop();
+
+  EXPECT_EQ(readFile(fileName(0)), kHeader.str() + record + record);
+  EXPECT_EQ(readFile(fileName(1)), kHeader.str() + record);
+}
+
+TEST_F(RotatingFileWriterTest, testRetention) {
+  RotatingFileWriter writer(basename(), 1, std::chrono::seconds(0), 2, false);
+  writeHeader(writer);
+  std::string record = "r";
+  for (int i = 0; i < 5; i++) {
+    writer.writeData(record.data(), record.size());
+  }
+  EXPECT_EQ(writer.currentFile(), fileName(4));
+  writer.stop();
+
+  // only maxFiles most recent files are kept
+  for (uint64_t seq = 0; seq < 3; seq++) {
+    EXPECT_FALSE(fileExists(fileName(seq))) << seq;
+  }
+  EXPECT_EQ(readFile(fileName(3)), kHeader.str() + record);
+  EXPECT_EQ(readFile(fileName(4)), kHeader.str() + record);
+}
+
+TEST_F(RotatingFileWriterTest, testRestartStartsNextFile) {
+  RotatingFileWriter writer(basename(), 0, std::chrono::seconds(0), 0, false);
+  writeHeader(writer);
+  std::string record = "first";
+  writer.writeData(record.data(), record.size());
+  writer.restart();
+  EXPECT_EQ(writer.currentFile(), fileName(1));
+  std::string header = "NEW:";
+  writer.writeHeader(header.data(), header.size());
+  writer.writeData(record.data(), record.size());
+  writer.stop();
+
+  EXPECT_EQ(readFile(fileName(0)), kHeader.str() + record);
+  EXPECT_EQ(readFile(fileName(1)), header + record);
+}
+
+TEST_F(RotatingFileWriterTest, testCompression) {
+  bool hasZstd =
+      folly::compression::hasStreamCodec(folly::compression::CodecType::ZSTD);
+  RotatingFileWriter writer(basename(), 0, std::chrono::seconds(0), 0, true);
+  if (!hasZstd) {
+    // falls back to plain output
+    EXPECT_EQ(writer.currentFile(), fileName(0));
+    return;
+  }
+  EXPECT_EQ(writer.currentFile(), fileName(0) + ".zst");
+  writeHeader(writer);
+  std::string expected = kHeader.str();
+  std::string record(1000, 'a');
+  for (int i = 0; i < 100; i++) {
+    writer.writeData(record.data(), record.size());
+    expected += record;
+  }
+  writer.stop();
+  EXPECT_EQ(writer.writtenBytes(), expected.size());
+
+  auto compressed = readFile(fileName(0) + ".zst");
+  EXPECT_LT(compressed.size(), expected.size());
+  auto codec = folly::compression::getCodec(folly::compression::CodecType::ZSTD);
+  EXPECT_EQ(codec->uncompress(compressed, expected.size()), expected);
+}
+
+TEST_F(RotatingFileWriterTest, testCompressionIsNotFlushedPerWrite) {
+  if (!folly::compression::hasStreamCodec(
+          folly::compression::CodecType::ZSTD)) {
+    GTEST_SKIP() << "zstd is not supported";
+  }
+  RotatingFileWriter writer(basename(), 0, std::chrono::seconds(0), 0, true);
+  writeHeader(writer);
+  std::string expected = kHeader.str();
+  std::string record = "small record";
+  constexpr int kRecords = 100;
+  for (int i = 0; i < kRecords; i++) {
+    writer.writeData(record.data(), record.size());
+    expected += record;
+  }
+  // every flush ends a block, which alone is bigger than a byte
+  EXPECT_LT(readFile(fileName(0) + ".zst").size(), kRecords);
+  writer.stop();
+
+  auto codec = folly::compression::getCodec(folly::compression::CodecType::ZSTD);
+  EXPECT_EQ(
+      codec->uncompress(readFile(fileName(0) + ".zst"), expected.size()),
+      expected);
+}
+
+TEST_F(RotatingFileWriterTest, testCompressionFlushInterval) {
+  if (!folly::compression::hasStreamCodec(
+          folly::compression::CodecType::ZSTD)) {
+    GTEST_SKIP() << "zstd is not supported";
+  }
+  RotatingFileWriter writer(
+      basename(),
+      0,
+      std::chrono::seconds(0),
+      0,
+      true,
+      std::chrono::milliseconds(10));
+  writeHeader(writer);
+  std::string record = "small record";
+  writer.writeData(record.data(), record.size());
+  auto size = readFile(fileName(0) + ".zst").size();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  writer.writeData(record.data(), record.size());
+  // buffered data is written out once interval has passed
+  EXPECT_GT(readFile(fileName(0) + ".zst").size(), size);
+  writer.stop();
+
+  auto expected = kHeader.str() + record + record;
+  auto codec = folly::compression::getCodec(folly::compression::CodecType::ZSTD);
+  EXPECT_EQ(
+      codec->uncompress(readFile(fileName(0) + ".zst"), expected.size()),
+      expected);
+}
+
+} // namespace katran
@@ -113,6 +113,23 @@ TEST(VipTest, testAddRemoveReal) {
   ASSERT_EQ(delta.size(), 0);
 }
 
+TEST_F(VipTestF, testPreviewHashRing) {
+  vip1.batchRealsUpdate(reals);
+  auto ring = vip1.getChRing();
+  std::vector<UpdateReal> ureals(1);
+  ureals[0].action = ModifyAction::DEL;
+  ureals[0].updatedReal.num = 0;
+  auto preview = vip1.previewHashRing(ureals);
+  // vip itself must not be changed
+  ASSERT_EQ(vip1.getChRing(), ring);
+  ASSERT_EQ(vip1.getReals().size(), 100);
+  // preview must be the same as the ring after the real update
+  vip1.batchRealsUpdate(ureals);
+  ASSERT_EQ(vip1.getChRing(), preview);
+  // no changes - same ring
+  ASSERT_EQ(vip1.previewHashRing({}), preview);
+}
+
 TEST_F(VipTestF, testGetRealsAndWeight) {
   vip1.batchRealsUpdate(reals);
   auto endpoints = vip1.getRealsAndWeight();
@@ -133,4 +150,22 @@ TEST_F(VipTestF, testGetReals) {
   ASSERT_EQ(delta.size(), 0);
 }
 
+TEST_F(VipTestF, testRestoreState) {
+  vip1.batchRealsUpdate(reals);
+  Vip restored(1);
+  ASSERT_FALSE(restored.restoreState(
+      vip1.getRealsAndWeight(), std::vector<int>(vip1.getChRingSize() - 1)));
+  ASSERT_TRUE(
+      restored.restoreState(vip1.getRealsAndWeight(), vip1.getChRing()));
+  ASSERT_EQ(restored.getReals().size(), 100);
+  ASSERT_EQ(restored.getChRing(), vip1.getChRing());
+  // restored ring is used as a base for delta computation
+  auto delta = restored.recalculateHashRing();
+  ASSERT_EQ(delta.size(), 0);
+  auto delta1 = vip1.delReal(0);
+  auto delta2 = restored.delReal(0);
+  ASSERT_EQ(delta1.size(), delta2.size());
+  ASSERT_EQ(restored.getChRing(), vip1.getChRing());
+}
+
 } // namespace katran
@@ -0,0 +1,55 @@
+/* Copyright (C) 2018-present, Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "katran/lib/CompactVipKey.h"
+
+namespace katran {
+
+// common setup of the tests for shadow data plane and its users
+constexpr uint32_t kMaxVips = 512;
+constexpr uint32_t kRingSize = 65537;
+constexpr uint32_t kNumReals = 3;
+constexpr uint8_t kTcp = 6;
+constexpr uint8_t kUdp = 17;
+
+inline CompactVipKey
+makeVip(const std::string& address, uint16_t port, uint8_t proto) {
+  VipKey vip;
+  vip.address = address;
+  vip.port = port;
+  vip.proto = proto;
+  return CompactVipKey(vip);
+}
+
+/**
+ * @return std::vector<int> ch ring of kRingSize, where real at position i is
+ * (i % kNumReals) + 1
+ */
+inline std::vector<int> makeRing() {
+  std::vector<int> ring(kRingSize);
+  for (uint32_t i = 0; i < kRingSize; i++) {
+    ring[i] = i % kNumReals + 1;
+  }
+  return ring;
+}
+
+} // namespace katran